@@ -7,29 +7,3344 @@
 //
 
 @import XCTest;
+@import UIKit;
+#import <SGSCategories/NSURLSession+SGS.h>
+#import <SGSCategories/SGSTaskHandle.h>
+#import <SGSCategories/SGSRetryPolicy.h>
+#import <SGSCategories/NSURL+SGS.h>
+#import <SGSCategories/SGSChunkedUploader.h>
+#import <SGSCategories/SGSMappedPropertyList.h>
+#import <SGSCategories/SGSHTTPResponseCache.h>
+#import <SGSCategories/SGSProgressGroup.h>
+#import <SGSCategories/SGSRequestScheduler.h>
+#import <SGSCategories/SGSSegmentedDownloader.h>
+#import <SGSCategories/SGSDownloadResumeJournal.h>
+#import <SGSCategories/SGSMultipartFormData.h>
+#import <SGSCategories/SGSNetworkMetrics.h>
+#import <SGSCategories/SGSPrefetcher.h>
+#import <SGSCategories/SGSRateLimiter.h>
+#import <SGSCategories/SGSPromise.h>
+#import <SGSCategories/SGSDeadline.h>
+#import <SGSCategories/NSData+SGS.h>
+#import <SGSCategories/SGSOfflineRequestQueue.h>
+#import <SGSCategories/SGSSessionRegistry.h>
+#import <SGSCategories/SGSResponsePipeline.h>
+#import <SGSCategories/SGSVerifiedDownloader.h>
+#import <SGSCategories/NSMutableURLRequest+SGS.h>
+#include <mach/mach.h>
+#include <objc/runtime.h>
+#include <CommonCrypto/CommonCrypto.h>
+
+#pragma mark - Stub URL Protocol
+
+/// 按主机返回预设响应的本地桩服务，响应用完后返回 200
+@interface StubURLProtocol : NSURLProtocol
+
++ (void)enqueueStatusCode:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body forHost:(NSString *)host;
+/// delay 秒后返回响应，单位：秒
++ (void)enqueueStatusCode:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body delay:(NSTimeInterval)delay forHost:(NSString *)host;
++ (void)enqueueError:(NSError *)error forHost:(NSString *)host;
++ (NSUInteger)requestCountForHost:(NSString *)host;
++ (NSURLRequest *)lastRequestForHost:(NSString *)host;
++ (void)reset;
+
+@end
+
+@implementation StubURLProtocol {
+    BOOL _stopped;
+}
+
++ (NSMutableDictionary<NSString *, NSMutableArray *> *)p_responsesByHost {
+    static NSMutableDictionary *responses = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        responses = [NSMutableDictionary dictionary];
+    });
+    return responses;
+}
+
++ (NSCountedSet<NSString *> *)p_requestCounts {
+    static NSCountedSet *counts = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        counts = [NSCountedSet set];
+    });
+    return counts;
+}
+
++ (NSMutableDictionary<NSString *, NSURLRequest *> *)p_lastRequests {
+    static NSMutableDictionary *requests = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        requests = [NSMutableDictionary dictionary];
+    });
+    return requests;
+}
+
++ (void)p_enqueue:(id)response forHost:(NSString *)host {
+    @synchronized (self) {
+        NSMutableArray *responses = [self p_responsesByHost][host];
+        if (responses == nil) {
+            responses = [NSMutableArray array];
+            [self p_responsesByHost][host] = responses;
+        }
+        [responses addObject:response];
+    }
+}
+
++ (void)enqueueStatusCode:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body forHost:(NSString *)host {
+    [self enqueueStatusCode:statusCode headers:headers body:body delay:0 forHost:host];
+}
+
++ (void)enqueueStatusCode:(NSInteger)statusCode headers:(NSDictionary *)headers body:(NSData *)body delay:(NSTimeInterval)delay forHost:(NSString *)host {
+    [self p_enqueue:@{@"statusCode": @(statusCode), @"headers": headers ?: @{}, @"body": body ?: [NSData data], @"delay": @(delay)} forHost:host];
+}
+
++ (void)enqueueError:(NSError *)error forHost:(NSString *)host {
+    [self p_enqueue:error forHost:host];
+}
+
++ (NSUInteger)requestCountForHost:(NSString *)host {
+    @synchronized (self) {
+        return [[self p_requestCounts] countForObject:host];
+    }
+}
+
++ (NSURLRequest *)lastRequestForHost:(NSString *)host {
+    @synchronized (self) {
+        return [self p_lastRequests][host];
+    }
+}
+
++ (void)reset {
+    @synchronized (self) {
+        [[self p_responsesByHost] removeAllObjects];
+        [[self p_requestCounts] removeAllObjects];
+        [[self p_lastRequests] removeAllObjects];
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.host hasSuffix:@".stub"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+- (void)startLoading {
+    NSString *host = self.request.URL.host;
+    id stub = nil;
+    @synchronized ([StubURLProtocol class]) {
+        [[StubURLProtocol p_requestCounts] addObject:host];
+        [StubURLProtocol p_lastRequests][host] = self.request;
+        NSMutableArray *responses = [StubURLProtocol p_responsesByHost][host];
+        stub = responses.firstObject;
+        if (stub != nil) [responses removeObjectAtIndex:0];
+    }
+
+    if ([stub isKindOfClass:[NSError class]]) {
+        [self.client URLProtocol:self didFailWithError:stub];
+        return ;
+    }
+
+    NSInteger statusCode = stub ? [stub[@"statusCode"] integerValue] : 200;
+    NSData *body = stub ? stub[@"body"] : [NSData data];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:stub[@"headers"]];
+    NSTimeInterval delay = [stub[@"delay"] doubleValue];
+
+    dispatch_block_t deliver = ^{
+        if (_stopped) return;
+        [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+        [self.client URLProtocol:self didLoadData:body];
+        [self.client URLProtocolDidFinishLoading:self];
+    };
+    if (delay <= 0) {
+        deliver();
+        return;
+    }
+
+    // 回调需要在调用 startLoading 的线程中进行
+    CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes, deliver);
+        CFRunLoopWakeUp(runLoop);
+    });
+}
+
+- (void)stopLoading {
+    _stopped = YES;
+}
+
+@end
+
+#pragma mark - Benchmark URL Protocol
+
+/// 离线回环桩服务，匹配 *.bench 主机，模拟延迟、带宽和响应大小，上传的请求体会被完整读取
+@interface BenchmarkURLProtocol : NSURLProtocol
+
+/// 收到请求到返回响应头的延迟，单位：秒，带宽单位：字节/秒，为 0 时不限速
++ (void)setLatency:(NSTimeInterval)latency bandwidth:(double)bandwidth;
+
+/// 返回 size 字节响应体的请求地址
++ (NSURL *)URLWithPayloadSize:(NSUInteger)size;
+
+/// 已读取的上传字节数
++ (unsigned long long)receivedBodyLength;
+
++ (void)reset;
+
+@end
+
+static const NSUInteger kBenchmarkChunkSize = 16 * 1024;
+static NSTimeInterval p_benchmarkLatency = 0;
+static double p_benchmarkBandwidth = 0;
+static unsigned long long p_benchmarkReceivedBodyLength = 0;
+
+@implementation BenchmarkURLProtocol {
+    CFRunLoopRef _clientRunLoop;
+    NSData *_payload;
+    BOOL _stopped;
+}
+
++ (void)setLatency:(NSTimeInterval)latency bandwidth:(double)bandwidth {
+    @synchronized (self) {
+        p_benchmarkLatency = latency;
+        p_benchmarkBandwidth = bandwidth;
+    }
+}
+
++ (NSURL *)URLWithPayloadSize:(NSUInteger)size {
+    return [NSURL URLWithString:[NSString stringWithFormat:@"http://loopback.bench/payload?size=%lu", (unsigned long)size]];
+}
+
++ (unsigned long long)receivedBodyLength {
+    @synchronized (self) {
+        return p_benchmarkReceivedBodyLength;
+    }
+}
+
++ (void)reset {
+    @synchronized (self) {
+        p_benchmarkLatency = 0;
+        p_benchmarkBandwidth = 0;
+        p_benchmarkReceivedBodyLength = 0;
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.host hasSuffix:@".bench"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+// 所有响应共享同一块只读内存，避免桩服务本身的分配影响内存统计
++ (NSData *)p_payloadWithSize:(NSUInteger)size {
+    static const NSUInteger maximumSize = 8 * 1024 * 1024;
+    static void *bytes = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        bytes = malloc(maximumSize);
+        memset(bytes, 'x', maximumSize);
+    });
+    return [NSData dataWithBytesNoCopy:bytes length:MIN(size, maximumSize) freeWhenDone:NO];
+}
+
+- (void)dealloc {
+    if (_clientRunLoop) CFRelease(_clientRunLoop);
+}
+
+- (void)startLoading {
+    _clientRunLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+
+    unsigned long long bodyLength = self.request.HTTPBody.length;
+    NSInputStream *bodyStream = self.request.HTTPBodyStream;
+    if (bodyStream != nil) {
+        uint8_t buffer[16 * 1024];
+        [bodyStream open];
+        NSInteger length = 0;
+        while ((length = [bodyStream read:buffer maxLength:sizeof(buffer)]) > 0) {
+            bodyLength += length;
+        }
+        [bodyStream close];
+    }
+
+    NSTimeInterval latency = 0;
+    @synchronized ([BenchmarkURLProtocol class]) {
+        p_benchmarkReceivedBodyLength += bodyLength;
+        latency = p_benchmarkLatency;
+    }
+
+    NSURLComponents *components = [NSURLComponents componentsWithURL:self.request.URL resolvingAgainstBaseURL:NO];
+    NSUInteger size = 0;
+    for (NSURLQueryItem *item in components.queryItems) {
+        if ([item.name isEqualToString:@"size"]) size = (NSUInteger)item.value.longLongValue;
+    }
+    _payload = [BenchmarkURLProtocol p_payloadWithSize:size];
+
+    [self p_afterDelay:latency perform:^{
+        NSDictionary *headers = @{@"Content-Length": [NSString stringWithFormat:@"%lu", (unsigned long)_payload.length],
+                                  @"Content-Type": @"application/octet-stream"};
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+        [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+        [self p_sendChunkAtOffset:0];
+    }];
+}
+
+- (void)stopLoading {
+    _stopped = YES;
+}
+
+- (void)p_sendChunkAtOffset:(NSUInteger)offset {
+    double bandwidth = 0;
+    @synchronized ([BenchmarkURLProtocol class]) {
+        bandwidth = p_benchmarkBandwidth;
+    }
+
+    // 不限速时一次发送全部数据
+    NSUInteger length = (bandwidth > 0) ? MIN(kBenchmarkChunkSize, _payload.length - offset) : (_payload.length - offset);
+    if (length > 0) {
+        [self.client URLProtocol:self didLoadData:[_payload subdataWithRange:NSMakeRange(offset, length)]];
+    }
+
+    if (offset + length >= _payload.length) {
+        [self.client URLProtocolDidFinishLoading:self];
+        return ;
+    }
+
+    [self p_afterDelay:(length / bandwidth) perform:^{
+        [self p_sendChunkAtOffset:offset + length];
+    }];
+}
+
+// 在加载请求的线程中执行，NSURLProtocol 的回调必须在该线程中调用
+- (void)p_afterDelay:(NSTimeInterval)delay perform:(dispatch_block_t)block {
+    CFRunLoopRef runLoop = _clientRunLoop;
+    dispatch_block_t guardedBlock = ^{
+        if (_stopped) return ;
+        block();
+    };
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes, guardedBlock);
+        CFRunLoopWakeUp(runLoop);
+    });
+}
+
+@end
+
+#pragma mark - Tus URL Protocol
+
+/// 最小的 tus 1.0 桩服务，匹配 *.tus 主机，支持 creation、concatenation 和 sha1 checksum 扩展，
+/// PATCH 请求延迟返回，用于观察并发的分块
+@interface TusURLProtocol : NSURLProtocol
+
+/// 之后 count 个 PATCH 请求体在校验前被篡改，服务器返回 460
++ (void)setCorruptedPatchCount:(NSUInteger)count;
+
+/// 成功接收 count 个 PATCH 请求后，之后的 PATCH 请求都返回 400，小于 0 时不限制
++ (void)setAcceptedPatchLimit:(NSInteger)count;
+
+/// 上传地址对应的数据，合并后的地址返回合并后的数据
++ (NSData *)dataForUploadURL:(NSURL *)url;
+
++ (NSUInteger)requestCountForMethod:(NSString *)method;
+
+/// 同时进行的 PATCH 请求数的最大值
++ (NSUInteger)maximumConcurrentPatchCount;
+
++ (void)reset;
+
+@end
+
+static NSMutableDictionary<NSString *, NSMutableData *> *p_tusUploads = nil;
+static NSMutableDictionary<NSString *, NSNumber *> *p_tusUploadLengths = nil;
+static NSCountedSet<NSString *> *p_tusMethodCounts = nil;
+static NSUInteger p_tusCorruptedPatchCount = 0;
+static NSInteger p_tusAcceptedPatchLimit = -1;
+static NSUInteger p_tusConcurrentPatchCount = 0;
+static NSUInteger p_tusMaximumConcurrentPatchCount = 0;
+static NSUInteger p_tusNextUploadID = 0;
+
+@implementation TusURLProtocol {
+    CFRunLoopRef _clientRunLoop;
+    BOOL _stopped;
+    BOOL _patchInFlight;
+}
+
++ (void)initialize {
+    if (self != [TusURLProtocol class]) return;
+    p_tusUploads = [NSMutableDictionary dictionary];
+    p_tusUploadLengths = [NSMutableDictionary dictionary];
+    p_tusMethodCounts = [NSCountedSet set];
+}
+
++ (void)setCorruptedPatchCount:(NSUInteger)count {
+    @synchronized (self) {
+        p_tusCorruptedPatchCount = count;
+    }
+}
+
++ (void)setAcceptedPatchLimit:(NSInteger)count {
+    @synchronized (self) {
+        p_tusAcceptedPatchLimit = count;
+    }
+}
+
++ (NSData *)dataForUploadURL:(NSURL *)url {
+    @synchronized (self) {
+        return [p_tusUploads[url.path] copy];
+    }
+}
+
++ (NSUInteger)requestCountForMethod:(NSString *)method {
+    @synchronized (self) {
+        return [p_tusMethodCounts countForObject:method];
+    }
+}
+
++ (NSUInteger)maximumConcurrentPatchCount {
+    @synchronized (self) {
+        return p_tusMaximumConcurrentPatchCount;
+    }
+}
+
++ (void)reset {
+    @synchronized (self) {
+        [p_tusUploads removeAllObjects];
+        [p_tusUploadLengths removeAllObjects];
+        [p_tusMethodCounts removeAllObjects];
+        p_tusCorruptedPatchCount = 0;
+        p_tusAcceptedPatchLimit = -1;
+        p_tusConcurrentPatchCount = 0;
+        p_tusMaximumConcurrentPatchCount = 0;
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.host hasSuffix:@".tus"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+- (void)dealloc {
+    if (_clientRunLoop) CFRelease(_clientRunLoop);
+}
+
+- (void)startLoading {
+    _clientRunLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+
+    NSURLRequest *request = self.request;
+    NSString *method = request.HTTPMethod;
+    NSInteger statusCode = 0;
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithObject:@"1.0.0" forKey:@"Tus-Resumable"];
+
+    @synchronized ([TusURLProtocol class]) {
+        [p_tusMethodCounts addObject:method];
+
+        if ([method isEqualToString:@"POST"]) {
+            statusCode = [self p_createWithHeaders:headers];
+        } else if ([method isEqualToString:@"HEAD"]) {
+            NSData *data = p_tusUploads[request.URL.path];
+            statusCode = data ? 200 : 404;
+            if (data) headers[@"Upload-Offset"] = [NSString stringWithFormat:@"%lu", (unsigned long)data.length];
+        } else if ([method isEqualToString:@"PATCH"]) {
+            statusCode = [self p_patchWithHeaders:headers];
+            _patchInFlight = YES;
+            p_tusConcurrentPatchCount += 1;
+            p_tusMaximumConcurrentPatchCount = MAX(p_tusMaximumConcurrentPatchCount, p_tusConcurrentPatchCount);
+        } else {
+            statusCode = 405;
+        }
+    }
+
+    [self p_afterDelay:(_patchInFlight ? 0.05 : 0) perform:^{
+        [self p_patchDidFinish];
+
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+        [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+        [self.client URLProtocolDidFinishLoading:self];
+    }];
+}
+
+- (void)stopLoading {
+    _stopped = YES;
+    [self p_patchDidFinish];
+}
+
+- (void)p_patchDidFinish {
+    @synchronized ([TusURLProtocol class]) {
+        if (!_patchInFlight) return ;
+        _patchInFlight = NO;
+        p_tusConcurrentPatchCount -= 1;
+    }
+}
+
+// 需要在 @synchronized ([TusURLProtocol class]) 中调用
+- (NSInteger)p_createWithHeaders:(NSMutableDictionary *)headers {
+    NSString *concat = [self.request valueForHTTPHeaderField:@"Upload-Concat"];
+    NSMutableData *data = [NSMutableData data];
+    int64_t length = [self.request valueForHTTPHeaderField:@"Upload-Length"].longLongValue;
+
+    if ([concat hasPrefix:@"final;"]) {
+        for (NSString *partial in [[concat substringFromIndex:6] componentsSeparatedByString:@" "]) {
+            NSString *path = [NSURL URLWithString:partial].path;
+            NSData *partialData = p_tusUploads[path];
+            if ((partialData == nil) || (partialData.length != p_tusUploadLengths[path].unsignedLongLongValue)) return 400;
+            [data appendData:partialData];
+        }
+        length = data.length;
+    } else if (![concat isEqualToString:@"partial"]) {
+        return 400;
+    }
+
+    // 返回相对地址，由客户端按创建地址解析
+    NSString *path = [NSString stringWithFormat:@"/files/%lu", (unsigned long)++p_tusNextUploadID];
+    p_tusUploads[path] = data;
+    p_tusUploadLengths[path] = @(length);
+    headers[@"Location"] = path;
+    return 201;
+}
+
+// 需要在 @synchronized ([TusURLProtocol class]) 中调用
+- (NSInteger)p_patchWithHeaders:(NSMutableDictionary *)headers {
+    NSString *path = self.request.URL.path;
+    NSMutableData *data = p_tusUploads[path];
+    if (data == nil) return 404;
+    if ([self.request valueForHTTPHeaderField:@"Upload-Offset"].longLongValue != (long long)data.length) return 409;
+
+    if (p_tusAcceptedPatchLimit == 0) return 400;
+
+    NSMutableData *body = [[self p_body] mutableCopy];
+    if ((p_tusCorruptedPatchCount > 0) && (body.length > 0)) {
+        p_tusCorruptedPatchCount -= 1;
+        ((uint8_t *)body.mutableBytes)[0] ^= 0xff;
+    }
+
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(body.bytes, (CC_LONG)body.length, digest);
+    NSString *checksum = [@"sha1 " stringByAppendingString:[[NSData dataWithBytes:digest length:CC_SHA1_DIGEST_LENGTH] base64EncodedStringWithOptions:0]];
+    if (![[self.request valueForHTTPHeaderField:@"Upload-Checksum"] isEqualToString:checksum]) return 460;
+
+    if (data.length + body.length > p_tusUploadLengths[path].unsignedLongLongValue) return 400;
+
+    [data appendData:body];
+    if (p_tusAcceptedPatchLimit > 0) p_tusAcceptedPatchLimit -= 1;
+    headers[@"Upload-Offset"] = [NSString stringWithFormat:@"%lu", (unsigned long)data.length];
+    return 204;
+}
+
+- (NSData *)p_body {
+    if (self.request.HTTPBody) return self.request.HTTPBody;
+
+    NSMutableData *body = [NSMutableData data];
+    NSInputStream *bodyStream = self.request.HTTPBodyStream;
+    if (bodyStream != nil) {
+        uint8_t buffer[16 * 1024];
+        [bodyStream open];
+        NSInteger length = 0;
+        while ((length = [bodyStream read:buffer maxLength:sizeof(buffer)]) > 0) {
+            [body appendBytes:buffer length:length];
+        }
+        [bodyStream close];
+    }
+    return body;
+}
+
+// 在加载请求的线程中执行，NSURLProtocol 的回调必须在该线程中调用
+- (void)p_afterDelay:(NSTimeInterval)delay perform:(dispatch_block_t)block {
+    CFRunLoopRef runLoop = _clientRunLoop;
+    dispatch_block_t guardedBlock = ^{
+        if (_stopped) return ;
+        block();
+    };
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes, guardedBlock);
+        CFRunLoopWakeUp(runLoop);
+    });
+}
+
+@end
+
+/// 当前进程的物理内存占用，单位：字节
+static uint64_t BenchmarkMemoryFootprint(void) {
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+    return info.phys_footprint;
+}
+
+
+#pragma mark - Legacy Query String
+
+/// 原先的 query 编码实现，用于校验新实现的输出一致并作为性能基准
+static void LegacyQueryStringPairs(id key, id value, NSMutableArray<NSString *> *pairs) {
+    NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:@"description" ascending:YES selector:@selector(compare:)];
+
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dictionary = value;
+        for (id nestedKey in [dictionary.allKeys sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
+            LegacyQueryStringPairs((key ? [NSString stringWithFormat:@"%@[%@]", key, nestedKey] : nestedKey), dictionary[nestedKey], pairs);
+        }
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        for (id nestedValue in (NSArray *)value) {
+            LegacyQueryStringPairs([NSString stringWithFormat:@"%@[]", key], nestedValue, pairs);
+        }
+    } else if ([value isKindOfClass:[NSSet class]]) {
+        for (id obj in [(NSSet *)value sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
+            LegacyQueryStringPairs(key, obj, pairs);
+        }
+    } else if ((value == nil) || [value isEqual:[NSNull null]]) {
+        [pairs addObject:[key description]];
+    } else {
+        [pairs addObject:[NSString stringWithFormat:@"%@=%@", [key description], [value description]]];
+    }
+}
+
+static NSString *LegacyQueryString(NSDictionary *parameters) {
+    NSMutableArray *pairs = [NSMutableArray array];
+    LegacyQueryStringPairs(nil, parameters, pairs);
+    return [[pairs componentsJoinedByString:@"&"] stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet URLQueryAllowedCharacterSet]];
+}
+
+static NSDictionary *QueryStringBenchmarkParameters(void) {
+    NSMutableDictionary *filters = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 200; i++) {
+        filters[[NSString stringWithFormat:@"field%03d", i]] = @{@"op": (i % 2 ? @"eq" : @"like"),
+                                                                 @"value": [NSString stringWithFormat:@"值 %d & more/%d", i, i * 7],
+                                                                 @"ids": @[@(i), @(i + 1), @(i + 2)]};
+    }
+    return @{@"keyword": @"南方 GIS", @"page": @1, @"size": @50, @"filter": filters};
+}
+
+
+#pragma mark - Legacy Progress Observer Registry
+
+/// 原先的进度观察者注册表：每个会话一个 NSLock 和以任务标识为键的字典，都通过关联对象获取，用于性能基准
+static const int kLegacyRegistryLockKey;
+static const int kLegacyRegistryObserversKey;
+
+static NSArray<NSString *> *LegacyProgressKeyPaths(void) {
+    return @[@"countOfBytesReceived", @"countOfBytesExpectedToReceive", @"countOfBytesSent", @"countOfBytesExpectedToSend", @"state"];
+}
+
+static NSLock *LegacyRegistryLock(NSURLSession *session) {
+    @synchronized (session) {
+        NSLock *lock = objc_getAssociatedObject(session, &kLegacyRegistryLockKey);
+        if (lock == nil) {
+            lock = [[NSLock alloc] init];
+            objc_setAssociatedObject(session, &kLegacyRegistryLockKey, lock, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        return lock;
+    }
+}
+
+static NSMutableDictionary<NSNumber *, NSObject *> *LegacyRegistryObservers(NSURLSession *session) {
+    @synchronized (session) {
+        NSMutableDictionary *observers = objc_getAssociatedObject(session, &kLegacyRegistryObserversKey);
+        if (observers == nil) {
+            observers = [NSMutableDictionary dictionary];
+            objc_setAssociatedObject(session, &kLegacyRegistryObserversKey, observers, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        return observers;
+    }
+}
+
+@interface LegacyProgressObserver : NSObject
+@end
+
+@implementation LegacyProgressObserver
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSKeyValueChangeKey,id> *)change context:(void *)context {
+}
+
+@end
+
+static void LegacyRegistryAdd(NSURLSession *session, NSURLSessionTask *task) {
+    NSLock *lock = LegacyRegistryLock(session);
+    NSMutableDictionary *observers = LegacyRegistryObservers(session);
+    LegacyProgressObserver *observer = [[LegacyProgressObserver alloc] init];
+
+    [lock lock];
+    observers[@(task.taskIdentifier)] = observer;
+    for (NSString *keyPath in LegacyProgressKeyPaths()) {
+        [task addObserver:observer forKeyPath:keyPath options:NSKeyValueObservingOptionNew context:NULL];
+    }
+    [lock unlock];
+}
+
+static void LegacyRegistryRemove(NSURLSession *session, NSURLSessionTask *task) {
+    NSLock *lock = LegacyRegistryLock(session);
+    NSMutableDictionary *observers = LegacyRegistryObservers(session);
+
+    [lock lock];
+    NSObject *observer = observers[@(task.taskIdentifier)];
+    for (NSString *keyPath in LegacyProgressKeyPaths()) {
+        [task removeObserver:observer forKeyPath:keyPath];
+    }
+    [observers removeObjectForKey:@(task.taskIdentifier)];
+    [lock unlock];
+}
+
+static NSUInteger LegacyRegistryCount(NSURLSession *session) {
+    NSLock *lock = LegacyRegistryLock(session);
+    [lock lock];
+    NSUInteger count = LegacyRegistryObservers(session).count;
+    [lock unlock];
+    return count;
+}
+
+
+#pragma mark - Crafted Binary Plist
+
+/// 按给定的对象字节拼出二进制 plist，对象引用和偏移量都是 1 字节，用于构造损坏的文件
+static NSData *CraftedBinaryPlist(NSArray<NSData *> *objects, uint64_t topObject) {
+    NSMutableData *data = [NSMutableData dataWithBytes:"bplist00" length:8];
+    NSMutableArray<NSNumber *> *offsets = [NSMutableArray array];
+    for (NSData *object in objects) {
+        [offsets addObject:@(data.length)];
+        [data appendData:object];
+    }
+
+    uint64_t offsetTableOffset = data.length;
+    for (NSNumber *offset in offsets) {
+        uint8_t byte = offset.unsignedCharValue;
+        [data appendBytes:&byte length:1];
+    }
+
+    uint8_t trailer[32] = {0};
+    trailer[6] = 1;
+    trailer[7] = 1;
+    uint64_t values[3] = {objects.count, topObject, offsetTableOffset};
+    for (int i = 0; i < 3; i++) {
+        for (int b = 0; b < 8; b++) {
+            trailer[8 + i * 8 + b] = (uint8_t)(values[i] >> (56 - b * 8));
+        }
+    }
+    [data appendBytes:trailer length:sizeof(trailer)];
+
+    return data;
+}
+
+static NSData *CraftedBytes(const uint8_t *bytes, NSUInteger length) {
+    return [NSData dataWithBytes:bytes length:length];
+}
+
+
+#pragma mark - Range URL Protocol
+
+/// 支持 HEAD 和 bytes 范围请求的桩服务，匹配 *.range 主机，返回固定的 64 KB 内容
+@interface RangeURLProtocol : NSURLProtocol
+
++ (NSData *)payload;
+
+/// 为 NO 时不返回 Accept-Ranges 并忽略 Range 请求头
++ (void)setSupportsRanges:(BOOL)supportsRanges;
+
+/// 之后 count 个范围请求返回 503
++ (void)setFailedRangeRequestCount:(NSUInteger)count;
+
+/// 大于 0 时不带 Range 的 GET 请求只返回前 length 字节且不结束
++ (void)setStallLength:(NSUInteger)length;
+
+/// 收到的 Range 请求头，包括失败的请求
++ (NSArray<NSString *> *)requestedRanges;
+
++ (NSUInteger)requestCountForMethod:(NSString *)method;
+
++ (void)reset;
+
+@end
+
+static BOOL p_rangeSupportsRanges = YES;
+static NSUInteger p_rangeFailedRequestCount = 0;
+static NSUInteger p_rangeStallLength = 0;
+static NSMutableArray<NSString *> *p_rangeRequestedRanges = nil;
+static NSCountedSet<NSString *> *p_rangeMethodCounts = nil;
+
+@implementation RangeURLProtocol
+
++ (void)initialize {
+    if (self != [RangeURLProtocol class]) return;
+    p_rangeRequestedRanges = [NSMutableArray array];
+    p_rangeMethodCounts = [NSCountedSet set];
+}
+
++ (NSData *)payload {
+    static NSData *payload = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableData *data = [NSMutableData dataWithLength:64 * 1024];
+        uint8_t *bytes = data.mutableBytes;
+        for (NSUInteger i = 0; i < data.length; i++) {
+            bytes[i] = (uint8_t)((i * 31) % 251);
+        }
+        payload = data;
+    });
+    return payload;
+}
+
++ (void)setSupportsRanges:(BOOL)supportsRanges {
+    @synchronized (self) {
+        p_rangeSupportsRanges = supportsRanges;
+    }
+}
+
++ (void)setFailedRangeRequestCount:(NSUInteger)count {
+    @synchronized (self) {
+        p_rangeFailedRequestCount = count;
+    }
+}
+
++ (void)setStallLength:(NSUInteger)length {
+    @synchronized (self) {
+        p_rangeStallLength = length;
+    }
+}
+
++ (NSArray<NSString *> *)requestedRanges {
+    @synchronized (self) {
+        return [p_rangeRequestedRanges copy];
+    }
+}
+
++ (NSUInteger)requestCountForMethod:(NSString *)method {
+    @synchronized (self) {
+        return [p_rangeMethodCounts countForObject:method];
+    }
+}
+
++ (void)reset {
+    @synchronized (self) {
+        p_rangeSupportsRanges = YES;
+        p_rangeFailedRequestCount = 0;
+        p_rangeStallLength = 0;
+        [p_rangeRequestedRanges removeAllObjects];
+        [p_rangeMethodCounts removeAllObjects];
+    }
+}
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request {
+    return [request.URL.host hasSuffix:@".range"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request {
+    return request;
+}
+
+- (void)startLoading {
+    NSData *payload = [RangeURLProtocol payload];
+    NSString *range = [self.request valueForHTTPHeaderField:@"Range"];
+    NSInteger statusCode = 200;
+    NSData *body = payload;
+    NSUInteger stallLength = 0;
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithObject:@"\"payload\"" forKey:@"ETag"];
+    headers[@"Last-Modified"] = @"Mon, 19 Oct 2026 00:00:00 GMT";
+
+    @synchronized ([RangeURLProtocol class]) {
+        [p_rangeMethodCounts addObject:self.request.HTTPMethod];
+        if (p_rangeSupportsRanges) headers[@"Accept-Ranges"] = @"bytes";
+
+        if ((range != nil) && p_rangeSupportsRanges) {
+            [p_rangeRequestedRanges addObject:range];
+
+            long long start = 0, end = 0;
+            NSScanner *scanner = [NSScanner scannerWithString:range];
+            [scanner scanString:@"bytes=" intoString:NULL];
+            [scanner scanLongLong:&start];
+            [scanner scanString:@"-" intoString:NULL];
+            [scanner scanLongLong:&end];
+            if (end < start) end = (long long)payload.length - 1;
+
+            if (p_rangeFailedRequestCount > 0) {
+                p_rangeFailedRequestCount -= 1;
+                statusCode = 503;
+                body = [NSData data];
+            } else {
+                statusCode = 206;
+                body = [payload subdataWithRange:NSMakeRange((NSUInteger)start, (NSUInteger)(end - start + 1))];
+                headers[@"Content-Range"] = [NSString stringWithFormat:@"bytes %lld-%lld/%lu", start, end, (unsigned long)payload.length];
+            }
+        } else if ([self.request.HTTPMethod isEqualToString:@"GET"]) {
+            stallLength = p_rangeStallLength;
+        }
+    }
+
+    headers[@"Content-Length"] = [NSString stringWithFormat:@"%lu", (unsigned long)body.length];
+    if ([self.request.HTTPMethod isEqualToString:@"HEAD"]) body = [NSData data];
+
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    if (stallLength > 0) {
+        // 模拟传输中断前的部分数据，等待任务被取消
+        [self.client URLProtocol:self didLoadData:[body subdataWithRange:NSMakeRange(0, MIN(stallLength, body.length))]];
+        return;
+    }
+    [self.client URLProtocol:self didLoadData:body];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading {
+}
+
+@end
+
+
+#pragma mark - Reused Connection Metrics
+
+/// 报告复用了连接的系统统计数据，系统不允许创建这两个类的实例，只能通过子类构造
+@interface ReusedConnectionTransactionMetrics : NSURLSessionTaskTransactionMetrics
+@end
+
+@implementation ReusedConnectionTransactionMetrics
+
+- (BOOL)isReusedConnection {
+    return YES;
+}
+
+@end
+
+@interface ReusedConnectionTaskMetrics : NSURLSessionTaskMetrics
+@end
+
+@implementation ReusedConnectionTaskMetrics
+
+- (NSArray<NSURLSessionTaskTransactionMetrics *> *)transactionMetrics {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    return @[[[ReusedConnectionTransactionMetrics alloc] init]];
+#pragma clang diagnostic pop
+}
+
+- (NSDateInterval *)taskInterval {
+    return [[NSDateInterval alloc] initWithStartDate:[NSDate date] duration:0];
+}
+
+@end
+
+
+#pragma mark - Nil Task Session
+
+/// 无法创建任务的会话，模拟已失效的会话
+@interface NilTaskSession : NSURLSession
+@end
+
+@implementation NilTaskSession
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request completionHandler:(void (^)(NSData *, NSURLResponse *, NSError *))completionHandler {
+    return nil;
+}
+
+- (NSURLSessionUploadTask *)uploadTaskWithRequest:(NSURLRequest *)request fromFile:(NSURL *)fileURL completionHandler:(void (^)(NSData *, NSURLResponse *, NSError *))completionHandler {
+    return nil;
+}
+
+@end
+
 
 @interface Tests : XCTestCase
 
-@end
+@end
+
+@implementation Tests
+
+- (void)setUp
+{
+    [super setUp];
+    // Put setup code here. This method is called before the invocation of each test method in the class.
+    [StubURLProtocol reset];
+    [BenchmarkURLProtocol reset];
+    [TusURLProtocol reset];
+    [RangeURLProtocol reset];
+}
+
+- (void)tearDown
+{
+    // Put teardown code here. This method is called after the invocation of each test method in the class.
+    [super tearDown];
+}
+
+#pragma mark - Progress Observer Registry
+
+static const size_t kRegistryStressWorkerCount = 16;
+static const size_t kRegistryStressTasksPerWorker = 64;
+
+/// 多个线程同时创建并立即取消任务，等待所有任务回调后返回
+- (void)p_runRegistryStressWithTaskFactory:(NSURLSessionTask *(^)(dispatch_block_t completion))factory
+{
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+
+    dispatch_apply(kRegistryStressWorkerCount, queue, ^(size_t worker) {
+        for (size_t i = 0; i < kRegistryStressTasksPerWorker; i++) {
+            dispatch_group_enter(group);
+            NSURLSessionTask *task = factory(^{
+                dispatch_group_leave(group);
+            });
+            [task cancel];
+        }
+    });
+
+    // 回调可能在主队列执行，不能阻塞主线程等待
+    XCTestExpectation *expectation = [self expectationWithDescription:@"all tasks completed"];
+    dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void)testProgressObserverRegistryStress
+{
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration ephemeralSessionConfiguration]];
+    NSURL *url = [NSURL URLWithString:@"http://127.0.0.1:9/"];
+    __block NSUInteger runCount = 0;
+
+    [NSURLSession resetProgressObserverRegistryMetrics];
+
+    [self measureBlock:^{
+        runCount += 1;
+        [self p_runRegistryStressWithTaskFactory:^NSURLSessionTask *(dispatch_block_t completion) {
+            return [session dataTaskWithURL:url downloadProgress:^(NSProgress * _Nonnull progress) {
+            } uploadProgress:^(NSProgress * _Nonnull progress) {
+            } responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+                completion();
+            } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+                completion();
+            }];
+        }];
+    }];
+
+    // 观察者在任务状态变为完成时移除，可能晚于回调
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+
+    NSDictionary *metrics = [NSURLSession progressObserverRegistryMetrics];
+    NSUInteger taskCount = runCount * kRegistryStressWorkerCount * kRegistryStressTasksPerWorker;
+    XCTAssertEqualObjects(metrics[@"observerCount"], @0);
+    // 每个任务至少注册和移除各加锁一次
+    XCTAssertGreaterThanOrEqual([metrics[@"acquisitionCount"] unsignedIntegerValue], taskCount * 2);
+    XCTAssertLessThanOrEqual([metrics[@"contentionCount"] unsignedIntegerValue], [metrics[@"acquisitionCount"] unsignedIntegerValue]);
+}
+
+- (void)testLegacyProgressObserverRegistryStress
+{
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:[NSURLSessionConfiguration ephemeralSessionConfiguration]];
+    NSURL *url = [NSURL URLWithString:@"http://127.0.0.1:9/"];
+
+    [self measureBlock:^{
+        [self p_runRegistryStressWithTaskFactory:^NSURLSessionTask *(dispatch_block_t completion) {
+            __block NSURLSessionDataTask *task = nil;
+            task = [session dataTaskWithURL:url completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+                LegacyRegistryRemove(session, task);
+                task = nil;
+                completion();
+            }];
+            LegacyRegistryAdd(session, task);
+            return task;
+        }];
+    }];
+
+    XCTAssertEqual(LegacyRegistryCount(session), 0);
+}
+
+
+#pragma mark - Retry
+
+- (NSURLSession *)p_stubSession
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[StubURLProtocol class]];
+    return [NSURLSession sessionWithConfiguration:configuration];
+}
+
+- (SGSRetryPolicy *)p_fastRetryPolicy
+{
+    SGSRetryPolicy *policy = [SGSRetryPolicy defaultPolicy];
+    policy.baseDelay = 0.01;
+    policy.maximumDelay = 0.05;
+    policy.circuitBreaker = [[SGSCircuitBreaker alloc] init];
+    return policy;
+}
+
+- (void)testRetryRecoversFromServerErrors
+{
+    NSString *host = @"recover.stub";
+    [StubURLProtocol enqueueStatusCode:503 headers:nil body:nil forHost:host];
+    [StubURLProtocol enqueueError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil] forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"ok" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request finished"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://recover.stub/items"]];
+    SGSTaskHandle *handle = [[self p_stubSession] dataTaskWithRequest:request retryPolicy:[self p_fastRetryPolicy] responseFilter:[NSURLSession responseStringFilter] success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        XCTAssertEqualObjects(responseObject, @"ok");
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }];
+    [handle resume];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 3);
+}
+
+- (void)testRetryStopsAfterMaximumRetryCount
+{
+    NSString *host = @"exhaust.stub";
+    for (int i = 0; i < 5; i++) {
+        [StubURLProtocol enqueueStatusCode:503 headers:nil body:nil forHost:host];
+    }
+
+    SGSRetryPolicy *policy = [self p_fastRetryPolicy];
+    policy.maximumRetryCount = 2;
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request finished"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://exhaust.stub/items"]];
+    [[[self p_stubSession] dataTaskWithRequest:request retryPolicy:policy responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 503);
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }] resume];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 3);
+}
+
+- (void)testRetryHonorsRetryAfter
+{
+    NSString *host = @"throttled.stub";
+    [StubURLProtocol enqueueStatusCode:429 headers:@{@"Retry-After": @"1"} body:nil forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil forHost:host];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request finished"];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://throttled.stub/items"]];
+    [[[self p_stubSession] dataTaskWithRequest:request retryPolicy:[self p_fastRetryPolicy] responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 200);
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }] resume];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertGreaterThanOrEqual(CFAbsoluteTimeGetCurrent() - start, 0.9);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+}
+
+- (void)testNonIdempotentRequestIsOnlyRetriedWhenUnsent
+{
+    NSString *host = @"post.stub";
+    [StubURLProtocol enqueueError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil] forHost:host];
+    [StubURLProtocol enqueueStatusCode:503 headers:nil body:nil forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil forHost:host];
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://post.stub/items"]];
+    request.HTTPMethod = @"POST";
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request finished"];
+    [[[self p_stubSession] uploadTaskWithRequest:request fromData:[NSData data] retryPolicy:[self p_fastRetryPolicy] progress:nil responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        // 连接失败可以重试，503 时请求可能已被处理，不再重试
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 503);
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }] resume];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+}
+
+- (void)testCircuitBreakerFailsFastWhileHostIsDown
+{
+    NSString *host = @"down.stub";
+    for (int i = 0; i < 5; i++) {
+        [StubURLProtocol enqueueStatusCode:503 headers:nil body:nil forHost:host];
+    }
+
+    SGSRetryPolicy *policy = [self p_fastRetryPolicy];
+    policy.maximumRetryCount = 1;
+    policy.circuitBreaker.failureThreshold = 2;
+    policy.circuitBreaker.resetTimeout = 60;
+
+    NSURLSession *session = [self p_stubSession];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://down.stub/items"]];
+
+    XCTestExpectation *first = [self expectationWithDescription:@"first request finished"];
+    [[session dataTaskWithRequest:request retryPolicy:policy responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTAssertEqual(((NSHTTPURLResponse *)response).statusCode, 503);
+        [first fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [first fulfill];
+    }] resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual([policy.circuitBreaker stateForHost:host], SGSCircuitBreakerStateOpen);
+
+    XCTestExpectation *second = [self expectationWithDescription:@"second request failed fast"];
+    [[session dataTaskWithRequest:request retryPolicy:policy responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTFail(@"request should not be sent while the circuit is open");
+        [second fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTAssertEqualObjects(error.domain, SGSRetryErrorDomain);
+        XCTAssertEqual(error.code, SGSRetryErrorCircuitOpen);
+        [second fulfill];
+    }] resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+}
+
+- (void)testCircuitBreakerAllowsSingleProbeAfterResetTimeout
+{
+    SGSCircuitBreaker *breaker = [[SGSCircuitBreaker alloc] init];
+    breaker.failureThreshold = 1;
+    breaker.resetTimeout = 0;
+
+    [breaker recordFailureForHost:@"probe.stub"];
+    XCTAssertTrue([breaker allowsRequestToHost:@"probe.stub"]);
+    XCTAssertEqual([breaker stateForHost:@"probe.stub"], SGSCircuitBreakerStateHalfOpen);
+
+    [breaker recordSuccessForHost:@"probe.stub"];
+    XCTAssertEqual([breaker stateForHost:@"probe.stub"], SGSCircuitBreakerStateClosed);
+}
+
+- (void)testDecorrelatedJitterStaysWithinBounds
+{
+    SGSRetryPolicy *policy = [SGSRetryPolicy defaultPolicy];
+    policy.baseDelay = 0.5;
+    policy.maximumDelay = 10;
+
+    NSTimeInterval previousDelay = 0;
+    for (int i = 0; i < 1000; i++) {
+        NSTimeInterval delay = [policy delayAfterPreviousDelay:previousDelay response:nil];
+        XCTAssertGreaterThanOrEqual(delay, policy.baseDelay);
+        XCTAssertLessThanOrEqual(delay, MIN(policy.maximumDelay, MAX(policy.baseDelay, previousDelay * 3)));
+        previousDelay = delay;
+    }
+}
+
+- (void)testRetryAfterParsing
+{
+    NSURL *url = [NSURL URLWithString:@"http://parse.stub/"];
+    NSHTTPURLResponse *seconds = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:503 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Retry-After": @"120"}];
+    XCTAssertEqualWithAccuracy([SGSRetryPolicy retryAfterIntervalForResponse:seconds], 120, 0.001);
+
+    NSHTTPURLResponse *past = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:503 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Retry-After": @"Wed, 21 Oct 2015 07:28:00 GMT"}];
+    XCTAssertEqualWithAccuracy([SGSRetryPolicy retryAfterIntervalForResponse:past], 0, 0.001);
+
+    NSHTTPURLResponse *none = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:503 HTTPVersion:@"HTTP/1.1" headerFields:@{}];
+    XCTAssertLessThan([SGSRetryPolicy retryAfterIntervalForResponse:none], 0);
+}
+
+- (void)testRetryAfterDateParsingIsThreadSafe
+{
+    NSURL *url = [NSURL URLWithString:@"http://parse.stub/"];
+    NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+    formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss 'GMT'";
+    NSString *future = [formatter stringFromDate:[NSDate dateWithTimeIntervalSinceNow:600]];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:503 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Retry-After": future}];
+
+    __block NSUInteger failures = 0;
+    dispatch_apply(256, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        NSTimeInterval interval = [SGSRetryPolicy retryAfterIntervalForResponse:response];
+        if ((interval < 590) || (interval > 600)) {
+            @synchronized (response) {
+                failures += 1;
+            }
+        }
+    });
+
+    XCTAssertEqual(failures, 0);
+}
+
+
+#pragma mark - Benchmark
+
+- (NSURLSession *)p_benchmarkSession
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[BenchmarkURLProtocol class]];
+    configuration.HTTPMaximumConnectionsPerHost = 16;
+    return [NSURLSession sessionWithConfiguration:configuration];
+}
+
+/*!
+ *  依次发起 requestCount 个请求并等待全部完成，start 中发起第 index 个请求，完成时调用 done（可在任意线程）
+ *
+ *  返回 requestsPerSecond、millisecondsPerRequest 和 memoryGrowth（字节）
+ */
+- (NSDictionary<NSString *, NSNumber *> *)p_benchmarkNamed:(NSString *)name
+                                              requestCount:(NSUInteger)requestCount
+                                                     start:(void (^)(NSUInteger index, dispatch_block_t done))start
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:name];
+    __block NSUInteger remaining = requestCount;
+    dispatch_block_t done = ^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (--remaining == 0) [expectation fulfill];
+        });
+    };
+
+    uint64_t memoryBefore = BenchmarkMemoryFootprint();
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+    for (NSUInteger i = 0; i < requestCount; i++) {
+        start(i, done);
+    }
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - startTime;
+    uint64_t memoryAfter = BenchmarkMemoryFootprint();
+    int64_t memoryGrowth = (int64_t)memoryAfter - (int64_t)memoryBefore;
+
+    NSLog(@"[benchmark] %@: %lu requests in %.3f s, %.1f req/s, %.3f ms/request, memory %+.1f KB",
+          name, (unsigned long)requestCount, elapsed, requestCount / elapsed, elapsed * 1000 / requestCount, memoryGrowth / 1024.0);
+
+    return @{@"requestsPerSecond": @(requestCount / elapsed),
+             @"millisecondsPerRequest": @(elapsed * 1000 / requestCount),
+             @"memoryGrowth": @(memoryGrowth)};
+}
+
+- (void)p_logOverheadOf:(NSDictionary *)helper comparedTo:(NSDictionary *)baseline name:(NSString *)name
+{
+    double overhead = [helper[@"millisecondsPerRequest"] doubleValue] - [baseline[@"millisecondsPerRequest"] doubleValue];
+    NSLog(@"[benchmark] %@ helper overhead: %.3f ms/request", name, overhead);
+}
+
+- (void)testBenchmarkStubHonorsLatencyAndBandwidth
+{
+    NSURLSession *session = [self p_benchmarkSession];
+    [BenchmarkURLProtocol setLatency:0.2 bandwidth:1024 * 1024];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"throttled download"];
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    __block NSUInteger receivedLength = 0;
+
+    [[session dataTaskWithURL:[BenchmarkURLProtocol URLWithPayloadSize:256 * 1024] responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        receivedLength = [responseObject length];
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }] resume];
+
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    XCTAssertEqual(receivedLength, 256 * 1024);
+    // 延迟 0.2 秒，再按 1 MB/s 传输 256 KB
+    XCTAssertGreaterThanOrEqual(CFAbsoluteTimeGetCurrent() - startTime, 0.2 + 0.2);
+}
+
+- (void)testDataTaskBenchmark
+{
+    NSURLSession *session = [self p_benchmarkSession];
+    NSURL *url = [BenchmarkURLProtocol URLWithPayloadSize:16 * 1024];
+    const NSUInteger requestCount = 500;
+
+    NSDictionary *baseline = [self p_benchmarkNamed:@"data (raw NSURLSession)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        [[session dataTaskWithURL:url completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            done();
+        }] resume];
+    }];
+
+    NSDictionary *helper = [self p_benchmarkNamed:@"data (SGS helper)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        [[session dataTaskWithURL:url downloadProgress:^(NSProgress * _Nonnull progress) {
+        } uploadProgress:nil responseFilter:[NSURLSession responseStringFilter] success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+            done();
+        } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+            done();
+        }] resume];
+    }];
+
+    [self p_logOverheadOf:helper comparedTo:baseline name:@"data"];
+    XCTAssertGreaterThan([helper[@"requestsPerSecond"] doubleValue], 0);
+}
+
+- (void)testUploadTaskBenchmark
+{
+    NSURLSession *session = [self p_benchmarkSession];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[BenchmarkURLProtocol URLWithPayloadSize:128]];
+    request.HTTPMethod = @"POST";
+    NSData *body = [NSMutableData dataWithLength:64 * 1024];
+    const NSUInteger requestCount = 300;
+
+    NSDictionary *baseline = [self p_benchmarkNamed:@"upload (raw NSURLSession)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        [[session uploadTaskWithRequest:request fromData:body completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            done();
+        }] resume];
+    }];
+
+    NSDictionary *helper = [self p_benchmarkNamed:@"upload (SGS helper)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        [[session uploadTaskWithRequest:request fromData:body progress:^(NSProgress * _Nonnull progress) {
+        } responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+            done();
+        } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+            done();
+        }] resume];
+    }];
+
+    [self p_logOverheadOf:helper comparedTo:baseline name:@"upload"];
+    NSLog(@"[benchmark] upload body bytes received by stub: %llu", [BenchmarkURLProtocol receivedBodyLength]);
+    XCTAssertGreaterThan([helper[@"requestsPerSecond"] doubleValue], 0);
+}
+
+- (void)testDownloadTaskBenchmark
+{
+    NSURLSession *session = [self p_benchmarkSession];
+    session.downloadResumeJournal = nil;
+    NSURLRequest *request = [NSURLRequest requestWithURL:[BenchmarkURLProtocol URLWithPayloadSize:256 * 1024]];
+    NSURL *directory = [NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES];
+    const NSUInteger requestCount = 200;
+
+    NSDictionary *baseline = [self p_benchmarkNamed:@"download (raw NSURLSession)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        [[session downloadTaskWithRequest:request completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            done();
+        }] resume];
+    }];
+
+    NSDictionary *helper = [self p_benchmarkNamed:@"download (SGS helper)" requestCount:requestCount start:^(NSUInteger index, dispatch_block_t done) {
+        NSURL *destination = [directory URLByAppendingPathComponent:[NSString stringWithFormat:@"benchmark-%lu", (unsigned long)index]];
+        [[session downloadTaskWithRequest:request progress:^(NSProgress * _Nonnull progress) {
+        } destination:^NSURL * _Nonnull(NSURLResponse * _Nonnull response, NSURL * _Nonnull location) {
+            return destination;
+        } success:^(NSURLResponse * _Nonnull response, NSURL * _Nullable filePath) {
+            [[NSFileManager defaultManager] removeItemAtURL:destination error:NULL];
+            done();
+        } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+            done();
+        }] resume];
+    }];
+
+    [self p_logOverheadOf:helper comparedTo:baseline name:@"download"];
+    XCTAssertGreaterThan([helper[@"requestsPerSecond"] doubleValue], 0);
+}
+
+#pragma mark - Chunked Upload
+
+- (NSURLSession *)p_tusSession
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[TusURLProtocol class]];
+    configuration.HTTPMaximumConnectionsPerHost = 8;
+    return [NSURLSession sessionWithConfiguration:configuration];
+}
+
+- (NSURL *)p_temporaryFileWithLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    arc4random_buf(data.mutableBytes, length);
+
+    NSString *fileName = [NSString stringWithFormat:@"chunked-%@.bin", [NSUUID UUID].UUIDString];
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+    [data writeToURL:fileURL atomically:YES];
+    return fileURL;
+}
+
+- (SGSChunkedUploader *)p_uploaderWithConcurrency:(NSUInteger)concurrency
+{
+    SGSChunkedUploader *uploader = [[SGSChunkedUploader alloc] init];
+    uploader.chunkSize = 1024;
+    uploader.maximumConcurrentChunks = concurrency;
+    SGSRetryPolicy *policy = [self p_fastRetryPolicy];
+    policy.circuitBreaker = nil;
+    uploader.retryPolicy = policy;
+    return uploader;
+}
+
+/// 上传文件并等待完成，返回合并后的地址，失败时返回 nil
+- (NSURL *)p_chunkedUploadFile:(NSURL *)fileURL endpoint:(NSURL *)endpoint uploader:(SGSChunkedUploader *)uploader
+{
+    __block NSURL *uploadURL = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"upload finished"];
+    [[[self p_tusSession] chunkedUploadTaskWithFile:fileURL endpoint:endpoint uploader:uploader metadata:@{@"type": @"测试"} progress:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        uploadURL = responseObject;
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        [expectation fulfill];
+    }] resume];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    return uploadURL;
+}
+
+- (void)testChunkedUploadReassemblesFileInParallel
+{
+    NSURL *fileURL = [self p_temporaryFileWithLength:10 * 1024 + 100];
+    NSURL *endpoint = [NSURL URLWithString:@"http://parallel.tus/files/"];
+    SGSChunkedUploader *uploader = [self p_uploaderWithConcurrency:3];
+
+    NSURL *uploadURL = [self p_chunkedUploadFile:fileURL endpoint:endpoint uploader:uploader];
+
+    XCTAssertNotNil(uploadURL);
+    XCTAssertEqualObjects([TusURLProtocol dataForUploadURL:uploadURL], [NSData dataWithContentsOfURL:fileURL]);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"PATCH"], 11);
+    XCTAssertGreaterThan([TusURLProtocol maximumConcurrentPatchCount], 1);
+    XCTAssertLessThanOrEqual([TusURLProtocol maximumConcurrentPatchCount], 3);
+    XCTAssertFalse([uploader hasJournalForFileURL:fileURL endpoint:endpoint]);
+
+    [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+}
+
+- (void)testChunkedUploadRetriesChecksumMismatch
+{
+    NSURL *fileURL = [self p_temporaryFileWithLength:4 * 1024];
+    NSURL *endpoint = [NSURL URLWithString:@"http://checksum.tus/files/"];
+    [TusURLProtocol setCorruptedPatchCount:2];
+
+    NSURL *uploadURL = [self p_chunkedUploadFile:fileURL endpoint:endpoint uploader:[self p_uploaderWithConcurrency:2]];
+
+    XCTAssertNotNil(uploadURL);
+    XCTAssertEqualObjects([TusURLProtocol dataForUploadURL:uploadURL], [NSData dataWithContentsOfURL:fileURL]);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"PATCH"], 4 + 2);
+
+    [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+}
+
+- (void)testChunkedUploadResumesCompletedChunksFromJournal
+{
+    NSURL *fileURL = [self p_temporaryFileWithLength:6 * 1024];
+    NSURL *endpoint = [NSURL URLWithString:@"http://resume.tus/files/"];
+    SGSChunkedUploader *uploader = [self p_uploaderWithConcurrency:1];
+    [uploader removeJournalForFileURL:fileURL endpoint:endpoint];
+
+    // 第 4 块被拒绝，上传失败，前 3 块保留在续传记录中
+    [TusURLProtocol setAcceptedPatchLimit:3];
+    XCTAssertNil([self p_chunkedUploadFile:fileURL endpoint:endpoint uploader:uploader]);
+    XCTAssertTrue([uploader hasJournalForFileURL:fileURL endpoint:endpoint]);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"POST"], 4);
+
+    [TusURLProtocol setAcceptedPatchLimit:-1];
+    NSUInteger patchCount = [TusURLProtocol requestCountForMethod:@"PATCH"];
+    NSURL *uploadURL = [self p_chunkedUploadFile:fileURL endpoint:endpoint uploader:uploader];
+
+    // 已完成的块不再上传，第 4 块先同步偏移量再上传，后 2 块重新创建
+    XCTAssertNotNil(uploadURL);
+    XCTAssertEqualObjects([TusURLProtocol dataForUploadURL:uploadURL], [NSData dataWithContentsOfURL:fileURL]);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"HEAD"], 1);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"PATCH"] - patchCount, 3);
+    XCTAssertEqual([TusURLProtocol requestCountForMethod:@"POST"], 4 + 2 + 1);
+    XCTAssertFalse([uploader hasJournalForFileURL:fileURL endpoint:endpoint]);
+
+    [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+}
+
+
+#pragma mark - Query String
+
+- (void)testQueryStringMatchesLegacyEncoder
+{
+    NSArray<NSDictionary *> *cases = @[@{},
+                                       @{@"keyword": @"abc", @"filter": @"Car"},
+                                       @{@"empty": @"", @"null": [NSNull null], @"number": @3.5, @"bool": @YES},
+                                       @{@"reserved": @"a&b=c?d/e#f[g]h%i+j k", @"unicode": @"中文 ü 😀"},
+                                       @{@"nested": @{@"b": @{@"c": @[@1, @{@"d": @"e"}]}, @"a": @"x"}, @"list": @[@"1", @[@"2", @"3"]]},
+                                       @{@"set": [NSSet setWithObjects:@"b", @"a", @"c", nil], @1: @"numeric key", @"z[]": @"bracket key"},
+                                       QueryStringBenchmarkParameters()];
+
+    for (NSDictionary *parameters in cases) {
+        XCTAssertEqualObjects([NSURL queryStringFromParameters:parameters], LegacyQueryString(parameters));
+    }
+
+    NSURL *url = [NSURL URLWithString:@"http://example.com/search?q=1"];
+    XCTAssertEqualObjects([url URLByAppendingQueryWithParameters:@{@"page": @2}].absoluteString, @"http://example.com/search?q=1&page=2");
+}
+
+- (void)testQueryStringEncoderPerformance
+{
+    NSDictionary *parameters = QueryStringBenchmarkParameters();
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100; i++) {
+            @autoreleasepool {
+                [NSURL queryStringFromParameters:parameters];
+            }
+        }
+    }];
+}
+
+- (void)testLegacyQueryStringEncoderPerformance
+{
+    NSDictionary *parameters = QueryStringBenchmarkParameters();
+
+    [self measureBlock:^{
+        for (int i = 0; i < 100; i++) {
+            @autoreleasepool {
+                LegacyQueryString(parameters);
+            }
+        }
+    }];
+}
+
+
+#pragma mark - Mapped Property List
+
+- (NSString *)p_writeTemporaryPlist:(NSData *)data
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@.plist", [NSUUID UUID].UUIDString]];
+    XCTAssertTrue([data writeToFile:path atomically:YES]);
+    return path;
+}
+
+- (void)testMappedPropertyListRejectsOverflowingCounts
+{
+    // 数组的扩展长度为 UINT64_MAX，start + count 溢出
+    const uint8_t array[] = {0xAF, 0x13, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    // 字典的扩展长度乘 2 后溢出
+    const uint8_t dictionary[] = {0xDF, 0x13, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+    // 字符串长度超出对象区
+    const uint8_t string[] = {0x6F, 0x13, 0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+    for (NSData *object in @[CraftedBytes(array, sizeof(array)), CraftedBytes(dictionary, sizeof(dictionary)), CraftedBytes(string, sizeof(string))]) {
+        NSString *path = [self p_writeTemporaryPlist:CraftedBinaryPlist(@[object], 0)];
+        NSError *error = nil;
+        XCTAssertNil([SGSMappedPropertyList propertyListWithContentsOfFile:path error:&error]);
+        XCTAssertEqual(error.code, NSPropertyListReadCorruptError);
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    }
+}
+
+- (void)testMappedPropertyListStopsAtSelfReferences
+{
+    // 0: [ref 0, ref 1]，1: {"self": ref 1, "parent": ref 0}
+    const uint8_t array[] = {0xA2, 0x00, 0x01};
+    const uint8_t dictionary[] = {0xD2, 0x02, 0x03, 0x01, 0x00};
+    const uint8_t selfKey[] = {0x54, 's', 'e', 'l', 'f'};
+    const uint8_t parentKey[] = {0x56, 'p', 'a', 'r', 'e', 'n', 't'};
+
+    NSString *path = [self p_writeTemporaryPlist:CraftedBinaryPlist(@[CraftedBytes(array, sizeof(array)),
+                                                                       CraftedBytes(dictionary, sizeof(dictionary)),
+                                                                       CraftedBytes(selfKey, sizeof(selfKey)),
+                                                                       CraftedBytes(parentKey, sizeof(parentKey))], 0)];
+
+    // 引用自身或祖先的元素和 value 被丢弃，不计入 count
+    NSArray *root = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    XCTAssertEqual(root.count, 1);
+
+    NSDictionary *child = root[0];
+    XCTAssertTrue([child isKindOfClass:[NSDictionary class]]);
+    XCTAssertEqual(child.count, 0);
+    XCTAssertNil(child[@"self"]);
+    XCTAssertNil(child[@"parent"]);
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMappedPropertyListCountsDuplicateKeysOnce
+{
+    // 0: {"a": 1, "a": 2}
+    const uint8_t dictionary[] = {0xD2, 0x01, 0x01, 0x02, 0x03};
+    const uint8_t key[] = {0x51, 'a'};
+    const uint8_t one[] = {0x10, 0x01};
+    const uint8_t two[] = {0x10, 0x02};
+
+    NSString *path = [self p_writeTemporaryPlist:CraftedBinaryPlist(@[CraftedBytes(dictionary, sizeof(dictionary)),
+                                                                       CraftedBytes(key, sizeof(key)),
+                                                                       CraftedBytes(one, sizeof(one)),
+                                                                       CraftedBytes(two, sizeof(two))], 0)];
+
+    NSDictionary *root = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    XCTAssertEqual(root.count, 1);
+    XCTAssertEqual(root.keyEnumerator.allObjects.count, root.count);
+    XCTAssertEqualObjects(root[@"a"], @2);
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMappedPropertyListDropsUnresolvableValues
+{
+    // 0: {"ok": 1, "bad": ref 9（越界）, "text": ref 4（无效的标记）}，1: [ref 3, ref 9, ref 4]
+    const uint8_t dictionary[] = {0xD3, 0x05, 0x06, 0x07, 0x03, 0x09, 0x04};
+    const uint8_t array[] = {0xA3, 0x03, 0x09, 0x04};
+    const uint8_t root[] = {0xA2, 0x00, 0x01};
+    const uint8_t one[] = {0x10, 0x01};
+    const uint8_t invalid[] = {0x07};
+    const uint8_t okKey[] = {0x52, 'o', 'k'};
+    const uint8_t badKey[] = {0x53, 'b', 'a', 'd'};
+    const uint8_t textKey[] = {0x54, 't', 'e', 'x', 't'};
+
+    NSString *path = [self p_writeTemporaryPlist:CraftedBinaryPlist(@[CraftedBytes(dictionary, sizeof(dictionary)),
+                                                                       CraftedBytes(array, sizeof(array)),
+                                                                       CraftedBytes(root, sizeof(root)),
+                                                                       CraftedBytes(one, sizeof(one)),
+                                                                       CraftedBytes(invalid, sizeof(invalid)),
+                                                                       CraftedBytes(okKey, sizeof(okKey)),
+                                                                       CraftedBytes(badKey, sizeof(badKey)),
+                                                                       CraftedBytes(textKey, sizeof(textKey))], 2)];
+
+    NSArray *plist = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    NSDictionary *dictionaryValue = plist[0];
+    XCTAssertEqual(dictionaryValue.count, 1);
+    XCTAssertEqualObjects(dictionaryValue.allKeys, @[@"ok"]);
+    XCTAssertEqualObjects(dictionaryValue.allValues, @[@1]);
+    for (NSString *key in dictionaryValue) {
+        XCTAssertNotNil(dictionaryValue[key]);
+    }
+    XCTAssertEqualObjects(dictionaryValue, @{@"ok": @1});
+
+    NSArray *arrayValue = plist[1];
+    XCTAssertEqualObjects(arrayValue, @[@1]);
+    XCTAssertNoThrow(arrayValue.description);
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testMappedPropertyListReloadsEditedBinarySource
+{
+    NSData *first = [NSPropertyListSerialization dataWithPropertyList:@{@"version": @1} format:NSPropertyListBinaryFormat_v1_0 options:kNilOptions error:nil];
+    NSString *path = [self p_writeTemporaryPlist:first];
+    XCTAssertEqualObjects([SGSMappedPropertyList propertyListWithContentsOfFile:path][@"version"], @1);
+
+    NSData *second = [NSPropertyListSerialization dataWithPropertyList:@{@"version": @2, @"note": @"edited"} format:NSPropertyListBinaryFormat_v1_0 options:kNilOptions error:nil];
+    XCTAssertTrue([second writeToFile:path atomically:YES]);
+    XCTAssertEqualObjects([SGSMappedPropertyList propertyListWithContentsOfFile:path][@"version"], @2);
+
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+
+#pragma mark - Coalescing
+
+- (void)testCoalescedRequestsShareOneNetworkHit
+{
+    NSString *host = @"coalesce.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"shared" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    NSURL *url = [NSURL URLWithString:@"http://coalesce.stub/items"];
+    const NSUInteger requestCount = 8;
+    NSMutableArray<SGSTaskHandle *> *handles = [NSMutableArray array];
+
+    for (NSUInteger i = 0; i < requestCount; i++) {
+        XCTestExpectation *expectation = [self expectationWithDescription:[NSString stringWithFormat:@"request %lu", (unsigned long)i]];
+        [handles addObject:[session coalescedDataTaskWithURL:url responseFilter:[NSURLSession responseStringFilter] success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+            XCTAssertEqualObjects(responseObject, @"shared");
+            [expectation fulfill];
+        } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+            XCTFail(@"%@", error);
+            [expectation fulfill];
+        }]];
+    }
+
+    XCTAssertEqual(session.requestCoalescer.inFlightCount, 1);
+    XCTAssertEqual(session.requestCoalescer.coalescedCount, requestCount - 1);
+
+    [handles makeObjectsPerformSelector:@selector(resume)];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 1);
+    XCTAssertEqual(session.requestCoalescer.inFlightCount, 0);
+}
+
+- (void)testCancellingOneCoalescedSubscriberKeepsSharedTask
+{
+    NSString *host = @"coalesce-cancel.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"kept" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    NSURL *url = [NSURL URLWithString:@"http://coalesce-cancel.stub/items"];
+
+    XCTestExpectation *cancelled = [self expectationWithDescription:@"cancelled subscriber"];
+    SGSTaskHandle *cancelledHandle = [session coalescedDataTaskWithURL:url responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTFail(@"cancelled subscriber received a response");
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [cancelled fulfill];
+    }];
+
+    XCTestExpectation *kept = [self expectationWithDescription:@"remaining subscriber"];
+    SGSTaskHandle *keptHandle = [session coalescedDataTaskWithURL:url responseFilter:[NSURLSession responseStringFilter] success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTAssertEqualObjects(responseObject, @"kept");
+        [kept fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [kept fulfill];
+    }];
+
+    XCTAssertEqual(cancelledHandle.task, keptHandle.task);
+
+    [cancelledHandle cancel];
+    XCTAssertNotEqual(keptHandle.task.state, NSURLSessionTaskStateCanceling);
+
+    [keptHandle resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 1);
+}
+
+
+
+#pragma mark - Response Cache
+
+- (SGSHTTPResponseCache *)p_temporaryResponseCache
+{
+    SGSHTTPResponseCache *cache = [[SGSHTTPResponseCache alloc] initWithName:[NSUUID UUID].UUIDString memoryCapacity:1024 * 1024 diskCapacity:4 * 1024 * 1024];
+    [self addTeardownBlock:^{
+        [cache removeAllCachedResponses];
+    }];
+    return cache;
+}
+
+- (id)p_responseObjectForRequest:(NSURLRequest *)request session:(NSURLSession *)session cache:(SGSHTTPResponseCache *)cache timeToLive:(NSTimeInterval)timeToLive
+{
+    __block id result = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:request.URL.absoluteString];
+    SGSTaskHandle *handle = [session dataTaskWithRequest:request cache:cache timeToLive:timeToLive responseFilter:[NSURLSession responseStringFilter] success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        result = responseObject;
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        result = error;
+        [expectation fulfill];
+    }];
+    [handle resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    return result;
+}
+
+- (void)testResponseCacheServesFreshHitWithoutNetwork
+{
+    NSString *host = @"cache-hit.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"Cache-Control": @"max-age=60"} body:[@"fresh" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    SGSHTTPResponseCache *cache = [self p_temporaryResponseCache];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://cache-hit.stub/items"]];
+
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"fresh");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"fresh");
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 1);
+    XCTAssertEqual(cache.missCount, 1);
+    XCTAssertEqual(cache.hitCount, 1);
+}
+
+- (void)testResponseCacheRestoresSecurelyArchivedResponseFromDisk
+{
+    NSString *name = [NSUUID UUID].UUIDString;
+    SGSHTTPResponseCache *cache = [[SGSHTTPResponseCache alloc] initWithName:name memoryCapacity:1024 * 1024 diskCapacity:4 * 1024 * 1024];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://cache-disk.stub/items"]];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Cache-Control": @"max-age=60"}];
+    NSData *data = [@"on-disk" dataUsingEncoding:NSUTF8StringEncoding];
+
+    XCTAssertNotNil([cache storeData:data response:response decodedObject:nil filter:nil forRequest:request timeToLive:SGSHTTPCacheTimeToLiveAutomatic]);
+
+    // currentDiskUsage 在 IO 队列中读取，会等待异步的磁盘写入完成
+    XCTAssertGreaterThan(cache.currentDiskUsage, 0);
+
+    // 新实例的内存缓存为空，只能从磁盘解码
+    SGSHTTPResponseCache *reopened = [[SGSHTTPResponseCache alloc] initWithName:name memoryCapacity:1024 * 1024 diskCapacity:4 * 1024 * 1024];
+    SGSCachedResponse *cached = [reopened cachedResponseForRequest:request];
+    XCTAssertEqualObjects(cached.data, data);
+    XCTAssertEqual(cached.response.statusCode, 200);
+    XCTAssertEqualObjects(cached.response.URL, request.URL);
+
+    [reopened removeAllCachedResponses];
+}
+
+- (void)testResponseCacheKeyIncludesCredentialsAndVaryHeaders
+{
+    NSString *host = @"cache-vary.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"Cache-Control": @"max-age=60", @"Vary": @"X-Client"} body:[@"alice" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"Cache-Control": @"max-age=60", @"Vary": @"X-Client"} body:[@"bob" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"Cache-Control": @"max-age=60", @"Vary": @"X-Client"} body:[@"bob-ios" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    SGSHTTPResponseCache *cache = [self p_temporaryResponseCache];
+    NSURL *url = [NSURL URLWithString:@"http://cache-vary.stub/profile"];
+
+    NSMutableURLRequest *alice = [NSMutableURLRequest requestWithURL:url];
+    [alice setValue:@"Bearer alice" forHTTPHeaderField:@"Authorization"];
+    NSMutableURLRequest *bob = [NSMutableURLRequest requestWithURL:url];
+    [bob setValue:@"Bearer bob" forHTTPHeaderField:@"Authorization"];
+    NSMutableURLRequest *bobOnIOS = [bob mutableCopy];
+    [bobOnIOS setValue:@"ios" forHTTPHeaderField:@"X-Client"];
+
+    XCTAssertEqualObjects([self p_responseObjectForRequest:alice session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"alice");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:bob session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"bob");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:alice session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"alice");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:bobOnIOS session:session cache:cache timeToLive:SGSHTTPCacheTimeToLiveAutomatic], @"bob-ios");
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 3);
+    XCTAssertEqual(cache.hitCount, 1);
+}
+
+- (void)testResponseCacheRevalidatesWithETag
+{
+    NSString *host = @"cache-etag.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"ETag": @"\"v1\""} body:[@"original" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+    [StubURLProtocol enqueueStatusCode:304 headers:@{@"ETag": @"\"v1\""} body:nil forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    SGSHTTPResponseCache *cache = [self p_temporaryResponseCache];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://cache-etag.stub/items"]];
+
+    // 有效期为 0，第二次请求需要重新验证
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:0], @"original");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:0], @"original");
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+    XCTAssertEqual(cache.notModifiedCount, 1);
+    XCTAssertEqual(cache.missCount, 1);
+}
+
+- (void)testResponseCacheExpiresAfterTimeToLive
+{
+    NSString *host = @"cache-ttl.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"v1" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"v2" dataUsingEncoding:NSUTF8StringEncoding] forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    SGSHTTPResponseCache *cache = [self p_temporaryResponseCache];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://cache-ttl.stub/items"]];
+
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:0.3], @"v1");
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:0.3], @"v1");
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 1);
+
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+
+    XCTAssertEqualObjects([self p_responseObjectForRequest:request session:session cache:cache timeToLive:0.3], @"v2");
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+}
+
+- (void)testCancellingCachedRequestBeforeResumeReportsCancellation
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"cancelled"];
+    SGSTaskHandle *handle = [[self p_stubSession] dataTaskWithURL:[NSURL URLWithString:@"http://cache-cancel.stub/items"] cache:[self p_temporaryResponseCache] timeToLive:60 responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        XCTFail(@"cancelled request received a response");
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [expectation fulfill];
+    }];
+
+    [handle cancel];
+    [handle resume];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([StubURLProtocol requestCountForHost:@"cache-cancel.stub"], 0);
+}
+
+
+
+#pragma mark - Progress Throttle
+
+- (void)testProgressThrottleDoesNotRepeatDeliveredFinalProgress
+{
+    NSMutableArray<NSNumber *> *deliveries = [NSMutableArray array];
+    NSMutableSet<NSThread *> *threads = [NSMutableSet set];
+    SGSProgressThrottle *throttle = [[SGSProgressThrottle alloc] initWithMaximumRate:10 queue:nil block:^(NSProgress * _Nonnull progress) {
+        @synchronized (deliveries) {
+            [deliveries addObject:@(progress.completedUnitCount)];
+            [threads addObject:[NSThread currentThread]];
+        }
+    }];
+
+    NSProgress *progress = [NSProgress progressWithTotalUnitCount:10];
+    progress.completedUnitCount = 5;
+    [throttle progressDidChange:progress];
+    progress.completedUnitCount = 10;
+    [throttle progressDidChange:progress];
+
+    // 等待合并的延迟回调送达 100%，之后结束不应再次回调
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+    [throttle finishWithProgress:progress];
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+
+    @synchronized (deliveries) {
+        XCTAssertEqual(deliveries.count, 2);
+        XCTAssertEqualObjects(deliveries.lastObject, @10);
+        XCTAssertFalse([threads containsObject:[NSThread mainThread]]);
+    }
+}
+
+
+
+#pragma mark - Request Scheduler
+
+- (SGSTaskHandle *)p_scheduleRequestNamed:(NSString *)name
+                                     host:(NSString *)host
+                                 priority:(SGSRequestPriority)priority
+                                scheduler:(SGSRequestScheduler *)scheduler
+                                  session:(NSURLSession *)session
+                                  started:(NSMutableArray<NSString *> *)started
+                                 finishes:(NSMutableDictionary<NSString *, dispatch_block_t> *)finishes
+{
+    NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://%@/%@", host, name]];
+    return [scheduler scheduleRequest:[NSURLRequest requestWithURL:url] priority:priority taskFactory:^NSURLSessionTask * _Nullable(dispatch_block_t  _Nonnull finish) {
+        [started addObject:name];
+        finishes[name] = finish;
+        return [session dataTaskWithURL:url];
+    } failure:nil];
+}
+
+- (void)testSchedulerStartsHigherPriorityFirst
+{
+    SGSRequestScheduler *scheduler = [[SGSRequestScheduler alloc] init];
+    scheduler.maximumConcurrentRequests = 1;
+    NSURLSession *session = [self p_stubSession];
+    NSMutableArray<NSString *> *started = [NSMutableArray array];
+    NSMutableDictionary<NSString *, dispatch_block_t> *finishes = [NSMutableDictionary dictionary];
+
+    [[self p_scheduleRequestNamed:@"blocker" host:@"schedule.stub" priority:SGSRequestPriorityUtility scheduler:scheduler session:session started:started finishes:finishes] resume];
+
+    NSArray *requests = @[@[@"bg1", @(SGSRequestPriorityBackground)],
+                          @[@"util1", @(SGSRequestPriorityUtility)],
+                          @[@"ui1", @(SGSRequestPriorityUserInitiated)],
+                          @[@"bg2", @(SGSRequestPriorityBackground)],
+                          @[@"ui2", @(SGSRequestPriorityUserInitiated)]];
+    for (NSArray *request in requests) {
+        [[self p_scheduleRequestNamed:request[0] host:@"schedule.stub" priority:[request[1] integerValue] scheduler:scheduler session:session started:started finishes:finishes] resume];
+    }
+
+    XCTAssertEqualObjects(started, @[@"blocker"]);
+    XCTAssertEqual(scheduler.queuedCount, 5);
+    XCTAssertEqual([scheduler queuedCountForPriority:SGSRequestPriorityUserInitiated], 2);
+
+    // 每完成一个请求启动下一个，依次完成直到队列为空
+    while (started.count < requests.count + 1) {
+        NSUInteger count = started.count;
+        finishes[started.lastObject]();
+        XCTAssertEqual(started.count, count + 1);
+    }
+    finishes[started.lastObject]();
+
+    NSArray *expected = @[@"blocker", @"ui1", @"ui2", @"util1", @"bg1", @"bg2"];
+    XCTAssertEqualObjects(started, expected);
+    XCTAssertEqual(scheduler.runningCount, 0);
+}
+
+- (void)testSchedulerHonorsConcurrencyLimits
+{
+    SGSRequestScheduler *scheduler = [[SGSRequestScheduler alloc] init];
+    scheduler.maximumConcurrentRequests = 3;
+    scheduler.maximumConcurrentRequestsPerHost = 2;
+    NSURLSession *session = [self p_stubSession];
+    NSMutableArray<NSString *> *started = [NSMutableArray array];
+    NSMutableDictionary<NSString *, dispatch_block_t> *finishes = [NSMutableDictionary dictionary];
+
+    for (NSString *name in @[@"a1", @"a2", @"a3", @"a4"]) {
+        [[self p_scheduleRequestNamed:name host:@"a.stub" priority:SGSRequestPriorityUtility scheduler:scheduler session:session started:started finishes:finishes] resume];
+    }
+    for (NSString *name in @[@"b1", @"b2"]) {
+        [[self p_scheduleRequestNamed:name host:@"b.stub" priority:SGSRequestPriorityUtility scheduler:scheduler session:session started:started finishes:finishes] resume];
+    }
+
+    // a.stub 达到单主机上限后不阻塞 b.stub，总数达到上限后不再启动
+    XCTAssertEqualObjects(started, (@[@"a1", @"a2", @"b1"]));
+    XCTAssertEqual(scheduler.runningCount, 3);
+    XCTAssertEqual(scheduler.queuedCount, 3);
+
+    finishes[@"a1"]();
+    XCTAssertEqualObjects(started.lastObject, @"a3");
+    XCTAssertEqual(scheduler.runningCount, 3);
+
+    finishes[@"b1"]();
+    XCTAssertEqualObjects(started.lastObject, @"b2");
+
+    // 重复调用 finish 不会多释放并发数
+    finishes[@"a1"]();
+    XCTAssertEqual(scheduler.runningCount, 3);
+    XCTAssertEqual(scheduler.queuedCount, 1);
+}
+
+- (void)testSchedulerFailsHandleWhenNoTaskIsCreated
+{
+    SGSRequestScheduler *scheduler = [[SGSRequestScheduler alloc] init];
+    __block NSError *failure = nil;
+
+    SGSTaskHandle *handle = [scheduler scheduleRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://nil-task.stub/"]] priority:SGSRequestPriorityUtility taskFactory:^NSURLSessionTask * _Nullable(dispatch_block_t  _Nonnull finish) {
+        return nil;
+    } failure:^(NSError * _Nonnull error) {
+        failure = error;
+    }];
+    [handle resume];
+
+    XCTAssertEqualObjects(failure.domain, NSURLErrorDomain);
+    XCTAssertEqual(failure.code, NSURLErrorUnknown);
+    XCTAssertEqual(scheduler.runningCount, 0);
+}
+
+
+
+#pragma mark - Segmented Download
+
+- (NSData *)p_segmentedDownloadWithDownloader:(SGSSegmentedDownloader *)downloader error:(NSError **)error
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[RangeURLProtocol class]];
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://file.range/payload.bin"]];
+
+    __block NSData *data = nil;
+    __block NSError *downloadError = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download finished"];
+    SGSTaskHandle *handle = [downloader handleForRequest:request session:session progress:nil completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable location, NSError * _Nullable completionError) {
+        // 临时文件在闭包返回后删除
+        data = location ? [NSData dataWithContentsOfURL:location] : nil;
+        downloadError = completionError;
+        [expectation fulfill];
+    }];
+    [handle resume];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    if (error) *error = downloadError;
+    return data;
+}
+
+- (SGSSegmentedDownloader *)p_segmentedDownloader
+{
+    SGSSegmentedDownloader *downloader = [[SGSSegmentedDownloader alloc] init];
+    downloader.segmentCount = 4;
+    downloader.minimumSegmentSize = 16 * 1024;
+    downloader.retryPolicy = [self p_fastRetryPolicy];
+    return downloader;
+}
+
+- (void)testSegmentedDownloadSplitsIntoRanges
+{
+    NSError *error = nil;
+    NSData *data = [self p_segmentedDownloadWithDownloader:[self p_segmentedDownloader] error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(data, [RangeURLProtocol payload]);
+    XCTAssertEqual([RangeURLProtocol requestCountForMethod:@"HEAD"], 1);
+
+    NSArray *ranges = [[RangeURLProtocol requestedRanges] sortedArrayUsingSelector:@selector(compare:)];
+    NSArray *expected = @[@"bytes=0-16383", @"bytes=16384-32767", @"bytes=32768-49151", @"bytes=49152-65535"];
+    XCTAssertEqualObjects(ranges, expected);
+}
+
+- (void)testSegmentedDownloadRetriesFailedSegment
+{
+    [RangeURLProtocol setFailedRangeRequestCount:1];
+
+    NSError *error = nil;
+    NSData *data = [self p_segmentedDownloadWithDownloader:[self p_segmentedDownloader] error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(data, [RangeURLProtocol payload]);
+    // 只重试失败的分段
+    XCTAssertEqual([RangeURLProtocol requestedRanges].count, 5);
+    XCTAssertEqual([RangeURLProtocol requestCountForMethod:@"GET"], 5);
+}
+
+- (void)testSegmentedDownloadFallsBackToSingleStream
+{
+    [RangeURLProtocol setSupportsRanges:NO];
+
+    NSError *error = nil;
+    NSData *data = [self p_segmentedDownloadWithDownloader:[self p_segmentedDownloader] error:&error];
+
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(data, [RangeURLProtocol payload]);
+    XCTAssertEqual([RangeURLProtocol requestCountForMethod:@"HEAD"], 1);
+    XCTAssertEqual([RangeURLProtocol requestCountForMethod:@"GET"], 1);
+    XCTAssertEqual([RangeURLProtocol requestedRanges].count, 0);
+}
+
+- (void)testCancellingSegmentedDownloadCancelsProbe
+{
+    XCTestExpectation *expectation = [self expectationWithDescription:@"cancelled"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://127.0.0.1:9/payload.bin"]];
+    SGSTaskHandle *handle = [[self p_segmentedDownloader] handleForRequest:request session:[NSURLSession sharedSession] progress:nil completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable location, NSError * _Nullable error) {
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [expectation fulfill];
+    }];
+    [handle resume];
+    NSURLSessionTask *probe = handle.task;
+    [handle cancel];
+
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqualObjects(probe.currentRequest.HTTPMethod, @"HEAD");
+    XCTAssertNotEqual(probe.state, NSURLSessionTaskStateRunning);
+}
+
+
+
+#pragma mark - Download Resume Journal
+
+- (SGSDownloadResumeJournal *)p_temporaryResumeJournal
+{
+    SGSDownloadResumeJournal *journal = [[SGSDownloadResumeJournal alloc] initWithName:[NSUUID UUID].UUIDString];
+    [self addTeardownBlock:^{
+        [journal removeAllEntries];
+    }];
+    return journal;
+}
+
+- (void)testResumeJournalReadsPendingWrites
+{
+    SGSDownloadResumeJournal *journal = [self p_temporaryResumeJournal];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://file.range/pending.bin"]];
+    NSData *resumeData = [@"resume data" dataUsingEncoding:NSUTF8StringEncoding];
+
+    // 写入是异步的，但写入完成前也应读到最新的数据
+    [journal setResumeData:resumeData forRequest:request];
+    XCTAssertEqualObjects([journal resumeDataForRequest:request], resumeData);
+
+    [journal removeResumeDataForRequest:request];
+    XCTAssertNil([journal resumeDataForRequest:request]);
+
+    NSMutableURLRequest *post = request.mutableCopy;
+    post.HTTPMethod = @"POST";
+    [journal setResumeData:resumeData forRequest:post];
+    XCTAssertNil([journal resumeDataForRequest:post]);
+}
+
+- (void)testResumeJournalRemovesStaleEntries
+{
+    SGSDownloadResumeJournal *journal = [self p_temporaryResumeJournal];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://file.range/stale.bin"]];
+    [journal setResumeData:[@"resume data" dataUsingEncoding:NSUTF8StringEncoding] forRequest:request];
+
+    journal.maximumAge = 0;
+    XCTAssertNil([journal resumeDataForRequest:request]);
+
+    [journal removeStaleEntries];
+    journal.maximumAge = 60;
+    XCTAssertNil([journal resumeDataForRequest:request]);
+
+    // 等待磁盘上的清理完成后仍然读不到
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(id evaluatedObject, NSDictionary *bindings) {
+        return [journal resumeDataForRequest:request] == nil;
+    }] evaluatedWithObject:journal handler:nil];
+    [self waitForExpectationsWithTimeout:2 handler:nil];
+
+    SGSDownloadResumeJournal *reopened = [[SGSDownloadResumeJournal alloc] initWithName:journal.name];
+    XCTAssertNil([reopened resumeDataForRequest:request]);
+}
+
+- (void)testResumeJournalCapturesTrackedDownloadAndResumes
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[RangeURLProtocol class]];
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration];
+    SGSDownloadResumeJournal *journal = [self p_temporaryResumeJournal];
+    session.downloadResumeJournal = journal;
+
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://file.range/resume.bin"]];
+    NSURL *destination = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    SGSDownloadTargetBlock target = ^NSURL *(NSURLResponse *response, NSURL *location) {
+        return destination;
+    };
+    [self addTeardownBlock:^{
+        [[NSFileManager defaultManager] removeItemAtURL:destination error:NULL];
+    }];
+
+    // 第一次下载只收到 16 KB，之后模拟应用终止
+    const NSUInteger stallLength = 16 * 1024;
+    [RangeURLProtocol setStallLength:stallLength];
+
+    __block NSError *captureError = nil;
+    XCTestExpectation *captured = [self expectationWithDescription:@"download captured"];
+    NSURLSessionDownloadTask *task = [session downloadTaskWithRequest:request progress:nil destination:target success:^(NSURLResponse *response, NSURL *filePath) {
+        XCTFail(@"stalled download should not succeed");
+    } failure:^(NSURLResponse *response, NSError *error) {
+        captureError = error;
+        [captured fulfill];
+    }];
+    [task resume];
+
+    XCTestExpectation *received = [[XCTNSPredicateExpectation alloc] initWithPredicate:[NSPredicate predicateWithFormat:@"countOfBytesReceived >= %llu", (unsigned long long)stallLength] object:task];
+    [self waitForExpectations:@[received] timeout:5];
+
+    [[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationWillTerminateNotification object:nil];
+    [self waitForExpectations:@[captured] timeout:5];
+
+    XCTAssertEqualObjects(captureError.domain, NSURLErrorDomain);
+    XCTAssertEqual(captureError.code, NSURLErrorCancelled);
+    XCTAssertNotNil([journal resumeDataForRequest:request]);
+
+    // 再次请求相同地址时自动从断点继续，成功后删除记录
+    [RangeURLProtocol setStallLength:0];
+
+    XCTestExpectation *finished = [self expectationWithDescription:@"download resumed"];
+    [[session downloadTaskWithRequest:request progress:nil destination:target success:^(NSURLResponse *response, NSURL *filePath) {
+        [finished fulfill];
+    } failure:^(NSURLResponse *response, NSError *error) {
+        XCTFail(@"%@", error);
+        [finished fulfill];
+    }] resume];
+    [self waitForExpectations:@[finished] timeout:5];
+
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:destination], [RangeURLProtocol payload]);
+    XCTAssertEqualObjects([RangeURLProtocol requestedRanges], @[[NSString stringWithFormat:@"bytes=%lu-", (unsigned long)stallLength]]);
+    XCTAssertNil([journal resumeDataForRequest:request]);
+}
+
+
+
+#pragma mark - Multipart Form Data
+
+- (NSData *)p_dataByReadingStream:(NSInputStream *)stream
+{
+    NSMutableData *data = [NSMutableData data];
+    uint8_t buffer[1000];
+    [stream open];
+    NSInteger length = 0;
+    while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0) {
+        [data appendBytes:buffer length:length];
+    }
+    [stream close];
+    return (length < 0) ? nil : data;
+}
+
+- (void)testMultipartFormDataEncodesBody
+{
+    NSURL *fileURL = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:@"multipart-test.txt"];
+    NSURL *bodyURL = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [self addTeardownBlock:^{
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+        [[NSFileManager defaultManager] removeItemAtURL:bodyURL error:NULL];
+    }];
+
+    // 文件比读取缓冲区大，覆盖跨多次读取的情况
+    NSMutableString *fileContent = [NSMutableString string];
+    for (NSUInteger i = 0; i < 500; i++) {
+        [fileContent appendFormat:@"line %lu\n", (unsigned long)i];
+    }
+    XCTAssertTrue([fileContent writeToURL:fileURL atomically:YES encoding:NSUTF8StringEncoding error:NULL]);
+
+    SGSMultipartFormData *formData = [SGSMultipartFormData formData];
+    [formData appendFieldWithValue:@"测试" name:@"title"];
+    [formData appendPartWithData:[@"{}" dataUsingEncoding:NSUTF8StringEncoding] name:@"meta\"data" fileName:@"meta.json" mimeType:@"application/json"];
+    NSError *error = nil;
+    XCTAssertTrue([formData appendPartWithFileURL:fileURL name:@"file" fileName:nil mimeType:nil error:&error], @"%@", error);
+
+    NSString *boundary = formData.boundary;
+    NSMutableString *expected = [NSMutableString string];
+    [expected appendFormat:@"--%@\r\nContent-Disposition: form-data; name=\"title\"\r\n\r\n测试\r\n", boundary];
+    [expected appendFormat:@"--%@\r\nContent-Disposition: form-data; name=\"meta%%22data\"; filename=\"meta.json\"\r\nContent-Type: application/json\r\n\r\n{}\r\n", boundary];
+    [expected appendFormat:@"--%@\r\nContent-Disposition: form-data; name=\"file\"; filename=\"multipart-test.txt\"\r\nContent-Type: text/plain\r\n\r\n%@\r\n", boundary, fileContent];
+    [expected appendFormat:@"--%@--\r\n", boundary];
+    NSData *expectedData = [expected dataUsingEncoding:NSUTF8StringEncoding];
+
+    XCTAssertEqualObjects(formData.contentType, ([NSString stringWithFormat:@"multipart/form-data; boundary=%@", boundary]));
+    XCTAssertEqual(formData.contentLength, expectedData.length);
+
+    // 每次生成的输入流都能完整读出请求体
+    XCTAssertEqualObjects([self p_dataByReadingStream:[formData newBodyStream]], expectedData);
+    XCTAssertEqualObjects([self p_dataByReadingStream:[formData newBodyStream]], expectedData);
+
+    XCTAssertTrue([formData writeToFileAtURL:bodyURL error:&error], @"%@", error);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:bodyURL], expectedData);
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://api.stub/upload"]];
+    [formData applyToRequest:request];
+    XCTAssertNotNil(request.HTTPBodyStream);
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Length"], ([NSString stringWithFormat:@"%lu", (unsigned long)expectedData.length]));
+}
+
+- (void)testMultipartFormDataWithoutFilesUsesHTTPBody
+{
+    SGSMultipartFormData *formData = [SGSMultipartFormData formData];
+    [formData appendFieldWithValue:@"value" name:@"name"];
 
-@implementation Tests
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://api.stub/upload"]];
+    [formData applyToRequest:request];
 
-- (void)setUp
+    // 内存中的请求体可以在重定向或认证质询时重新发送
+    XCTAssertNil(request.HTTPBodyStream);
+    XCTAssertEqualObjects(request.HTTPBody, [self p_dataByReadingStream:[formData newBodyStream]]);
+    XCTAssertEqual(request.HTTPBody.length, formData.contentLength);
+}
+
+
+
+#pragma mark - Network Metrics
+
+- (NSURLSessionDataTask *)p_completedTaskForRequest:(NSURLRequest *)request session:(NSURLSession *)session
 {
-    [super setUp];
-    // Put setup code here. This method is called before the invocation of each test method in the class.
+    XCTestExpectation *expectation = [self expectationWithDescription:@"task completed"];
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [expectation fulfill];
+    }];
+    [task resume];
+    [self waitForExpectations:@[expectation] timeout:5];
+    return task;
 }
 
-- (void)tearDown
+- (void)testMetricsCollectorRecordsEachTaskOnceAndSeparatesFailures
 {
-    // Put teardown code here. This method is called after the invocation of each test method in the class.
-    [super tearDown];
+    NSURLSession *session = [self p_stubSession];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://metrics.stub/items"]];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:[@"ok" dataUsingEncoding:NSUTF8StringEncoding] forHost:@"metrics.stub"];
+    [StubURLProtocol enqueueStatusCode:500 headers:nil body:nil forHost:@"metrics.stub"];
+    NSURLSessionDataTask *succeeded = [self p_completedTaskForRequest:request session:session];
+    NSURLSessionDataTask *failed = [self p_completedTaskForRequest:request session:session];
+
+    SGSNetworkMetricsCollector *collector = [[SGSNetworkMetricsCollector alloc] init];
+    NSDate *startDate = [NSDate dateWithTimeIntervalSinceNow:-0.2];
+    NSDate *firstByteDate = [NSDate dateWithTimeIntervalSinceNow:-0.1];
+
+    // 重复收集同一任务只记录一次
+    [collector collectMetricsForTask:succeeded startDate:startDate firstByteDate:firstByteDate endDate:[NSDate date]];
+    [collector collectMetricsForTask:succeeded startDate:startDate firstByteDate:firstByteDate endDate:[NSDate date]];
+    [collector collectMetricsForTask:failed startDate:startDate firstByteDate:firstByteDate endDate:[NSDate date]];
+
+    NSDictionary *summary = [collector latencySummaryForHost:@"metrics.stub"];
+    XCTAssertEqualObjects(summary[@"total"][@"count"], @1);
+    XCTAssertEqualObjects(summary[@"timeToFirstByte"][@"count"], @1);
+    XCTAssertEqualObjects(summary[@"failed"][@"count"], @1);
 }
 
-- (void)testExample
+
+
+#pragma mark - Prefetch
+
+- (void)testPrefetchCancelsResponsesBeyondByteBudget
 {
-    XCTFail(@"No implementation for \"%s\"", __PRETTY_FUNCTION__);
+    NSURLSession *session = [self p_stubSession];
+    SGSPrefetcher *prefetcher = [[SGSPrefetcher alloc] initWithSession:session cache:[self p_temporaryResponseCache]];
+    NSData *body = [NSMutableData dataWithLength:1024];
+    NSMutableArray<NSURL *> *URLs = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [StubURLProtocol enqueueStatusCode:200 headers:@{@"Content-Length": @"1024", @"Cache-Control": @"max-age=60"} body:body forHost:@"prefetch.stub"];
+        [URLs addObject:[NSURL URLWithString:[NSString stringWithFormat:@"http://prefetch.stub/tiles/%lu", (unsigned long)i]]];
+    }
+
+    // 第一个响应预留 1 KB 后剩余预算不足以容纳其它响应
+    [prefetcher prefetchURLs:URLs byteBudget:1500];
+
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(SGSPrefetcher *evaluatedObject, NSDictionary *bindings) {
+        NSDictionary *metrics = evaluatedObject.metrics;
+        return ([metrics[@"fetchedCount"] unsignedIntegerValue] + [metrics[@"skippedCount"] unsignedIntegerValue] == 3);
+    }] evaluatedWithObject:prefetcher handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    NSDictionary *metrics = prefetcher.metrics;
+    XCTAssertEqualObjects(metrics[@"fetchedCount"], @1);
+    XCTAssertEqualObjects(metrics[@"skippedCount"], @2);
+    XCTAssertLessThanOrEqual([metrics[@"fetchedBytes"] longLongValue], 1500);
 }
 
-@end
 
+
+#pragma mark - Hedging
+
+- (id)p_hedgedResultForRequest:(NSURLRequest *)request session:(NSURLSession *)session delay:(NSTimeInterval)delay
+{
+    __block id result = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"hedged request finished"];
+    [[session dataTaskWithRequest:request hedgeAfterDelay:delay responseFilter:nil success:^(NSURLResponse *response, id responseObject) {
+        result = responseObject;
+        [expectation fulfill];
+    } failure:^(NSURLResponse *response, NSError *error) {
+        result = error;
+        [expectation fulfill];
+    }] resume];
+    [self waitForExpectations:@[expectation] timeout:5];
+    return result;
+}
+
+- (void)testHedgedRequestIgnoresServerErrorFromFasterAttempt
+{
+    NSURLSession *session = [self p_stubSession];
+    NSData *body = [@"slow" dataUsingEncoding:NSUTF8StringEncoding];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:body delay:0.5 forHost:@"hedge.stub"];
+    [StubURLProtocol enqueueStatusCode:503 headers:nil body:nil forHost:@"hedge.stub"];
+
+    // 第二个请求先返回 503，应等待第一个请求的结果
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://hedge.stub/items"]];
+    id result = [self p_hedgedResultForRequest:request session:session delay:0.05];
+
+    XCTAssertEqualObjects(result, body);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:@"hedge.stub"], 2);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"hedgedCount"], @1);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"hedgeWinCount"], @0);
+}
+
+- (void)testHedgingOnlyAppliesToGetAndHead
+{
+    NSURLSession *session = [self p_stubSession];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:0.3 forHost:@"hedge-put.stub"];
+
+    // PUT 虽然幂等，但对冲可能在服务器上产生重复写入
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://hedge-put.stub/items/1"]];
+    request.HTTPMethod = @"PUT";
+    id result = [self p_hedgedResultForRequest:request session:session delay:0.05];
+
+    XCTAssertFalse([result isKindOfClass:[NSError class]]);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:@"hedge-put.stub"], 1);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"requestCount"], @1);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"hedgedCount"], @0);
+}
+
+- (void)testHedgingMetricsArePerSession
+{
+    NSURLSession *session = [self p_stubSession];
+    NSURLSession *otherSession = [self p_stubSession];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:0.3 forHost:@"hedge-metrics.stub"];
+
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://hedge-metrics.stub/items"]];
+    [self p_hedgedResultForRequest:request session:session delay:0.05];
+
+    XCTAssertEqualObjects(session.hedgingMetrics[@"requestCount"], @1);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"hedgedCount"], @1);
+    XCTAssertEqualObjects(session.hedgingMetrics[@"hedgeWinCount"], @1);
+    XCTAssertEqualObjects(otherSession.hedgingMetrics[@"requestCount"], @0);
+
+    [session resetHedgingMetrics];
+    XCTAssertEqualObjects(session.hedgingMetrics[@"requestCount"], @0);
+}
+
+
+
+#pragma mark - Rate Limiting
+
+- (void)testRateLimiterFailsNilTaskAndReturnsToken
+{
+    SGSRateLimiter *limiter = [[SGSRateLimiter alloc] init];
+    [limiter setRequestsPerSecond:0.1 burst:1 forHost:@"limit.stub"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://limit.stub/items"]];
+
+    __block NSError *failureError = nil;
+    XCTestExpectation *failed = [self expectationWithDescription:@"nil task failed"];
+    [[limiter limitRequest:request taskFactory:^NSURLSessionTask *{
+        return nil;
+    } failure:^(NSError *error) {
+        failureError = error;
+        [failed fulfill];
+    }] resume];
+    [self waitForExpectations:@[failed] timeout:2];
+
+    XCTAssertEqualObjects(failureError.domain, NSURLErrorDomain);
+    XCTAssertEqual(failureError.code, NSURLErrorUnknown);
+
+    // 令牌已归还，下一个请求不需要等待 10 秒
+    NSURLSession *session = [self p_stubSession];
+    XCTestExpectation *started = [self expectationWithDescription:@"next request started"];
+    [[limiter limitRequest:request taskFactory:^NSURLSessionTask *{
+        [started fulfill];
+        return [session dataTaskWithRequest:request];
+    } failure:^(NSError *error) {
+        XCTFail(@"%@", error);
+    }] resume];
+    [self waitForExpectations:@[started] timeout:2];
+}
+
+- (void)testRateLimiterReportsCancelledWhileWaiting
+{
+    SGSRateLimiter *limiter = [[SGSRateLimiter alloc] init];
+    [limiter setRequestsPerSecond:0.1 burst:1 forHost:@"limit-cancel.stub"];
+    NSURLSession *session = [self p_stubSession];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://limit-cancel.stub/items"]];
+
+    [[limiter limitRequest:request taskFactory:^NSURLSessionTask *{
+        return [session dataTaskWithRequest:request];
+    } failure:nil] resume];
+
+    __block NSError *failureError = nil;
+    XCTestExpectation *failed = [self expectationWithDescription:@"waiting request cancelled"];
+    SGSTaskHandle *handle = [limiter limitRequest:request taskFactory:^NSURLSessionTask *{
+        XCTFail(@"cancelled request should not create a task");
+        return nil;
+    } failure:^(NSError *error) {
+        failureError = error;
+        [failed fulfill];
+    }];
+    [handle resume];
+    [handle cancel];
+    [self waitForExpectations:@[failed] timeout:2];
+
+    XCTAssertEqual(failureError.code, NSURLErrorCancelled);
+}
+
+
+
+#pragma mark - Promise
+
+- (NSError *)p_errorOfPromise:(SGSPromise *)promise value:(id *)value
+{
+    __block NSError *result = nil;
+    __block id resultValue = nil;
+    XCTestExpectation *settled = [self expectationWithDescription:@"promise settled"];
+    [[promise then:^id(id obj) {
+        resultValue = obj;
+        [settled fulfill];
+        return nil;
+    }] recover:^id(NSError *error) {
+        result = error;
+        [settled fulfill];
+        return nil;
+    }];
+    [self waitForExpectations:@[settled] timeout:2];
+
+    if (value) *value = resultValue;
+    return result;
+}
+
+- (void)testPromiseRunsThenBlocksInOrder
+{
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    NSMutableArray *order = [NSMutableArray array];
+    XCTestExpectation *finished = [self expectationWithDescription:@"chain finished"];
+
+    [[[promise then:^id(id value) {
+        [order addObject:value];
+        return @2;
+    }] then:^id(id value) {
+        [order addObject:value];
+        SGSPromise *nested = [SGSPromise pendingPromise];
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_DEFAULT, 0), ^{
+            [nested fulfill:@3];
+        });
+        return nested;
+    }] then:^id(id value) {
+        [order addObject:value];
+        [finished fulfill];
+        return nil;
+    }];
+    [promise fulfill:@1];
+    [self waitForExpectations:@[finished] timeout:2];
+
+    XCTAssertEqualObjects(order, (@[@1, @2, @3]));
+}
+
+- (void)testPromiseAllRejectsWithFirstErrorAndCancelsOthers
+{
+    SGSPromise *first = [SGSPromise pendingPromise];
+    SGSPromise *second = [SGSPromise pendingPromise];
+    __block BOOL secondCancelled = NO;
+    second.cancellationHandler = ^{
+        secondCancelled = YES;
+    };
+
+    SGSPromise *all = [SGSPromise all:@[first, second]];
+    NSError *failure = [NSError errorWithDomain:@"test" code:1 userInfo:nil];
+    [first reject:failure];
+
+    XCTAssertEqualObjects([self p_errorOfPromise:all value:NULL], failure);
+    XCTAssertTrue(secondCancelled);
+
+    id value = nil;
+    SGSPromise *fulfilled = [SGSPromise all:@[[SGSPromise promiseWithValue:@1], [SGSPromise promiseWithValue:nil]]];
+    XCTAssertNil([self p_errorOfPromise:fulfilled value:&value]);
+    XCTAssertEqualObjects(value, (@[@1, [NSNull null]]));
+}
+
+- (void)testPromiseAnyAndRace
+{
+    SGSPromise *pending = [SGSPromise pendingPromise];
+    __block BOOL pendingCancelled = NO;
+    pending.cancellationHandler = ^{
+        pendingCancelled = YES;
+    };
+
+    id value = nil;
+    NSError *failure = [NSError errorWithDomain:@"test" code:1 userInfo:nil];
+    SGSPromise *any = [SGSPromise any:@[[SGSPromise promiseWithError:failure], [SGSPromise promiseWithValue:@"any"], pending]];
+    XCTAssertNil([self p_errorOfPromise:any value:&value]);
+    XCTAssertEqualObjects(value, @"any");
+    XCTAssertTrue(pendingCancelled);
+
+    NSError *error = [self p_errorOfPromise:[SGSPromise any:@[[SGSPromise promiseWithError:failure]]] value:NULL];
+    XCTAssertEqualObjects(error.domain, SGSPromiseErrorDomain);
+    XCTAssertEqual(error.code, SGSPromiseErrorAllRejected);
+    XCTAssertEqualObjects(error.userInfo[SGSPromiseUnderlyingErrorsKey], @[failure]);
+
+    SGSPromise *slow = [SGSPromise pendingPromise];
+    SGSPromise *race = [SGSPromise race:@[slow, [SGSPromise promiseWithError:failure]]];
+    XCTAssertEqualObjects([self p_errorOfPromise:race value:NULL], failure);
+    XCTAssertEqual([self p_errorOfPromise:slow value:NULL].code, NSURLErrorCancelled);
+}
+
+- (void)testPromiseTimeoutRejectsAndCancelsUnsharedUpstream
+{
+    SGSPromise *upstream = [SGSPromise pendingPromise];
+    __block BOOL upstreamCancelled = NO;
+    upstream.cancellationHandler = ^{
+        upstreamCancelled = YES;
+    };
+
+    NSError *error = [self p_errorOfPromise:[upstream timeout:0.05] value:NULL];
+    XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
+    XCTAssertEqual(error.code, NSURLErrorTimedOut);
+    XCTAssertTrue(upstreamCancelled);
+
+    id value = nil;
+    SGSPromise *fast = [SGSPromise pendingPromise];
+    SGSPromise *timeout = [fast timeout:1];
+    [fast fulfill:@"fast"];
+    XCTAssertNil([self p_errorOfPromise:timeout value:&value]);
+    XCTAssertEqualObjects(value, @"fast");
+}
+
+- (void)testPromiseCancelsSharedUpstreamAfterLastDependent
+{
+    SGSPromise *upstream = [SGSPromise pendingPromise];
+    __block NSUInteger cancelCount = 0;
+    upstream.cancellationHandler = ^{
+        cancelCount += 1;
+    };
+
+    SGSPromise *first = [upstream then:^id(id value) { return value; }];
+    SGSPromise *second = [upstream then:^id(id value) { return value; }];
+    SGSPromise *third = [upstream timeout:0.05];
+
+    [first cancel];
+    XCTAssertEqual(cancelCount, 0);
+
+    // 超时同样只释放依赖，仍有 second 等待结果
+    XCTAssertEqual([self p_errorOfPromise:third value:NULL].code, NSURLErrorTimedOut);
+    XCTAssertEqual(cancelCount, 0);
+
+    [second cancel];
+    XCTAssertEqual(cancelCount, 1);
+    XCTAssertEqual([self p_errorOfPromise:upstream value:NULL].code, NSURLErrorCancelled);
+
+    // 直接取消时总是取消
+    SGSPromise *direct = [SGSPromise pendingPromise];
+    SGSPromise *dependent = [direct then:^id(id value) { return value; }];
+    [direct cancel];
+    XCTAssertEqual([self p_errorOfPromise:dependent value:NULL].code, NSURLErrorCancelled);
+}
+
+
+
+#pragma mark - Deadline
+
+- (NSError *)p_deadlineErrorForRequest:(NSURLRequest *)request session:(NSURLSession *)session deadline:(SGSDeadline *)deadline cancelsHandle:(BOOL)cancelsHandle
+{
+    __block NSError *result = nil;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"deadline request finished"];
+    SGSTaskHandle *handle = [session dataTaskWithRequest:request deadline:deadline responseFilter:nil success:^(NSURLResponse *response, id responseObject) {
+        [expectation fulfill];
+    } failure:^(NSURLResponse *response, NSError *error) {
+        result = error;
+        [expectation fulfill];
+    }];
+    [handle resume];
+    if (cancelsHandle) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.05 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [handle cancel];
+        });
+    }
+    [self waitForExpectations:@[expectation] timeout:5];
+    return result;
+}
+
+- (void)testDeadlineReportsUserCancelAsCancelled
+{
+    NSURLSession *session = [self p_stubSession];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://deadline-cancel.stub/items"]];
+
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:1 forHost:@"deadline-cancel.stub"];
+    SGSDeadline *deadline = [SGSDeadline deadlineWithBudget:10 name:@"deadline-cancel"];
+    XCTAssertEqual([self p_deadlineErrorForRequest:request session:session deadline:deadline cancelsHandle:YES].code, NSURLErrorCancelled);
+
+    // 截止时间被取消同样不是超时
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:1 forHost:@"deadline-cancel.stub"];
+    deadline = [SGSDeadline deadlineWithBudget:10 name:@"deadline-cancel"];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.05 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [deadline cancel];
+    });
+    XCTAssertEqual([self p_deadlineErrorForRequest:request session:session deadline:deadline cancelsHandle:NO].code, NSURLErrorCancelled);
+}
+
+- (void)testDeadlineReportsExpiryAsTimedOut
+{
+    NSURLSession *session = [self p_stubSession];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://deadline-expire.stub/items"]];
+
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:1 forHost:@"deadline-expire.stub"];
+    SGSDeadline *deadline = [SGSDeadline deadlineWithBudget:0.1 name:@"deadline-expire"];
+    XCTAssertEqual([self p_deadlineErrorForRequest:request session:session deadline:deadline cancelsHandle:NO].code, NSURLErrorTimedOut);
+
+    // 已经过期的截止时间不发出请求
+    XCTAssertEqual([self p_deadlineErrorForRequest:request session:session deadline:deadline cancelsHandle:NO].code, NSURLErrorTimedOut);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:@"deadline-expire.stub"], 1);
+}
+
+- (void)testDeadlineCountsOverrunOnlyWithRequestsInFlight
+{
+    [SGSDeadline resetMetrics];
+
+    XCTestExpectation *idleExpired = [self expectationWithDescription:@"idle deadline expired"];
+    SGSDeadline *idle = [SGSDeadline deadlineWithBudget:0.05 name:@"deadline-idle"];
+    [idle addExpirationHandler:^{
+        [idleExpired fulfill];
+    }];
+    id finishedToken = [idle addRequestExpirationHandler:^{
+        XCTFail(@"finished request should not expire");
+    }];
+    [idle removeExpirationHandler:finishedToken];
+
+    XCTestExpectation *busyExpired = [self expectationWithDescription:@"busy deadline expired"];
+    SGSDeadline *busy = [SGSDeadline deadlineWithBudget:0.05 name:@"deadline-busy"];
+    [busy addRequestExpirationHandler:^{}];
+    [busy addRequestExpirationHandler:^{
+        [busyExpired fulfill];
+    }];
+    [self waitForExpectations:@[idleExpired, busyExpired] timeout:2];
+
+    NSDictionary *metrics = [SGSDeadline metrics];
+    XCTAssertEqualObjects(metrics[@"deadline-idle"][@"overrunCount"], @0);
+    XCTAssertEqualObjects(metrics[@"deadline-idle"][@"expiredRequestCount"], @0);
+    XCTAssertEqualObjects(metrics[@"deadline-busy"][@"overrunCount"], @1);
+    XCTAssertEqualObjects(metrics[@"deadline-busy"][@"expiredRequestCount"], @2);
+}
+
+
+
+#pragma mark - Digest
+
+- (void)testSHA256HexString
+{
+    NSData *data = [@"abc" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects([data sha256HexString], @"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    XCTAssertEqualObjects([[NSData data] sha256HexString], @"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+}
+
+
+
+#pragma mark - Offline Request Queue
+
+- (NSUInteger)p_replayOfflineQueue:(SGSOfflineRequestQueue *)queue
+{
+    __block NSUInteger remainingCount = NSNotFound;
+    XCTestExpectation *replayed = [self expectationWithDescription:@"offline queue replayed"];
+    [queue replayWithCompletion:^(NSUInteger count) {
+        remainingCount = count;
+        [replayed fulfill];
+    }];
+    [self waitForExpectations:@[replayed] timeout:5];
+    return remainingCount;
+}
+
+- (void)testOfflineQueueStripsCredentialsAndSignsAtReplay
+{
+    NSString *name = [NSUUID UUID].UUIDString;
+    SGSOfflineRequestQueue *queue = [[SGSOfflineRequestQueue alloc] initWithName:name session:[self p_stubSession]];
+    queue.automaticallyReplays = NO;
+    queue.requestSigningHandler = ^NSURLRequest *(NSURLRequest *request) {
+        NSMutableURLRequest *signedRequest = [request mutableCopy];
+        [signedRequest setValue:@"Bearer fresh-token" forHTTPHeaderField:@"Authorization"];
+        return signedRequest;
+    };
+
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-sign.stub/items"]];
+    request.HTTPMethod = @"POST";
+    request.HTTPBody = [@"payload" dataUsingEncoding:NSUTF8StringEncoding];
+    [request setValue:@"Bearer stale-token" forHTTPHeaderField:@"authorization"];
+    [request setValue:@"session=secret-cookie" forHTTPHeaderField:@"Cookie"];
+    [request setValue:@"kept-value" forHTTPHeaderField:@"X-Custom"];
+    XCTAssertNotNil([queue enqueueRequest:request collapseKey:nil error:NULL]);
+    XCTAssertEqual(queue.count, 1);
+
+    // 凭证不出现在磁盘上的索引中
+    NSString *support = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES).firstObject;
+    NSString *indexPath = [[[support stringByAppendingPathComponent:@"com.southgis.SGSCategories.OfflineRequestQueue"] stringByAppendingPathComponent:name] stringByAppendingPathComponent:@"queue.plist"];
+    NSData *index = [NSData dataWithContentsOfFile:indexPath];
+    XCTAssertNotNil(index);
+    XCTAssertEqual([index rangeOfData:[@"stale-token" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, index.length)].location, NSNotFound);
+    XCTAssertEqual([index rangeOfData:[@"secret-cookie" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, index.length)].location, NSNotFound);
+    XCTAssertNotEqual([index rangeOfData:[@"kept-value" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, index.length)].location, NSNotFound);
+
+    XCTAssertEqual([self p_replayOfflineQueue:queue], 0);
+    NSURLRequest *sent = [StubURLProtocol lastRequestForHost:@"offline-sign.stub"];
+    XCTAssertEqualObjects([sent valueForHTTPHeaderField:@"Authorization"], @"Bearer fresh-token");
+    XCTAssertEqualObjects([sent valueForHTTPHeaderField:@"X-Custom"], @"kept-value");
+    XCTAssertNil([sent valueForHTTPHeaderField:@"Cookie"]);
+}
+
+- (void)testOfflineQueueRestoresSecurelyArchivedRequests
+{
+    NSString *name = [NSUUID UUID].UUIDString;
+    SGSOfflineRequestQueue *queue = [[SGSOfflineRequestQueue alloc] initWithName:name session:[self p_stubSession]];
+    queue.automaticallyReplays = NO;
+
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-restore.stub/items"]];
+    NSString *identifier = [queue enqueueRequest:request collapseKey:nil error:NULL];
+    XCTAssertEqual(queue.count, 1);
+
+    // 重新加载的队列可能立即自动重放，延迟响应使请求保留在队列中
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil delay:1 forHost:@"offline-restore.stub"];
+    SGSOfflineRequestQueue *restored = [[SGSOfflineRequestQueue alloc] initWithName:name session:[self p_stubSession]];
+    XCTAssertEqual(restored.count, 1);
+
+    __block NSString *resultIdentifier = nil;
+    __block SGSOfflineRequestStatus resultStatus = SGSOfflineRequestStatusFailed;
+    restored.resultHandler = ^(NSString *identifier, SGSOfflineRequestStatus status, NSURLResponse *response, NSData *data, NSError *error) {
+        resultIdentifier = identifier;
+        resultStatus = status;
+    };
+    XCTAssertEqual([self p_replayOfflineQueue:restored], 0);
+    XCTAssertEqualObjects(resultIdentifier, identifier);
+    XCTAssertEqual(resultStatus, SGSOfflineRequestStatusSucceeded);
+}
+
+- (void)testOfflineQueueDoesNotTreatCancellationAsOffline
+{
+    NSString *host = @"offline-cancel.stub";
+    SGSOfflineRequestQueue *queue = [[SGSOfflineRequestQueue alloc] initWithName:[NSUUID UUID].UUIDString session:[self p_stubSession]];
+    queue.automaticallyReplays = NO;
+    queue.maximumAttemptCount = 1;
+
+    [queue enqueueRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-cancel.stub/first"]] collapseKey:nil error:NULL];
+    [queue enqueueRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-cancel.stub/second"]] collapseKey:nil error:NULL];
+    [StubURLProtocol enqueueError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil] forHost:host];
+
+    NSMutableArray<NSNumber *> *statuses = [NSMutableArray array];
+    queue.resultHandler = ^(NSString *identifier, SGSOfflineRequestStatus status, NSURLResponse *response, NSData *data, NSError *error) {
+        [statuses addObject:@(status)];
+    };
+
+    // 取消的请求不会中断本次重放
+    XCTAssertEqual([self p_replayOfflineQueue:queue], 0);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 2);
+    XCTAssertEqual(statuses.count, 2);
+    XCTAssertTrue([statuses containsObject:@(SGSOfflineRequestStatusFailed)]);
+    XCTAssertFalse([statuses containsObject:@(SGSOfflineRequestStatusDeferred)]);
+}
+
+- (void)testOfflineQueueFailsRequestsWithoutTask
+{
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    NSURLSession *session = [[NilTaskSession alloc] init];
+#pragma clang diagnostic pop
+    SGSOfflineRequestQueue *queue = [[SGSOfflineRequestQueue alloc] initWithName:[NSUUID UUID].UUIDString session:session];
+    queue.automaticallyReplays = NO;
+
+    NSMutableURLRequest *upload = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-nil-task.stub/upload"]];
+    upload.HTTPMethod = @"POST";
+    upload.HTTPBody = [@"payload" dataUsingEncoding:NSUTF8StringEncoding];
+    [queue enqueueRequest:upload collapseKey:nil error:NULL];
+    [queue enqueueRequest:[NSURLRequest requestWithURL:[NSURL URLWithString:@"http://offline-nil-task.stub/data"]] collapseKey:nil error:NULL];
+    XCTAssertEqual(queue.count, 2);
+
+    NSMutableArray<NSNumber *> *statuses = [NSMutableArray array];
+    NSMutableArray<NSError *> *errors = [NSMutableArray array];
+    queue.resultHandler = ^(NSString *identifier, SGSOfflineRequestStatus status, NSURLResponse *response, NSData *data, NSError *error) {
+        [statuses addObject:@(status)];
+        if (error) [errors addObject:error];
+    };
+
+    // 两个请求都以永久失败移除，不会被当作离线而停止重放
+    XCTAssertEqual([self p_replayOfflineQueue:queue], 0);
+    XCTAssertEqualObjects(statuses, (@[@(SGSOfflineRequestStatusFailed), @(SGSOfflineRequestStatusFailed)]));
+    XCTAssertEqual(errors.count, 2);
+    for (NSError *error in errors) {
+        XCTAssertEqualObjects(error.domain, SGSOfflineRequestErrorDomain);
+        XCTAssertEqual(error.code, SGSOfflineRequestErrorTaskCreationFailed);
+    }
+}
+
+
+
+#pragma mark - Warm-Up
+
+- (void)testWarmUpKeepsStatsPerSession
+{
+    NSURLSession *first = [self p_stubSession];
+    NSURLSession *second = [self p_stubSession];
+    NSURL *origin = [NSURL URLWithString:@"http://warmup.stub"];
+    [StubURLProtocol enqueueStatusCode:405 headers:nil body:nil delay:0.2 forHost:@"warmup.stub"];
+    [StubURLProtocol enqueueStatusCode:405 headers:nil body:nil delay:0.2 forHost:@"warmup.stub"];
+
+    // 另一个会话正在预热同一个源时不能跳过，连接不在会话间共享
+    __block NSDictionary *firstDurations = nil;
+    __block NSDictionary *secondDurations = nil;
+    XCTestExpectation *firstWarmed = [self expectationWithDescription:@"first session warmed up"];
+    XCTestExpectation *secondWarmed = [self expectationWithDescription:@"second session warmed up"];
+    [first warmUpConnectionsToOrigins:@[origin] completion:^(NSDictionary<NSString *,NSNumber *> *durations) {
+        firstDurations = durations;
+        [firstWarmed fulfill];
+    }];
+    [second warmUpConnectionsToOrigins:@[origin] completion:^(NSDictionary<NSString *,NSNumber *> *durations) {
+        secondDurations = durations;
+        [secondWarmed fulfill];
+    }];
+    [self waitForExpectations:@[firstWarmed, secondWarmed] timeout:5];
+
+    XCTAssertNotNil(firstDurations[@"http://warmup.stub"]);
+    XCTAssertNotNil(secondDurations[@"http://warmup.stub"]);
+    XCTAssertEqual([StubURLProtocol requestCountForHost:@"warmup.stub"], 2);
+    XCTAssertEqualObjects(first.warmUpMetrics[@"http://warmup.stub"][@"warmUpCount"], @1);
+    XCTAssertEqualObjects(second.warmUpMetrics[@"http://warmup.stub"][@"warmUpCount"], @1);
+
+    [first resetWarmUpMetrics];
+    XCTAssertNil(first.warmUpMetrics[@"http://warmup.stub"]);
+    XCTAssertEqualObjects(second.warmUpMetrics[@"http://warmup.stub"][@"warmUpCount"], @1);
+    XCTAssertEqual([self p_stubSession].warmUpMetrics.count, 0);
+}
+
+- (void)p_warmUpSession:(NSURLSession *)session origin:(NSURL *)origin
+{
+    XCTestExpectation *warmed = [self expectationWithDescription:@"warmed up"];
+    [session warmUpConnectionsToOrigins:@[origin] completion:^(NSDictionary<NSString *,NSNumber *> *durations) {
+        [warmed fulfill];
+    }];
+    [self waitForExpectations:@[warmed] timeout:5];
+}
+
+- (void)testWarmUpRecordsReusedConnectionFromSystemMetrics
+{
+    NSString *host = @"warmup-reuse.stub";
+    NSURL *origin = [NSURL URLWithString:@"http://warmup-reuse.stub"];
+    [StubURLProtocol enqueueStatusCode:405 headers:nil body:nil forHost:host];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil forHost:host];
+
+    NSURLSession *session = [self p_stubSession];
+    SGSNetworkMetricsCollector *collector = [[SGSNetworkMetricsCollector alloc] init];
+    session.metricsCollector = collector;
+    [self p_warmUpSession:session origin:origin];
+
+    XCTestExpectation *finished = [self expectationWithDescription:@"first request finished"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://warmup-reuse.stub/items"]];
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:request responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        [finished fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [finished fulfill];
+    }];
+
+    // 桩服务不会真正复用连接，以复用了连接的系统统计数据代替，同一任务只记录先收到的统计
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    [collector collectSessionTaskMetrics:[[ReusedConnectionTaskMetrics alloc] init] forTask:task];
+#pragma clang diagnostic pop
+    [task resume];
+    [self waitForExpectations:@[finished] timeout:5];
+
+    // latencySummary 在收集器的队列中读取，此时观察者已经处理完统计数据
+    [collector latencySummary];
+    NSDictionary *metrics = session.warmUpMetrics[@"http://warmup-reuse.stub"];
+    XCTAssertEqualObjects(metrics[@"reusedConnection"], @YES);
+    XCTAssertEqualObjects(metrics[@"reusedCount"], @1);
+    XCTAssertEqualObjects(metrics[@"notReusedCount"], @0);
+}
+
+- (void)testHelperTasksCollectSystemMetrics
+{
+    if (@available(iOS 15.0, *)) {
+        NSString *host = @"warmup-system.stub";
+        NSURL *origin = [NSURL URLWithString:@"http://warmup-system.stub"];
+        [StubURLProtocol enqueueStatusCode:405 headers:nil body:nil forHost:host];
+        [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil forHost:host];
+
+        NSURLSession *session = [self p_stubSession];
+        SGSNetworkMetricsCollector *collector = [[SGSNetworkMetricsCollector alloc] init];
+        session.metricsCollector = collector;
+        [self p_warmUpSession:session origin:origin];
+
+        XCTestExpectation *finished = [self expectationWithDescription:@"first request finished"];
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://warmup-system.stub/items"]];
+        [[session dataTaskWithRequest:request responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+            [finished fulfill];
+        } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+            XCTFail(@"%@", error);
+            [finished fulfill];
+        }] resume];
+        [self waitForExpectations:@[finished] timeout:5];
+
+        // 系统统计数据由任务代理转交收集器，不需要会话代理转发
+        [collector latencySummary];
+        NSDictionary *metrics = session.warmUpMetrics[@"http://warmup-system.stub"];
+        XCTAssertNotNil(metrics[@"reusedConnection"]);
+        XCTAssertEqual([metrics[@"reusedCount"] unsignedIntegerValue] + [metrics[@"notReusedCount"] unsignedIntegerValue], 1);
+    }
+}
+
+
+
+#pragma mark - Session Registry
+
+- (void)testSessionRegistrySeparatesConfigurationsByTLSMinimum
+{
+    SGSSessionRegistry *registry = [[SGSSessionRegistry alloc] init];
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    configuration.timeoutIntervalForRequest = 17;
+    NSURLSessionConfiguration *strictConfiguration = [configuration copy];
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    configuration.TLSMinimumSupportedProtocol = kTLSProtocol1;
+    strictConfiguration.TLSMinimumSupportedProtocol = kTLSProtocol12;
+#pragma clang diagnostic pop
+
+    NSURLSession *session = [registry acquireSessionWithConfiguration:configuration];
+    NSURLSession *strictSession = [registry acquireSessionWithConfiguration:strictConfiguration];
+    XCTAssertNotEqual(session, strictSession);
+
+    // 配置完全相同时仍然共享
+    NSURLSession *sharedSession = [registry acquireSessionWithConfiguration:[strictConfiguration copy]];
+    XCTAssertEqual(sharedSession, strictSession);
+
+    [registry relinquishSession:session];
+    [registry relinquishSession:strictSession];
+    [registry relinquishSession:sharedSession];
+}
+
+
+
+#pragma mark - Response Pipeline
+
+- (void)testResponsePipelineRunsStagesInOrder
+{
+    NSMutableArray<NSString *> *order = [NSMutableArray array];
+    SGSResponsePipeline *pipeline = [[SGSResponsePipeline alloc] init];
+    [[[pipeline addJSONStage] addEnvelopeStageWithCodeKey:@"code" successCode:200 messageKey:@"description" resultKey:@"results"]
+     addStageNamed:@"model" inputClass:[NSArray class] block:^id(NSURLResponse *response, NSArray *input) {
+         [order addObject:@"model"];
+         return @(input.count);
+     }];
+    [pipeline addStageNamed:@"last" inputClass:[NSNumber class] block:^id(NSURLResponse *response, NSNumber *input) {
+        [order addObject:@"last"];
+        return @(input.integerValue * 10);
+    }];
+    XCTAssertEqualObjects(pipeline.stageNames, (@[@"json", @"envelope", @"model", @"last"]));
+
+    NSURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://pipeline.stub"] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    NSData *data = [@"{\"code\": 200, \"results\": [1, 2, 3]}" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects([pipeline resultForResponse:response data:data], @30);
+    XCTAssertEqualObjects(order, (@[@"model", @"last"]));
+
+    // 出错后不再执行后续阶段
+    [order removeAllObjects];
+    NSData *failure = [@"{\"code\": 500, \"description\": \"busy\"}" dataUsingEncoding:NSUTF8StringEncoding];
+    NSError *error = [pipeline resultForResponse:response data:failure];
+    XCTAssertEqual(error.code, SGSResponsePipelineErrorEnvelopeFailure);
+    XCTAssertEqualObjects(error.userInfo[SGSResponsePipelineEnvelopeCodeKey], @500);
+    XCTAssertEqual(order.count, 0);
+    XCTAssertEqualObjects(pipeline.stageMetrics[@"envelope"][@"errorCount"], @1);
+    XCTAssertEqualObjects(pipeline.stageMetrics[@"last"][@"count"], @1);
+}
+
+- (void)testResponsePipelineDecodesOffMainThread
+{
+    __block BOOL stageOnMainThread = YES;
+    __block BOOL successOnMainThread = NO;
+    __block id result = nil;
+    SGSResponsePipeline *pipeline = [[[SGSResponsePipeline alloc] init] addJSONStage];
+    [pipeline addStageNamed:@"thread" inputClass:Nil block:^id(NSURLResponse *response, id input) {
+        stageOnMainThread = [NSThread isMainThread];
+        return input;
+    }];
+
+    NSData *body = [@"{\"name\": \"value\"}" dataUsingEncoding:NSUTF8StringEncoding];
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:body forHost:@"pipeline.stub"];
+    XCTestExpectation *finished = [self expectationWithDescription:@"pipeline request finished"];
+    [[[self p_stubSession] dataTaskWithURL:[NSURL URLWithString:@"http://pipeline.stub/items"] responsePipeline:pipeline success:^(NSURLResponse *response, id responseObject) {
+        successOnMainThread = [NSThread isMainThread];
+        result = responseObject;
+        [finished fulfill];
+    } failure:^(NSURLResponse *response, NSError *error) {
+        XCTFail(@"%@", error);
+        [finished fulfill];
+    }] resume];
+    [self waitForExpectations:@[finished] timeout:5];
+
+    XCTAssertFalse(stageOnMainThread);
+    XCTAssertTrue(successOnMainThread);
+    XCTAssertEqualObjects(result, @{@"name": @"value"});
+}
+
+- (void)testResponsePipelineFallsBackToRawDataWithoutStages
+{
+    NSURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"http://pipeline-nil.stub"] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:nil];
+    NSData *body = [@"raw" dataUsingEncoding:NSUTF8StringEncoding];
+    SGSResponsePipeline *pipeline = [SGSResponsePipeline pipelineWithFilter:nil];
+    XCTAssertEqual(pipeline.stageNames.count, 0);
+    XCTAssertEqualObjects([pipeline resultForResponse:response data:body], body);
+
+    __block id result = nil;
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:body forHost:@"pipeline-nil.stub"];
+    XCTestExpectation *finished = [self expectationWithDescription:@"request without pipeline finished"];
+    SGSResponsePipeline *missingPipeline = nil;
+    [[[self p_stubSession] dataTaskWithURL:[NSURL URLWithString:@"http://pipeline-nil.stub/items"] responsePipeline:missingPipeline success:^(NSURLResponse *response, id responseObject) {
+        result = responseObject;
+        [finished fulfill];
+    } failure:^(NSURLResponse *response, NSError *error) {
+        XCTFail(@"%@", error);
+        [finished fulfill];
+    }] resume];
+    [self waitForExpectations:@[finished] timeout:5];
+
+    XCTAssertEqualObjects(result, body);
+}
+
+
+
+#pragma mark - Verified Download
+
+- (void)testVerifiedDownloadUsesSessionProgressSettings
+{
+    NSString *host = @"verified.progress";
+    NSData *body = [NSMutableData dataWithLength:64 * 1024];
+    [StubURLProtocol enqueueStatusCode:200 headers:@{@"Content-Length": @(body.length).stringValue} body:body forHost:host];
+
+    static const void *kDeliveryQueueKey = &kDeliveryQueueKey;
+    dispatch_queue_t deliveryQueue = dispatch_queue_create("verified.progress", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(deliveryQueue, kDeliveryQueueKey, (void *)kDeliveryQueueKey, NULL);
+
+    NSURLSession *session = [self p_stubSession];
+    session.progressDeliveryQueue = deliveryQueue;
+    session.progressMaximumRate = 10;
+
+    NSURL *fileURL = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://%@/file", host]]];
+
+    __block double fraction = 0;
+    __block BOOL onDeliveryQueue = YES;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download finished"];
+    SGSTaskHandle *handle = [session.verifiedDownloader handleForRequest:request toFileURL:fileURL expectedSize:body.length digestAlgorithm:SGSDigestAlgorithmSHA256 expectedDigest:[body sha256HexString] progress:^(NSProgress * _Nonnull progress) {
+        onDeliveryQueue = onDeliveryQueue && (dispatch_get_specific(kDeliveryQueueKey) != NULL);
+        fraction = progress.fractionCompleted;
+    } completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable publishedURL, NSString * _Nullable digest, NSError * _Nullable error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(publishedURL, fileURL);
+        XCTAssertEqualObjects(digest, [body sha256HexString]);
+        [expectation fulfill];
+    }];
+    [handle resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // 等待最后一次进度回调
+    dispatch_sync(deliveryQueue, ^{});
+    XCTAssertTrue(onDeliveryQueue);
+    XCTAssertEqualWithAccuracy(fraction, 1.0, 0.001);
+    XCTAssertEqualObjects([NSData dataWithContentsOfURL:fileURL], body);
+    XCTAssertTrue(session.verifiedDownloader == session.verifiedDownloader);
+
+    [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+}
+
+- (void)testCancellingVerifiedDownloadBeforeResumeReportsCancellation
+{
+    NSString *host = @"verified.cancel";
+    NSURL *fileURL = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://%@/file", host]]];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"download cancelled"];
+    SGSTaskHandle *handle = [[self p_stubSession].verifiedDownloader handleForRequest:request toFileURL:fileURL expectedSize:NSURLSessionTransferSizeUnknown digestAlgorithm:SGSDigestAlgorithmSHA1 expectedDigest:nil progress:nil completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable publishedURL, NSString * _Nullable digest, NSError * _Nullable error) {
+        XCTAssertNil(publishedURL);
+        XCTAssertEqualObjects(error.domain, NSURLErrorDomain);
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [expectation fulfill];
+    }];
+    [handle cancel];
+    [handle resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    XCTAssertEqual([StubURLProtocol requestCountForHost:host], 0);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:fileURL.path]);
+}
+
+
+
+#pragma mark - Request Body Compression
+
+- (NSMutableURLRequest *)p_requestWithBody:(NSData *)body
+{
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://compress.stub/upload"]];
+    request.HTTPMethod = @"POST";
+    request.HTTPBody = body;
+    return request;
+}
+
+- (NSData *)p_compressibleDataWithLength:(NSUInteger)length
+{
+    NSMutableData *data = [NSMutableData dataWithCapacity:length];
+    const char *pattern = "abcdefgh";
+    while (data.length < length) {
+        [data appendBytes:pattern length:MIN(strlen(pattern), length - data.length)];
+    }
+    return data;
+}
+
+- (void)testGzipHTTPBodyRespectsThreshold
+{
+    NSData *body = [self p_compressibleDataWithLength:1024];
+
+    NSMutableURLRequest *request = [self p_requestWithBody:body];
+    XCTAssertFalse([request gzipHTTPBodyIfLargerThan:body.length]);
+    XCTAssertEqualObjects(request.HTTPBody, body);
+    XCTAssertNil([request valueForHTTPHeaderField:@"Content-Encoding"]);
+    XCTAssertNil([NSURLProtocol propertyForKey:SGSHTTPBodyOriginalLengthKey inRequest:request]);
+
+    request = [self p_requestWithBody:body];
+    XCTAssertTrue([request gzipHTTPBodyIfLargerThan:body.length - 1]);
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+    XCTAssertLessThan(request.HTTPBody.length, body.length);
+    XCTAssertEqualObjects([request.HTTPBody gzipInflate], body);
+    XCTAssertEqualObjects([NSURLProtocol propertyForKey:SGSHTTPBodyOriginalLengthKey inRequest:request], @(body.length));
+    XCTAssertEqualObjects([NSURLProtocol propertyForKey:SGSHTTPBodyCompressedLengthKey inRequest:request], @(request.HTTPBody.length));
+}
+
+- (void)testGzipHTTPBodySkipsEncodedIncompressibleAndStreamedBodies
+{
+    NSData *body = [self p_compressibleDataWithLength:1024];
+
+    NSMutableURLRequest *encoded = [self p_requestWithBody:body];
+    [encoded setValue:@"br" forHTTPHeaderField:@"Content-Encoding"];
+    XCTAssertFalse([encoded gzipHTTPBodyIfLargerThan:0]);
+    XCTAssertEqualObjects(encoded.HTTPBody, body);
+    XCTAssertEqualObjects([encoded valueForHTTPHeaderField:@"Content-Encoding"], @"br");
+
+    // 随机数据压缩后不会变小
+    NSMutableData *random = [NSMutableData dataWithLength:256];
+    arc4random_buf(random.mutableBytes, random.length);
+    NSMutableURLRequest *incompressible = [self p_requestWithBody:random];
+    XCTAssertFalse([incompressible gzipHTTPBodyIfLargerThan:0]);
+    XCTAssertEqualObjects(incompressible.HTTPBody, random);
+    XCTAssertNil([incompressible valueForHTTPHeaderField:@"Content-Encoding"]);
+
+    NSMutableURLRequest *streamed = [self p_requestWithBody:nil];
+    streamed.HTTPBodyStream = [NSInputStream inputStreamWithData:body];
+    XCTAssertFalse([streamed gzipHTTPBodyIfLargerThan:0]);
+    XCTAssertNotNil(streamed.HTTPBodyStream);
+    XCTAssertNil([streamed valueForHTTPHeaderField:@"Content-Encoding"]);
+}
+
+- (void)testGzipMultipartRequestUpdatesContentLength
+{
+    SGSMultipartFormData *formData = [SGSMultipartFormData formData];
+    [formData appendPartWithData:[self p_compressibleDataWithLength:4096] name:@"file" fileName:@"file.txt" mimeType:@"text/plain"];
+
+    NSMutableURLRequest *request = [self p_requestWithBody:nil];
+    [formData applyToRequest:request];
+    NSData *body = request.HTTPBody;
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Length"], ([NSString stringWithFormat:@"%lu", (unsigned long)body.length]));
+
+    XCTAssertTrue([request gzipHTTPBodyIfLargerThan:1024]);
+    XCTAssertEqualObjects([request valueForHTTPHeaderField:@"Content-Length"], ([NSString stringWithFormat:@"%lu", (unsigned long)request.HTTPBody.length]));
+    XCTAssertEqualObjects([request.HTTPBody gzipInflate], body);
+}
+
+- (void)testCompressingDataTaskRecordsCompressionMetrics
+{
+    NSString *host = @"compress.stub";
+    [StubURLProtocol enqueueStatusCode:200 headers:nil body:nil forHost:host];
+    NSData *body = [self p_compressibleDataWithLength:4096];
+
+    XCTestExpectation *expectation = [self expectationWithDescription:@"request finished"];
+    SGSTaskHandle *handle = [[self p_stubSession] dataTaskWithRequest:[self p_requestWithBody:body] compressingBodyLargerThan:1024 responseFilter:nil success:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject) {
+        [expectation fulfill];
+    } failure:^(NSURLResponse * _Nullable response, NSError * _Nonnull error) {
+        XCTFail(@"%@", error);
+        [expectation fulfill];
+    }];
+    [handle resume];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    NSURLRequest *sent = [StubURLProtocol lastRequestForHost:host];
+    XCTAssertEqualObjects([sent valueForHTTPHeaderField:@"Content-Encoding"], @"gzip");
+
+    NSDictionary *metrics = [NSURLSession requestBodyCompressionMetricsForTask:handle.task];
+    XCTAssertEqualObjects(metrics[SGSHTTPBodyOriginalLengthKey], @(body.length));
+    XCTAssertLessThan([metrics[SGSHTTPBodyCompressedLengthKey] unsignedIntegerValue], body.length);
+}
+
+@end
@@ -46,6 +46,35 @@ NS_ASSUME_NONNULL_BEGIN
                                       relativeToDirectory:(NSSearchPathDirectory)directory
                                                  inDomain:(NSSearchPathDomainMask)domainMask;
 
+/*!
+ *  @abstract 以内存映射的方式从 main bundle 中读取不可变的数组
+ *
+ *  @discussion 适用于体积较大的 plist 文件，XML 格式的文件在第一次读取时转换为二进制格式并缓存，
+ *      之后通过内存映射读取，数组中的元素在第一次访问时才会被解析，详见 SGSMappedPropertyList
+ *
+ *  @param filename 文件名
+ *  @param ext      扩展名
+ *
+ *  @return NSArray or nil
+ */
++ (nullable NSArray<ObjectType> *)mappedArrayWithContentsOfMainBundleFile:(NSString *)filename
+                                                                 fileType:(nullable NSString *)ext;
+
+/*!
+ *  @abstract 以内存映射的方式从指定文件中读取不可变的数组
+ *
+ *  @discussion 适用于体积较大的 plist 文件，详见 SGSMappedPropertyList
+ *
+ *  @param path       文件名或相对路径
+ *  @param directory  文件夹，例如：NSDocumentDirectory
+ *  @param domainMask 域，例如：NSUserDomainMask
+ *
+ *  @return NSArray or nil
+ */
++ (nullable NSArray<ObjectType> *)mappedArrayWithContentsOfFile:(NSString *)path
+                                            relativeToDirectory:(NSSearchPathDirectory)directory
+                                                       inDomain:(NSSearchPathDomainMask)domainMask;
+
 /*!
  *  @abstract 将数组写入到指定路径中
  *
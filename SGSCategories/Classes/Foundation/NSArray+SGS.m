@@ -9,6 +9,7 @@
 #import "NSArray+SGS.h"
 #import "NSString+SGS.h"
 #import "NSData+SGS.h"
+#import "SGSMappedPropertyList.h"
 
 @implementation NSArray (SGS)
 
@@ -29,6 +30,25 @@
     return [NSArray arrayWithContentsOfFile:path];
 }
 
++ (NSArray *)mappedArrayWithContentsOfMainBundleFile:(NSString *)filename
+                                            fileType:(NSString *)ext
+{
+    NSString *path = [[NSBundle mainBundle] pathForResource:filename ofType:ext];
+    if (path == nil) return nil;
+    id plist = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    return ([plist isKindOfClass:[NSArray class]] ? plist : nil);
+}
+
++ (NSArray *)mappedArrayWithContentsOfFile:(NSString *)path
+                       relativeToDirectory:(NSSearchPathDirectory)directory
+                                  inDomain:(NSSearchPathDomainMask)domainMask
+{
+    path = [NSString stringWithPath:path relativeToDirectory:directory inDomain:domainMask];
+    if (path == nil) return nil;
+    id plist = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    return ([plist isKindOfClass:[NSArray class]] ? plist : nil);
+}
+
 - (BOOL)writeToFile:(NSString *)path
 relativeToDirectory:(NSSearchPathDirectory)directory
            inDomain:(NSSearchPathDomainMask)domainMask
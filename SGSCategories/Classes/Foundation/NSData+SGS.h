@@ -257,6 +257,21 @@ relativeToDirectory:(NSSearchPathDirectory)directory
  */
 - (nullable NSData *)zlibDeflate;
 
+
+#pragma mark - 摘要
+///-----------------------------------------------------------------------------
+/// @name 摘要
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief SHA-256 摘要的十六进制字符串
+ *
+ *  @discussion 长度固定为 64 的小写字符串，可以用作缓存等文件的文件名
+ *
+ *  @return 小写形式的十六进制字符串
+ */
+- (NSString *)sha256HexString;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -227,8 +227,8 @@ relativeToDirectory:(NSSearchPathDirectory)directory
                      8, Z_DEFAULT_STRATEGY) != Z_OK)
         return nil;
     
-    // 16K chunks for expansion
-    NSMutableData *compressed = [NSMutableData dataWithLength:16384];
+    // 按压缩后的上限一次分配，避免大数据多次扩容；16K chunks for expansion
+    NSMutableData *compressed = [NSMutableData dataWithLength:MAX(deflateBound(&strm, strm.avail_in), 16384)];
     
     do {
         if (strm.total_out >= [compressed length])
@@ -332,4 +332,13 @@ relativeToDirectory:(NSSearchPathDirectory)directory
 }
 
 
+#pragma mark - 摘要
+
+- (NSString *)sha256HexString {
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(self.bytes, (CC_LONG)self.length, digest);
+    return [[NSData dataWithBytes:digest length:CC_SHA256_DIGEST_LENGTH] toHexString];
+}
+
+
 @end
@@ -98,6 +98,15 @@ NS_ASSUME_NONNULL_BEGIN
  */
 + (instancetype)ISO8601DateFormatterWithInternetDateTime;
 
+/*!
+ *  @brief 获取 HTTP 日期格式（RFC 1123）的 NSDateFormatter，格式为：EEE, dd MMM yyyy HH:mm:ss 'GMT'
+ *
+ *  @discussion 例如：Mon, 13 Jun 2016 08:00:00 GMT，用于解析 Expires、Last-Modified、Retry-After 等响应头
+ *
+ *  @return NSDateFormatter
+ */
++ (instancetype)RFC1123DateFormatter;
+
 /*!
  *  @brief 获取常用日期格式的NSDateFormatter，格式为：yyyy-M-d H:mm
  *
@@ -118,6 +118,19 @@
     return formatter;
 }
 
+// EEE, dd MMM yyyy HH:mm:ss 'GMT'
++ (instancetype)RFC1123DateFormatter {
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss 'GMT'";
+    });
+    return formatter;
+}
+
 // yyyy-M-d H:mm
 + (instancetype)shortCommonFormat {
     static NSDateFormatter *formatter;
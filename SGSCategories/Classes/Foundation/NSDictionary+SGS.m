@@ -9,6 +9,7 @@
 #import "NSDictionary+SGS.h"
 #import "NSString+SGS.h"
 #import "NSData+SGS.h"
+#import "SGSMappedPropertyList.h"
 
 @implementation NSDictionary (SGS)
 
@@ -31,6 +32,25 @@
     return [NSDictionary dictionaryWithContentsOfFile:path];
 }
 
++ (NSDictionary *)mappedDictionaryWithContentsOfMainBundleFile:(NSString *)filename
+                                                      fileType:(NSString *)ext
+{
+    NSString *path = [[NSBundle mainBundle] pathForResource:filename ofType:ext];
+    if (path == nil) return nil;
+    id plist = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    return ([plist isKindOfClass:[NSDictionary class]] ? plist : nil);
+}
+
++ (NSDictionary *)mappedDictionaryWithContentsOfFile:(NSString *)path
+                                 relativeToDirectory:(NSSearchPathDirectory)directory
+                                            inDomain:(NSSearchPathDomainMask)domainMask
+{
+    path = [NSString stringWithPath:path relativeToDirectory:directory inDomain:domainMask];
+    if (path == nil) return nil;
+    id plist = [SGSMappedPropertyList propertyListWithContentsOfFile:path];
+    return ([plist isKindOfClass:[NSDictionary class]] ? plist : nil);
+}
+
 - (BOOL)writeToFile:(NSString *)path
 relativeToDirectory:(NSSearchPathDirectory)directory
            inDomain:(NSSearchPathDomainMask)domainMask
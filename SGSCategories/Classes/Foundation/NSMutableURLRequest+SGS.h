@@ -10,6 +10,18 @@
 
 #import <Foundation/Foundation.h>
 
+@class SGSMultipartFormData;
+
+/*!
+ *  @brief 请求体压缩前的长度，保存在请求的 NSURLProtocol 属性中，值为 NSNumber
+ */
+FOUNDATION_EXPORT NSString * const SGSHTTPBodyOriginalLengthKey;
+
+/*!
+ *  @brief 请求体压缩后的长度，保存在请求的 NSURLProtocol 属性中，值为 NSNumber
+ */
+FOUNDATION_EXPORT NSString * const SGSHTTPBodyCompressedLengthKey;
+
 typedef NS_ENUM(NSInteger, SGSHTTPMethod) {
     SGSHTTPMethodGET,
     SGSHTTPMethodPOST,
@@ -149,6 +161,47 @@ NS_ASSUME_NONNULL_BEGIN
                        timeoutInterval:(NSTimeInterval)timeoutInterval;
 
 
+/*!
+ *  @brief 以 multipart/form-data 编码形式初始化 HTTP 请求
+ *
+ *  @discussion 包含文件时请求体以输入流（HTTPBodyStream）的形式提供，文件只在发送时分块读取，
+ *      输入流只能发送一次，需要重新发送时参考 SGSMultipartFormData 的 newBodyStream；
+ *      不包含文件时请求体直接设置为 HTTPBody，
+ *      同时设置 Content-Type 和 Content-Length 请求头，
+ *      请求参数的值将以 description 作为文本字段添加在其它部分之前，
+ *      默认使用 NSURLRequestUseProtocolCachePolicy 缓存策略，默认请求超时时长为60秒
+ *
+ *  @param method     HTTP 请求方法，通常为 POST 或 PUT
+ *  @param URLString  请求地址
+ *  @param parameters 请求参数
+ *  @param block      添加数据或文件的回调，可以为空
+ *
+ *  @return NSMutableURLRequest
+ */
++ (instancetype)multipartRequestWithMethod:(SGSHTTPMethod)method
+                                 URLString:(NSString *)URLString
+                                parameters:(nullable NSDictionary *)parameters
+                          constructingBody:(nullable void (^)(SGSMultipartFormData *formData))block;
+
+
+/*!
+ *  @brief 使用 gzip 压缩请求体，并设置 Content-Encoding: gzip 请求头
+ *
+ *  @discussion 只压缩 HTTPBody，使用 HTTPBodyStream、请求体长度不超过 threshold、已经设置 Content-Encoding 或压缩后没有变小时不做处理，
+ *      已经设置 Content-Length 时更新为压缩后的长度，
+ *      压缩前后的长度以 SGSHTTPBodyOriginalLengthKey 和 SGSHTTPBodyCompressedLengthKey 为键保存在请求的 NSURLProtocol 属性中，
+ *      可以通过 [NSURLProtocol propertyForKey:inRequest:] 或任务的 originalRequest 读取
+ *
+ *      压缩较大的请求体比较耗时，不应在主线程中调用，
+ *      也可以使用 NSURLSession 的 dataTaskWithRequest:compressingBodyLargerThan:responseFilter:success:failure:
+ *
+ *  @param threshold 需要压缩的最小长度，单位：字节
+ *
+ *  @return 是否已压缩
+ */
+- (BOOL)gzipHTTPBodyIfLargerThan:(NSUInteger)threshold;
+
+
 /*!
  *  @brief 在请求头中设置认证用户名和密码，内部默认进行 Base-64 编码
  *
@@ -8,6 +8,11 @@
 
 #import "NSMutableURLRequest+SGS.h"
 #import "NSURL+SGS.h"
+#import "SGSMultipartFormData.h"
+#import "NSData+SGS.h"
+
+NSString * const SGSHTTPBodyOriginalLengthKey = @"SGSHTTPBodyOriginalLength";
+NSString * const SGSHTTPBodyCompressedLengthKey = @"SGSHTTPBodyCompressedLength";
 
 @implementation NSMutableURLRequest (SGS)
 
@@ -95,6 +100,25 @@
     return mutableRequest;
 }
 
++ (instancetype)multipartRequestWithMethod:(SGSHTTPMethod)method
+                                 URLString:(NSString *)URLString
+                                parameters:(NSDictionary *)parameters
+                          constructingBody:(void (^)(SGSMultipartFormData *))block
+{
+    NSMutableURLRequest *mutableRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:URLString]];
+    mutableRequest.HTTPMethod = [mutableRequest p_HTTPMethod:method];
+    
+    SGSMultipartFormData *formData = [SGSMultipartFormData formData];
+    [parameters enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        [formData appendFieldWithValue:[obj description] name:[key description]];
+    }];
+    if (block) block(formData);
+    
+    [formData applyToRequest:mutableRequest];
+    
+    return mutableRequest;
+}
+
 
 #pragma mark - Authorization
 
@@ -111,6 +135,31 @@
 }
 
 
+#pragma mark - Compression
+
+- (BOOL)gzipHTTPBodyIfLargerThan:(NSUInteger)threshold {
+    // 流式请求体的长度未知，无法在发送前压缩
+    if (self.HTTPBodyStream != nil) return NO;
+    
+    NSData *body = self.HTTPBody;
+    if ((body.length <= threshold) || ([self valueForHTTPHeaderField:@"Content-Encoding"] != nil)) return NO;
+    
+    NSData *compressed = [body gzipDeflate];
+    if ((compressed == nil) || (compressed.length >= body.length)) return NO;
+    
+    self.HTTPBody = compressed;
+    [self setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    // 已经设置的 Content-Length 是压缩前的长度，例如 multipart 请求
+    if ([self valueForHTTPHeaderField:@"Content-Length"] != nil) {
+        [self setValue:[NSString stringWithFormat:@"%lu", (unsigned long)compressed.length] forHTTPHeaderField:@"Content-Length"];
+    }
+    [NSURLProtocol setProperty:@(body.length) forKey:SGSHTTPBodyOriginalLengthKey inRequest:self];
+    [NSURLProtocol setProperty:@(compressed.length) forKey:SGSHTTPBodyCompressedLengthKey inRequest:self];
+    
+    return YES;
+}
+
+
 #pragma mark - Serializing
 
 + (BOOL)p_encodingParametersInURIWithHTTPMethod:(SGSHTTPMethod)method {
@@ -8,34 +8,170 @@
 
 #import "NSURL+SGS.h"
 
-@interface p_QueryItem : NSObject
-+ (instancetype)queryItemWithName:(id)name value:(id)value;
-- (NSString *)nameValuePairString;
-@end
+#pragma mark - Query Buffer
+
+/// 按需扩容的字节缓冲区，query 字符串只包含 ASCII 字符，最后一次性转换为 NSString
+typedef struct {
+    char *bytes;
+    size_t length;
+    size_t capacity;
+} p_QueryBuffer;
 
-@implementation p_QueryItem {
-    id _name;
-    id _value;
+static void p_QueryBufferAppend(p_QueryBuffer *buffer, const char *bytes, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = MAX(buffer->capacity * 2, buffer->length + length);
+        buffer->bytes = reallocf(buffer->bytes, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
 }
 
-+ (instancetype)queryItemWithName:(id)name value:(id)value {
-    p_QueryItem *item = [[p_QueryItem alloc] init];
-    item->_name = name;
-    item->_value = value;
-    return item;
+/// URLQueryAllowedCharacterSet 中的 ASCII 字符，该字符集不包含非 ASCII 字符
+static const BOOL *p_QueryAllowedASCIITable(void) {
+    static BOOL table[128];
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSCharacterSet *allowed = [NSCharacterSet URLQueryAllowedCharacterSet];
+        for (unichar c = 0; c < 128; c++) {
+            table[c] = [allowed characterIsMember:c];
+        }
+    });
+    return table;
 }
 
-- (NSString *)nameValuePairString {
-    if ((_value == nil) || [_value isEqual:[NSNull null]]) {
-        return [_name description];
-    } else {
-        return [NSString stringWithFormat:@"%@=%@", [_name description], [_value description]];
+static void p_QueryBufferAppendEncodedBytes(p_QueryBuffer *buffer, const uint8_t *bytes, size_t length) {
+    static const char hex[] = "0123456789ABCDEF";
+    const BOOL *allowed = p_QueryAllowedASCIITable();
+    
+    // 预留最坏情况下的长度，循环中不再检查容量
+    if (buffer->length + length * 3 > buffer->capacity) {
+        size_t capacity = MAX(buffer->capacity * 2, buffer->length + length * 3);
+        buffer->bytes = reallocf(buffer->bytes, capacity);
+        buffer->capacity = capacity;
     }
+    
+    char *out = buffer->bytes + buffer->length;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t byte = bytes[i];
+        if ((byte < 128) && allowed[byte]) {
+            *out++ = (char)byte;
+        } else {
+            *out++ = '%';
+            *out++ = hex[byte >> 4];
+            *out++ = hex[byte & 0x0F];
+        }
+    }
+    buffer->length = out - buffer->bytes;
 }
 
-@end
+/// 以 UTF-8 编码后按 URLQueryAllowedCharacterSet 进行百分号编码，字符串无法转换为 UTF-8 时返回 NO
+static BOOL p_QueryBufferAppendEncodedString(p_QueryBuffer *buffer, NSString *string) {
+    // 纯 ASCII 字符串通常可以直接取得内部存储，长度不一致时（非 ASCII 或包含 \0）使用逐段转换
+    const char *cString = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+    if (cString != NULL) {
+        size_t length = strlen(cString);
+        if (length == string.length) {
+            p_QueryBufferAppendEncodedBytes(buffer, (const uint8_t *)cString, length);
+            return YES;
+        }
+    }
+    
+    uint8_t chunk[256];
+    NSRange range = NSMakeRange(0, string.length);
+    while (range.length > 0) {
+        NSUInteger usedLength = 0;
+        NSRange remaining = range;
+        BOOL converted = [string getBytes:chunk maxLength:sizeof(chunk) usedLength:&usedLength encoding:NSUTF8StringEncoding options:kNilOptions range:range remainingRange:&remaining];
+        if (!converted || (remaining.location == range.location)) return NO;
+        
+        p_QueryBufferAppendEncodedBytes(buffer, chunk, usedLength);
+        range = remaining;
+    }
+    return YES;
+}
 
 
+#pragma mark - Query Writer
+
+/// 单次遍历参数并直接写出编码后的 query，key 保存已编码的键名前缀，仅内部使用
+typedef struct {
+    p_QueryBuffer output;
+    p_QueryBuffer key;
+    BOOL hasPair;
+    BOOL failed;
+} p_QueryWriter;
+
+static NSArray *p_QuerySortedObjects(id<NSFastEnumeration> objects, NSUInteger count) {
+    NSMutableArray *array = [NSMutableArray arrayWithCapacity:count];
+    BOOL allStrings = YES;
+    for (id obj in objects) {
+        [array addObject:obj];
+        if (allStrings && ![obj isKindOfClass:[NSString class]]) allStrings = NO;
+    }
+    
+    // 与按 description 排序结果一致，字符串的 description 即自身，不需要再次获取
+    if (allStrings) {
+        [array sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSString *obj1, NSString *obj2) {
+            return [obj1 compare:obj2];
+        }];
+    } else {
+        [array sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(id obj1, id obj2) {
+            return [[obj1 description] compare:[obj2 description]];
+        }];
+    }
+    return array;
+}
+
+static void p_QueryWriterWrite(p_QueryWriter *writer, BOOL hasKey, id value) {
+    if (writer->failed) return;
+    
+    size_t keyLength = writer->key.length;
+    
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        NSDictionary *dictionary = value;
+        for (id nestedKey in p_QuerySortedObjects(dictionary.keyEnumerator, dictionary.count)) {
+            if (hasKey) p_QueryBufferAppend(&writer->key, "%5B", 3);
+            if (!p_QueryBufferAppendEncodedString(&writer->key, [nestedKey description] ?: @"(null)")) {
+                writer->failed = YES;
+                return;
+            }
+            if (hasKey) p_QueryBufferAppend(&writer->key, "%5D", 3);
+            
+            p_QueryWriterWrite(writer, YES, dictionary[nestedKey]);
+            writer->key.length = keyLength;
+        }
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        if (!hasKey) p_QueryBufferAppend(&writer->key, "(null)", 6);
+        p_QueryBufferAppend(&writer->key, "%5B%5D", 6);
+        for (id nestedValue in (NSArray *)value) {
+            p_QueryWriterWrite(writer, YES, nestedValue);
+        }
+        writer->key.length = keyLength;
+    } else if ([value isKindOfClass:[NSSet class]]) {
+        NSSet *set = value;
+        for (id obj in p_QuerySortedObjects(set, set.count)) {
+            p_QueryWriterWrite(writer, hasKey, obj);
+        }
+    } else {
+        if (writer->hasPair) p_QueryBufferAppend(&writer->output, "&", 1);
+        writer->hasPair = YES;
+        
+        if (hasKey) {
+            p_QueryBufferAppend(&writer->output, writer->key.bytes, writer->key.length);
+        } else {
+            p_QueryBufferAppend(&writer->output, "(null)", 6);
+        }
+        
+        if ((value != nil) && ![value isEqual:[NSNull null]]) {
+            p_QueryBufferAppend(&writer->output, "=", 1);
+            if (!p_QueryBufferAppendEncodedString(&writer->output, [value description] ?: @"(null)")) {
+                writer->failed = YES;
+            }
+        }
+    }
+}
+
 
 @implementation NSURL (SGS)
 
@@ -59,52 +195,36 @@
     NSURL *result = self;
     NSString *query = [NSURL queryStringFromParameters:parameters];
     if ((query != nil) && (query.length > 0)) {
-        result = [NSURL URLWithString:[self.absoluteString stringByAppendingFormat:self.query ? @"&%@" : @"?%@", query]];
+        NSString *absoluteString = self.absoluteString;
+        NSMutableString *URLString = [NSMutableString stringWithCapacity:absoluteString.length + query.length + 1];
+        [URLString appendString:absoluteString];
+        [URLString appendString:(self.query ? @"&" : @"?")];
+        [URLString appendString:query];
+        result = [NSURL URLWithString:URLString];
     }
     
     return result;
 }
 
 + (NSString *)queryStringFromParameters:(NSDictionary *)parameters {
-    NSMutableArray *mutablePairs = [NSMutableArray array];
-    NSArray *queryStringPairs = [self p_queryStringPairsFromKey:nil value:parameters];
-    for (p_QueryItem *pair in queryStringPairs) {
-        [mutablePairs addObject:[pair nameValuePairString]];
-    }
-    
-    NSString *queryString = [mutablePairs componentsJoinedByString:@"&"];
+    p_QueryWriter writer = {0};
+    p_QueryWriterWrite(&writer, NO, parameters);
     
-    return [queryString stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet URLQueryAllowedCharacterSet]];
-}
-
-+ (NSArray *)p_queryStringPairsFromKey:(NSString *)key value:(id)value {
-    NSMutableArray *mutableQueryStringComponents = [NSMutableArray array];
-    
-    NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:@"description" ascending:YES selector:@selector(compare:)];
-    
-    if ([value isKindOfClass:[NSDictionary class]]) {
-        NSDictionary *dictionary = value;
-        for (id nestedKey in [dictionary.allKeys sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
-            id nestedValue = dictionary[nestedKey];
-            if (nestedValue) {
-                [mutableQueryStringComponents addObjectsFromArray:[self p_queryStringPairsFromKey:(key ? [NSString stringWithFormat:@"%@[%@]", key, nestedKey] : nestedKey) value:nestedValue]];
-            }
-        }
-    } else if ([value isKindOfClass:[NSArray class]]) {
-        NSArray *array = value;
-        for (id nestedValue in array) {
-            [mutableQueryStringComponents addObjectsFromArray:[self p_queryStringPairsFromKey:[NSString stringWithFormat:@"%@[]", key] value:nestedValue]];
-        }
-    } else if ([value isKindOfClass:[NSSet class]]) {
-        NSSet *set = value;
-        for (id obj in [set sortedArrayUsingDescriptors:@[ sortDescriptor ]]) {
-            [mutableQueryStringComponents addObjectsFromArray:[self p_queryStringPairsFromKey:key value:obj]];
-        }
+    NSString *queryString = nil;
+    if (writer.failed) {
+        queryString = nil;
+    } else if (writer.output.length == 0) {
+        queryString = @"";
     } else {
-        [mutableQueryStringComponents addObject:[p_QueryItem queryItemWithName:key value:value]];
+        // 缓冲区的所有权转交给字符串
+        queryString = [[NSString alloc] initWithBytesNoCopy:writer.output.bytes length:writer.output.length encoding:NSASCIIStringEncoding freeWhenDone:YES];
+        writer.output.bytes = NULL;
     }
     
-    return mutableQueryStringComponents;
+    free(writer.output.bytes);
+    free(writer.key.bytes);
+    
+    return queryString;
 }
 
 @end
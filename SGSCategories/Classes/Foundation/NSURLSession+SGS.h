@@ -9,6 +9,8 @@
  */
 
 #import <Foundation/Foundation.h>
+#import "SGSRequestScheduler.h"
+#import "SGSVerifiedDownloader.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -63,6 +65,13 @@ typedef void(^SGSDownloadSuccessBlock)(NSURLResponse *response, NSURL * _Nullabl
  */
 typedef NSURL * _Nonnull (^SGSDownloadTargetBlock)(NSURLResponse *response, NSURL *location);
 
+/*!
+ *  @brief 对冲请求的延迟取主机最近的 p95 总耗时
+ */
+FOUNDATION_EXPORT const NSTimeInterval SGSHedgeDelayObservedP95;
+
+@class SGSTaskHandle, SGSRequestCoalescer, SGSHTTPResponseCache, SGSProgressGroup, SGSRetryPolicy, SGSSegmentedDownloader, SGSDownloadResumeJournal, SGSMultipartFormData, SGSNetworkMetricsCollector, SGSPrefetcher, SGSRateLimiter, SGSPromise, SGSDeadline, SGSChunkedUploader, SGSResponsePipeline;
+
 
 @interface NSURLSession (SGS)
 
@@ -87,6 +96,77 @@ typedef NSURL * _Nonnull (^SGSDownloadTargetBlock)(NSURLResponse *response, NSUR
 
 
 
+#pragma mark - Progress
+///-----------------------------------------------------------------------------
+/// @name Progress
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 进度回调的最大频率，单位：次/秒，默认为 0，表示每次进度变化都回调
+ *
+ *  @discussion 设置后，两次回调之间的间隔内的进度变化会合并为一次回调，
+ *      任务成功完成时无论间隔多少都会进行一次 100% 的回调，例如设置为 30 可以满足界面刷新需要，
+ *      只影响设置之后创建的任务
+ */
+@property (nonatomic, assign) double progressMaximumRate;
+
+/*!
+ *  @brief 进度回调所在的队列，默认为空，表示在进度变化的线程中回调（设置了 progressMaximumRate 时在内部的串行队列中回调），
+ *      只影响设置之后创建的任务
+ */
+@property (nonatomic, strong, nullable) dispatch_queue_t progressDeliveryQueue;
+
+/*!
+ *  @brief 创建任务组，合计组内所有任务的进度
+ *
+ *  @discussion 回调频率和队列使用 progressMaximumRate 和 progressDeliveryQueue，
+ *      所有任务完成后进行一次 100% 的回调，详见 SGSProgressGroup
+ *
+ *  @param tasks         网络任务
+ *  @param progressBlock 总进度回调
+ *
+ *  @return SGSProgressGroup，调用方需要持有该对象直到任务完成
+ */
+- (SGSProgressGroup *)progressGroupWithTasks:(NSArray<NSURLSessionTask *> *)tasks
+                                    progress:(nullable SGSProgressBlock)progressBlock;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 耗时统计收集器，默认为空，表示不收集
+ *
+ *  @discussion 设置后，SGS 辅助方法创建的任务的耗时统计会交给收集器：
+ *      iOS 15 及以上为任务设置任务代理收集系统统计数据，包括 DNS、连接和 TLS 耗时以及是否复用了连接；
+ *      iOS 15 之前或会话代理自己实现了 URLSession:task:didFinishCollectingMetrics: 时，以时间戳估算首字节时间、传输时间和总耗时，
+ *      此时系统统计数据需要在会话代理中调用收集器的 collectSessionTaskMetrics:forTask: 转发，详见 SGSNetworkMetricsCollector，
+ *      只影响设置之后创建的任务
+ */
+@property (nonatomic, strong, nullable) SGSNetworkMetricsCollector *metricsCollector;
+
+/*!
+ *  @brief 进度观察者注册表的统计数据
+ *
+ *  @discussion 注册表按任务分片保存进度观察者，统计数据包括：
+ *      - shardCount：分片数
+ *      - observerCount：当前注册的观察者数
+ *      - acquisitionCount：加锁次数
+ *      - contentionCount：加锁时发生竞争的次数
+ *
+ *  @return 统计数据字典
+ */
++ (NSDictionary<NSString *, NSNumber *> *)progressObserverRegistryMetrics;
+
+/*!
+ *  @brief 重置进度观察者注册表的加锁统计
+ */
++ (void)resetProgressObserverRegistryMetrics;
+
+
+
 #pragma mark - HTTP Request
 ///-----------------------------------------------------------------------------
 /// @name HTTP Request
@@ -184,6 +264,161 @@ typedef NSURL * _Nonnull (^SGSDownloadTargetBlock)(NSURLResponse *response, NSUR
                                   success:(nullable SGSResponseSuccessBlock)success
                                   failure:(nullable SGSResponseFailureBlock)failure;
 
+
+#pragma mark - Response Pipeline
+///-----------------------------------------------------------------------------
+/// @name Response Pipeline
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 使用分阶段处理管道的 HTTP 请求
+ *
+ *  @discussion 请求完毕后在 SGSResponsePipeline 的解码队列中执行管道，不占用会话的代理队列，
+ *      管道的结果为 NSError 时回调 failure，否则回调 success，都在主线程回调
+ *
+ *      单个过滤闭包的请求仍然使用 responseFilter 参数，也可以通过 [pipeline filterBlock] 传入管道
+ *
+ *  @param request  HTTP 请求
+ *  @param pipeline 响应处理管道，为空时以原始数据回调 success
+ *  @param success  请求成功
+ *  @param failure  请求失败
+ *
+ *  @return NSURLSessionDataTask
+ */
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request
+                             responsePipeline:(nullable SGSResponsePipeline *)pipeline
+                                      success:(nullable SGSResponseSuccessBlock)success
+                                      failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 使用分阶段处理管道的 HTTP GET 请求
+ *
+ *  @param url      请求地址
+ *  @param pipeline 响应处理管道，为空时以原始数据回调 success
+ *  @param success  请求成功
+ *  @param failure  请求失败
+ *
+ *  @return NSURLSessionDataTask
+ */
+- (NSURLSessionDataTask *)dataTaskWithURL:(NSURL *)url
+                         responsePipeline:(nullable SGSResponsePipeline *)pipeline
+                                  success:(nullable SGSResponseSuccessBlock)success
+                                  failure:(nullable SGSResponseFailureBlock)failure;
+
+
+#pragma mark - Coalescing
+///-----------------------------------------------------------------------------
+/// @name Coalescing
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 当前会话的请求合并器，用于配置参与计算请求键的请求头
+ */
+@property (nonatomic, strong, readonly) SGSRequestCoalescer *requestCoalescer;
+
+/*!
+ *  @brief 可合并的 HTTP 请求
+ *
+ *  @discussion 如果已有相同的 GET / HEAD 请求正在进行，将不会创建新的任务，
+ *      而是在已有任务完成后一起回调，使用相同 filter 的调用方只会解析一次返回数据，
+ *      详见 SGSRequestCoalescer
+ *
+ *      通过返回的句柄取消请求只会影响当前调用方，所有调用方都取消后才会取消共享的任务
+ *
+ *  @param request HTTP 请求
+ *  @param filter  请求完毕后的过滤闭包
+ *  @param success 请求成功
+ *  @param failure 请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)coalescedDataTaskWithRequest:(NSURLRequest *)request
+                                 responseFilter:(nullable SGSResponseFilterBlock)filter
+                                        success:(nullable SGSResponseSuccessBlock)success
+                                        failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 可合并的 HTTP GET 请求
+ *
+ *  @discussion 详见 coalescedDataTaskWithRequest:responseFilter:success:failure:
+ *
+ *  @param url     请求地址
+ *  @param filter  请求完毕后的过滤闭包
+ *  @param success 请求成功
+ *  @param failure 请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)coalescedDataTaskWithURL:(NSURL *)url
+                             responseFilter:(nullable SGSResponseFilterBlock)filter
+                                    success:(nullable SGSResponseSuccessBlock)success
+                                    failure:(nullable SGSResponseFailureBlock)failure;
+
+#pragma mark - Cache
+///-----------------------------------------------------------------------------
+/// @name Cache
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 使用两级缓存的 HTTP GET 请求
+ *
+ *  @discussion 调用句柄的 resume 后在后台线程查找缓存：
+ *      - 缓存有效：不发起请求，直接回调 success
+ *      - 缓存过期但在 stale-while-revalidate 时间内：先回调缓存，再在后台重新验证并更新缓存，不再重复回调
+ *      - 缓存过期：使用 If-None-Match / If-Modified-Since 重新验证，304 时回调缓存
+ *      - 没有缓存：发起请求并根据响应头缓存
+ *
+ *      请求因网络不可用失败时，如果存在过期的缓存将回调该缓存
+ *
+ *      filter 解析后的对象会保存在内存缓存中，再次使用相同 filter 命中缓存时不需要重新解析，
+ *      非 GET 请求不使用缓存
+ *
+ *  @param request    HTTP 请求
+ *  @param cache      缓存，为空时使用 [SGSHTTPResponseCache sharedCache]
+ *  @param timeToLive 缓存有效期，单位：秒，SGSHTTPCacheTimeToLiveAutomatic 表示根据响应头计算
+ *  @param filter     请求完毕后的过滤闭包
+ *  @param success    请求成功
+ *  @param failure    请求失败
+ *
+ *  @return SGSTaskHandle，命中有效缓存时 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                                 cache:(nullable SGSHTTPResponseCache *)cache
+                            timeToLive:(NSTimeInterval)timeToLive
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 使用两级缓存的 HTTP GET 请求
+ *
+ *  @discussion 详见 dataTaskWithRequest:cache:timeToLive:responseFilter:success:failure:
+ *
+ *  @param url        请求地址
+ *  @param cache      缓存，为空时使用 [SGSHTTPResponseCache sharedCache]
+ *  @param timeToLive 缓存有效期，单位：秒，SGSHTTPCacheTimeToLiveAutomatic 表示根据响应头计算
+ *  @param filter     请求完毕后的过滤闭包
+ *  @param success    请求成功
+ *  @param failure    请求失败
+ *
+ *  @return SGSTaskHandle，命中有效缓存时 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                             cache:(nullable SGSHTTPResponseCache *)cache
+                        timeToLive:(NSTimeInterval)timeToLive
+                    responseFilter:(nullable SGSResponseFilterBlock)filter
+                           success:(nullable SGSResponseSuccessBlock)success
+                           failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 当前会话的预加载器，使用 [SGSHTTPResponseCache sharedCache] 保存响应
+ *
+ *  @discussion 以低优先级预先获取之后需要的请求，会话中有其他请求时暂停，
+ *      完成后使用 dataTaskWithRequest:cache:timeToLive:responseFilter:success:failure: 可以直接命中缓存，
+ *      详见 SGSPrefetcher
+ */
+@property (nonatomic, strong, readonly) SGSPrefetcher *prefetcher;
+
 #pragma mark - Upload
 ///-----------------------------------------------------------------------------
 /// @name Upload
@@ -239,12 +474,126 @@ typedef NSURL * _Nonnull (^SGSDownloadTargetBlock)(NSURLResponse *response, NSUR
                                           success:(nullable SGSResponseSuccessBlock)success
                                           failure:(nullable SGSResponseFailureBlock)failure;
 
+/*!
+ *  @brief 以 multipart/form-data 流式上传
+ *
+ *  @discussion 包含文件时先在调用线程中将请求体分块写入临时文件，再从文件上传，上传结束后删除临时文件，
+ *      文件较大时不应在主线程中调用；不包含文件时直接使用内存中的请求体，
+ *      两种方式都可以在 307 重定向或认证质询时重新发送请求体
+ *
+ *      上传进度的总量取自 formData 计算出的 Content-Length
+ *
+ *      filter、success 和 failure 的说明参考 uploadTaskWithRequest:fromFile:progress:responseFilter:success:failure:
+ *
+ *  @param request       HTTP 请求，请求方法为 GET 时改为 POST，请求体和 Content-Type、Content-Length 请求头将被 formData 覆盖
+ *  @param formData      multipart/form-data 请求体
+ *  @param progressBlock 上传进度闭包
+ *  @param filter        上传完毕后的过滤闭包
+ *  @param success       上传成功
+ *  @param failure       上传失败
+ *
+ *  @return NSURLSessionDataTask
+ */
+- (NSURLSessionDataTask *)uploadTaskWithRequest:(NSURLRequest *)request
+                              multipartFormData:(SGSMultipartFormData *)formData
+                                       progress:(nullable SGSProgressBlock)progressBlock
+                                 responseFilter:(nullable SGSResponseFilterBlock)filter
+                                        success:(nullable SGSResponseSuccessBlock)success
+                                        failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 可断点续传的分块并行上传
+ *
+ *  @discussion 使用 tus 协议将文件分块并行上传，每块带有 SHA-1 校验，完成后在服务器上合并，
+ *      失败、取消或应用重新启动后再次上传同一个文件时跳过已完成的块，详见 SGSChunkedUploader
+ *
+ *  @param fileURL       待上传的文件
+ *  @param endpoint      tus 服务的创建地址
+ *  @param uploader      分块上传配置，为空时使用默认配置（每块 5 MB，同时上传 3 块）
+ *  @param metadata      文件的元数据，为空时只包含 filename
+ *  @param progressBlock 合并后的上传进度闭包
+ *  @param success       上传成功，responseObject 为合并后文件的地址（NSURL）
+ *  @param failure       上传失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)chunkedUploadTaskWithFile:(NSURL *)fileURL
+                                    endpoint:(NSURL *)endpoint
+                                    uploader:(nullable SGSChunkedUploader *)uploader
+                                    metadata:(nullable NSDictionary<NSString *, NSString *> *)metadata
+                                    progress:(nullable SGSProgressBlock)progressBlock
+                                     success:(nullable SGSResponseSuccessBlock)success
+                                     failure:(nullable SGSResponseFailureBlock)failure;
+
+
+#pragma mark - Compression
+///-----------------------------------------------------------------------------
+/// @name Compression
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 在后台队列中使用 gzip 压缩请求体后发起请求
+ *
+ *  @discussion 请求体长度超过 threshold 时压缩并设置 Content-Encoding: gzip 请求头，
+ *      详见 NSMutableURLRequest 的 gzipHTTPBodyIfLargerThan:，
+ *      压缩前后的长度可以通过 requestBodyCompressionMetricsForTask: 读取
+ *
+ *      任务在压缩完成后才创建，调用 SGSTaskHandle 的 resume 后开始压缩，
+ *      压缩完成前取消时以 NSURLErrorCancelled 回调 failure
+ *
+ *      filter、success 和 failure 的说明参考 dataTaskWithRequest:responseFilter:success:failure:
+ *
+ *  @param request   HTTP 请求，服务端需要支持 gzip 编码的请求体
+ *  @param threshold 需要压缩的最小长度，单位：字节
+ *  @param filter    请求完毕后的过滤闭包
+ *  @param success   请求成功
+ *  @param failure   请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+             compressingBodyLargerThan:(NSUInteger)threshold
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 任务请求体的压缩统计数据
+ *
+ *  @discussion 统计数据包括：
+ *      - SGSHTTPBodyOriginalLengthKey：压缩前的长度
+ *      - SGSHTTPBodyCompressedLengthKey：压缩后的长度
+ *
+ *  @param task 网络任务
+ *
+ *  @return 统计数据字典，请求体没有压缩时返回 nil
+ */
++ (nullable NSDictionary<NSString *, NSNumber *> *)requestBodyCompressionMetricsForTask:(NSURLSessionTask *)task;
 
 #pragma mark - Download
 ///-----------------------------------------------------------------------------
 /// @name Download
 ///-----------------------------------------------------------------------------
 
+/*!
+ *  @brief 下载断点数据的记录，默认为 [SGSDownloadResumeJournal sharedJournal]，设置为 nil 时不自动续传
+ *
+ *  @discussion 下载方法创建 GET 下载任务时，如果记录中存在相同地址的断点数据，将从断点继续下载；
+ *      任务失败时保存断点数据，成功后删除；应用即将终止时取消正在进行的下载并保存断点数据，
+ *      详见 SGSDownloadResumeJournal
+ */
+@property (nonatomic, strong, nullable) SGSDownloadResumeJournal *downloadResumeJournal;
+
+/*!
+ *  @brief 取消下载任务并将断点数据保存到 downloadResumeJournal
+ *
+ *  @discussion 通过进度闭包中的 NSProgress 取消下载任务时也会保存断点数据，
+ *      直接调用任务的 cancel 不会产生断点数据
+ *
+ *  @param task 下载任务
+ */
+- (void)cancelDownloadTaskProducingResumeData:(NSURLSessionDownloadTask *)task;
+
 /*!
  *  @brief 下载
  *
@@ -295,6 +644,541 @@ typedef NSURL * _Nonnull (^SGSDownloadTargetBlock)(NSURLResponse *response, NSUR
                                                  success:(nullable SGSDownloadSuccessBlock)success
                                                  failure:(nullable SGSResponseFailureBlock)failure;
 
+/*!
+ *  @brief 分段并行下载
+ *
+ *  @discussion 服务器支持范围请求时将文件分为多段同时下载，失败的分段单独重试，
+ *      不支持时退化为单连接下载，详见 SGSSegmentedDownloader
+ *
+ *  @param request       HTTP 请求
+ *  @param downloader    分段下载配置，为空时使用默认配置（4 段，每段至少 1 MB）
+ *  @param progressBlock 合并后的下载进度闭包
+ *  @param destination   下载完毕后的保存路径
+ *  @param success       下载成功
+ *  @param failure       下载失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)segmentedDownloadTaskWithRequest:(NSURLRequest *)request
+                                         downloader:(nullable SGSSegmentedDownloader *)downloader
+                                           progress:(nullable SGSProgressBlock)progressBlock
+                                        destination:(nullable SGSDownloadTargetBlock)destination
+                                            success:(nullable SGSDownloadSuccessBlock)success
+                                            failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 当前会话的校验下载器，使用当前会话发出请求（iOS 15 之前使用当前会话的配置），首次访问时创建
+ */
+@property (nonatomic, strong, readonly) SGSVerifiedDownloader *verifiedDownloader;
+
+/*!
+ *  @brief 预分配空间并边下载边校验的下载
+ *
+ *  @discussion 已知大小时先检查可用空间并预分配文件，下载时同时计算摘要，
+ *      大小和摘要校验通过后才原子地替换目标文件，不需要下载后重新读取文件，
+ *      使用 verifiedDownloader 发出请求，进度回调使用 progressMaximumRate 和 progressDeliveryQueue，详见 SGSVerifiedDownloader
+ *
+ *  @param request        HTTP 请求
+ *  @param fileURL        目标文件路径
+ *  @param expectedSize   期望的文件大小，未知时为 NSURLSessionTransferSizeUnknown
+ *  @param algorithm      摘要算法
+ *  @param expectedDigest 期望的十六进制摘要，为空时不校验摘要
+ *  @param progressBlock  下载进度闭包
+ *  @param success        下载成功，filePath 为目标文件路径
+ *  @param failure        下载失败，校验失败时为 SGSVerifiedDownloadErrorDomain 中的错误
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)verifiedDownloadTaskWithRequest:(NSURLRequest *)request
+                                         toFileURL:(NSURL *)fileURL
+                                      expectedSize:(int64_t)expectedSize
+                                   digestAlgorithm:(SGSDigestAlgorithm)algorithm
+                                    expectedDigest:(nullable NSString *)expectedDigest
+                                          progress:(nullable SGSProgressBlock)progressBlock
+                                           success:(nullable SGSDownloadSuccessBlock)success
+                                           failure:(nullable SGSResponseFailureBlock)failure;
+
+
+#pragma mark - Retry
+///-----------------------------------------------------------------------------
+/// @name Retry
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 失败后自动重试的 HTTP 请求
+ *
+ *  @discussion 调用句柄的 resume 后发出请求，网络错误或可重试的状态码按 retryPolicy 退避后重试，
+ *      重试次数用完或不满足重试条件时回调最后一次的结果，每次重试都会创建新的任务，句柄的 task 随之变化
+ *
+ *      retryPolicy 设置了熔断器时，主机处于熔断状态的请求不会发出，直接回调 SGSRetryErrorDomain 中的
+ *      SGSRetryErrorCircuitOpen 错误，详见 SGSRetryPolicy 和 SGSCircuitBreaker
+ *
+ *  @param request     HTTP 请求
+ *  @param retryPolicy 重试策略，为空时使用 [SGSRetryPolicy defaultPolicy]
+ *  @param filter      请求完毕后的过滤闭包
+ *  @param success     请求成功
+ *  @param failure     请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                           retryPolicy:(nullable SGSRetryPolicy *)retryPolicy
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 失败后自动重试的文件上传
+ *
+ *  @discussion 非幂等请求（如 POST）默认只在请求没有发出时重试，详见 dataTaskWithRequest:retryPolicy:responseFilter:success:failure:
+ *
+ *  @param request       HTTP 请求
+ *  @param fileURL       文件 URL
+ *  @param retryPolicy   重试策略，为空时使用 [SGSRetryPolicy defaultPolicy]
+ *  @param progressBlock 上传进度闭包，重试时从头开始
+ *  @param filter        上传完毕后的过滤闭包
+ *  @param success       上传成功
+ *  @param failure       上传失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)uploadTaskWithRequest:(NSURLRequest *)request
+                                fromFile:(NSURL *)fileURL
+                             retryPolicy:(nullable SGSRetryPolicy *)retryPolicy
+                                progress:(nullable SGSProgressBlock)progressBlock
+                          responseFilter:(nullable SGSResponseFilterBlock)filter
+                                 success:(nullable SGSResponseSuccessBlock)success
+                                 failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 失败后自动重试的数据上传
+ *
+ *  @discussion 非幂等请求（如 POST）默认只在请求没有发出时重试，详见 dataTaskWithRequest:retryPolicy:responseFilter:success:failure:
+ *
+ *  @param request       HTTP 请求
+ *  @param bodyData      待上传的数据
+ *  @param retryPolicy   重试策略，为空时使用 [SGSRetryPolicy defaultPolicy]
+ *  @param progressBlock 上传进度闭包，重试时从头开始
+ *  @param filter        上传完毕后的过滤闭包
+ *  @param success       上传成功
+ *  @param failure       上传失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)uploadTaskWithRequest:(NSURLRequest *)request
+                                fromData:(nullable NSData *)bodyData
+                             retryPolicy:(nullable SGSRetryPolicy *)retryPolicy
+                                progress:(nullable SGSProgressBlock)progressBlock
+                          responseFilter:(nullable SGSResponseFilterBlock)filter
+                                 success:(nullable SGSResponseSuccessBlock)success
+                                 failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 失败后自动重试的下载
+ *
+ *  @discussion 失败的错误信息中包含断点数据时，重试将从断点继续下载，
+ *      详见 dataTaskWithRequest:retryPolicy:responseFilter:success:failure:
+ *
+ *  @param request       HTTP 请求
+ *  @param retryPolicy   重试策略，为空时使用 [SGSRetryPolicy defaultPolicy]
+ *  @param progressBlock 下载进度闭包
+ *  @param destination   下载完毕后的保存路径
+ *  @param success       下载成功
+ *  @param failure       下载失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)downloadTaskWithRequest:(NSURLRequest *)request
+                               retryPolicy:(nullable SGSRetryPolicy *)retryPolicy
+                                  progress:(nullable SGSProgressBlock)progressBlock
+                               destination:(nullable SGSDownloadTargetBlock)destination
+                                   success:(nullable SGSDownloadSuccessBlock)success
+                                   failure:(nullable SGSResponseFailureBlock)failure;
+
+
+#pragma mark - Hedging
+///-----------------------------------------------------------------------------
+/// @name Hedging
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 对冲请求，降低幂等请求的尾部延迟
+ *
+ *  @discussion 调用句柄的 resume 后发出请求，超过 delay 秒仍未完成时再发出一个相同的请求，
+ *      使用先成功（没有错误且状态码不是 5xx）的结果并取消另一个，两个都失败时回调后完成的结果，
+ *      句柄的 task 始终为第一个任务，取消句柄会取消所有任务
+ *
+ *      只对冲 GET 和 HEAD 请求，其他请求按普通请求发出，
+ *      对冲会增加服务器负载，应根据当前会话的 hedgingMetrics 中的对冲比例调整 delay
+ *
+ *  @param request HTTP 请求
+ *  @param delay   发出第二个请求前的等待时间，单位：秒，
+ *                 为 SGSHedgeDelayObservedP95 时取 metricsCollector 中该主机的 p95 总耗时，
+ *                 没有设置收集器或样本不足时为 1 秒
+ *  @param filter  请求完毕后的过滤闭包
+ *  @param success 请求成功
+ *  @param failure 请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                       hedgeAfterDelay:(NSTimeInterval)delay
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 当前会话对冲请求的统计数据
+ *
+ *  @discussion 统计数据包括：
+ *      - requestCount：发出的对冲请求数
+ *      - hedgedCount：发出了第二个请求的次数
+ *      - hedgeWinCount：第二个请求先成功的次数
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSNumber *> *)hedgingMetrics;
+
+/*!
+ *  @brief 重置当前会话对冲请求的统计数据
+ */
+- (void)resetHedgingMetrics;
+
+
+#pragma mark - Rate Limiting
+///-----------------------------------------------------------------------------
+/// @name Rate Limiting
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 限速的 HTTP 请求
+ *
+ *  @discussion 调用句柄的 resume 后等待限速器的令牌，取得令牌后才创建任务，等待不会阻塞线程，
+ *      请求完成后将响应交给限速器，以便按服务器的限速响应头调整速率，详见 SGSRateLimiter
+ *
+ *      等待中被取消时回调 NSURLErrorCancelled 错误
+ *
+ *  @param request     HTTP 请求
+ *  @param rateLimiter 限速器，为空时使用 [SGSRateLimiter sharedLimiter]
+ *  @param filter      请求完毕后的过滤闭包
+ *  @param success     请求成功
+ *  @param failure     请求失败
+ *
+ *  @return SGSTaskHandle，等待中的 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                           rateLimiter:(nullable SGSRateLimiter *)rateLimiter
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 限速的 HTTP GET 请求
+ *
+ *  @discussion 详见 dataTaskWithRequest:rateLimiter:responseFilter:success:failure:
+ *
+ *  @param url         请求地址
+ *  @param rateLimiter 限速器，为空时使用 [SGSRateLimiter sharedLimiter]
+ *  @param filter      请求完毕后的过滤闭包
+ *  @param success     请求成功
+ *  @param failure     请求失败
+ *
+ *  @return SGSTaskHandle，等待中的 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                       rateLimiter:(nullable SGSRateLimiter *)rateLimiter
+                    responseFilter:(nullable SGSResponseFilterBlock)filter
+                           success:(nullable SGSResponseSuccessBlock)success
+                           failure:(nullable SGSResponseFailureBlock)failure;
+
+
+#pragma mark - Promise
+///-----------------------------------------------------------------------------
+/// @name Promise
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 返回 Promise 的 HTTP 请求
+ *
+ *  @discussion 立即发出请求，成功时 Promise 的值为过滤后的对象（filter 为空时为 NSData），
+ *      filter 返回 NSError 或请求出错时 Promise 失败，取消 Promise 会取消任务
+ *
+ *      Promise 在任务的回调线程中确定结果，不会切换到主线程，使用 then、all 等组合多个请求，详见 SGSPromise
+ *
+ *  @param request HTTP 请求
+ *  @param filter  请求完毕后的过滤闭包
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)promiseWithRequest:(NSURLRequest *)request responseFilter:(nullable SGSResponseFilterBlock)filter;
+
+/*!
+ *  @brief 返回 Promise 的 HTTP GET 请求
+ *
+ *  @discussion 详见 promiseWithRequest:responseFilter:
+ *
+ *  @param url    请求地址
+ *  @param filter 请求完毕后的过滤闭包
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)promiseWithURL:(NSURL *)url responseFilter:(nullable SGSResponseFilterBlock)filter;
+
+/*!
+ *  @brief 返回 Promise 的文件上传
+ *
+ *  @discussion 详见 promiseWithRequest:responseFilter:
+ *
+ *  @param request       HTTP 请求
+ *  @param fileURL       文件 URL
+ *  @param progressBlock 上传进度闭包
+ *  @param filter        上传完毕后的过滤闭包
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)uploadPromiseWithRequest:(NSURLRequest *)request
+                                fromFile:(NSURL *)fileURL
+                                progress:(nullable SGSProgressBlock)progressBlock
+                          responseFilter:(nullable SGSResponseFilterBlock)filter;
+
+/*!
+ *  @brief 返回 Promise 的数据上传
+ *
+ *  @discussion 详见 promiseWithRequest:responseFilter:
+ *
+ *  @param request       HTTP 请求
+ *  @param bodyData      待上传的数据
+ *  @param progressBlock 上传进度闭包
+ *  @param filter        上传完毕后的过滤闭包
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)uploadPromiseWithRequest:(NSURLRequest *)request
+                                fromData:(nullable NSData *)bodyData
+                                progress:(nullable SGSProgressBlock)progressBlock
+                          responseFilter:(nullable SGSResponseFilterBlock)filter;
+
+/*!
+ *  @brief 返回 Promise 的下载
+ *
+ *  @discussion 成功时 Promise 的值为保存后的文件路径，destination 为空时为 nil，
+ *      详见 promiseWithRequest:responseFilter:
+ *
+ *  @param request       HTTP 请求
+ *  @param progressBlock 下载进度闭包
+ *  @param destination   下载完毕后的保存路径
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)downloadPromiseWithRequest:(NSURLRequest *)request
+                                  progress:(nullable SGSProgressBlock)progressBlock
+                               destination:(nullable SGSDownloadTargetBlock)destination;
+
+
+#pragma mark - Deadline
+///-----------------------------------------------------------------------------
+/// @name Deadline
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 受截止时间限制的 HTTP 请求
+ *
+ *  @discussion 调用句柄的 resume 后发出请求，请求的超时时间缩短为截止时间的剩余时间，
+ *      截止时间到达时取消仍在进行的请求，以 NSURLErrorTimedOut 错误回调 failure，
+ *      resume 时已经过期的请求不会发出，同样回调 NSURLErrorTimedOut 错误，
+ *      取消句柄或截止时间被取消时回调 NSURLErrorCancelled 错误，详见 SGSDeadline
+ *
+ *  @param request  HTTP 请求
+ *  @param deadline 截止时间，串联的请求使用同一个截止时间共享总预算
+ *  @param filter   请求完毕后的过滤闭包
+ *  @param success  请求成功
+ *  @param failure  请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                              deadline:(SGSDeadline *)deadline
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 返回 Promise 的受截止时间限制的 HTTP 请求
+ *
+ *  @discussion 立即发出请求，详见 dataTaskWithRequest:deadline:responseFilter:success:failure:
+ *      和 promiseWithRequest:responseFilter:
+ *
+ *  @param request  HTTP 请求
+ *  @param deadline 截止时间
+ *  @param filter   请求完毕后的过滤闭包
+ *
+ *  @return SGSPromise
+ */
+- (SGSPromise *)promiseWithRequest:(NSURLRequest *)request
+                          deadline:(SGSDeadline *)deadline
+                    responseFilter:(nullable SGSResponseFilterBlock)filter;
+
+
+#pragma mark - Warm-Up
+///-----------------------------------------------------------------------------
+/// @name Warm-Up
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 预先建立连接，减少第一个请求的 DNS、TCP 和 TLS 耗时
+ *
+ *  @discussion 向每个源的根路径发出 HEAD 请求，之后当前会话向同一个源发出的请求可以复用已经建立的连接，
+ *      应在启动时对稍后使用的会话调用，任何 HTTP 响应（包括 404、405）都说明连接已经建立，只有网络错误视为预热失败，
+ *      当前会话中同一个源正在预热时忽略重复的预热
+ *
+ *      设置了 metricsCollector 时，预热请求和预热后第一个请求的耗时统计记录在当前会话的 warmUpMetrics 中，
+ *      第一个请求只统计当前会话通过本扩展的方法发出的请求，不同会话的连接不能共享，各自分开统计，
+ *      收集器收到系统统计数据时才能得知第一个请求是否复用了连接以及节省的建连耗时，
+ *      iOS 15 及以上辅助方法的任务自动收集系统统计数据，之前的系统需要会话代理转发（见 metricsCollector），
+ *      没有系统统计数据时建连耗时以预热请求的总耗时代替，reusedCount 和 notReusedCount 不会增加
+ *
+ *  @param origins    源地址，只使用 scheme、host 和 port，例如 https://api.example.com
+ *  @param completion 全部预热结束后在主线程回调，参数为预热成功的源及其耗时（秒）
+ */
+- (void)warmUpConnectionsToOrigins:(NSArray<NSURL *> *)origins
+                        completion:(nullable void (^)(NSDictionary<NSString *, NSNumber *> *durations))completion;
+
+/*!
+ *  @brief 当前会话预热的统计数据
+ *
+ *  @discussion 以源（如 https://api.example.com）为键，值为包含以下数据的字典：
+ *      - warmUpCount：预热成功的次数
+ *      - failedCount：预热失败的次数
+ *      - setupDuration：最近一次预热的建连耗时，单位：秒，为系统统计数据中 DNS 和连接耗时之和，没有时为预热请求的总耗时
+ *      - reusedCount：预热后第一个请求复用了连接的次数
+ *      - notReusedCount：预热后第一个请求没有复用连接的次数
+ *      - savedDuration：复用连接累计节省的建连耗时，单位：秒
+ *      - reusedConnection：最近一次预热后第一个请求是否复用了连接，没有系统统计数据时不包含
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)warmUpMetrics;
+
+/*!
+ *  @brief 重置当前会话预热的统计数据
+ */
+- (void)resetWarmUpMetrics;
+
+
+#pragma mark - Session Registry
+///-----------------------------------------------------------------------------
+/// @name Session Registry
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 共享的默认会话
+ *
+ *  @discussion 即 [SGSSessionRegistry sharedRegistry].defaultSession，使用 defaultSessionConfiguration，
+ *      没有特殊配置需求的请求都应使用这个会话，以复用同一个连接池，
+ *      需要其他配置时通过 [SGSSessionRegistry sharedRegistry] 租用共享会话，而不是各自创建会话
+ *
+ *  @return NSURLSession
+ */
++ (NSURLSession *)sharedRegistrySession;
+
+
+#pragma mark - Scheduling
+///-----------------------------------------------------------------------------
+/// @name Scheduling
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 按优先级排队的 HTTP 请求
+ *
+ *  @discussion 调用句柄的 resume 后进入调度器排队，优先级高的请求先启动，
+ *      并发数受调度器的全局和单个主机上限限制，详见 SGSRequestScheduler
+ *
+ *      排队中的请求可以通过 [scheduler setPriority:forHandle:] 调整优先级，
+ *      排队中被取消时回调 NSURLErrorCancelled 错误
+ *
+ *  @param request   HTTP 请求
+ *  @param priority  优先级
+ *  @param scheduler 调度器，为空时使用 [SGSRequestScheduler sharedScheduler]
+ *  @param filter    请求完毕后的过滤闭包
+ *  @param success   请求成功
+ *  @param failure   请求失败
+ *
+ *  @return SGSTaskHandle，排队中的 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                              priority:(SGSRequestPriority)priority
+                             scheduler:(nullable SGSRequestScheduler *)scheduler
+                        responseFilter:(nullable SGSResponseFilterBlock)filter
+                               success:(nullable SGSResponseSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 按优先级排队的 HTTP GET 请求
+ *
+ *  @discussion 详见 dataTaskWithRequest:priority:scheduler:responseFilter:success:failure:
+ *
+ *  @param url       请求地址
+ *  @param priority  优先级
+ *  @param scheduler 调度器，为空时使用 [SGSRequestScheduler sharedScheduler]
+ *  @param filter    请求完毕后的过滤闭包
+ *  @param success   请求成功
+ *  @param failure   请求失败
+ *
+ *  @return SGSTaskHandle，排队中的 task 为 nil
+ */
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                          priority:(SGSRequestPriority)priority
+                         scheduler:(nullable SGSRequestScheduler *)scheduler
+                    responseFilter:(nullable SGSResponseFilterBlock)filter
+                           success:(nullable SGSResponseSuccessBlock)success
+                           failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 按优先级排队的下载
+ *
+ *  @discussion 详见 dataTaskWithRequest:priority:scheduler:responseFilter:success:failure:
+ *
+ *  @param request       HTTP 请求
+ *  @param priority      优先级
+ *  @param scheduler     调度器，为空时使用 [SGSRequestScheduler sharedScheduler]
+ *  @param progressBlock 下载进度闭包
+ *  @param destination   下载完毕后的保存路径
+ *  @param success       下载成功
+ *  @param failure       下载失败
+ *
+ *  @return SGSTaskHandle，排队中的 task 为 nil
+ */
+- (SGSTaskHandle *)downloadTaskWithRequest:(NSURLRequest *)request
+                                  priority:(SGSRequestPriority)priority
+                                 scheduler:(nullable SGSRequestScheduler *)scheduler
+                                  progress:(nullable SGSProgressBlock)progressBlock
+                               destination:(nullable SGSDownloadTargetBlock)destination
+                                   success:(nullable SGSDownloadSuccessBlock)success
+                                   failure:(nullable SGSResponseFailureBlock)failure;
+
+/*!
+ *  @brief 按优先级排队的下载
+ *
+ *  @discussion 详见 dataTaskWithRequest:priority:scheduler:responseFilter:success:failure:
+ *
+ *  @param url           下载地址
+ *  @param priority      优先级
+ *  @param scheduler     调度器，为空时使用 [SGSRequestScheduler sharedScheduler]
+ *  @param progressBlock 下载进度闭包
+ *  @param destination   下载完毕后的保存路径
+ *  @param success       下载成功
+ *  @param failure       下载失败
+ *
+ *  @return SGSTaskHandle，排队中的 task 为 nil
+ */
+- (SGSTaskHandle *)downloadTaskWithURL:(NSURL *)url
+                              priority:(SGSRequestPriority)priority
+                             scheduler:(nullable SGSRequestScheduler *)scheduler
+                              progress:(nullable SGSProgressBlock)progressBlock
+                           destination:(nullable SGSDownloadTargetBlock)destination
+                               success:(nullable SGSDownloadSuccessBlock)success
+                               failure:(nullable SGSResponseFailureBlock)failure;
+
 @end
 
 NS_ASSUME_NONNULL_END
\ No newline at end of file
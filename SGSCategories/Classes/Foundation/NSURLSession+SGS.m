@@ -7,10 +7,43 @@
  */
 
 #import "NSURLSession+SGS.h"
+#import "SGSTaskHandle.h"
+#import "SGSRequestCoalescer.h"
+#import "SGSHTTPResponseCache.h"
+#import "SGSProgressGroup.h"
+#import "SGSRetryPolicy.h"
+#import "SGSSegmentedDownloader.h"
+#import "SGSDownloadResumeJournal.h"
+#import "SGSMultipartFormData.h"
+#import "NSMutableURLRequest+SGS.h"
+#import "SGSNetworkMetrics.h"
+#import "SGSPrefetcher.h"
+#import "SGSRateLimiter.h"
+#import "SGSPromise.h"
+#import "SGSDeadline.h"
+#import "SGSChunkedUploader.h"
+#import "SGSSessionRegistry.h"
+#import "SGSResponsePipeline.h"
+#import "SGSVerifiedDownloader.h"
 #import <objc/runtime.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
-static const int kLockKey;
-static const int kProgressObserversKey;
+static const int kRequestCoalescerKey;
+static const int kProgressMaximumRateKey;
+static const int kProgressDeliveryQueueKey;
+static const int kDownloadResumeJournalKey;
+static const int kMetricsCollectorKey;
+static const int kPrefetcherKey;
+static const int kVerifiedDownloaderKey;
+static const int kHedgeCountersKey;
+static const int kWarmUpStatsKey;
+
+/// 单次尝试完成后的回调，deliver 用于回调调用方，不再重试时需要在该回调中同步调用
+typedef void(^p_RetryAttemptCompletion)(NSURLResponse *response, NSError *error, dispatch_block_t deliver);
+
+/// 创建单次尝试的任务，previousError 为上一次尝试的错误
+typedef NSURLSessionTask *(^p_RetryTaskFactory)(NSError *previousError, p_RetryAttemptCompletion completion);
 
 #pragma mark - Session Task Progress Observer
 
@@ -22,11 +55,24 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
 @interface p_SessionTaskProgressObserver : NSObject
 @property (nonatomic, copy) void (^uploadProgressBlock)(NSProgress *progress);
 @property (nonatomic, copy) void (^downloadProgressBlock)(NSProgress *progress);
+@property (nonatomic, assign) double maximumRate;
+@property (nonatomic, strong) dispatch_queue_t deliveryQueue;
+@property (nonatomic, copy) void (^completionHandler)(NSURLSessionTask *task);
+@property (nonatomic, copy) void (^cancellationHandler)(NSURLSessionTask *task);
+@property (nonatomic, strong) SGSNetworkMetricsCollector *metricsCollector;
+/// 任务代理会收集系统统计数据，不再以时间戳估算
+@property (nonatomic, assign) BOOL collectsSessionTaskMetrics;
 @end
 
 @implementation p_SessionTaskProgressObserver {
     NSProgress *_uploadProgress;
     NSProgress *_downloadProgress;
+    SGSProgressThrottle *_uploadThrottle;
+    SGSProgressThrottle *_downloadThrottle;
+    
+    // 估算耗时使用的时间戳
+    NSDate *_startDate;
+    NSDate *_firstByteDate;
 }
 
 - (instancetype)init {
@@ -45,12 +91,20 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
     _downloadProgress.totalUnitCount = task.countOfBytesExpectedToReceive;
     _uploadProgress.totalUnitCount   = task.countOfBytesExpectedToSend;
     
+    _downloadThrottle = [[SGSProgressThrottle alloc] initWithMaximumRate:self.maximumRate queue:self.deliveryQueue block:self.downloadProgressBlock];
+    _uploadThrottle = [[SGSProgressThrottle alloc] initWithMaximumRate:self.maximumRate queue:self.deliveryQueue block:self.uploadProgressBlock];
+    
     __weak __typeof__(task) weakTask = task;
+    void (^cancellationHandler)(NSURLSessionTask *) = self.cancellationHandler;
     
     [_downloadProgress setCancellable:YES];
     [_downloadProgress setCancellationHandler:^{
         __typeof__(weakTask) strongTask = weakTask;
-        [strongTask cancel];
+        if (cancellationHandler && strongTask) {
+            cancellationHandler(strongTask);
+        } else {
+            [strongTask cancel];
+        }
     }];
     [_downloadProgress setPausable:YES];
     [_downloadProgress setPausingHandler:^{
@@ -67,7 +121,11 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
     [_uploadProgress setCancellable:YES];
     [_uploadProgress setCancellationHandler:^{
         __typeof__(weakTask) strongTask = weakTask;
-        [strongTask cancel];
+        if (cancellationHandler && strongTask) {
+            cancellationHandler(strongTask);
+        } else {
+            [strongTask cancel];
+        }
     }];
     [_uploadProgress setPausable:YES];
     [_uploadProgress setPausingHandler:^{
@@ -108,6 +166,12 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
                       forKeyPath:NSStringFromSelector(@selector(fractionCompleted))
                          options:NSKeyValueObservingOptionNew
                          context:NULL];
+    
+    // 完成时会移除所有观察者，state 必须最后添加
+    [task addObserver:self
+           forKeyPath:NSStringFromSelector(@selector(state))
+              options:NSKeyValueObservingOptionNew
+              context:NULL];
 }
 
 - (void)p_cleanUpProgressForTask:(NSURLSessionTask *)task {
@@ -115,6 +179,7 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
     [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesExpectedToReceive))];
     [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesSent))];
     [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesExpectedToSend))];
+    [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(state))];
     [_downloadProgress removeObserver:self forKeyPath:NSStringFromSelector(@selector(fractionCompleted))];
     [_uploadProgress removeObserver:self forKeyPath:NSStringFromSelector(@selector(fractionCompleted))];
 }
@@ -122,6 +187,7 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
 - (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSString *,id> *)change context:(void *)context {
     if ([object isKindOfClass:[NSURLSessionTask class]]) {
         if ([keyPath isEqualToString:NSStringFromSelector(@selector(countOfBytesReceived))]) {
+            if ((_firstByteDate == nil) && (self.metricsCollector != nil)) _firstByteDate = [NSDate date];
             _downloadProgress.completedUnitCount = [change[NSKeyValueChangeNewKey] longLongValue];
         } else if ([keyPath isEqualToString:NSStringFromSelector(@selector(countOfBytesExpectedToReceive))]) {
             _downloadProgress.totalUnitCount = [change[NSKeyValueChangeNewKey] longLongValue];
@@ -129,14 +195,246 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
             _uploadProgress.completedUnitCount = [change[NSKeyValueChangeNewKey] longLongValue];
         } else if ([keyPath isEqualToString:NSStringFromSelector(@selector(countOfBytesExpectedToSend))]) {
             _uploadProgress.totalUnitCount = [change[NSKeyValueChangeNewKey] longLongValue];
+        } else if ([keyPath isEqualToString:NSStringFromSelector(@selector(state))]) {
+            NSURLSessionTaskState state = [change[NSKeyValueChangeNewKey] integerValue];
+            if ((state == NSURLSessionTaskStateRunning) && (_startDate == nil)) {
+                _startDate = [NSDate date];
+            } else if (state == NSURLSessionTaskStateCompleted) {
+                [self p_taskDidComplete:object];
+            }
         }
     } else if ([object isEqual:_downloadProgress]) {
-        if (self.downloadProgressBlock) {
-            self.downloadProgressBlock(object);
-        }
+        [_downloadThrottle progressDidChange:object];
     } else if ([object isEqual:_uploadProgress]) {
-        if (self.uploadProgressBlock) {
-            self.uploadProgressBlock(object);
+        [_uploadThrottle progressDidChange:object];
+    }
+}
+
+// 任务成功完成时将进度补齐到 100%，无论是否限频都会进行最后一次回调
+- (void)p_taskDidComplete:(NSURLSessionTask *)task {
+    if (task.error == nil) {
+        [self p_completeProgress:_downloadProgress];
+        [self p_completeProgress:_uploadProgress];
+    }
+    
+    [_downloadThrottle finishWithProgress:_downloadProgress];
+    [_uploadThrottle finishWithProgress:_uploadProgress];
+    
+    if ((self.metricsCollector != nil) && (_startDate != nil) && !self.collectsSessionTaskMetrics) {
+        [self.metricsCollector collectMetricsForTask:task startDate:_startDate firstByteDate:_firstByteDate endDate:[NSDate date]];
+    }
+    
+    if (self.completionHandler) {
+        self.completionHandler(task);
+    }
+}
+
+- (void)p_completeProgress:(NSProgress *)progress {
+    if (progress.totalUnitCount <= 0) {
+        progress.totalUnitCount = MAX(progress.completedUnitCount, 1);
+    }
+    progress.completedUnitCount = progress.totalUnitCount;
+}
+
+@end
+
+
+#pragma mark - Progress Observer Registry
+
+/*!
+ *  进度观察者注册表：全局分片的旁路表，以任务指针为键，
+ *  不同任务大多落在不同的分片上，避免所有任务竞争同一把锁，也不再需要每次查询关联对象
+ */
+#define kProgressObserverRegistryShardCount 16
+
+typedef struct {
+    pthread_mutex_t lock;
+    CFMutableDictionaryRef observersByTask;
+} p_ProgressObserverRegistryShard;
+
+static p_ProgressObserverRegistryShard p_registryShards[kProgressObserverRegistryShardCount];
+static atomic_uint_fast64_t p_registryAcquisitionCount;
+static atomic_uint_fast64_t p_registryContentionCount;
+
+static p_ProgressObserverRegistryShard * p_registryShardForTask(NSURLSessionTask *task) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        for (int i = 0; i < kProgressObserverRegistryShardCount; i++) {
+            pthread_mutex_init(&p_registryShards[i].lock, NULL);
+            // 键不持有任务，值持有观察者
+            p_registryShards[i].observersByTask = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, &kCFTypeDictionaryValueCallBacks);
+        }
+    });
+    
+    uintptr_t hash = (uintptr_t)(__bridge void *)task;
+    hash = (hash >> 4) ^ (hash >> 12);
+    return &p_registryShards[hash % kProgressObserverRegistryShardCount];
+}
+
+// 先尝试加锁，失败时记录一次竞争再阻塞等待
+static void p_registryShardLock(p_ProgressObserverRegistryShard *shard) {
+    atomic_fetch_add_explicit(&p_registryAcquisitionCount, 1, memory_order_relaxed);
+    if (pthread_mutex_trylock(&shard->lock) != 0) {
+        atomic_fetch_add_explicit(&p_registryContentionCount, 1, memory_order_relaxed);
+        pthread_mutex_lock(&shard->lock);
+    }
+}
+
+static void p_registryShardUnlock(p_ProgressObserverRegistryShard *shard) {
+    pthread_mutex_unlock(&shard->lock);
+}
+
+
+#pragma mark - Hedge State
+
+const NSTimeInterval SGSHedgeDelayObservedP95 = -1;
+
+/// 使用观察到的 p95 时至少需要的样本数，不足时使用默认延迟
+static const NSUInteger kHedgeMinimumSampleCount = 20;
+static const NSTimeInterval kHedgeDefaultDelay = 1.0;
+
+/// 单个会话的对冲统计，仅内部使用
+@interface p_HedgeCounters : NSObject {
+@public
+    atomic_uint_fast64_t _requestCount;
+    atomic_uint_fast64_t _hedgedCount;
+    atomic_uint_fast64_t _winCount;
+}
+@end
+
+@implementation p_HedgeCounters
+@end
+
+/// 一次对冲请求的所有任务，通过 @synchronized 访问，仅内部使用
+@interface p_HedgeState : NSObject
+@property (nonatomic, strong) NSMutableArray<NSURLSessionTask *> *tasks;
+/// 尚未完成的任务数
+@property (nonatomic, assign) NSUInteger outstandingCount;
+/// 已经回调了结果
+@property (nonatomic, assign) BOOL finished;
+/// 句柄已被取消，不再发出第二个请求
+@property (nonatomic, assign) BOOL cancelled;
+@end
+
+@implementation p_HedgeState
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _tasks = [NSMutableArray arrayWithCapacity:2];
+    }
+    return self;
+}
+
+@end
+
+
+#pragma mark - Task Metrics Delegate
+
+/// 为辅助方法创建的任务收集系统统计数据，任务持有代理，仅内部使用
+@interface p_TaskMetricsDelegate : NSObject <NSURLSessionTaskDelegate>
+@property (nonatomic, strong) SGSNetworkMetricsCollector *metricsCollector;
+@end
+
+@implementation p_TaskMetricsDelegate
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didFinishCollectingMetrics:(NSURLSessionTaskMetrics *)metrics {
+    [self.metricsCollector collectSessionTaskMetrics:metrics forTask:task];
+}
+
+@end
+
+
+#pragma mark - Warm-Up State
+
+static const NSTimeInterval kWarmUpTimeoutInterval = 10;
+
+/// 会话中单个源的预热统计，通过 @synchronized (会话的 p_warmUpStatsByOrigin) 访问，仅内部使用
+@interface p_WarmUpStats : NSObject
+@property (nonatomic, assign) NSUInteger warmUpCount;
+@property (nonatomic, assign) NSUInteger failedCount;
+@property (nonatomic, assign) NSUInteger reusedCount;
+@property (nonatomic, assign) NSUInteger notReusedCount;
+@property (nonatomic, assign) NSTimeInterval setupDuration;
+@property (nonatomic, assign) NSTimeInterval savedDuration;
+@property (nonatomic, strong) NSNumber *reusedConnection;
+/// 正在预热
+@property (nonatomic, assign) BOOL warming;
+/// 等待预热请求的耗时统计
+@property (nonatomic, assign) BOOL awaitingWarmUpMetrics;
+/// 等待预热后第一个请求的耗时统计
+@property (nonatomic, assign) BOOL awaitingFirstRequest;
+@property (nonatomic, strong) NSURL *warmUpURL;
+@end
+
+@implementation p_WarmUpStats
+@end
+
+/// scheme://host[:port]，没有 scheme 或 host 时返回 nil
+static NSString *p_warmUpOriginForURL(NSURL *url) {
+    NSString *scheme = url.scheme.lowercaseString;
+    NSString *host = url.host.lowercaseString;
+    if ((scheme.length == 0) || (host.length == 0)) return nil;
+
+    if (url.port != nil) return [NSString stringWithFormat:@"%@://%@:%@", scheme, host, url.port];
+    return [NSString stringWithFormat:@"%@://%@", scheme, host];
+}
+
+/// 观察收集器中与预热的源相关的耗时统计，通过任务关联的统计区分会话，仅内部使用
+@interface p_WarmUpObserver : NSObject <SGSNetworkMetricsObserver>
++ (instancetype)sharedObserver;
+@end
+
+@implementation p_WarmUpObserver
+
++ (instancetype)sharedObserver {
+    static p_WarmUpObserver *observer = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        observer = [[p_WarmUpObserver alloc] init];
+    });
+    return observer;
+}
+
+- (void)metricsCollector:(SGSNetworkMetricsCollector *)collector didCollectMetrics:(SGSTaskMetrics *)metrics {
+    NSString *origin = p_warmUpOriginForURL(metrics.URL);
+    if (origin == nil) return;
+
+    // 只统计预热过的会话中的任务，其他会话的请求不能复用这些连接
+    NSURLSessionTask *task = metrics.task;
+    NSMutableDictionary<NSString *, p_WarmUpStats *> *allStats = task ? objc_getAssociatedObject(task, &kWarmUpStatsKey) : nil;
+    if (allStats == nil) return;
+
+    @synchronized (allStats) {
+        p_WarmUpStats *stats = allStats[origin];
+        if (stats == nil) return;
+
+        BOOL isWarmUp = [metrics.HTTPMethod isEqualToString:@"HEAD"] && [metrics.URL isEqual:stats.warmUpURL];
+        if (isWarmUp) {
+            if (!stats.awaitingWarmUpMetrics) return;
+            stats.awaitingWarmUpMetrics = NO;
+
+            // 复用已有连接的预热没有建连耗时，保留上次的结果
+            if (metrics.isCollectedBySystem && !metrics.isReusedConnection) {
+                stats.setupDuration = MAX(metrics.domainLookupDuration, 0) + MAX(metrics.connectDuration, 0);
+            } else if (!metrics.isCollectedBySystem) {
+                stats.setupDuration = metrics.totalDuration;
+            }
+            return;
+        }
+
+        if (!stats.awaitingFirstRequest) return;
+        stats.awaitingFirstRequest = NO;
+
+        // 时间戳估算无法得知是否复用了连接
+        if (!metrics.isCollectedBySystem) return;
+
+        stats.reusedConnection = @(metrics.isReusedConnection);
+        if (metrics.isReusedConnection) {
+            stats.reusedCount += 1;
+            stats.savedDuration += stats.setupDuration;
+        } else {
+            stats.notReusedCount += 1;
         }
     }
 }
@@ -228,168 +526,1455 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
 }
 
 
-#pragma mark - Upload Task
+#pragma mark - Response Pipeline
 
-- (NSURLSessionUploadTask *)uploadTaskWithRequest:(NSURLRequest *)request
-                                         fromFile:(NSURL *)fileURL
-                                         progress:(SGSProgressBlock)progressBlock
-                                   responseFilter:(SGSResponseFilterBlock)filter
-                                          success:(SGSResponseSuccessBlock)success
-                                          failure:(SGSResponseFailureBlock)failure
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request
+                             responsePipeline:(SGSResponsePipeline *)pipeline
+                                      success:(SGSResponseSuccessBlock)success
+                                      failure:(SGSResponseFailureBlock)failure
 {
     __weak typeof(&*self) weakSelf = self;
     
-    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromFile:fileURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+    NSURLSessionDataTask *task = [self dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
         
-        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+        if (error != nil) {
+            [weakSelf p_invokeBlock:failure response:response obj:error];
+            return;
+        }
+        
+        // 没有管道时与没有过滤闭包一样返回原始数据
+        if (pipeline == nil) {
+            [weakSelf p_invokeBlock:success response:response obj:data];
+            return;
+        }
+        
+        // 在解码队列中执行管道，代理队列可以继续处理其他任务的回调
+        [pipeline processResponse:response data:data completion:^(id result) {
+            if ([result isKindOfClass:[NSError class]]) {
+                [weakSelf p_invokeBlock:failure response:response obj:result];
+            } else {
+                [weakSelf p_invokeBlock:success response:response obj:result];
+            }
+        }];
     }];
     
-    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
     
     return task;
 }
 
-- (NSURLSessionUploadTask *)uploadTaskWithRequest:(NSURLRequest *)request
-                                         fromData:(NSData *)bodyData
-                                         progress:(SGSProgressBlock)progressBlock
-                                   responseFilter:(SGSResponseFilterBlock)filter
-                                          success:(SGSResponseSuccessBlock)success
-                                          failure:(SGSResponseFailureBlock)failure
+- (NSURLSessionDataTask *)dataTaskWithURL:(NSURL *)url
+                         responsePipeline:(SGSResponsePipeline *)pipeline
+                                  success:(SGSResponseSuccessBlock)success
+                                  failure:(SGSResponseFailureBlock)failure
 {
-    __weak typeof(&*self) weakSelf = self;
-    
-    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromData:bodyData completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
-        
-        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
-    }];
-    
-    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
-    
-    return task;
+    return [self dataTaskWithRequest:[NSURLRequest requestWithURL:url] responsePipeline:pipeline success:success failure:failure];
 }
 
 
-#pragma mark - Download Task
+#pragma mark - Coalescing
 
-- (NSURLSessionDownloadTask *)downloadTaskWithRequest:(NSURLRequest *)request
-                                             progress:(SGSProgressBlock)progressBlock
-                                          destination:(SGSDownloadTargetBlock)destination
-                                              success:(SGSDownloadSuccessBlock)success
-                                              failure:(SGSResponseFailureBlock)failure
+- (SGSTaskHandle *)coalescedDataTaskWithRequest:(NSURLRequest *)request
+                                 responseFilter:(SGSResponseFilterBlock)filter
+                                        success:(SGSResponseSuccessBlock)success
+                                        failure:(SGSResponseFailureBlock)failure
 {
     __weak typeof(&*self) weakSelf = self;
     
-    NSURLSessionDownloadTask *task = [self downloadTaskWithRequest:request completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+    return [[self requestCoalescer] handleForRequest:request session:self responseFilter:filter completion:^(NSURLResponse *response, id responseObject, NSError *error) {
         
-        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+        if (error) {
+            [weakSelf p_invokeBlock:failure response:response obj:error];
+        } else {
+            [weakSelf p_invokeBlock:success response:response obj:responseObject];
+        }
     }];
-    
-    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
-    
-    return task;
 }
 
-- (NSURLSessionDownloadTask *)downloadTaskWithURL:(NSURL *)url
-                                         progress:(SGSProgressBlock)progressBlock
-                                      destination:(SGSDownloadTargetBlock)destination
-                                          success:(SGSDownloadSuccessBlock)success
-                                          failure:(SGSResponseFailureBlock)failure
+- (SGSTaskHandle *)coalescedDataTaskWithURL:(NSURL *)url
+                             responseFilter:(SGSResponseFilterBlock)filter
+                                    success:(SGSResponseSuccessBlock)success
+                                    failure:(SGSResponseFailureBlock)failure
 {
-    __weak typeof(&*self) weakSelf = self;
-    
-    NSURLSessionDownloadTask *task = [self downloadTaskWithURL:url completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
-        
-        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
-    }];
-    
-    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
-    
-    return task;
+    return [self coalescedDataTaskWithRequest:[NSURLRequest requestWithURL:url] responseFilter:filter success:success failure:failure];
 }
 
-- (NSURLSessionDownloadTask *)downloadTaskWithResumeData:(NSData *)resumeData
-                                                progress:(SGSProgressBlock)progressBlock
-                                             destination:(SGSDownloadTargetBlock)destination
-                                                 success:(SGSDownloadSuccessBlock)success
-                                                 failure:(SGSResponseFailureBlock)failure
+
+#pragma mark - Cache
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                                 cache:(SGSHTTPResponseCache *)cache
+                            timeToLive:(NSTimeInterval)timeToLive
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
 {
+    if (cache == nil) cache = [SGSHTTPResponseCache sharedCache];
+    
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
     __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
     
-    NSURLSessionDownloadTask *task = [self downloadTaskWithResumeData:resumeData completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
         
-        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
-    }];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [weakSelf p_startRequest:request withCache:cache timeToLive:timeToLive handle:strongHandle responseFilter:filter success:success failure:failure];
+        });
+    };
     
-    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+    handle.cancellationHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        BOOL started = NO;
+        @synchronized (strongHandle) {
+            started = (strongHandle.resumingHandler == nil);
+            strongHandle.resumingHandler = nil;
+        }
+        
+        // 已开始时由 p_startRequest 检查取消状态或取消网络任务，未开始时直接回调取消
+        if (started) {
+            [strongHandle.task cancel];
+        } else {
+            [weakSelf p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+        }
+    };
     
-    return task;
+    return handle;
 }
 
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                             cache:(SGSHTTPResponseCache *)cache
+                        timeToLive:(NSTimeInterval)timeToLive
+                    responseFilter:(SGSResponseFilterBlock)filter
+                           success:(SGSResponseSuccessBlock)success
+                           failure:(SGSResponseFailureBlock)failure
+{
+    return [self dataTaskWithRequest:[NSURLRequest requestWithURL:url] cache:cache timeToLive:timeToLive responseFilter:filter success:success failure:failure];
+}
 
-#pragma mark - Completion
-
-- (void)p_callBackObjectWithFilter:(id (^)(NSURLResponse *, NSData *))filter
-                           success:(void (^)(id, id))success
-                          failure:(void (^)(id, id))failure
-                         response:(NSURLResponse *)response
-                             data:(NSData *)data
-                            error:(NSError *)error
+- (void)p_startRequest:(NSURLRequest *)request
+             withCache:(SGSHTTPResponseCache *)cache
+            timeToLive:(NSTimeInterval)timeToLive
+                handle:(SGSTaskHandle *)handle
+        responseFilter:(SGSResponseFilterBlock)filter
+               success:(SGSResponseSuccessBlock)success
+               failure:(SGSResponseFailureBlock)failure
 {
-    if (error) {
-        [self p_invokeBlock:failure response:response obj:error];
+    SGSCachedResponse *cached = [cache cachedResponseForRequest:request];
+    
+    if (cached.isFresh) {
+        if (handle.isCancelled) {
+            [self p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+            return ;
+        }
+        [cache recordHitWithStale:NO];
+        [self p_callBackCachedResponse:cached cache:cache filter:filter success:success failure:failure];
         return ;
     }
     
-    id responseObject = data;
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    mutableRequest.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
     
-    if (filter != nil) {
-        responseObject = filter(response, data);
+    BOOL servedStale = NO;
+    if (cached.canRevalidate) {
+        if (cached.ETag) [mutableRequest setValue:cached.ETag forHTTPHeaderField:@"If-None-Match"];
+        if (cached.lastModified) [mutableRequest setValue:cached.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+        
+        if (cached.canServeWhileRevalidating && !handle.isCancelled) {
+            servedStale = YES;
+            [cache recordHitWithStale:YES];
+            [self p_callBackCachedResponse:cached cache:cache filter:filter success:success failure:failure];
+        }
+    } else {
+        [cache recordMiss];
     }
     
-    if ([responseObject isKindOfClass:[NSError class]]) {
-        [self p_invokeBlock:failure response:response obj:responseObject];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDataTask *task = [self dataTaskWithRequest:mutableRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        
+        if (error) {
+            if (servedStale) return ;
+            
+            // 网络不可用时使用过期的缓存
+            if ((cached != nil) && [NSURLSession p_isOfflineError:error]) {
+                [cache recordHitWithStale:YES];
+                [weakSelf p_callBackCachedResponse:cached cache:cache filter:filter success:success failure:failure];
+            } else {
+                [weakSelf p_invokeBlock:failure response:response obj:error];
+            }
+            return ;
+        }
+        
+        if ((cached != nil) && (httpResponse.statusCode == 304)) {
+            [cache refreshCachedResponse:cached withNotModifiedResponse:httpResponse forRequest:request timeToLive:timeToLive];
+            if (!servedStale) {
+                [weakSelf p_callBackCachedResponse:cached cache:cache filter:filter success:success failure:failure];
+            }
+            return ;
+        }
+        
+        id responseObject = data;
+        if (filter != nil) {
+            responseObject = filter(response, data);
+        }
+        
+        if ((httpResponse != nil) && ![responseObject isKindOfClass:[NSError class]]) {
+            [cache storeData:data response:httpResponse decodedObject:(filter ? responseObject : nil) filter:filter forRequest:request timeToLive:timeToLive];
+        }
+        
+        if (servedStale) return ;
+        
+        if ([responseObject isKindOfClass:[NSError class]]) {
+            [weakSelf p_invokeBlock:failure response:response obj:responseObject];
+        } else {
+            [weakSelf p_invokeBlock:success response:response obj:responseObject];
+        }
+    }];
+    
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+    
+    handle.task = task;
+    if (handle.isCancelled) {
+        [task cancel];
     } else {
-        [self p_invokeBlock:success response:response obj:responseObject];
+        [task resume];
     }
 }
 
-- (void)p_callBackFileWithDestination:(NSURL *(^)(NSURLResponse *, NSURL *))destination
-                              success:(void (^)(id, id))success
-                              failure:(void (^)(id, id))failure
-                             response:(NSURLResponse *)response
-                             location:(NSURL *)location
-                                error:(NSError *)error
+- (void)p_callBackCachedResponse:(SGSCachedResponse *)cached
+                           cache:(SGSHTTPResponseCache *)cache
+                          filter:(SGSResponseFilterBlock)filter
+                         success:(SGSResponseSuccessBlock)success
+                         failure:(SGSResponseFailureBlock)failure
 {
-    if (error) {
-        [self p_invokeBlock:failure response:response obj:error];
-        return ;
-    }
+    id responseObject = cached.data;
     
-    NSURL *fileURL = nil;
-    if (destination) {
-        NSURL *destURL = destination(response, location);
-        if (destURL) {
-            fileURL = destURL;
-            [[NSFileManager defaultManager] moveItemAtURL:location toURL:destURL error:&error];
-            if (error) {
-                [self p_invokeBlock:failure response:response obj:error];
-                return ;
+    if (filter != nil) {
+        responseObject = [cache decodedObjectForFilter:filter inCachedResponse:cached];
+        if (responseObject == nil) {
+            responseObject = filter(cached.response, cached.data);
+            if ((responseObject != nil) && ![responseObject isKindOfClass:[NSError class]]) {
+                [cache setDecodedObject:responseObject forFilter:filter inCachedResponse:cached];
             }
         }
     }
     
-    [self p_invokeBlock:success response:response obj:fileURL];
+    if ([responseObject isKindOfClass:[NSError class]]) {
+        [self p_invokeBlock:failure response:cached.response obj:responseObject];
+    } else {
+        [self p_invokeBlock:success response:cached.response obj:responseObject];
+    }
 }
 
-- (void)p_invokeBlock:(void (^)(id, id))block response:(NSURLResponse *)response obj:(id)obj {
-    if (block) {
-        if ([NSThread isMainThread]) {
-            block(response, obj);
-        } else {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                block(response, obj);
-            });
-        }
++ (BOOL)p_isOfflineError:(NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+    
+    switch (error.code) {
+        case NSURLErrorNotConnectedToInternet:
+        case NSURLErrorNetworkConnectionLost:
+        case NSURLErrorTimedOut:
+        case NSURLErrorCannotFindHost:
+        case NSURLErrorCannotConnectToHost:
+        case NSURLErrorDNSLookupFailed:
+        case NSURLErrorInternationalRoamingOff:
+        case NSURLErrorDataNotAllowed:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+
+#pragma mark - Upload Task
+
+- (NSURLSessionUploadTask *)uploadTaskWithRequest:(NSURLRequest *)request
+                                         fromFile:(NSURL *)fileURL
+                                         progress:(SGSProgressBlock)progressBlock
+                                   responseFilter:(SGSResponseFilterBlock)filter
+                                          success:(SGSResponseSuccessBlock)success
+                                          failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromFile:fileURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+    }];
+    
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    
+    return task;
+}
+
+- (NSURLSessionUploadTask *)uploadTaskWithRequest:(NSURLRequest *)request
+                                         fromData:(NSData *)bodyData
+                                         progress:(SGSProgressBlock)progressBlock
+                                   responseFilter:(SGSResponseFilterBlock)filter
+                                          success:(SGSResponseSuccessBlock)success
+                                          failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromData:bodyData completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+    }];
+    
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    
+    return task;
+}
+
+- (NSURLSessionDataTask *)uploadTaskWithRequest:(NSURLRequest *)request
+                              multipartFormData:(SGSMultipartFormData *)formData
+                                       progress:(SGSProgressBlock)progressBlock
+                                 responseFilter:(SGSResponseFilterBlock)filter
+                                        success:(SGSResponseSuccessBlock)success
+                                        failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSMutableURLRequest *mutableRequest = request.mutableCopy;
+    if (mutableRequest.HTTPMethod == nil || [mutableRequest.HTTPMethod isEqualToString:@"GET"]) {
+        mutableRequest.HTTPMethod = @"POST";
+    }
+    [formData applyToRequest:mutableRequest];
+    
+    // 回调形式的会话无法响应 needNewBodyStream，输入流只能发送一次，
+    // 因此包含文件时先写入临时文件，重定向、认证质询时可以从文件重新发送
+    NSURL *bodyFileURL = nil;
+    if (mutableRequest.HTTPBodyStream != nil) {
+        NSURL *fileURL = [[NSURL fileURLWithPath:NSTemporaryDirectory() isDirectory:YES] URLByAppendingPathComponent:[NSString stringWithFormat:@"SGSMultipart-%@", [NSUUID UUID].UUIDString]];
+        if ([formData writeToFileAtURL:fileURL error:NULL]) {
+            bodyFileURL = fileURL;
+            mutableRequest.HTTPBodyStream = nil;
+        }
+    }
+    
+    void (^completionHandler)(NSData *, NSURLResponse *, NSError *) = ^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        if (bodyFileURL != nil) {
+            [[NSFileManager defaultManager] removeItemAtURL:bodyFileURL error:NULL];
+        }
+        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+    };
+    
+    // 写入失败时仍然使用输入流，由上传过程报告读取错误
+    NSURLSessionDataTask *task = nil;
+    if (bodyFileURL != nil) {
+        task = [self uploadTaskWithRequest:mutableRequest fromFile:bodyFileURL completionHandler:completionHandler];
+    } else {
+        task = [self dataTaskWithRequest:mutableRequest completionHandler:completionHandler];
+    }
+    
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    
+    return task;
+}
+
+- (SGSTaskHandle *)chunkedUploadTaskWithFile:(NSURL *)fileURL
+                                    endpoint:(NSURL *)endpoint
+                                    uploader:(SGSChunkedUploader *)uploader
+                                    metadata:(NSDictionary<NSString *,NSString *> *)metadata
+                                    progress:(SGSProgressBlock)progressBlock
+                                     success:(SGSResponseSuccessBlock)success
+                                     failure:(SGSResponseFailureBlock)failure
+{
+    if (uploader == nil) uploader = [[SGSChunkedUploader alloc] init];
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [uploader handleForFileURL:fileURL endpoint:endpoint session:self metadata:metadata progress:progressBlock completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable uploadURL, NSError * _Nullable error) {
+        
+        if (error != nil) {
+            [weakSelf p_invokeBlock:failure response:response obj:error];
+        } else {
+            [weakSelf p_invokeBlock:success response:response obj:uploadURL];
+        }
+    }];
+}
+
+
+#pragma mark - Compression
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+             compressingBodyLargerThan:(NSUInteger)threshold
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+    
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+        
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            if (strongHandle.isCancelled) {
+                [weakSelf p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+                return ;
+            }
+            
+            NSMutableURLRequest *mutableRequest = [request mutableCopy];
+            [mutableRequest gzipHTTPBodyIfLargerThan:threshold];
+            
+            NSURLSessionDataTask *task = [weakSelf dataTaskWithRequest:mutableRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+                
+                [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+            }];
+            [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+            
+            strongHandle.task = task;
+            if (strongHandle.isCancelled) {
+                [task cancel];
+            } else {
+                [task resume];
+            }
+        });
+    };
+    
+    return handle;
+}
+
++ (NSDictionary<NSString *, NSNumber *> *)requestBodyCompressionMetricsForTask:(NSURLSessionTask *)task {
+    NSURLRequest *request = task.originalRequest;
+    if (request == nil) return nil;
+    
+    NSNumber *originalLength = [NSURLProtocol propertyForKey:SGSHTTPBodyOriginalLengthKey inRequest:request];
+    NSNumber *compressedLength = [NSURLProtocol propertyForKey:SGSHTTPBodyCompressedLengthKey inRequest:request];
+    if ((originalLength == nil) || (compressedLength == nil)) return nil;
+    
+    return @{SGSHTTPBodyOriginalLengthKey: originalLength,
+             SGSHTTPBodyCompressedLengthKey: compressedLength};
+}
+
+#pragma mark - Download Task
+
+- (NSURLSessionDownloadTask *)downloadTaskWithRequest:(NSURLRequest *)request
+                                             progress:(SGSProgressBlock)progressBlock
+                                          destination:(SGSDownloadTargetBlock)destination
+                                              success:(SGSDownloadSuccessBlock)success
+                                              failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDownloadTask *task = [self p_resumableDownloadTaskWithRequest:request resumeData:nil completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+    }];
+    
+    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+    
+    return task;
+}
+
+- (NSURLSessionDownloadTask *)downloadTaskWithURL:(NSURL *)url
+                                         progress:(SGSProgressBlock)progressBlock
+                                      destination:(SGSDownloadTargetBlock)destination
+                                          success:(SGSDownloadSuccessBlock)success
+                                          failure:(SGSResponseFailureBlock)failure
+{
+    return [self downloadTaskWithRequest:[NSURLRequest requestWithURL:url] progress:progressBlock destination:destination success:success failure:failure];
+}
+
+- (NSURLSessionDownloadTask *)downloadTaskWithResumeData:(NSData *)resumeData
+                                                progress:(SGSProgressBlock)progressBlock
+                                             destination:(SGSDownloadTargetBlock)destination
+                                                 success:(SGSDownloadSuccessBlock)success
+                                                 failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDownloadTask *task = [self downloadTaskWithResumeData:resumeData completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+    }];
+    
+    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+    
+    return task;
+}
+
+
+- (void)cancelDownloadTaskProducingResumeData:(NSURLSessionDownloadTask *)task {
+    SGSDownloadResumeJournal *journal = self.downloadResumeJournal;
+    if ((journal == nil) || (task.originalRequest == nil)) {
+        [task cancel];
+        return ;
+    }
+    
+    [journal cancelDownloadTask:task forRequest:task.originalRequest completion:nil];
+}
+
+// 存在断点数据时从断点继续下载，失败时保存断点数据，成功后删除，resumeData 为空时使用记录中的断点数据
+- (NSURLSessionDownloadTask *)p_resumableDownloadTaskWithRequest:(NSURLRequest *)request
+                                                     resumeData:(NSData *)resumeData
+                                              completionHandler:(void (^)(NSURL *location, NSURLResponse *response, NSError *error))completionHandler
+{
+    SGSDownloadResumeJournal *journal = self.downloadResumeJournal;
+    if (resumeData == nil) {
+        resumeData = [journal resumeDataForRequest:request];
+    }
+    __block BOOL resumed = NO;
+    
+    void (^handler)(NSURL *, NSURLResponse *, NSError *) = ^(NSURL *location, NSURLResponse *response, NSError *error) {
+        if (error == nil) {
+            [journal removeResumeDataForRequest:request];
+        } else {
+            NSData *newResumeData = error.userInfo[NSURLSessionDownloadTaskResumeData];
+            BOOL cancelled = [error.domain isEqualToString:NSURLErrorDomain] && (error.code == NSURLErrorCancelled);
+            if (newResumeData != nil) {
+                [journal setResumeData:newResumeData forRequest:request];
+            } else if (resumed && !cancelled) {
+                // 断点数据可能已经失效，下次重新下载
+                [journal removeResumeDataForRequest:request];
+            }
+        }
+        
+        if (completionHandler) completionHandler(location, response, error);
+    };
+    
+    NSURLSessionDownloadTask *task = nil;
+    if (resumeData != nil) {
+        @try {
+            task = [self downloadTaskWithResumeData:resumeData completionHandler:handler];
+        } @catch (NSException *exception) {
+            task = nil;
+        }
+        
+        if (task != nil) {
+            resumed = YES;
+        } else {
+            [journal removeResumeDataForRequest:request];
+        }
+    }
+    
+    if (task == nil) {
+        task = [self downloadTaskWithRequest:request completionHandler:handler];
+    }
+    
+    [journal trackDownloadTask:task forRequest:request];
+    
+    return task;
+}
+
+- (SGSTaskHandle *)segmentedDownloadTaskWithRequest:(NSURLRequest *)request
+                                         downloader:(SGSSegmentedDownloader *)downloader
+                                           progress:(SGSProgressBlock)progressBlock
+                                        destination:(SGSDownloadTargetBlock)destination
+                                            success:(SGSDownloadSuccessBlock)success
+                                            failure:(SGSResponseFailureBlock)failure
+{
+    if (downloader == nil) downloader = [[SGSSegmentedDownloader alloc] init];
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [downloader handleForRequest:request session:self progress:progressBlock completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable location, NSError * _Nullable error) {
+        
+        [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+    }];
+}
+
+- (SGSTaskHandle *)verifiedDownloadTaskWithRequest:(NSURLRequest *)request
+                                         toFileURL:(NSURL *)fileURL
+                                      expectedSize:(int64_t)expectedSize
+                                   digestAlgorithm:(SGSDigestAlgorithm)algorithm
+                                    expectedDigest:(NSString *)expectedDigest
+                                          progress:(SGSProgressBlock)progressBlock
+                                           success:(SGSDownloadSuccessBlock)success
+                                           failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [self.verifiedDownloader handleForRequest:request toFileURL:fileURL expectedSize:expectedSize digestAlgorithm:algorithm expectedDigest:expectedDigest progress:progressBlock completion:^(NSURLResponse * _Nullable response, NSURL * _Nullable publishedURL, NSString * _Nullable digest, NSError * _Nullable error) {
+        
+        if (error != nil) {
+            [weakSelf p_invokeBlock:failure response:response obj:error];
+        } else {
+            [weakSelf p_invokeBlock:success response:response obj:publishedURL];
+        }
+    }];
+}
+
+
+#pragma mark - Retry
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                           retryPolicy:(SGSRetryPolicy *)retryPolicy
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [self p_handleWithRequest:request retryPolicy:retryPolicy failure:failure taskFactory:^NSURLSessionTask *(NSError *previousError, p_RetryAttemptCompletion completion) {
+        
+        NSURLSessionDataTask *task = [weakSelf dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            completion(response, error, ^{
+                [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+            });
+        }];
+        [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+        
+        return task;
+    }];
+}
+
+- (SGSTaskHandle *)uploadTaskWithRequest:(NSURLRequest *)request
+                                fromFile:(NSURL *)fileURL
+                             retryPolicy:(SGSRetryPolicy *)retryPolicy
+                                progress:(SGSProgressBlock)progressBlock
+                          responseFilter:(SGSResponseFilterBlock)filter
+                                 success:(SGSResponseSuccessBlock)success
+                                 failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [self p_handleWithRequest:request retryPolicy:retryPolicy failure:failure taskFactory:^NSURLSessionTask *(NSError *previousError, p_RetryAttemptCompletion completion) {
+        
+        NSURLSessionUploadTask *task = [weakSelf uploadTaskWithRequest:request fromFile:fileURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            completion(response, error, ^{
+                [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+            });
+        }];
+        
+        [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+        
+        return task;
+    }];
+}
+
+- (SGSTaskHandle *)uploadTaskWithRequest:(NSURLRequest *)request
+                                fromData:(NSData *)bodyData
+                             retryPolicy:(SGSRetryPolicy *)retryPolicy
+                                progress:(SGSProgressBlock)progressBlock
+                          responseFilter:(SGSResponseFilterBlock)filter
+                                 success:(SGSResponseSuccessBlock)success
+                                 failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [self p_handleWithRequest:request retryPolicy:retryPolicy failure:failure taskFactory:^NSURLSessionTask *(NSError *previousError, p_RetryAttemptCompletion completion) {
+        
+        NSURLSessionUploadTask *task = [weakSelf uploadTaskWithRequest:request fromData:bodyData completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            completion(response, error, ^{
+                [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+            });
+        }];
+        
+        [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+        
+        return task;
+    }];
+}
+
+- (SGSTaskHandle *)downloadTaskWithRequest:(NSURLRequest *)request
+                               retryPolicy:(SGSRetryPolicy *)retryPolicy
+                                  progress:(SGSProgressBlock)progressBlock
+                               destination:(SGSDownloadTargetBlock)destination
+                                   success:(SGSDownloadSuccessBlock)success
+                                   failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [self p_handleWithRequest:request retryPolicy:retryPolicy failure:failure taskFactory:^NSURLSessionTask *(NSError *previousError, p_RetryAttemptCompletion completion) {
+        
+        // 临时文件在 completionHandler 返回后会被删除，deliver 需要同步调用
+        void (^completionHandler)(NSURL *, NSURLResponse *, NSError *) = ^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            completion(response, error, ^{
+                [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+            });
+        };
+        
+        // 上一次失败时有断点数据则从断点继续下载
+        NSData *resumeData = previousError.userInfo[NSURLSessionDownloadTaskResumeData];
+        NSURLSessionDownloadTask *task = [weakSelf p_resumableDownloadTaskWithRequest:request resumeData:resumeData completionHandler:completionHandler];
+        
+        [weakSelf p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+        
+        return task;
+    }];
+}
+
+- (SGSTaskHandle *)p_handleWithRequest:(NSURLRequest *)request
+                           retryPolicy:(SGSRetryPolicy *)retryPolicy
+                               failure:(SGSResponseFailureBlock)failure
+                           taskFactory:(p_RetryTaskFactory)factory
+{
+    SGSRetryPolicy *policy = [retryPolicy copy] ?: [SGSRetryPolicy defaultPolicy];
+    
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+    
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+        
+        [weakSelf p_startAttemptWithRequest:request retryPolicy:policy retryCount:0 previousDelay:0 previousError:nil handle:strongHandle failure:failure taskFactory:factory];
+    };
+    
+    return handle;
+}
+
+- (void)p_startAttemptWithRequest:(NSURLRequest *)request
+                      retryPolicy:(SGSRetryPolicy *)policy
+                       retryCount:(NSUInteger)retryCount
+                    previousDelay:(NSTimeInterval)previousDelay
+                    previousError:(NSError *)previousError
+                           handle:(SGSTaskHandle *)handle
+                          failure:(SGSResponseFailureBlock)failure
+                      taskFactory:(p_RetryTaskFactory)factory
+{
+    if (handle.isCancelled) {
+        [self p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+        return ;
+    }
+    
+    // 主机熔断时直接失败
+    NSString *host = request.URL.host;
+    SGSCircuitBreaker *breaker = policy.circuitBreaker;
+    if ((breaker != nil) && ![breaker allowsRequestToHost:host]) {
+        NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+        userInfo[NSLocalizedDescriptionKey] = [NSString stringWithFormat:@"Circuit breaker is open for host: %@", host];
+        userInfo[NSURLErrorFailingURLErrorKey] = request.URL;
+        userInfo[NSUnderlyingErrorKey] = previousError;
+        [self p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:SGSRetryErrorDomain code:SGSRetryErrorCircuitOpen userInfo:userInfo]];
+        return ;
+    }
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionTask *task = factory(previousError, ^(NSURLResponse *response, NSError *error, dispatch_block_t deliver) {
+        
+        BOOL cancelled = [error.domain isEqualToString:NSURLErrorDomain] && (error.code == NSURLErrorCancelled);
+        if (cancelled || handle.isCancelled) {
+            deliver();
+            return ;
+        }
+        
+        if ([policy isRetryableResponse:response error:error]) {
+            [breaker recordFailureForHost:host];
+        } else {
+            [breaker recordSuccessForHost:host];
+        }
+        
+        if (![policy shouldRetryRequest:request response:response error:error retryCount:retryCount]) {
+            deliver();
+            return ;
+        }
+        
+        NSTimeInterval delay = [policy delayAfterPreviousDelay:previousDelay response:response];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [weakSelf p_startAttemptWithRequest:request retryPolicy:policy retryCount:(retryCount + 1) previousDelay:delay previousError:error handle:handle failure:failure taskFactory:factory];
+        });
+    });
+    
+    // 会话已失效或上传文件不存在时无法创建任务，不再重试
+    if (task == nil) {
+        NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+        userInfo[NSLocalizedDescriptionKey] = @"Could not create a task for the request.";
+        userInfo[NSURLErrorFailingURLErrorKey] = request.URL;
+        userInfo[NSUnderlyingErrorKey] = previousError;
+        [self p_invokeBlock:failure response:nil obj:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorUnknown userInfo:userInfo]];
+        return ;
+    }
+    
+    handle.task = task;
+    if (handle.isCancelled) {
+        [task cancel];
+    } else {
+        [task resume];
+    }
+}
+
+
+#pragma mark - Hedging
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                       hedgeAfterDelay:(NSTimeInterval)delay
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+    
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+        
+        [weakSelf p_startHedgedRequest:request delay:delay handle:strongHandle responseFilter:filter success:success failure:failure];
+    };
+    
+    return handle;
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)hedgingMetrics {
+    p_HedgeCounters *counters = [self p_hedgeCounters];
+    return @{@"requestCount": @(atomic_load_explicit(&counters->_requestCount, memory_order_relaxed)),
+             @"hedgedCount": @(atomic_load_explicit(&counters->_hedgedCount, memory_order_relaxed)),
+             @"hedgeWinCount": @(atomic_load_explicit(&counters->_winCount, memory_order_relaxed))};
+}
+
+- (void)resetHedgingMetrics {
+    p_HedgeCounters *counters = [self p_hedgeCounters];
+    atomic_store_explicit(&counters->_requestCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->_hedgedCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->_winCount, 0, memory_order_relaxed);
+}
+
+- (p_HedgeCounters *)p_hedgeCounters {
+    @synchronized (self) {
+        p_HedgeCounters *counters = objc_getAssociatedObject(self, &kHedgeCountersKey);
+        if (counters == nil) {
+            counters = [[p_HedgeCounters alloc] init];
+            objc_setAssociatedObject(self, &kHedgeCountersKey, counters, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return counters;
+    }
+}
+
+- (void)p_startHedgedRequest:(NSURLRequest *)request
+                       delay:(NSTimeInterval)delay
+                      handle:(SGSTaskHandle *)handle
+              responseFilter:(SGSResponseFilterBlock)filter
+                     success:(SGSResponseSuccessBlock)success
+                     failure:(SGSResponseFailureBlock)failure
+{
+    p_HedgeCounters *counters = [self p_hedgeCounters];
+    atomic_fetch_add_explicit(&counters->_requestCount, 1, memory_order_relaxed);
+    
+    p_HedgeState *state = [[p_HedgeState alloc] init];
+    NSURLSessionDataTask *task = [self p_hedgeAttemptWithRequest:request state:state isHedge:NO responseFilter:filter success:success failure:failure];
+    
+    handle.cancellationHandler = ^{
+        NSArray<NSURLSessionTask *> *tasks = nil;
+        @synchronized (state) {
+            state.cancelled = YES;
+            tasks = [state.tasks copy];
+        }
+        for (NSURLSessionTask *attempt in tasks) {
+            [attempt cancel];
+        }
+    };
+    
+    handle.task = task;
+    if (handle.isCancelled) {
+        [task cancel];
+        return ;
+    }
+    [task resume];
+    
+    // 只对冲没有副作用的读取请求
+    NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+    if (![method isEqualToString:@"GET"] && ![method isEqualToString:@"HEAD"]) return;
+    
+    if (delay < 0) delay = [self p_observedHedgeDelayForHost:request.URL.host];
+    
+    __weak typeof(&*self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSURLSessionDataTask *hedgeTask = nil;
+        @synchronized (state) {
+            if (state.finished || state.cancelled) return;
+            hedgeTask = [weakSelf p_hedgeAttemptWithRequest:request state:state isHedge:YES responseFilter:filter success:success failure:failure];
+        }
+        if (hedgeTask == nil) return;
+        
+        atomic_fetch_add_explicit(&counters->_hedgedCount, 1, memory_order_relaxed);
+        [hedgeTask resume];
+    });
+}
+
+// 创建一个尝试的任务并加入 state，先成功的任务回调结果并取消其他任务，
+// 失败或返回 5xx 时如果还有其他任务未完成则等待其结果
+- (NSURLSessionDataTask *)p_hedgeAttemptWithRequest:(NSURLRequest *)request
+                                              state:(p_HedgeState *)state
+                                            isHedge:(BOOL)isHedge
+                                     responseFilter:(SGSResponseFilterBlock)filter
+                                            success:(SGSResponseSuccessBlock)success
+                                            failure:(SGSResponseFailureBlock)failure
+{
+    __weak typeof(&*self) weakSelf = self;
+    
+    p_HedgeCounters *counters = [self p_hedgeCounters];
+    
+    NSURLSessionDataTask *task = [self dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        NSInteger statusCode = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+        BOOL succeeded = (error == nil) && (statusCode < 500);
+        
+        NSArray<NSURLSessionTask *> *tasks = nil;
+        @synchronized (state) {
+            state.outstandingCount -= 1;
+            if (state.finished) return;
+            if (!succeeded && (state.outstandingCount > 0)) return;
+            
+            state.finished = YES;
+            tasks = [state.tasks copy];
+            [state.tasks removeAllObjects];
+        }
+        
+        for (NSURLSessionTask *other in tasks) {
+            if (other.state == NSURLSessionTaskStateRunning) [other cancel];
+        }
+        if (isHedge && succeeded) {
+            atomic_fetch_add_explicit(&counters->_winCount, 1, memory_order_relaxed);
+        }
+        
+        [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+    }];
+    if (task == nil) return nil;
+    
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+    
+    @synchronized (state) {
+        [state.tasks addObject:task];
+        state.outstandingCount += 1;
+    }
+    
+    return task;
+}
+
+- (NSTimeInterval)p_observedHedgeDelayForHost:(NSString *)host {
+    SGSNetworkMetricsCollector *collector = self.metricsCollector;
+    if ((collector == nil) || (host.length == 0)) return kHedgeDefaultDelay;
+    
+    NSDictionary<NSString *, NSNumber *> *total = [collector latencySummaryForHost:host][@"total"];
+    if (total[@"count"].unsignedIntegerValue < kHedgeMinimumSampleCount) return kHedgeDefaultDelay;
+    
+    return total[@"p95"].doubleValue / 1000.0;
+}
+
+
+#pragma mark - Rate Limiting
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                           rateLimiter:(SGSRateLimiter *)rateLimiter
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    if (rateLimiter == nil) rateLimiter = [SGSRateLimiter sharedLimiter];
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [rateLimiter limitRequest:request taskFactory:^NSURLSessionTask *{
+        
+        NSURLSessionDataTask *task = [weakSelf dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            [rateLimiter updateWithResponse:response forRequest:request];
+            [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+        }];
+        [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+        
+        return task;
+    } failure:^(NSError *error) {
+        [weakSelf p_invokeBlock:failure response:nil obj:error];
+    }];
+}
+
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                       rateLimiter:(SGSRateLimiter *)rateLimiter
+                    responseFilter:(SGSResponseFilterBlock)filter
+                           success:(SGSResponseSuccessBlock)success
+                           failure:(SGSResponseFailureBlock)failure
+{
+    return [self dataTaskWithRequest:[NSURLRequest requestWithURL:url] rateLimiter:rateLimiter responseFilter:filter success:success failure:failure];
+}
+
+
+#pragma mark - Promise
+
+- (SGSPromise *)promiseWithRequest:(NSURLRequest *)request responseFilter:(SGSResponseFilterBlock)filter {
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDataTask *task = [self dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_resolvePromise:promise withResult:[weakSelf p_responseObjectWithFilter:filter response:response data:data error:error]];
+    }];
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+    
+    return [self p_promiseWithTask:task promise:promise];
+}
+
+- (SGSPromise *)promiseWithURL:(NSURL *)url responseFilter:(SGSResponseFilterBlock)filter {
+    return [self promiseWithRequest:[NSURLRequest requestWithURL:url] responseFilter:filter];
+}
+
+- (SGSPromise *)uploadPromiseWithRequest:(NSURLRequest *)request
+                                fromFile:(NSURL *)fileURL
+                                progress:(SGSProgressBlock)progressBlock
+                          responseFilter:(SGSResponseFilterBlock)filter
+{
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromFile:fileURL completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_resolvePromise:promise withResult:[weakSelf p_responseObjectWithFilter:filter response:response data:data error:error]];
+    }];
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    
+    return [self p_promiseWithTask:task promise:promise];
+}
+
+- (SGSPromise *)uploadPromiseWithRequest:(NSURLRequest *)request
+                                fromData:(NSData *)bodyData
+                                progress:(SGSProgressBlock)progressBlock
+                          responseFilter:(SGSResponseFilterBlock)filter
+{
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionUploadTask *task = [self uploadTaskWithRequest:request fromData:bodyData completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_resolvePromise:promise withResult:[weakSelf p_responseObjectWithFilter:filter response:response data:data error:error]];
+    }];
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:progressBlock forTask:task];
+    
+    return [self p_promiseWithTask:task promise:promise];
+}
+
+- (SGSPromise *)downloadPromiseWithRequest:(NSURLRequest *)request
+                                  progress:(SGSProgressBlock)progressBlock
+                               destination:(SGSDownloadTargetBlock)destination
+{
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDownloadTask *task = [self p_resumableDownloadTaskWithRequest:request resumeData:nil completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        
+        [weakSelf p_resolvePromise:promise withResult:[weakSelf p_fileURLWithDestination:destination response:response location:location error:error]];
+    }];
+    [self p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+    
+    return [self p_promiseWithTask:task promise:promise];
+}
+
+
+#pragma mark - Deadline
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                              deadline:(SGSDeadline *)deadline
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+    
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+        
+        NSURLSessionDataTask *task = [weakSelf p_dataTaskWithRequest:request deadline:deadline completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+            
+            [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+        }];
+        if (task == nil) {
+            [weakSelf p_invokeBlock:failure response:nil obj:[NSURLSession p_errorForExpiredDeadline:deadline]];
+            return ;
+        }
+        
+        strongHandle.task = task;
+        if (strongHandle.isCancelled) {
+            [task cancel];
+        } else {
+            [task resume];
+        }
+    };
+    
+    return handle;
+}
+
+- (SGSPromise *)promiseWithRequest:(NSURLRequest *)request
+                          deadline:(SGSDeadline *)deadline
+                    responseFilter:(SGSResponseFilterBlock)filter
+{
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    __weak typeof(&*self) weakSelf = self;
+    
+    NSURLSessionDataTask *task = [self p_dataTaskWithRequest:request deadline:deadline completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        
+        [weakSelf p_resolvePromise:promise withResult:[weakSelf p_responseObjectWithFilter:filter response:response data:data error:error]];
+    }];
+    if (task == nil) {
+        [promise reject:[NSURLSession p_errorForExpiredDeadline:deadline]];
+        return promise;
+    }
+    
+    return [self p_promiseWithTask:task promise:promise];
+}
+
+// 创建受截止时间限制的任务，已经过期时返回 nil，
+// 因到达截止时间被取消的任务以 NSURLErrorTimedOut 错误完成，主动取消或截止时间被取消时仍为 NSURLErrorCancelled
+- (NSURLSessionDataTask *)p_dataTaskWithRequest:(NSURLRequest *)request
+                                       deadline:(SGSDeadline *)deadline
+                              completionHandler:(void (^)(NSData *data, NSURLResponse *response, NSError *error))completionHandler
+{
+    if (deadline.isExpired) {
+        [deadline recordRejectedRequest];
+        return nil;
+    }
+    
+    __block id token = nil;
+    __block BOOL timedOut = NO;
+    NSURLSessionDataTask *task = [self dataTaskWithRequest:[deadline requestByApplyingToRequest:request] completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [deadline removeExpirationHandler:token];
+        
+        if (timedOut && [error.domain isEqualToString:NSURLErrorDomain] && (error.code == NSURLErrorCancelled)) {
+            error = [NSURLSession p_deadlineExceededError];
+        }
+        completionHandler(data, response, error);
+    }];
+    [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+    
+    __weak NSURLSessionDataTask *weakTask = task;
+    __weak SGSDeadline *weakDeadline = deadline;
+    token = [deadline addRequestExpirationHandler:^{
+        // 截止时间被取消时截止时间还没有到达
+        timedOut = (weakDeadline.date.timeIntervalSinceNow <= 0);
+        [weakTask cancel];
+    }];
+    
+    return task;
+}
+
++ (NSError *)p_deadlineExceededError {
+    return [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:@{NSLocalizedDescriptionKey: @"The request deadline has passed."}];
+}
+
+// 发出前已经过期，截止时间被取消时为 NSURLErrorCancelled
++ (NSError *)p_errorForExpiredDeadline:(SGSDeadline *)deadline {
+    if (deadline.date.timeIntervalSinceNow <= 0) return [NSURLSession p_deadlineExceededError];
+    return [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+}
+
+
+#pragma mark - Warm-Up
+
+- (void)warmUpConnectionsToOrigins:(NSArray<NSURL *> *)origins
+                        completion:(void (^)(NSDictionary<NSString *,NSNumber *> *))completion
+{
+    SGSNetworkMetricsCollector *collector = self.metricsCollector;
+    if (collector != nil) [collector addObserver:[p_WarmUpObserver sharedObserver]];
+    
+    NSMutableDictionary<NSString *, NSNumber *> *durations = [NSMutableDictionary dictionary];
+    dispatch_group_t group = dispatch_group_create();
+    NSMutableDictionary<NSString *, p_WarmUpStats *> *allStats = [self p_warmUpStatsByOrigin];
+    
+    for (NSURL *url in origins) {
+        NSString *origin = p_warmUpOriginForURL(url);
+        if (origin == nil) continue;
+        
+        NSURL *warmUpURL = [NSURL URLWithString:[origin stringByAppendingString:@"/"]];
+        @synchronized (allStats) {
+            p_WarmUpStats *stats = allStats[origin];
+            if (stats == nil) {
+                stats = [[p_WarmUpStats alloc] init];
+                allStats[origin] = stats;
+            }
+            if (stats.warming) continue;
+            
+            stats.warming = YES;
+            stats.awaitingWarmUpMetrics = (collector != nil);
+            stats.awaitingFirstRequest = NO;
+            stats.warmUpURL = warmUpURL;
+        }
+        
+        NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:warmUpURL cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:kWarmUpTimeoutInterval];
+        request.HTTPMethod = @"HEAD";
+        
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+        dispatch_group_enter(group);
+        
+        NSURLSessionDataTask *task = [self dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - startTime;
+            
+            @synchronized (allStats) {
+                p_WarmUpStats *stats = allStats[origin];
+                stats.warming = NO;
+                if (error != nil) {
+                    stats.failedCount += 1;
+                    stats.awaitingWarmUpMetrics = NO;
+                } else {
+                    stats.warmUpCount += 1;
+                    stats.awaitingFirstRequest = (collector != nil);
+                    // 没有收集器时只能以预热请求的总耗时作为建连耗时
+                    if (collector == nil) stats.setupDuration = duration;
+                }
+            }
+            
+            if (error == nil) {
+                @synchronized (durations) {
+                    durations[origin] = @(duration);
+                }
+            }
+            dispatch_group_leave(group);
+        }];
+        task.priority = NSURLSessionTaskPriorityHigh;
+        [self p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+        [task resume];
+    }
+    
+    dispatch_group_notify(group, dispatch_get_main_queue(), ^{
+        if (completion) completion([durations copy]);
+    });
+}
+
+- (NSDictionary<NSString *,NSDictionary<NSString *,NSNumber *> *> *)warmUpMetrics {
+    NSMutableDictionary *metrics = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSString *, p_WarmUpStats *> *allStats = objc_getAssociatedObject(self, &kWarmUpStatsKey);
+    if (allStats == nil) return metrics;
+    
+    @synchronized (allStats) {
+        [allStats enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull origin, p_WarmUpStats * _Nonnull stats, BOOL * _Nonnull stop) {
+            NSMutableDictionary *dict = [@{@"warmUpCount": @(stats.warmUpCount),
+                                           @"failedCount": @(stats.failedCount),
+                                           @"setupDuration": @(stats.setupDuration),
+                                           @"reusedCount": @(stats.reusedCount),
+                                           @"notReusedCount": @(stats.notReusedCount),
+                                           @"savedDuration": @(stats.savedDuration)} mutableCopy];
+            if (stats.reusedConnection) dict[@"reusedConnection"] = stats.reusedConnection;
+            metrics[origin] = dict;
+        }];
+    }
+    
+    return metrics;
+}
+
+- (void)resetWarmUpMetrics {
+    NSMutableDictionary<NSString *, p_WarmUpStats *> *allStats = objc_getAssociatedObject(self, &kWarmUpStatsKey);
+    if (allStats == nil) return;
+    
+    @synchronized (allStats) {
+        // 正在预热的源保留状态，等待预热结束
+        for (NSString *origin in allStats.allKeys) {
+            if (!allStats[origin].warming) [allStats removeObjectForKey:origin];
+        }
+    }
+}
+
+// 按源保存的预热统计，与会话关联，第一次预热时创建
+- (NSMutableDictionary<NSString *, p_WarmUpStats *> *)p_warmUpStatsByOrigin {
+    @synchronized (self) {
+        NSMutableDictionary *allStats = objc_getAssociatedObject(self, &kWarmUpStatsKey);
+        if (allStats == nil) {
+            allStats = [NSMutableDictionary dictionary];
+            objc_setAssociatedObject(self, &kWarmUpStatsKey, allStats, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return allStats;
+    }
+}
+
+
+#pragma mark - Session Registry
+
++ (NSURLSession *)sharedRegistrySession {
+    return [SGSSessionRegistry sharedRegistry].defaultSession;
+}
+
+
+#pragma mark - Scheduling
+
+- (SGSTaskHandle *)dataTaskWithRequest:(NSURLRequest *)request
+                              priority:(SGSRequestPriority)priority
+                             scheduler:(SGSRequestScheduler *)scheduler
+                        responseFilter:(SGSResponseFilterBlock)filter
+                               success:(SGSResponseSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    if (scheduler == nil) scheduler = [SGSRequestScheduler sharedScheduler];
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [scheduler scheduleRequest:request priority:priority taskFactory:^NSURLSessionTask *(dispatch_block_t finish) {
+        
+        NSURLSessionDataTask *task = [weakSelf dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            finish();
+            [weakSelf p_callBackObjectWithFilter:filter success:success failure:failure response:response data:data error:error];
+        }];
+        [weakSelf p_addDownloadProgressBlock:nil uploadProgressBlock:nil forTask:task];
+        
+        return task;
+    } failure:^(NSError *error) {
+        [weakSelf p_invokeBlock:failure response:nil obj:error];
+    }];
+}
+
+- (SGSTaskHandle *)dataTaskWithURL:(NSURL *)url
+                          priority:(SGSRequestPriority)priority
+                         scheduler:(SGSRequestScheduler *)scheduler
+                    responseFilter:(SGSResponseFilterBlock)filter
+                           success:(SGSResponseSuccessBlock)success
+                           failure:(SGSResponseFailureBlock)failure
+{
+    return [self dataTaskWithRequest:[NSURLRequest requestWithURL:url] priority:priority scheduler:scheduler responseFilter:filter success:success failure:failure];
+}
+
+- (SGSTaskHandle *)downloadTaskWithRequest:(NSURLRequest *)request
+                                  priority:(SGSRequestPriority)priority
+                                 scheduler:(SGSRequestScheduler *)scheduler
+                                  progress:(SGSProgressBlock)progressBlock
+                               destination:(SGSDownloadTargetBlock)destination
+                                   success:(SGSDownloadSuccessBlock)success
+                                   failure:(SGSResponseFailureBlock)failure
+{
+    if (scheduler == nil) scheduler = [SGSRequestScheduler sharedScheduler];
+    
+    __weak typeof(&*self) weakSelf = self;
+    
+    return [scheduler scheduleRequest:request priority:priority taskFactory:^NSURLSessionTask *(dispatch_block_t finish) {
+        
+        NSURLSessionDownloadTask *task = [weakSelf p_resumableDownloadTaskWithRequest:request resumeData:nil completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+            finish();
+            [weakSelf p_callBackFileWithDestination:destination success:success failure:failure response:response location:location error:error];
+        }];
+        
+        [weakSelf p_addDownloadProgressBlock:progressBlock uploadProgressBlock:nil forTask:task];
+        
+        return task;
+    } failure:^(NSError *error) {
+        [weakSelf p_invokeBlock:failure response:nil obj:error];
+    }];
+}
+
+- (SGSTaskHandle *)downloadTaskWithURL:(NSURL *)url
+                              priority:(SGSRequestPriority)priority
+                             scheduler:(SGSRequestScheduler *)scheduler
+                              progress:(SGSProgressBlock)progressBlock
+                           destination:(SGSDownloadTargetBlock)destination
+                               success:(SGSDownloadSuccessBlock)success
+                               failure:(SGSResponseFailureBlock)failure
+{
+    return [self downloadTaskWithRequest:[NSURLRequest requestWithURL:url] priority:priority scheduler:scheduler progress:progressBlock destination:destination success:success failure:failure];
+}
+
+
+#pragma mark - Completion
+
+- (void)p_callBackObjectWithFilter:(id (^)(NSURLResponse *, NSData *))filter
+                           success:(void (^)(id, id))success
+                          failure:(void (^)(id, id))failure
+                         response:(NSURLResponse *)response
+                             data:(NSData *)data
+                            error:(NSError *)error
+{
+    id responseObject = [self p_responseObjectWithFilter:filter response:response data:data error:error];
+    
+    if ([responseObject isKindOfClass:[NSError class]]) {
+        [self p_invokeBlock:failure response:response obj:responseObject];
+    } else {
+        [self p_invokeBlock:success response:response obj:responseObject];
+    }
+}
+
+- (void)p_callBackFileWithDestination:(NSURL *(^)(NSURLResponse *, NSURL *))destination
+                              success:(void (^)(id, id))success
+                              failure:(void (^)(id, id))failure
+                             response:(NSURLResponse *)response
+                             location:(NSURL *)location
+                                error:(NSError *)error
+{
+    id fileURL = [self p_fileURLWithDestination:destination response:response location:location error:error];
+    
+    if ([fileURL isKindOfClass:[NSError class]]) {
+        [self p_invokeBlock:failure response:response obj:fileURL];
+    } else {
+        [self p_invokeBlock:success response:response obj:fileURL];
+    }
+}
+
+// 返回过滤后的对象，失败时返回 NSError
+- (id)p_responseObjectWithFilter:(id (^)(NSURLResponse *, NSData *))filter
+                        response:(NSURLResponse *)response
+                            data:(NSData *)data
+                           error:(NSError *)error
+{
+    if (error) return error;
+    
+    return (filter != nil) ? filter(response, data) : data;
+}
+
+// 返回移动后的文件路径，没有指定路径时返回 nil，失败时返回 NSError
+- (id)p_fileURLWithDestination:(NSURL *(^)(NSURLResponse *, NSURL *))destination
+                      response:(NSURLResponse *)response
+                      location:(NSURL *)location
+                         error:(NSError *)error
+{
+    if (error) return error;
+    
+    NSURL *fileURL = nil;
+    if (destination) {
+        NSURL *destURL = destination(response, location);
+        if (destURL) {
+            fileURL = destURL;
+            [[NSFileManager defaultManager] moveItemAtURL:location toURL:destURL error:&error];
+            if (error) return error;
+        }
+    }
+    
+    return fileURL;
+}
+
+// 在任务的回调线程中直接确定 Promise 的结果，不切换到主线程
+- (void)p_resolvePromise:(SGSPromise *)promise withResult:(id)result {
+    if ([result isKindOfClass:[NSError class]]) {
+        [promise reject:result];
+    } else {
+        [promise fulfill:result];
+    }
+}
+
+- (SGSPromise *)p_promiseWithTask:(NSURLSessionTask *)task promise:(SGSPromise *)promise {
+    if (task == nil) {
+        [promise reject:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadURL userInfo:nil]];
+        return promise;
+    }
+    
+    __weak NSURLSessionTask *weakTask = task;
+    promise.cancellationHandler = ^{
+        [weakTask cancel];
+    };
+    [task resume];
+    
+    return promise;
+}
+
+- (void)p_invokeBlock:(void (^)(id, id))block response:(NSURLResponse *)response obj:(id)obj {
+    if (block) {
+        if ([NSThread isMainThread]) {
+            block(response, obj);
+        } else {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                block(response, obj);
+            });
+        }
     }
 }
 
@@ -400,67 +1985,198 @@ typedef NS_ENUM(NSInteger, kSessionTaskProgressType) {
                uploadProgressBlock:(void (^)(NSProgress *))uploadProgressBlock
                            forTask:(NSURLSessionTask *)task
 {
-    if ((downloadProgressBlock == nil) && (uploadProgressBlock == nil)) return;
+    // 辅助方法创建的任务都视为前台请求，只通知已经创建的预加载器
+    SGSPrefetcher *prefetcher = objc_getAssociatedObject(self, &kPrefetcherKey);
+    [prefetcher observeForegroundTask:task];
+    
+    // 预热过的会话为任务关联预热统计，用于判断预热后的第一个请求
+    NSMutableDictionary *warmUpStats = objc_getAssociatedObject(self, &kWarmUpStatsKey);
+    if ((task != nil) && (warmUpStats != nil)) objc_setAssociatedObject(task, &kWarmUpStatsKey, warmUpStats, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    
+    SGSNetworkMetricsCollector *metricsCollector = self.metricsCollector;
+    if ((downloadProgressBlock == nil) && (uploadProgressBlock == nil) && (metricsCollector == nil)) return;
+    
+    BOOL collectsSessionTaskMetrics = (metricsCollector != nil) && [self p_setMetricsDelegateWithCollector:metricsCollector forTask:task];
     
     p_SessionTaskProgressObserver *observer = [[p_SessionTaskProgressObserver alloc] init];
     observer.downloadProgressBlock = downloadProgressBlock;
     observer.uploadProgressBlock = uploadProgressBlock;
+    observer.maximumRate = self.progressMaximumRate;
+    observer.deliveryQueue = self.progressDeliveryQueue;
+    observer.metricsCollector = metricsCollector;
+    observer.collectsSessionTaskMetrics = collectsSessionTaskMetrics;
+    
+    __weak typeof(&*self) weakSelf = self;
+    observer.completionHandler = ^(NSURLSessionTask *task) {
+        [weakSelf p_removeProgressObserverForTask:task];
+    };
+    // 通过进度取消下载时保存断点数据
+    if ([task isKindOfClass:[NSURLSessionDownloadTask class]]) {
+        observer.cancellationHandler = ^(NSURLSessionTask *task) {
+            [weakSelf cancelDownloadTaskProducingResumeData:(NSURLSessionDownloadTask *)task];
+        };
+    }
     [self p_addProgressObserver:observer forTask:task];
 }
 
+// iOS 15 及以上为任务设置收集系统统计数据的代理，得到 DNS、连接耗时以及是否复用了连接，
+// 会话代理自己处理 URLSession:task:didFinishCollectingMetrics: 或任务已有代理时不设置，返回是否已设置
+- (BOOL)p_setMetricsDelegateWithCollector:(SGSNetworkMetricsCollector *)collector forTask:(NSURLSessionTask *)task {
+#if defined(__IPHONE_15_0) && (__IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_15_0)
+    if (@available(iOS 15.0, *)) {
+        if ((task == nil) || (task.delegate != nil) || (self.configuration.identifier != nil)) return NO;
+        if ([self.delegate respondsToSelector:@selector(URLSession:task:didFinishCollectingMetrics:)]) return NO;
+        
+        p_TaskMetricsDelegate *delegate = [[p_TaskMetricsDelegate alloc] init];
+        delegate.metricsCollector = collector;
+        task.delegate = delegate;
+        return YES;
+    }
+#endif
+    return NO;
+}
+
 - (void)p_addProgressObserver:(p_SessionTaskProgressObserver *)observer
                       forTask:(NSURLSessionTask *)task
 {
-    NSLock *lock = [self p_lock];
-    NSMutableDictionary *progressObserversByTaskIdentifier = [self p_progressObserversByTaskIdentifier];
-    [lock lock];
-    progressObserversByTaskIdentifier[@(task.taskIdentifier)] = observer;
+    p_ProgressObserverRegistryShard *shard = p_registryShardForTask(task);
+    p_registryShardLock(shard);
+    CFDictionarySetValue(shard->observersByTask, (__bridge const void *)task, (__bridge const void *)observer);
+    p_registryShardUnlock(shard);
+    
+    // 先加入注册表再添加 KVO，任务在添加 KVO 时完成也能从注册表中找到并移除观察者
     [observer p_setupProgressForTask:task];
-    [lock unlock];
 }
 
 - (p_SessionTaskProgressObserver *)p_progressObserverForTask:(NSURLSessionTask *)task {
-    NSLock *lock = [self p_lock];
-    NSMutableDictionary *progressObserversByTaskIdentifier = [self p_progressObserversByTaskIdentifier];
+    p_ProgressObserverRegistryShard *shard = p_registryShardForTask(task);
     p_SessionTaskProgressObserver *observer = nil;
-    [lock lock];
-    observer = progressObserversByTaskIdentifier[@(task.taskIdentifier)];
-    [lock unlock];
+    p_registryShardLock(shard);
+    observer = (__bridge p_SessionTaskProgressObserver *)CFDictionaryGetValue(shard->observersByTask, (__bridge const void *)task);
+    p_registryShardUnlock(shard);
     
     return observer;
 }
 
 - (void)p_removeProgressObserverForTask:(NSURLSessionTask *)task {
-    NSLock *lock = [self p_lock];
-    NSMutableDictionary *progressObserversByTaskIdentifier = [self p_progressObserversByTaskIdentifier];
-    p_SessionTaskProgressObserver *observer = [self p_progressObserverForTask:task];
-    [lock lock];
+    p_ProgressObserverRegistryShard *shard = p_registryShardForTask(task);
+    p_SessionTaskProgressObserver *observer = nil;
+    p_registryShardLock(shard);
+    observer = (__bridge p_SessionTaskProgressObserver *)CFDictionaryGetValue(shard->observersByTask, (__bridge const void *)task);
+    CFDictionaryRemoveValue(shard->observersByTask, (__bridge const void *)task);
+    p_registryShardUnlock(shard);
+    
+    // 在锁外移除 KVO，observer 由局部变量持有
     [observer p_cleanUpProgressForTask:task];
-    [progressObserversByTaskIdentifier removeObjectForKey:@(task.taskIdentifier)];
-    [lock unlock];
 }
 
++ (NSDictionary<NSString *,NSNumber *> *)progressObserverRegistryMetrics {
+    NSUInteger count = 0;
+    for (int i = 0; i < kProgressObserverRegistryShardCount; i++) {
+        p_ProgressObserverRegistryShard *shard = &p_registryShards[i];
+        if (shard->observersByTask == NULL) continue;
+        pthread_mutex_lock(&shard->lock);
+        count += CFDictionaryGetCount(shard->observersByTask);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    
+    return @{@"shardCount": @(kProgressObserverRegistryShardCount),
+             @"observerCount": @(count),
+             @"acquisitionCount": @(atomic_load_explicit(&p_registryAcquisitionCount, memory_order_relaxed)),
+             @"contentionCount": @(atomic_load_explicit(&p_registryContentionCount, memory_order_relaxed))};
+}
 
-#pragma mark - Associated
++ (void)resetProgressObserverRegistryMetrics {
+    atomic_store_explicit(&p_registryAcquisitionCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&p_registryContentionCount, 0, memory_order_relaxed);
+}
+
+
+#pragma mark - Progress Delivery
+
+- (double)progressMaximumRate {
+    return [objc_getAssociatedObject(self, &kProgressMaximumRateKey) doubleValue];
+}
+
+- (void)setProgressMaximumRate:(double)progressMaximumRate {
+    objc_setAssociatedObject(self, &kProgressMaximumRateKey, @(progressMaximumRate), OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (dispatch_queue_t)progressDeliveryQueue {
+    return objc_getAssociatedObject(self, &kProgressDeliveryQueueKey);
+}
+
+- (void)setProgressDeliveryQueue:(dispatch_queue_t)progressDeliveryQueue {
+    objc_setAssociatedObject(self, &kProgressDeliveryQueueKey, progressDeliveryQueue, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
 
-- (NSLock *)p_lock {
-    NSLock *lock = objc_getAssociatedObject(self, &kLockKey);
-    if (lock == nil) {
-        lock = [[NSLock alloc] init];
-        objc_setAssociatedObject(self, &kLockKey, lock, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+- (SGSProgressGroup *)progressGroupWithTasks:(NSArray<NSURLSessionTask *> *)tasks progress:(SGSProgressBlock)progressBlock {
+    SGSProgressGroup *group = [[SGSProgressGroup alloc] initWithMaximumRate:self.progressMaximumRate queue:self.progressDeliveryQueue progress:progressBlock];
+    for (NSURLSessionTask *task in tasks) {
+        [group addTask:task];
     }
     
-    return lock;
+    return group;
 }
 
-- (NSMutableDictionary *)p_progressObserversByTaskIdentifier {
-    NSMutableDictionary *dict = objc_getAssociatedObject(self, &kProgressObserversKey);
-    if (dict == nil) {
-        dict = [NSMutableDictionary dictionary];
-        objc_setAssociatedObject(self, &kProgressObserversKey, dict, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-    }
+
+#pragma mark - Associated
+
+- (SGSDownloadResumeJournal *)downloadResumeJournal {
+    id journal = objc_getAssociatedObject(self, &kDownloadResumeJournalKey);
+    if (journal == nil) return [SGSDownloadResumeJournal sharedJournal];
+    if (journal == [NSNull null]) return nil;
     
-    return dict;
+    return journal;
+}
+
+- (void)setDownloadResumeJournal:(SGSDownloadResumeJournal *)downloadResumeJournal {
+    // 使用 NSNull 区分未设置和设置为空
+    objc_setAssociatedObject(self, &kDownloadResumeJournalKey, downloadResumeJournal ?: [NSNull null], OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (SGSNetworkMetricsCollector *)metricsCollector {
+    return objc_getAssociatedObject(self, &kMetricsCollectorKey);
+}
+
+- (void)setMetricsCollector:(SGSNetworkMetricsCollector *)metricsCollector {
+    objc_setAssociatedObject(self, &kMetricsCollectorKey, metricsCollector, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+- (SGSPrefetcher *)prefetcher {
+    @synchronized (self) {
+        SGSPrefetcher *prefetcher = objc_getAssociatedObject(self, &kPrefetcherKey);
+        if (prefetcher == nil) {
+            prefetcher = [[SGSPrefetcher alloc] initWithSession:self cache:nil];
+            objc_setAssociatedObject(self, &kPrefetcherKey, prefetcher, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return prefetcher;
+    }
+}
+
+- (SGSVerifiedDownloader *)verifiedDownloader {
+    @synchronized (self) {
+        SGSVerifiedDownloader *downloader = objc_getAssociatedObject(self, &kVerifiedDownloaderKey);
+        if (downloader == nil) {
+            downloader = [[SGSVerifiedDownloader alloc] initWithSession:self];
+            objc_setAssociatedObject(self, &kVerifiedDownloaderKey, downloader, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return downloader;
+    }
+}
+
+- (SGSRequestCoalescer *)requestCoalescer {
+    @synchronized (self) {
+        SGSRequestCoalescer *coalescer = objc_getAssociatedObject(self, &kRequestCoalescerKey);
+        if (coalescer == nil) {
+            coalescer = [[SGSRequestCoalescer alloc] init];
+            objc_setAssociatedObject(self, &kRequestCoalescerKey, coalescer, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return coalescer;
+    }
 }
 
 @end
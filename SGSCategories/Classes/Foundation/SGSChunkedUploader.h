@@ -0,0 +1,112 @@
+/*!
+ *  @header SGSChunkedUploader.h
+ *
+ *  @abstract 可断点续传的分块并行上传
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NSURLSession+SGS.h"
+
+@class SGSTaskHandle, SGSRetryPolicy;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 服务器返回的分块校验失败状态码（tus checksum 扩展）
+ */
+FOUNDATION_EXPORT const NSInteger SGSChunkedUploadChecksumMismatchStatusCode;
+
+/*!
+ *  @brief 分块上传完成闭包
+ *
+ *  @param response  合并请求的响应
+ *  @param uploadURL 合并后文件的地址，即合并请求响应头中的 Location
+ *  @param error     失败信息
+ */
+typedef void(^SGSChunkedUploadCompletionBlock)(NSURLResponse * _Nullable response, NSURL * _Nullable uploadURL, NSError * _Nullable error);
+
+/*!
+ *  @brief 分块并行上传
+ *
+ *  @discussion 使用 tus 1.0 协议（creation、concatenation、checksum 扩展）：
+ *      1. 文件按 chunkSize 分块，每块以 Upload-Concat: partial 创建一个部分上传，得到各自的地址
+ *      2. 最多 maximumConcurrentChunks 块同时以 PATCH 上传，请求头 Upload-Checksum 带有该次请求体的 SHA-1，
+ *         服务器校验失败时返回 460，该块重新上传
+ *      3. 所有块完成后以 Upload-Concat: final 合并为一个文件，metadata 放在合并请求的 Upload-Metadata 中
+ *
+ *      每块的地址和完成状态在创建和完成时保存在 Application Support 目录下，
+ *      失败、取消或应用重新启动后再次上传同一个文件到同一个地址时，已完成的块直接跳过，
+ *      未完成的块先用 HEAD 查询服务器已收到的偏移量再继续上传，文件大小或修改时间变化时重新上传
+ *
+ *      单个块失败时按 retryPolicy 单独重试，由于每次重试前都会同步偏移量，PATCH 请求也可以安全地重试
+ *
+ *      所有块的进度合并为一个总进度，回调频率和队列使用会话的 progressMaximumRate 和 progressDeliveryQueue
+ */
+@interface SGSChunkedUploader : NSObject
+
+/*!
+ *  @brief 分块大小，单位：字节，默认为 5 MB，上传过程中每个进行中的块在内存中保留一份数据
+ */
+@property (atomic, assign) int64_t chunkSize;
+
+/*!
+ *  @brief 最多同时上传的块数，默认为 3
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentChunks;
+
+/*!
+ *  @brief 分块失败时的重试策略，默认最多重试 3 次且不使用熔断器
+ */
+@property (atomic, copy) SGSRetryPolicy *retryPolicy;
+
+/*!
+ *  @brief 附加到每个请求的请求头，例如身份认证
+ */
+@property (atomic, copy, nullable) NSDictionary<NSString *, NSString *> *HTTPHeaders;
+
+/*!
+ *  @brief 创建分块上传
+ *
+ *  @discussion 调用句柄的 resume 后开始上传，句柄的 task 为最近启动的任务，取消句柄将取消所有块，已完成的块保留
+ *
+ *  @param fileURL       待上传的文件
+ *  @param endpoint      tus 服务的创建地址
+ *  @param session       网络会话
+ *  @param metadata      文件的元数据，为空时只包含 filename
+ *  @param progressBlock 上传进度闭包
+ *  @param completion    完成闭包，在后台线程回调
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)handleForFileURL:(NSURL *)fileURL
+                           endpoint:(NSURL *)endpoint
+                            session:(NSURLSession *)session
+                           metadata:(nullable NSDictionary<NSString *, NSString *> *)metadata
+                           progress:(nullable SGSProgressBlock)progressBlock
+                         completion:(SGSChunkedUploadCompletionBlock)completion;
+
+/*!
+ *  @brief 是否有可以续传的记录
+ *
+ *  @param fileURL  待上传的文件
+ *  @param endpoint tus 服务的创建地址
+ *
+ *  @return YES 有记录
+ */
+- (BOOL)hasJournalForFileURL:(NSURL *)fileURL endpoint:(NSURL *)endpoint;
+
+/*!
+ *  @brief 移除续传记录，下次上传将从头开始
+ *
+ *  @param fileURL  待上传的文件
+ *  @param endpoint tus 服务的创建地址
+ */
+- (void)removeJournalForFileURL:(NSURL *)fileURL endpoint:(NSURL *)endpoint;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,729 @@
+/*!
+ *  @header SGSChunkedUploader.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSChunkedUploader.h"
+#import "SGSTaskHandle.h"
+#import "SGSRetryPolicy.h"
+#import "SGSProgressGroup.h"
+#import "NSData+SGS.h"
+#include <CommonCrypto/CommonCrypto.h>
+
+const NSInteger SGSChunkedUploadChecksumMismatchStatusCode = 460;
+
+static NSString * const kTusVersion = @"1.0.0";
+static NSString * const kChunkedUploadDirectoryName = @"com.southgis.SGSCategories.ChunkedUpload";
+
+// 续传记录的键
+static NSString * const kJournalFileSizeKey = @"fileSize";
+static NSString * const kJournalModificationDateKey = @"modificationDate";  // 秒，XML 属性列表中的日期只精确到秒
+static NSString * const kJournalChunkSizeKey = @"chunkSize";
+static NSString * const kJournalChunksKey = @"chunks";
+static NSString * const kJournalChunkURLKey = @"url";
+static NSString * const kJournalChunkCompletedKey = @"completed";
+
+// 所有续传记录的读写都在这个串行队列中执行
+static dispatch_queue_t p_journalQueue() {
+    static dispatch_queue_t queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("com.southgis.SGSCategories.ChunkedUpload.journal", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+static NSString *p_journalPath(NSURL *fileURL, NSURL *endpoint) {
+    NSString *key = [NSString stringWithFormat:@"%@\n%@", endpoint.absoluteString, fileURL.URLByStandardizingPath.path];
+    NSString *filename = [[[key dataUsingEncoding:NSUTF8StringEncoding] sha256HexString] stringByAppendingPathExtension:@"plist"];
+
+    NSString *support = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES).firstObject;
+    return [[support stringByAppendingPathComponent:kChunkedUploadDirectoryName] stringByAppendingPathComponent:filename];
+}
+
+
+#pragma mark - Upload Chunk
+
+/// 单个分块的状态，仅内部使用
+@interface p_UploadChunk : NSObject
+@property (nonatomic, assign) int64_t offset;
+@property (nonatomic, assign) int64_t length;
+@property (nonatomic, strong) NSURL *uploadURL;         // 服务器上部分上传的地址，未创建时为 nil
+@property (nonatomic, assign) int64_t uploadedLength;   // 服务器已确认收到的字节数
+@property (nonatomic, assign) int64_t sentLength;       // 进行中的 PATCH 请求已发送的字节数
+@property (nonatomic, assign) BOOL offsetKnown;         // 为 NO 时需要先用 HEAD 同步偏移量
+@property (nonatomic, assign) NSUInteger retryCount;
+@property (nonatomic, assign) NSTimeInterval retryDelay;
+@property (nonatomic, assign) BOOL completed;
+@property (nonatomic, strong) NSURLSessionTask *task;
+@end
+
+@implementation p_UploadChunk
+@end
+
+
+#pragma mark - Chunked Upload
+
+/// 一次分块上传，仅内部使用
+@interface p_ChunkedUpload : NSObject
+@property (nonatomic, weak) SGSTaskHandle *handle;
+@end
+
+@implementation p_ChunkedUpload {
+    NSURLSession *_session;
+    NSURL *_fileURL;
+    NSURL *_endpoint;
+    int64_t _chunkSize;
+    NSUInteger _maximumConcurrentChunks;
+    SGSRetryPolicy *_retryPolicy;
+    NSDictionary<NSString *, NSString *> *_HTTPHeaders;
+    NSDictionary<NSString *, NSString *> *_metadata;
+    SGSChunkedUploadCompletionBlock _completion;
+    NSString *_journalPath;
+
+    NSLock *_lock;
+    NSMutableArray<p_UploadChunk *> *_chunks;
+    NSMutableArray<p_UploadChunk *> *_pendingChunks;
+    NSUInteger _activeCount;
+    NSUInteger _remainingCount;
+    BOOL _finished;
+
+    int64_t _fileSize;
+    NSDate *_modificationDate;
+    NSUInteger _finalizeRetryCount;
+    NSTimeInterval _finalizeRetryDelay;
+
+    NSProgress *_progress;
+    SGSProgressThrottle *_throttle;
+}
+
+- (instancetype)initWithSession:(NSURLSession *)session
+                        fileURL:(NSURL *)fileURL
+                       endpoint:(NSURL *)endpoint
+                      chunkSize:(int64_t)chunkSize
+        maximumConcurrentChunks:(NSUInteger)maximumConcurrentChunks
+                    retryPolicy:(SGSRetryPolicy *)retryPolicy
+                    HTTPHeaders:(NSDictionary<NSString *, NSString *> *)HTTPHeaders
+                       metadata:(NSDictionary<NSString *, NSString *> *)metadata
+                       progress:(SGSProgressBlock)progressBlock
+                     completion:(SGSChunkedUploadCompletionBlock)completion
+{
+    self = [super init];
+    if (self) {
+        _session = session;
+        _fileURL = fileURL;
+        _endpoint = endpoint;
+        _chunkSize = MAX(chunkSize, 1);
+        _maximumConcurrentChunks = MAX(maximumConcurrentChunks, 1);
+        _retryPolicy = retryPolicy;
+        _HTTPHeaders = [HTTPHeaders copy];
+        _completion = [completion copy];
+        _journalPath = p_journalPath(fileURL, endpoint);
+
+        NSMutableDictionary *allMetadata = [NSMutableDictionary dictionaryWithDictionary:metadata ?: @{}];
+        if ((allMetadata[@"filename"] == nil) && (fileURL.lastPathComponent.length > 0)) {
+            allMetadata[@"filename"] = fileURL.lastPathComponent;
+        }
+        _metadata = [allMetadata copy];
+
+        _lock = [[NSLock alloc] init];
+        _chunks = [NSMutableArray array];
+        _pendingChunks = [NSMutableArray array];
+
+        _progress = [[NSProgress alloc] initWithParent:nil userInfo:nil];
+        _progress.totalUnitCount = NSURLSessionTransferSizeUnknown;
+        if (progressBlock) {
+            _throttle = [[SGSProgressThrottle alloc] initWithMaximumRate:session.progressMaximumRate queue:session.progressDeliveryQueue block:progressBlock];
+        }
+    }
+    return self;
+}
+
+- (void)start {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self p_prepareChunks];
+    });
+}
+
+- (void)cancel {
+    [self p_finishWithResponse:nil uploadURL:nil error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+}
+
+
+#pragma mark - Journal
+
+// 按文件大小划分分块，续传记录与当前文件一致时恢复各分块的地址和完成状态
+- (void)p_prepareChunks {
+    if ([self p_isFinished]) return;
+
+    NSError *error = nil;
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:_fileURL.path error:&error];
+    if (attributes == nil) {
+        [self p_finishWithResponse:nil uploadURL:nil error:error];
+        return;
+    }
+
+    _fileSize = (int64_t)attributes.fileSize;
+    _modificationDate = attributes.fileModificationDate;
+
+    __block NSDictionary *journal = nil;
+    dispatch_sync(p_journalQueue(), ^{
+        journal = [NSDictionary dictionaryWithContentsOfFile:_journalPath];
+    });
+
+    NSArray<NSDictionary *> *savedChunks = nil;
+    if (([journal[kJournalFileSizeKey] longLongValue] == _fileSize) &&
+        ([journal[kJournalChunkSizeKey] longLongValue] == _chunkSize) &&
+        (fabs([journal[kJournalModificationDateKey] doubleValue] - _modificationDate.timeIntervalSince1970) < 0.001))
+    {
+        savedChunks = journal[kJournalChunksKey];
+    }
+
+    NSUInteger count = (NSUInteger)MAX((_fileSize + _chunkSize - 1) / _chunkSize, 1);
+    if (savedChunks.count != count) savedChunks = nil;
+
+    [_lock lock];
+    for (NSUInteger i = 0; i < count; i++) {
+        p_UploadChunk *chunk = [[p_UploadChunk alloc] init];
+        chunk.offset = _chunkSize * i;
+        chunk.length = MIN(_chunkSize, _fileSize - chunk.offset);
+
+        NSString *url = savedChunks[i][kJournalChunkURLKey];
+        if (url.length > 0) {
+            chunk.uploadURL = [NSURL URLWithString:url];
+            chunk.completed = [savedChunks[i][kJournalChunkCompletedKey] boolValue];
+            chunk.uploadedLength = chunk.completed ? chunk.length : 0;
+        }
+
+        [_chunks addObject:chunk];
+        if (!chunk.completed) [_pendingChunks addObject:chunk];
+    }
+    _remainingCount = _pendingChunks.count;
+    _progress.totalUnitCount = MAX(_fileSize, 1);
+    BOOL allCompleted = (_remainingCount == 0);
+    [_lock unlock];
+
+    if (savedChunks == nil) [self p_saveJournal];
+    [self p_updateProgress];
+
+    if (allCompleted) {
+        [self p_finalize];
+    } else {
+        [self p_startPendingChunks];
+    }
+}
+
+- (void)p_saveJournal {
+    [_lock lock];
+    NSMutableArray *chunks = [NSMutableArray arrayWithCapacity:_chunks.count];
+    for (p_UploadChunk *chunk in _chunks) {
+        NSMutableDictionary *item = [NSMutableDictionary dictionaryWithCapacity:2];
+        if (chunk.uploadURL) item[kJournalChunkURLKey] = chunk.uploadURL.absoluteString;
+        item[kJournalChunkCompletedKey] = @(chunk.completed);
+        [chunks addObject:item];
+    }
+    [_lock unlock];
+
+    NSDictionary *journal = @{kJournalFileSizeKey: @(_fileSize),
+                              kJournalModificationDateKey: @(_modificationDate.timeIntervalSince1970),
+                              kJournalChunkSizeKey: @(_chunkSize),
+                              kJournalChunksKey: chunks};
+    NSString *path = _journalPath;
+
+    dispatch_async(p_journalQueue(), ^{
+        [[NSFileManager defaultManager] createDirectoryAtPath:path.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+        [journal writeToFile:path atomically:YES];
+    });
+}
+
+- (void)p_removeJournal {
+    NSString *path = _journalPath;
+    dispatch_async(p_journalQueue(), ^{
+        [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    });
+}
+
+
+#pragma mark - Chunk
+
+- (void)p_startPendingChunks {
+    NSMutableArray<p_UploadChunk *> *chunks = [NSMutableArray array];
+
+    [_lock lock];
+    while (!_finished && (_activeCount < _maximumConcurrentChunks) && (_pendingChunks.count > 0)) {
+        [chunks addObject:_pendingChunks.firstObject];
+        [_pendingChunks removeObjectAtIndex:0];
+        _activeCount += 1;
+    }
+    [_lock unlock];
+
+    for (p_UploadChunk *chunk in chunks) {
+        [self p_continueChunk:chunk];
+    }
+}
+
+// 按分块的状态执行下一步：创建、同步偏移量或上传数据
+- (void)p_continueChunk:(p_UploadChunk *)chunk {
+    if ([self p_isFinished]) return;
+
+    [_lock lock];
+    NSURL *uploadURL = chunk.uploadURL;
+    BOOL offsetKnown = chunk.offsetKnown;
+    [_lock unlock];
+
+    if (uploadURL == nil) {
+        [self p_createChunk:chunk];
+    } else if (!offsetKnown) {
+        [self p_fetchOffsetOfChunk:chunk];
+    } else {
+        [self p_patchChunk:chunk];
+    }
+}
+
+- (void)p_createChunk:(p_UploadChunk *)chunk {
+    NSMutableURLRequest *request = [self p_requestWithURL:_endpoint method:@"POST"];
+    [request setValue:[NSString stringWithFormat:@"%lld", chunk.length] forHTTPHeaderField:@"Upload-Length"];
+    [request setValue:@"partial" forHTTPHeaderField:@"Upload-Concat"];
+
+    NSURLSessionDataTask *task = [_session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        if ([self p_isFinished]) return;
+
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        NSString *location = [httpResponse.allHeaderFields[@"Location"] description];
+        NSURL *uploadURL = (location.length > 0) ? [NSURL URLWithString:location relativeToURL:_endpoint].absoluteURL : nil;
+
+        if ((error == nil) && (httpResponse.statusCode == 201) && (uploadURL != nil)) {
+            [_lock lock];
+            chunk.uploadURL = uploadURL;
+            chunk.uploadedLength = 0;
+            chunk.offsetKnown = YES;
+            [_lock unlock];
+
+            [self p_saveJournal];
+            [self p_chunkDidAdvance:chunk];
+        } else {
+            [self p_chunk:chunk didFailWithRequest:request response:httpResponse error:error];
+        }
+    }];
+
+    [self p_observeTask:task forChunk:chunk];
+    [self p_resumeTask:task];
+}
+
+- (void)p_fetchOffsetOfChunk:(p_UploadChunk *)chunk {
+    NSMutableURLRequest *request = [self p_requestWithURL:chunk.uploadURL method:@"HEAD"];
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+
+    NSURLSessionDataTask *task = [_session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        if ([self p_isFinished]) return;
+
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        NSString *offset = [httpResponse.allHeaderFields[@"Upload-Offset"] description];
+
+        if ((error == nil) && (httpResponse.statusCode / 100 == 2) && (offset.length > 0)) {
+            [_lock lock];
+            chunk.uploadedLength = MIN(MAX(offset.longLongValue, 0), chunk.length);
+            chunk.offsetKnown = YES;
+            [_lock unlock];
+
+            [self p_chunkDidAdvance:chunk];
+            return;
+        }
+
+        // 部分上传已过期或被删除，重新创建
+        if ((error == nil) && ((httpResponse.statusCode == 403) || (httpResponse.statusCode == 404) || (httpResponse.statusCode == 410))) {
+            [_lock lock];
+            chunk.uploadURL = nil;
+            chunk.uploadedLength = 0;
+            [_lock unlock];
+
+            [self p_saveJournal];
+            [self p_createChunk:chunk];
+            return;
+        }
+
+        [self p_chunk:chunk didFailWithRequest:request response:httpResponse error:error];
+    }];
+
+    [self p_observeTask:task forChunk:chunk];
+    [self p_resumeTask:task];
+}
+
+- (void)p_patchChunk:(p_UploadChunk *)chunk {
+    [_lock lock];
+    int64_t uploadedLength = chunk.uploadedLength;
+    [_lock unlock];
+
+    NSError *readError = nil;
+    NSData *data = [self p_readLength:chunk.length - uploadedLength atOffset:chunk.offset + uploadedLength error:&readError];
+    if (data == nil) {
+        [self p_finishWithResponse:nil uploadURL:nil error:readError];
+        return;
+    }
+
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+    NSString *checksum = [[NSData dataWithBytes:digest length:CC_SHA1_DIGEST_LENGTH] base64EncodedStringWithOptions:0];
+
+    NSMutableURLRequest *request = [self p_requestWithURL:chunk.uploadURL method:@"PATCH"];
+    [request setValue:[NSString stringWithFormat:@"%lld", uploadedLength] forHTTPHeaderField:@"Upload-Offset"];
+    [request setValue:@"application/offset+octet-stream" forHTTPHeaderField:@"Content-Type"];
+    [request setValue:[@"sha1 " stringByAppendingString:checksum] forHTTPHeaderField:@"Upload-Checksum"];
+
+    NSURLSessionUploadTask *task = [_session uploadTaskWithRequest:request fromData:data completionHandler:^(NSData * _Nullable responseData, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [self p_stopObservingChunk:chunk];
+        if ([self p_isFinished]) return;
+
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        NSString *offset = [httpResponse.allHeaderFields[@"Upload-Offset"] description];
+
+        if ((error == nil) && (httpResponse.statusCode / 100 == 2)) {
+            int64_t newOffset = (offset.length > 0) ? offset.longLongValue : (uploadedLength + (int64_t)data.length);
+
+            [_lock lock];
+            chunk.uploadedLength = MIN(MAX(newOffset, 0), chunk.length);
+            chunk.sentLength = 0;
+            [_lock unlock];
+
+            [self p_chunkDidAdvance:chunk];
+        } else {
+            [self p_chunk:chunk didFailWithRequest:request response:httpResponse error:error];
+        }
+    }];
+
+    [self p_observeTask:task forChunk:chunk];
+    [self p_resumeTask:task];
+}
+
+// 创建、同步偏移量或上传成功后，分块已全部上传时完成，否则继续上传
+- (void)p_chunkDidAdvance:(p_UploadChunk *)chunk {
+    [_lock lock];
+    BOOL completed = (chunk.uploadedLength >= chunk.length);
+    [_lock unlock];
+
+    [self p_updateProgress];
+
+    if (completed) {
+        [self p_chunkDidFinish:chunk];
+    } else {
+        [self p_patchChunk:chunk];
+    }
+}
+
+- (void)p_chunk:(p_UploadChunk *)chunk
+didFailWithRequest:(NSURLRequest *)request
+       response:(NSHTTPURLResponse *)response
+          error:(NSError *)error
+{
+    // 校验失败（460）或偏移量冲突（409）时同步偏移量后重新上传
+    BOOL retryable = (response.statusCode == SGSChunkedUploadChecksumMismatchStatusCode) ||
+                     (response.statusCode == 409) ||
+                     [_retryPolicy isRetryableResponse:response error:error];
+
+    if (!retryable || (chunk.retryCount >= _retryPolicy.maximumRetryCount)) {
+        if (error == nil) {
+            error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey: request.URL}];
+        }
+        [self p_finishWithResponse:response uploadURL:nil error:error];
+        return;
+    }
+
+    // 每次重试前都重新查询偏移量，PATCH 不会重复写入
+    [_lock lock];
+    chunk.retryCount += 1;
+    chunk.retryDelay = [_retryPolicy delayAfterPreviousDelay:chunk.retryDelay response:response];
+    chunk.offsetKnown = NO;
+    chunk.sentLength = 0;
+    NSTimeInterval delay = chunk.retryDelay;
+    [_lock unlock];
+
+    [self p_updateProgress];
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self p_continueChunk:chunk];
+    });
+}
+
+- (void)p_chunkDidFinish:(p_UploadChunk *)chunk {
+    [_lock lock];
+    chunk.completed = YES;
+    chunk.uploadedLength = chunk.length;
+    chunk.sentLength = 0;
+    chunk.task = nil;
+    _activeCount -= 1;
+    _remainingCount -= 1;
+    BOOL allFinished = (_remainingCount == 0);
+    [_lock unlock];
+
+    [self p_saveJournal];
+
+    if (allFinished) {
+        [self p_finalize];
+    } else {
+        [self p_startPendingChunks];
+    }
+}
+
+
+#pragma mark - Finalize
+
+// 将所有部分上传合并为一个文件
+- (void)p_finalize {
+    if ([self p_isFinished]) return;
+
+    [_lock lock];
+    NSMutableArray<NSString *> *urls = [NSMutableArray arrayWithCapacity:_chunks.count];
+    for (p_UploadChunk *chunk in _chunks) {
+        [urls addObject:chunk.uploadURL.absoluteString];
+    }
+    [_lock unlock];
+
+    NSMutableURLRequest *request = [self p_requestWithURL:_endpoint method:@"POST"];
+    [request setValue:[@"final;" stringByAppendingString:[urls componentsJoinedByString:@" "]] forHTTPHeaderField:@"Upload-Concat"];
+
+    NSMutableArray<NSString *> *pairs = [NSMutableArray arrayWithCapacity:_metadata.count];
+    [_metadata enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSString * _Nonnull value, BOOL * _Nonnull stop) {
+        NSString *encoded = [[value dataUsingEncoding:NSUTF8StringEncoding] base64EncodedStringWithOptions:0];
+        [pairs addObject:[NSString stringWithFormat:@"%@ %@", key, encoded]];
+    }];
+    if (pairs.count > 0) {
+        [request setValue:[pairs componentsJoinedByString:@","] forHTTPHeaderField:@"Upload-Metadata"];
+    }
+
+    NSURLSessionDataTask *task = [_session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        if ([self p_isFinished]) return;
+
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        NSString *location = [httpResponse.allHeaderFields[@"Location"] description];
+        NSURL *uploadURL = (location.length > 0) ? [NSURL URLWithString:location relativeToURL:_endpoint].absoluteURL : nil;
+
+        if ((error == nil) && (httpResponse.statusCode == 201) && (uploadURL != nil)) {
+            [self p_removeJournal];
+            [self p_finishWithResponse:httpResponse uploadURL:uploadURL error:nil];
+            return;
+        }
+
+        // 合并请求是 POST，只在请求没有发出时重试
+        if (![_retryPolicy shouldRetryRequest:request response:response error:error retryCount:_finalizeRetryCount]) {
+            if (error == nil) {
+                error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey: request.URL}];
+            }
+            [self p_finishWithResponse:httpResponse uploadURL:nil error:error];
+            return;
+        }
+
+        _finalizeRetryCount += 1;
+        _finalizeRetryDelay = [_retryPolicy delayAfterPreviousDelay:_finalizeRetryDelay response:response];
+
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_finalizeRetryDelay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self p_finalize];
+        });
+    }];
+
+    [self p_resumeTask:task];
+}
+
+
+#pragma mark - Progress
+
+- (void)p_observeTask:(NSURLSessionTask *)task forChunk:(p_UploadChunk *)chunk {
+    [_lock lock];
+    chunk.task = task;
+    [_lock unlock];
+
+    if ((_throttle == nil) || ![task isKindOfClass:[NSURLSessionUploadTask class]]) return;
+
+    [task addObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesSent)) options:NSKeyValueObservingOptionNew context:(__bridge void *)chunk];
+}
+
+- (void)p_stopObservingChunk:(p_UploadChunk *)chunk {
+    if (_throttle == nil) return;
+
+    NSURLSessionTask *task = chunk.task;
+    if (![task isKindOfClass:[NSURLSessionUploadTask class]]) return;
+
+    [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesSent)) context:(__bridge void *)chunk];
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSString *,id> *)change context:(void *)context {
+    p_UploadChunk *chunk = (__bridge p_UploadChunk *)context;
+    NSURLSessionTask *task = object;
+
+    [_lock lock];
+    chunk.sentLength = MIN(task.countOfBytesSent, chunk.length - chunk.uploadedLength);
+    [_lock unlock];
+
+    [self p_updateProgress];
+}
+
+- (void)p_updateProgress {
+    if (_throttle == nil) return;
+
+    [_lock lock];
+    int64_t sent = 0;
+    for (p_UploadChunk *chunk in _chunks) {
+        sent += chunk.uploadedLength + chunk.sentLength;
+    }
+    _progress.completedUnitCount = sent;
+    [_lock unlock];
+
+    [_throttle progressDidChange:_progress];
+}
+
+
+#pragma mark - Private
+
+- (NSMutableURLRequest *)p_requestWithURL:(NSURL *)url method:(NSString *)method {
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+    request.HTTPMethod = method;
+    [_HTTPHeaders enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSString * _Nonnull value, BOOL * _Nonnull stop) {
+        [request setValue:value forHTTPHeaderField:key];
+    }];
+    [request setValue:kTusVersion forHTTPHeaderField:@"Tus-Resumable"];
+    return request;
+}
+
+- (NSData *)p_readLength:(int64_t)length atOffset:(int64_t)offset error:(NSError **)error {
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingFromURL:_fileURL error:error];
+    if (fileHandle == nil) return nil;
+
+    NSData *data = nil;
+    @try {
+        [fileHandle seekToFileOffset:(unsigned long long)offset];
+        data = [fileHandle readDataOfLength:(NSUInteger)length];
+    } @catch (NSException *exception) {
+        data = nil;
+    }
+    [fileHandle closeFile];
+
+    // 文件在上传过程中被截断
+    if (data.length != (NSUInteger)length) {
+        if (error) *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSLocalizedDescriptionKey: @"The file changed during the chunked upload.", NSURLErrorKey: _fileURL}];
+        return nil;
+    }
+
+    return data;
+}
+
+- (void)p_resumeTask:(NSURLSessionTask *)task {
+    SGSTaskHandle *handle = self.handle;
+    handle.task = task;
+
+    if ([self p_isFinished]) {
+        [task cancel];
+    } else {
+        [task resume];
+    }
+}
+
+- (BOOL)p_isFinished {
+    [_lock lock];
+    BOOL finished = _finished;
+    [_lock unlock];
+    return finished;
+}
+
+// 只回调一次，失败时取消所有分块，续传记录保留
+- (void)p_finishWithResponse:(NSURLResponse *)response uploadURL:(NSURL *)uploadURL error:(NSError *)error {
+    [_lock lock];
+    if (_finished) {
+        [_lock unlock];
+        return;
+    }
+    _finished = YES;
+    NSArray<p_UploadChunk *> *chunks = [_chunks copy];
+    [_lock unlock];
+
+    if (error) {
+        for (p_UploadChunk *chunk in chunks) {
+            if (!chunk.completed) [chunk.task cancel];
+        }
+    } else {
+        [_lock lock];
+        if (_progress.totalUnitCount <= 0) _progress.totalUnitCount = MAX(_progress.completedUnitCount, 1);
+        _progress.completedUnitCount = _progress.totalUnitCount;
+        [_lock unlock];
+    }
+    [_throttle finishWithProgress:_progress];
+
+    if (_completion) _completion(response, uploadURL, error);
+}
+
+@end
+
+
+#pragma mark - SGSChunkedUploader
+
+@implementation SGSChunkedUploader
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _chunkSize = 5 * 1024 * 1024;
+        _maximumConcurrentChunks = 3;
+
+        SGSRetryPolicy *policy = [SGSRetryPolicy defaultPolicy];
+        policy.circuitBreaker = nil;
+        _retryPolicy = policy;
+    }
+    return self;
+}
+
+- (SGSTaskHandle *)handleForFileURL:(NSURL *)fileURL
+                           endpoint:(NSURL *)endpoint
+                            session:(NSURLSession *)session
+                           metadata:(NSDictionary<NSString *, NSString *> *)metadata
+                           progress:(SGSProgressBlock)progressBlock
+                         completion:(SGSChunkedUploadCompletionBlock)completion
+{
+    p_ChunkedUpload *upload = [[p_ChunkedUpload alloc] initWithSession:session
+                                                               fileURL:fileURL
+                                                              endpoint:endpoint
+                                                             chunkSize:self.chunkSize
+                                               maximumConcurrentChunks:self.maximumConcurrentChunks
+                                                           retryPolicy:self.retryPolicy
+                                                           HTTPHeaders:self.HTTPHeaders
+                                                              metadata:metadata
+                                                              progress:progressBlock
+                                                            completion:completion];
+
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    upload.handle = handle;
+    __weak SGSTaskHandle *weakHandle = handle;
+
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+
+        [upload start];
+    };
+    handle.cancellationHandler = ^{
+        [upload cancel];
+    };
+
+    return handle;
+}
+
+- (BOOL)hasJournalForFileURL:(NSURL *)fileURL endpoint:(NSURL *)endpoint {
+    NSString *path = p_journalPath(fileURL, endpoint);
+    __block BOOL exists = NO;
+    dispatch_sync(p_journalQueue(), ^{
+        exists = [[NSFileManager defaultManager] fileExistsAtPath:path];
+    });
+    return exists;
+}
+
+- (void)removeJournalForFileURL:(NSURL *)fileURL endpoint:(NSURL *)endpoint {
+    NSString *path = p_journalPath(fileURL, endpoint);
+    dispatch_sync(p_journalQueue(), ^{
+        [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    });
+}
+
+@end
@@ -0,0 +1,168 @@
+/*!
+ *  @header SGSDeadline.h
+ *
+ *  @abstract 跨多个请求传递的截止时间
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 截止时间
+ *
+ *  @discussion 一个页面或一组串联请求共用的总耗时预算，关联的请求超时时间缩短为剩余时间，
+ *      截止时间到达时执行所有过期闭包，由过期闭包取消仍在进行的请求
+ *
+ *      截止时间到达时仍有进行中的请求视为一次超出预算，连同各项计数一起记录在 metrics 中，
+ *      子截止时间随当前截止时间一起过期时统计在当前截止时间中，
+ *      调用 finish 表示整组请求已经结束，之后到达截止时间不再计为超出预算
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSDeadline : NSObject
+
+/*!
+ *  @brief 从现在开始计算的截止时间
+ *
+ *  @param budget 总耗时预算，单位：秒
+ *  @param name   名称，用于按名称汇总统计数据，例如页面名称
+ *
+ *  @return SGSDeadline
+ */
++ (instancetype)deadlineWithBudget:(NSTimeInterval)budget name:(nullable NSString *)name;
+
+/*!
+ *  @brief 指定时间的截止时间
+ *
+ *  @param date 截止时间
+ *  @param name 名称，用于按名称汇总统计数据，例如页面名称
+ *
+ *  @return SGSDeadline
+ */
++ (instancetype)deadlineWithDate:(NSDate *)date name:(nullable NSString *)name;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 名称，为空时统计在 @"default" 中
+ */
+@property (nonatomic, copy, readonly) NSString *name;
+
+/*!
+ *  @brief 截止时间
+ */
+@property (nonatomic, strong, readonly) NSDate *date;
+
+/*!
+ *  @brief 剩余时间，单位：秒，已经过期时小于等于 0
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval remainingTime;
+
+/*!
+ *  @brief 是否已经过期，到达截止时间或被取消
+ */
+@property (atomic, assign, readonly, getter=isExpired) BOOL expired;
+
+/*!
+ *  @brief 子截止时间
+ *
+ *  @discussion 子截止时间不晚于当前截止时间，当前截止时间过期时子截止时间一起过期，
+ *      用于在总预算内限制某一步的耗时
+ *
+ *  @param budget 子截止时间的预算，单位：秒
+ *
+ *  @return SGSDeadline
+ */
+- (SGSDeadline *)childDeadlineWithBudget:(NSTimeInterval)budget;
+
+/*!
+ *  @brief 将请求的超时时间缩短为剩余时间
+ *
+ *  @param request HTTP 请求
+ *
+ *  @return 超时时间不超过剩余时间的请求，剩余时间更长时返回原请求
+ */
+- (NSURLRequest *)requestByApplyingToRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 添加过期闭包
+ *
+ *  @discussion 过期时在全局队列中执行，已经过期时立即执行并返回 nil，已经调用 finish 时不添加并返回 nil，
+ *      不计为进行中的请求，到达截止时间时不会因此计为超出预算
+ *
+ *  @param handler 过期闭包
+ *
+ *  @return 用于移除闭包的标识
+ */
+- (nullable id)addExpirationHandler:(dispatch_block_t)handler;
+
+/*!
+ *  @brief 添加进行中请求的过期闭包
+ *
+ *  @discussion 与 addExpirationHandler: 相同，但计为一个进行中的请求，
+ *      请求完成后应调用 removeExpirationHandler: 移除，否则到达截止时间时会计为超出预算
+ *
+ *  @param handler 过期闭包，通常用于取消请求
+ *
+ *  @return 用于移除闭包的标识
+ */
+- (nullable id)addRequestExpirationHandler:(dispatch_block_t)handler;
+
+/*!
+ *  @brief 移除过期闭包
+ *
+ *  @param token addExpirationHandler: 或 addRequestExpirationHandler: 返回的标识
+ */
+- (void)removeExpirationHandler:(nullable id)token;
+
+/*!
+ *  @brief 整组请求已经结束
+ *
+ *  @discussion 记录本次耗时，之后到达截止时间时不再执行过期闭包
+ */
+- (void)finish;
+
+/*!
+ *  @brief 立即过期，执行所有过期闭包，不计为超出预算
+ */
+- (void)cancel;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 记录一次发出前已经过期而没有发出的请求
+ */
+- (void)recordRejectedRequest;
+
+/*!
+ *  @brief 所有截止时间的统计数据
+ *
+ *  @discussion 以名称为键，值为包含以下数据的字典：
+ *      - finishedCount：按时结束的次数
+ *      - overrunCount：到达截止时间时仍有进行中请求的次数
+ *      - cancelledCount：被取消的次数
+ *      - expiredRequestCount：因过期被取消的请求数
+ *      - rejectedRequestCount：发出前已经过期而没有发出的请求数
+ *      - averageUsedBudget：按时结束时平均使用的预算比例，0 ~ 1
+ *
+ *  @return 统计数据字典
+ */
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)metrics;
+
+/*!
+ *  @brief 重置统计数据
+ */
++ (void)resetMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,270 @@
+/*!
+ *  @header SGSDeadline.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSDeadline.h"
+#include <pthread.h>
+
+static NSString * const kDeadlineDefaultName = @"default";
+
+#pragma mark - Deadline Stats
+
+/// 同一名称的截止时间的统计数据，通过 p_statsLock 访问，仅内部使用
+@interface p_DeadlineStats : NSObject
+@property (nonatomic, assign) NSUInteger finishedCount;
+@property (nonatomic, assign) NSUInteger overrunCount;
+@property (nonatomic, assign) NSUInteger cancelledCount;
+@property (nonatomic, assign) NSUInteger expiredRequestCount;
+@property (nonatomic, assign) NSUInteger rejectedRequestCount;
+@property (nonatomic, assign) double totalUsedBudget;
+@end
+
+@implementation p_DeadlineStats
+@end
+
+static pthread_mutex_t p_statsLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary<NSString *, p_DeadlineStats *> *p_statsByName;
+
+static void p_updateStats(NSString *name, void (^update)(p_DeadlineStats *stats)) {
+    pthread_mutex_lock(&p_statsLock);
+    if (p_statsByName == nil) p_statsByName = [NSMutableDictionary dictionary];
+
+    p_DeadlineStats *stats = p_statsByName[name];
+    if (stats == nil) {
+        stats = [[p_DeadlineStats alloc] init];
+        p_statsByName[name] = stats;
+    }
+    update(stats);
+    pthread_mutex_unlock(&p_statsLock);
+}
+
+
+#pragma mark - SGSDeadline
+
+@implementation SGSDeadline {
+    CFAbsoluteTime _startTime;
+    CFAbsoluteTime _deadlineTime;
+    BOOL _expired;
+    BOOL _finished;
+
+    NSMutableDictionary<NSNumber *, dispatch_block_t> *_handlers;
+    // 进行中请求的过期闭包的标识
+    NSMutableSet<NSNumber *> *_requestTokens;
+    NSUInteger _nextToken;
+    NSHashTable<SGSDeadline *> *_children;
+}
+
++ (instancetype)deadlineWithBudget:(NSTimeInterval)budget name:(NSString *)name {
+    return [[self alloc] p_initWithDeadlineTime:(CFAbsoluteTimeGetCurrent() + budget) name:name];
+}
+
++ (instancetype)deadlineWithDate:(NSDate *)date name:(NSString *)name {
+    return [[self alloc] p_initWithDeadlineTime:date.timeIntervalSinceReferenceDate name:name];
+}
+
+- (instancetype)p_initWithDeadlineTime:(CFAbsoluteTime)deadlineTime name:(NSString *)name {
+    self = [super init];
+    if (self) {
+        _name = [name copy] ?: kDeadlineDefaultName;
+        _startTime = CFAbsoluteTimeGetCurrent();
+        _deadlineTime = deadlineTime;
+        _handlers = [NSMutableDictionary dictionary];
+        _requestTokens = [NSMutableSet set];
+        _children = [NSHashTable weakObjectsHashTable];
+
+        NSTimeInterval remaining = MAX(deadlineTime - _startTime, 0);
+        __weak typeof(&*self) weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(remaining * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [weakSelf p_expireByCancellation:NO];
+        });
+    }
+    return self;
+}
+
+- (NSDate *)date {
+    return [NSDate dateWithTimeIntervalSinceReferenceDate:_deadlineTime];
+}
+
+- (NSTimeInterval)remainingTime {
+    @synchronized (self) {
+        if (_expired) return MIN(_deadlineTime - CFAbsoluteTimeGetCurrent(), 0);
+    }
+    return _deadlineTime - CFAbsoluteTimeGetCurrent();
+}
+
+- (BOOL)isExpired {
+    @synchronized (self) {
+        if (_expired) return YES;
+    }
+    return (_deadlineTime <= CFAbsoluteTimeGetCurrent());
+}
+
+- (SGSDeadline *)childDeadlineWithBudget:(NSTimeInterval)budget {
+    CFAbsoluteTime deadlineTime = MIN(_deadlineTime, CFAbsoluteTimeGetCurrent() + budget);
+    SGSDeadline *child = [[SGSDeadline alloc] p_initWithDeadlineTime:deadlineTime name:_name];
+
+    BOOL expired = NO;
+    @synchronized (self) {
+        expired = _expired;
+        if (!expired) [_children addObject:child];
+    }
+    if (expired) [child cancel];
+
+    return child;
+}
+
+- (NSURLRequest *)requestByApplyingToRequest:(NSURLRequest *)request {
+    NSTimeInterval remaining = self.remainingTime;
+    if (remaining >= request.timeoutInterval) return request;
+
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    // 超时时间必须大于 0
+    mutableRequest.timeoutInterval = MAX(remaining, 0.001);
+    return mutableRequest;
+}
+
+- (id)addExpirationHandler:(dispatch_block_t)handler {
+    return [self p_addExpirationHandler:handler request:NO];
+}
+
+- (id)addRequestExpirationHandler:(dispatch_block_t)handler {
+    return [self p_addExpirationHandler:handler request:YES];
+}
+
+- (void)removeExpirationHandler:(id)token {
+    if (token == nil) return;
+
+    @synchronized (self) {
+        [_handlers removeObjectForKey:token];
+        [_requestTokens removeObject:token];
+    }
+}
+
+- (void)finish {
+    NSArray<SGSDeadline *> *children = nil;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    @synchronized (self) {
+        if (_expired || _finished) return;
+        _finished = YES;
+        [_handlers removeAllObjects];
+        [_requestTokens removeAllObjects];
+        children = _children.allObjects;
+    }
+
+    NSTimeInterval budget = _deadlineTime - _startTime;
+    double usedBudget = (budget > 0) ? MIN((now - _startTime) / budget, 1) : 1;
+    p_updateStats(_name, ^(p_DeadlineStats *stats) {
+        stats.finishedCount += 1;
+        stats.totalUsedBudget += usedBudget;
+    });
+
+    for (SGSDeadline *child in children) {
+        [child finish];
+    }
+}
+
+- (void)cancel {
+    [self p_expireByCancellation:YES];
+}
+
+
+#pragma mark - Metrics
+
+- (void)recordRejectedRequest {
+    p_updateStats(_name, ^(p_DeadlineStats *stats) {
+        stats.rejectedRequestCount += 1;
+    });
+}
+
++ (NSDictionary<NSString *,NSDictionary<NSString *,NSNumber *> *> *)metrics {
+    NSMutableDictionary *metrics = [NSMutableDictionary dictionary];
+
+    pthread_mutex_lock(&p_statsLock);
+    for (NSString *name in p_statsByName) {
+        p_DeadlineStats *stats = p_statsByName[name];
+        metrics[name] = @{@"finishedCount": @(stats.finishedCount),
+                          @"overrunCount": @(stats.overrunCount),
+                          @"cancelledCount": @(stats.cancelledCount),
+                          @"expiredRequestCount": @(stats.expiredRequestCount),
+                          @"rejectedRequestCount": @(stats.rejectedRequestCount),
+                          @"averageUsedBudget": @((stats.finishedCount > 0) ? (stats.totalUsedBudget / stats.finishedCount) : 0)};
+    }
+    pthread_mutex_unlock(&p_statsLock);
+
+    return metrics;
+}
+
++ (void)resetMetrics {
+    pthread_mutex_lock(&p_statsLock);
+    [p_statsByName removeAllObjects];
+    pthread_mutex_unlock(&p_statsLock);
+}
+
+
+#pragma mark - Private
+
+- (id)p_addExpirationHandler:(dispatch_block_t)handler request:(BOOL)request {
+    if (handler == nil) return nil;
+
+    @synchronized (self) {
+        if (!_expired && (_deadlineTime > CFAbsoluteTimeGetCurrent())) {
+            if (_finished) return nil;
+
+            NSNumber *token = @(_nextToken++);
+            _handlers[token] = [handler copy];
+            if (request) [_requestTokens addObject:token];
+            return token;
+        }
+    }
+
+    // 已经到达截止时间，定时器可能还没有触发
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), handler);
+    return nil;
+}
+
+- (void)p_expireByCancellation:(BOOL)cancelled {
+    NSUInteger requestCount = 0;
+    if (![self p_expireReturningRequestCount:&requestCount]) return;
+
+    p_updateStats(_name, ^(p_DeadlineStats *stats) {
+        if (cancelled) {
+            stats.cancelledCount += 1;
+        } else if (requestCount > 0) {
+            stats.overrunCount += 1;
+        }
+        stats.expiredRequestCount += requestCount;
+    });
+}
+
+// 过期并执行过期闭包，子截止时间一起过期，统计在当前截止时间中，已经过期或结束时返回 NO
+- (BOOL)p_expireReturningRequestCount:(NSUInteger *)requestCount {
+    NSArray<dispatch_block_t> *handlers = nil;
+    NSArray<SGSDeadline *> *children = nil;
+
+    @synchronized (self) {
+        if (_expired) return NO;
+        _expired = YES;
+        if (_finished) return NO;
+
+        handlers = _handlers.allValues;
+        *requestCount += _requestTokens.count;
+        [_handlers removeAllObjects];
+        [_requestTokens removeAllObjects];
+        children = _children.allObjects;
+    }
+
+    for (dispatch_block_t handler in handlers) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), handler);
+    }
+    for (SGSDeadline *child in children) {
+        [child p_expireReturningRequestCount:requestCount];
+    }
+    return YES;
+}
+
+@end
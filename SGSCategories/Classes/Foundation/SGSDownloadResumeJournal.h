@@ -0,0 +1,118 @@
+/*!
+ *  @header SGSDownloadResumeJournal.h
+ *
+ *  @abstract 下载断点数据的持久化记录
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 下载断点数据的持久化记录
+ *
+ *  @discussion 以下载地址为键将断点数据保存在 Caches 目录下，下次下载相同地址时从断点继续，
+ *      超过 maximumAge 的记录视为过期，读取时忽略并删除，创建时会在后台清理一次过期记录
+ *
+ *      应用进入后台时会申请后台时间，在后台剩余时间不足 captureLeadTime 秒时
+ *      取消跟踪中的下载任务并保存断点数据，应用即将终止时也会尝试保存，但不会阻塞主线程
+ *
+ *      写入在后台串行队列中异步进行，写入完成前读取会返回最新的数据
+ *
+ *      只记录没有请求体的 GET 请求，所有方法都是线程安全的
+ */
+@interface SGSDownloadResumeJournal : NSObject
+
+/*!
+ *  @brief 共享的记录
+ */
++ (instancetype)sharedJournal;
+
+/*!
+ *  @brief 初始化
+ *
+ *  @param name 记录名称，不同名称使用不同的磁盘目录
+ *
+ *  @return SGSDownloadResumeJournal
+ */
+- (instancetype)initWithName:(NSString *)name NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 记录名称
+ */
+@property (nonatomic, copy, readonly) NSString *name;
+
+/*!
+ *  @brief 记录的有效期，单位：秒，默认为 7 天
+ */
+@property (atomic, assign) NSTimeInterval maximumAge;
+
+/*!
+ *  @brief 后台剩余时间少于该值时保存跟踪中任务的断点数据，单位：秒，默认为 5
+ */
+@property (atomic, assign) NSTimeInterval captureLeadTime;
+
+/*!
+ *  @brief 获取请求对应的断点数据
+ *
+ *  @param request HTTP 请求
+ *
+ *  @return 断点数据，不存在、已过期或不是 GET 请求时返回 nil
+ */
+- (nullable NSData *)resumeDataForRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 保存断点数据
+ *
+ *  @param resumeData 断点数据
+ *  @param request    HTTP 请求
+ */
+- (void)setResumeData:(NSData *)resumeData forRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 移除请求对应的断点数据
+ *
+ *  @param request HTTP 请求
+ */
+- (void)removeResumeDataForRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 跟踪下载任务，应用被挂起或即将终止前取消任务并保存断点数据
+ *
+ *  @discussion 只弱引用任务，任务完成后自动停止跟踪
+ *
+ *  @param task    下载任务
+ *  @param request 用作键的 HTTP 请求
+ */
+- (void)trackDownloadTask:(NSURLSessionDownloadTask *)task forRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 取消下载任务并保存断点数据
+ *
+ *  @param task       下载任务
+ *  @param request    用作键的 HTTP 请求
+ *  @param completion 保存完毕的回调，可以为空
+ */
+- (void)cancelDownloadTask:(NSURLSessionDownloadTask *)task
+                forRequest:(NSURLRequest *)request
+                completion:(nullable void (^)(NSData * _Nullable resumeData))completion;
+
+/*!
+ *  @brief 移除过期的记录
+ */
+- (void)removeStaleEntries;
+
+/*!
+ *  @brief 移除所有记录
+ */
+- (void)removeAllEntries;
+
+@end
+
+NS_ASSUME_NONNULL_END
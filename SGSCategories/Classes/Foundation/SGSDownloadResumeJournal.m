@@ -0,0 +1,345 @@
+/*!
+ *  @header SGSDownloadResumeJournal.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSDownloadResumeJournal.h"
+#import "NSData+SGS.h"
+
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
+static NSString * const kResumeJournalDirectoryName = @"com.southgis.SGSCategories.DownloadResumeJournal";
+
+@implementation SGSDownloadResumeJournal {
+    NSString *_directory;
+    dispatch_queue_t _ioQueue;
+
+    NSLock *_lock;
+    NSMapTable<NSURLSessionDownloadTask *, NSURLRequest *> *_requestsByTask;
+
+    // 尚未写入磁盘的变更，值为 NSNull 表示等待删除，读取时优先使用
+    NSMutableDictionary<NSString *, id> *_pendingData;
+    NSMutableDictionary<NSString *, NSDate *> *_pendingDates;
+    NSUInteger _pendingRemoveAllCount;
+
+#if TARGET_OS_IPHONE
+    UIBackgroundTaskIdentifier _backgroundTask;
+#endif
+}
+
++ (instancetype)sharedJournal {
+    static SGSDownloadResumeJournal *journal = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        journal = [[SGSDownloadResumeJournal alloc] initWithName:@"default"];
+    });
+    return journal;
+}
+
+- (instancetype)initWithName:(NSString *)name {
+    self = [super init];
+    if (self) {
+        _name = name.copy;
+        _maximumAge = 7 * 24 * 60 * 60;
+        _captureLeadTime = 5;
+
+        _lock = [[NSLock alloc] init];
+        _requestsByTask = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                valueOptions:NSPointerFunctionsStrongMemory];
+        _pendingData = [NSMutableDictionary dictionary];
+        _pendingDates = [NSMutableDictionary dictionary];
+
+        NSString *caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+        _directory = [[caches stringByAppendingPathComponent:kResumeJournalDirectoryName] stringByAppendingPathComponent:name];
+        _ioQueue = dispatch_queue_create("com.southgis.SGSCategories.DownloadResumeJournal.io", DISPATCH_QUEUE_SERIAL);
+
+        dispatch_async(_ioQueue, ^{
+            [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            [self p_removeStaleEntries];
+        });
+
+#if TARGET_OS_IPHONE
+        _backgroundTask = UIBackgroundTaskInvalid;
+
+        NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+        [center addObserver:self selector:@selector(p_applicationDidEnterBackground:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+        [center addObserver:self selector:@selector(p_applicationWillEnterForeground:) name:UIApplicationWillEnterForegroundNotification object:nil];
+        [center addObserver:self selector:@selector(p_applicationWillTerminate:) name:UIApplicationWillTerminateNotification object:nil];
+#endif
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+
+#pragma mark - Public
+
+- (NSData *)resumeDataForRequest:(NSURLRequest *)request {
+    NSString *path = [self p_pathForRequest:request];
+    if (path == nil) return nil;
+
+    NSTimeInterval maximumAge = self.maximumAge;
+
+    // 优先读取尚未写入磁盘的变更，避免在调用线程等待 _ioQueue
+    [_lock lock];
+    id pending = _pendingData[path];
+    NSDate *pendingDate = _pendingDates[path];
+    BOOL removingAll = (_pendingRemoveAllCount > 0);
+    [_lock unlock];
+
+    if (pending != nil) {
+        if ((pending == [NSNull null]) || (-pendingDate.timeIntervalSinceNow > maximumAge)) return nil;
+        return pending;
+    }
+    if (removingAll) return nil;
+
+    // 写入是原子的，可以直接读取文件
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+    if (attributes == nil) return nil;
+
+    if (-[attributes fileModificationDate].timeIntervalSinceNow > maximumAge) {
+        [self removeResumeDataForRequest:request];
+        return nil;
+    }
+
+    return [NSData dataWithContentsOfFile:path];
+}
+
+- (void)setResumeData:(NSData *)resumeData forRequest:(NSURLRequest *)request {
+    NSString *path = [self p_pathForRequest:request];
+    if ((path == nil) || (resumeData.length == 0)) return;
+
+    NSData *data = resumeData.copy;
+    [self p_setPendingObject:data forPath:path];
+
+    dispatch_async(_ioQueue, ^{
+        [data writeToFile:path atomically:YES];
+        [self p_clearPendingObject:data forPath:path];
+    });
+}
+
+- (void)removeResumeDataForRequest:(NSURLRequest *)request {
+    NSString *path = [self p_pathForRequest:request];
+    if (path == nil) return;
+
+    id marker = [NSNull null];
+    [self p_setPendingObject:marker forPath:path];
+
+    dispatch_async(_ioQueue, ^{
+        [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+        [self p_clearPendingObject:marker forPath:path];
+    });
+}
+
+- (void)trackDownloadTask:(NSURLSessionDownloadTask *)task forRequest:(NSURLRequest *)request {
+    if ((task == nil) || ([self p_pathForRequest:request] == nil)) return;
+
+    [_lock lock];
+    [_requestsByTask setObject:request forKey:task];
+    [_lock unlock];
+}
+
+- (void)cancelDownloadTask:(NSURLSessionDownloadTask *)task
+                forRequest:(NSURLRequest *)request
+                completion:(void (^)(NSData *))completion
+{
+    __weak typeof(&*self) weakSelf = self;
+
+    [task cancelByProducingResumeData:^(NSData * _Nullable resumeData) {
+        if (resumeData != nil) {
+            [weakSelf setResumeData:resumeData forRequest:request];
+        }
+        if (completion) completion(resumeData);
+    }];
+}
+
+- (void)removeStaleEntries {
+    NSTimeInterval maximumAge = self.maximumAge;
+
+    id marker = [NSNull null];
+    NSMutableArray<NSString *> *stalePaths = [NSMutableArray array];
+
+    [_lock lock];
+    for (NSString *path in _pendingDates.allKeys) {
+        if (-_pendingDates[path].timeIntervalSinceNow > maximumAge) {
+            _pendingData[path] = marker;
+            [stalePaths addObject:path];
+        }
+    }
+    [_lock unlock];
+
+    dispatch_async(_ioQueue, ^{
+        [self p_removeStaleEntries];
+        for (NSString *path in stalePaths) {
+            [self p_clearPendingObject:marker forPath:path];
+        }
+    });
+}
+
+- (void)removeAllEntries {
+    [_lock lock];
+    [_pendingData removeAllObjects];
+    [_pendingDates removeAllObjects];
+    _pendingRemoveAllCount += 1;
+    [_lock unlock];
+
+    dispatch_async(_ioQueue, ^{
+        [[NSFileManager defaultManager] removeItemAtPath:_directory error:NULL];
+        [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+        [_lock lock];
+        _pendingRemoveAllCount -= 1;
+        [_lock unlock];
+    });
+}
+
+
+#pragma mark - Application Lifecycle
+
+#if TARGET_OS_IPHONE
+// 进入后台后申请后台时间，在即将被挂起前取消跟踪中的任务并保存断点数据，
+// 应用在挂起状态下被系统终止时不会收到任何通知，因此不能等到终止时再保存
+- (void)p_applicationDidEnterBackground:(NSNotification *)notification {
+    UIApplication *application = notification.object;
+    if (![application isKindOfClass:[UIApplication class]] || (_backgroundTask != UIBackgroundTaskInvalid)) return;
+    if ([self p_trackedTasks].count == 0) return;
+
+    __weak typeof(&*self) weakSelf = self;
+    _backgroundTask = [application beginBackgroundTaskWithName:kResumeJournalDirectoryName expirationHandler:^{
+        // 后台时间已耗尽，必须立即结束
+        [weakSelf p_captureTrackedTasksWithCompletion:nil];
+        [weakSelf p_endBackgroundTask];
+    }];
+    if (_backgroundTask == UIBackgroundTaskInvalid) {
+        [self p_captureTrackedTasksWithCompletion:nil];
+        return;
+    }
+
+    UIBackgroundTaskIdentifier backgroundTask = _backgroundTask;
+    NSTimeInterval delay = MAX(0, application.backgroundTimeRemaining - self.captureLeadTime);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        typeof(&*weakSelf) strongSelf = weakSelf;
+        if ((strongSelf == nil) || (strongSelf->_backgroundTask != backgroundTask)) return;
+
+        [strongSelf p_captureTrackedTasksEndingBackgroundTask];
+    });
+}
+
+- (void)p_applicationWillEnterForeground:(NSNotification *)notification {
+    [self p_endBackgroundTask];
+}
+
+- (void)p_captureTrackedTasksEndingBackgroundTask {
+    __weak typeof(&*self) weakSelf = self;
+    [self p_captureTrackedTasksWithCompletion:^{
+        [weakSelf p_endBackgroundTask];
+    }];
+}
+
+- (void)p_endBackgroundTask {
+    if (_backgroundTask == UIBackgroundTaskInvalid) return;
+
+    [[UIApplication sharedApplication] endBackgroundTask:_backgroundTask];
+    _backgroundTask = UIBackgroundTaskInvalid;
+}
+#endif
+
+// 应用即将终止时尽力保存断点数据，不阻塞主线程
+- (void)p_applicationWillTerminate:(NSNotification *)notification {
+    [self p_captureTrackedTasksWithCompletion:nil];
+}
+
+- (NSArray<NSURLSessionDownloadTask *> *)p_trackedTasks {
+    NSMutableArray<NSURLSessionDownloadTask *> *tasks = [NSMutableArray array];
+
+    [_lock lock];
+    for (NSURLSessionDownloadTask *task in _requestsByTask.keyEnumerator) {
+        if ((task.state == NSURLSessionTaskStateRunning) || (task.state == NSURLSessionTaskStateSuspended)) {
+            [tasks addObject:task];
+        }
+    }
+    [_lock unlock];
+
+    return tasks;
+}
+
+// 取消所有跟踪中的任务并保存断点数据，全部写入磁盘后在主线程回调
+- (void)p_captureTrackedTasksWithCompletion:(dispatch_block_t)completion {
+    NSArray<NSURLSessionDownloadTask *> *tasks = [self p_trackedTasks];
+    dispatch_group_t group = dispatch_group_create();
+
+    for (NSURLSessionDownloadTask *task in tasks) {
+        [_lock lock];
+        NSURLRequest *request = [_requestsByTask objectForKey:task];
+        [_lock unlock];
+        if (request == nil) continue;
+
+        dispatch_group_enter(group);
+        [self cancelDownloadTask:task forRequest:request completion:^(NSData *resumeData) {
+            dispatch_group_leave(group);
+        }];
+    }
+
+    if (completion == nil) return;
+
+    dispatch_queue_t ioQueue = _ioQueue;
+    dispatch_group_notify(group, ioQueue, ^{
+        // 排在已提交的写入之后
+        dispatch_async(dispatch_get_main_queue(), completion);
+    });
+}
+
+
+#pragma mark - Private
+
+- (NSString *)p_pathForRequest:(NSURLRequest *)request {
+    NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+    if (![method isEqualToString:@"GET"] || (request.HTTPBody != nil) || (request.HTTPBodyStream != nil)) return nil;
+
+    NSData *data = [request.URL.absoluteString dataUsingEncoding:NSUTF8StringEncoding];
+    if (data == nil) return nil;
+
+    return [_directory stringByAppendingPathComponent:[data sha256HexString]];
+}
+
+- (void)p_setPendingObject:(id)object forPath:(NSString *)path {
+    [_lock lock];
+    _pendingData[path] = object;
+    _pendingDates[path] = [NSDate date];
+    [_lock unlock];
+}
+
+// 写入完成后只清除本次提交的变更，之后提交的变更仍然有效
+- (void)p_clearPendingObject:(id)object forPath:(NSString *)path {
+    [_lock lock];
+    if (_pendingData[path] == object) {
+        [_pendingData removeObjectForKey:path];
+        [_pendingDates removeObjectForKey:path];
+    }
+    [_lock unlock];
+}
+
+// 只在 _ioQueue 中调用
+- (void)p_removeStaleEntries {
+    NSTimeInterval maximumAge = self.maximumAge;
+    NSURL *directoryURL = [NSURL fileURLWithPath:_directory isDirectory:YES];
+    NSArray<NSURL *> *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:directoryURL includingPropertiesForKeys:@[NSURLContentModificationDateKey] options:NSDirectoryEnumerationSkipsHiddenFiles error:NULL];
+
+    for (NSURL *url in files) {
+        NSDate *date = nil;
+        [url getResourceValue:&date forKey:NSURLContentModificationDateKey error:NULL];
+        if ((date == nil) || (-date.timeIntervalSinceNow > maximumAge)) {
+            [[NSFileManager defaultManager] removeItemAtURL:url error:NULL];
+        }
+    }
+}
+
+@end
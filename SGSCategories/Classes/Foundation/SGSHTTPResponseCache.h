@@ -0,0 +1,300 @@
+/*!
+ *  @header SGSHTTPResponseCache.h
+ *
+ *  @abstract 内存 + 磁盘两级 HTTP 响应缓存
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 使用响应头计算缓存有效期
+ */
+FOUNDATION_EXPORT const NSTimeInterval SGSHTTPCacheTimeToLiveAutomatic;
+
+/*!
+ *  @brief 缓存的响应
+ */
+@interface SGSCachedResponse : NSObject
+
+/*!
+ *  @brief 响应
+ */
+@property (nonatomic, strong, readonly) NSHTTPURLResponse *response;
+
+/*!
+ *  @brief 响应数据
+ */
+@property (nonatomic, strong, readonly) NSData *data;
+
+/*!
+ *  @brief 缓存时间
+ */
+@property (nonatomic, strong, readonly) NSDate *storedDate;
+
+/*!
+ *  @brief 过期时间，过期后需要重新验证
+ */
+@property (nonatomic, strong, readonly) NSDate *expirationDate;
+
+/*!
+ *  @brief 过期后仍可以先返回缓存、同时在后台重新验证的截止时间
+ */
+@property (nonatomic, strong, readonly) NSDate *staleWhileRevalidateDate;
+
+/*!
+ *  @brief 响应头中的 ETag
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *ETag;
+
+/*!
+ *  @brief 响应头中的 Last-Modified
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *lastModified;
+
+/*!
+ *  @brief 是否在有效期内
+ */
+@property (nonatomic, assign, readonly, getter=isFresh) BOOL fresh;
+
+/*!
+ *  @brief 是否可以先返回缓存再在后台重新验证
+ */
+@property (nonatomic, assign, readonly) BOOL canServeWhileRevalidating;
+
+/*!
+ *  @brief 是否可以重新验证（存在 ETag 或 Last-Modified）
+ */
+@property (nonatomic, assign, readonly) BOOL canRevalidate;
+
+@end
+
+
+/*!
+ *  @brief 内存 + 磁盘两级 HTTP 响应缓存
+ *
+ *  @discussion 内存缓存使用 LRU 淘汰策略，磁盘缓存按最近访问时间淘汰，
+ *      内存缓存还可以保存 filter 解析后的对象，命中时可以跳过 JSON 解析
+ *
+ *      缓存有效期优先使用调用方指定的值，其次依次使用响应头中的 Cache-Control: max-age、Expires 以及 defaultTimeToLive，
+ *      过期后使用 ETag / Last-Modified 重新验证；
+ *      Cache-Control: stale-while-revalidate 或 staleWhileRevalidateInterval 时间内先返回过期缓存并在后台重新验证；
+ *      响应头包含 Cache-Control: no-store 时不缓存
+ *
+ *      缓存以 GET 请求的 URL 和 varyingHeaderFields 中的请求头作为键，
+ *      同时保存响应头 Vary 中列出的请求头的值，读取时这些请求头的值不一致视为未命中，
+ *      响应头包含 Vary: * 时不缓存
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSHTTPResponseCache : NSObject
+
+/*!
+ *  @brief 共享的缓存，内存容量 4 MB，磁盘容量 50 MB
+ */
++ (instancetype)sharedCache;
+
+/*!
+ *  @brief 初始化缓存
+ *
+ *  @param name           缓存名称，不同名称使用不同的磁盘目录
+ *  @param memoryCapacity 内存容量，单位：字节
+ *  @param diskCapacity   磁盘容量，单位：字节
+ *
+ *  @return SGSHTTPResponseCache
+ */
+- (instancetype)initWithName:(NSString *)name
+              memoryCapacity:(NSUInteger)memoryCapacity
+                diskCapacity:(NSUInteger)diskCapacity NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 缓存名称
+ */
+@property (nonatomic, copy, readonly) NSString *name;
+
+/*!
+ *  @brief 内存容量，单位：字节
+ */
+@property (atomic, assign) NSUInteger memoryCapacity;
+
+/*!
+ *  @brief 磁盘容量，单位：字节
+ */
+@property (atomic, assign) NSUInteger diskCapacity;
+
+/*!
+ *  @brief 单个响应的最大缓存大小，超过该大小不缓存，默认为磁盘容量的 1/10
+ */
+@property (atomic, assign) NSUInteger maximumEntrySize;
+
+/*!
+ *  @brief 参与计算缓存键的请求头，默认为 Accept、Accept-Language、Authorization
+ */
+@property (atomic, copy) NSArray<NSString *> *varyingHeaderFields;
+
+/*!
+ *  @brief 响应头中没有缓存有效期时使用的有效期，默认为 0，即每次都需要重新验证
+ */
+@property (atomic, assign) NSTimeInterval defaultTimeToLive;
+
+/*!
+ *  @brief 响应头中没有 stale-while-revalidate 时使用的值，默认为 0
+ */
+@property (atomic, assign) NSTimeInterval staleWhileRevalidateInterval;
+
+/*!
+ *  @brief 当前内存缓存占用的大小，单位：字节
+ */
+@property (nonatomic, assign, readonly) NSUInteger currentMemoryUsage;
+
+/*!
+ *  @brief 当前磁盘缓存占用的大小，单位：字节
+ */
+@property (nonatomic, assign, readonly) NSUInteger currentDiskUsage;
+
+/*!
+ *  @brief 获取缓存的响应，依次查找内存和磁盘
+ *
+ *  @discussion 可能会读取磁盘，建议在后台线程中调用
+ *
+ *  @param request HTTP 请求
+ *
+ *  @return SGSCachedResponse or nil
+ */
+- (nullable SGSCachedResponse *)cachedResponseForRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 缓存响应
+ *
+ *  @param data          响应数据
+ *  @param response      响应
+ *  @param decodedObject filter 解析后的对象，只保存在内存中
+ *  @param filter        解析 decodedObject 所使用的过滤闭包
+ *  @param request       HTTP 请求
+ *  @param timeToLive    有效期，SGSHTTPCacheTimeToLiveAutomatic 表示根据响应头计算
+ *
+ *  @return 缓存的响应，不满足缓存条件时返回 nil
+ */
+- (nullable SGSCachedResponse *)storeData:(NSData *)data
+                                 response:(NSHTTPURLResponse *)response
+                            decodedObject:(nullable id)decodedObject
+                                   filter:(nullable id)filter
+                               forRequest:(NSURLRequest *)request
+                               timeToLive:(NSTimeInterval)timeToLive;
+
+/*!
+ *  @brief 收到 304 Not Modified 后更新缓存的有效期
+ *
+ *  @param cachedResponse 缓存的响应
+ *  @param response       304 响应
+ *  @param request        HTTP 请求
+ *  @param timeToLive     有效期，SGSHTTPCacheTimeToLiveAutomatic 表示根据响应头计算
+ *
+ *  @return 更新后的缓存响应
+ */
+- (SGSCachedResponse *)refreshCachedResponse:(SGSCachedResponse *)cachedResponse
+                     withNotModifiedResponse:(NSHTTPURLResponse *)response
+                                  forRequest:(NSURLRequest *)request
+                                  timeToLive:(NSTimeInterval)timeToLive;
+
+/*!
+ *  @brief 获取 filter 解析后的对象
+ *
+ *  @param filter         过滤闭包
+ *  @param cachedResponse 缓存的响应
+ *
+ *  @return 解析后的对象，不存在时返回 nil
+ */
+- (nullable id)decodedObjectForFilter:(id)filter inCachedResponse:(SGSCachedResponse *)cachedResponse;
+
+/*!
+ *  @brief 保存 filter 解析后的对象到内存缓存
+ *
+ *  @param decodedObject  解析后的对象
+ *  @param filter         过滤闭包
+ *  @param cachedResponse 缓存的响应
+ */
+- (void)setDecodedObject:(id)decodedObject forFilter:(id)filter inCachedResponse:(SGSCachedResponse *)cachedResponse;
+
+/*!
+ *  @brief 移除请求对应的缓存
+ *
+ *  @param request HTTP 请求
+ */
+- (void)removeCachedResponseForRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 移除所有缓存
+ */
+- (void)removeAllCachedResponses;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 命中有效缓存的次数
+ */
+@property (nonatomic, assign, readonly) NSUInteger hitCount;
+
+/*!
+ *  @brief 返回过期缓存的次数（后台重新验证或离线）
+ */
+@property (nonatomic, assign, readonly) NSUInteger staleHitCount;
+
+/*!
+ *  @brief 未命中的次数
+ */
+@property (nonatomic, assign, readonly) NSUInteger missCount;
+
+/*!
+ *  @brief 重新验证后缓存仍然有效（304）的次数
+ */
+@property (nonatomic, assign, readonly) NSUInteger notModifiedCount;
+
+/*!
+ *  @brief 命中内存中解析后对象的次数
+ */
+@property (nonatomic, assign, readonly) NSUInteger decodedObjectHitCount;
+
+/*!
+ *  @brief 因容量限制被淘汰的缓存数
+ */
+@property (nonatomic, assign, readonly) NSUInteger evictionCount;
+
+/*!
+ *  @brief 记录一次命中
+ *
+ *  @param stale 是否为过期缓存
+ */
+- (void)recordHitWithStale:(BOOL)stale;
+
+/*!
+ *  @brief 记录一次未命中
+ */
+- (void)recordMiss;
+
+/*!
+ *  @brief 所有统计数据
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSNumber *> *)metrics;
+
+/*!
+ *  @brief 重置统计数据
+ */
+- (void)resetMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,697 @@
+/*!
+ *  @header SGSHTTPResponseCache.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSHTTPResponseCache.h"
+#import "NSDateFormatter+SGS.h"
+#import "NSData+SGS.h"
+#include <pthread.h>
+
+const NSTimeInterval SGSHTTPCacheTimeToLiveAutomatic = -1;
+
+static NSString * const kHTTPCacheDirectoryName = @"com.southgis.SGSCategories.HTTPResponseCache";
+
+static NSString * const kArchiveResponseKey       = @"response";
+static NSString * const kArchiveDataKey           = @"data";
+static NSString * const kArchiveStoredDateKey     = @"storedDate";
+static NSString * const kArchiveExpirationDateKey = @"expirationDate";
+static NSString * const kArchiveStaleDateKey      = @"staleWhileRevalidateDate";
+static NSString * const kArchiveVaryingHeadersKey = @"varyingHeaders";
+
+// 不区分大小写地读取响应头
+static NSString * p_headerValue(NSHTTPURLResponse *response, NSString *field) {
+    for (NSString *key in response.allHeaderFields) {
+        if ([key caseInsensitiveCompare:field] == NSOrderedSame) {
+            return response.allHeaderFields[key];
+        }
+    }
+    return nil;
+}
+
+// 响应头 Vary 中列出的请求头名称，Vary: * 时返回 nil
+static NSArray<NSString *> * p_varyFieldNames(NSHTTPURLResponse *response) {
+    NSString *vary = p_headerValue(response, @"Vary");
+    NSMutableArray<NSString *> *names = [NSMutableArray array];
+    for (NSString *component in [vary componentsSeparatedByString:@","]) {
+        NSString *name = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]].lowercaseString;
+        if ([name isEqualToString:@"*"]) return nil;
+        if (name.length > 0) [names addObject:name];
+    }
+    return names;
+}
+
+
+#pragma mark - SGSCachedResponse
+
+@interface SGSCachedResponse ()
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong, readwrite) NSHTTPURLResponse *response;
+@property (nonatomic, strong, readwrite) NSData *data;
+@property (nonatomic, strong, readwrite) NSDate *storedDate;
+@property (nonatomic, strong, readwrite) NSDate *expirationDate;
+@property (nonatomic, strong, readwrite) NSDate *staleWhileRevalidateDate;
+/// Vary 中的请求头（小写）及缓存时请求中的值，请求中没有该请求头时值为空字符串
+@property (nonatomic, copy) NSDictionary<NSString *, NSString *> *varyingHeaders;
+@property (nonatomic, strong) NSMapTable *decodedObjectsByFilter;
+@end
+
+@implementation SGSCachedResponse
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _decodedObjectsByFilter = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                        valueOptions:NSPointerFunctionsStrongMemory];
+    }
+    return self;
+}
+
+- (NSString *)ETag {
+    return p_headerValue(self.response, @"ETag");
+}
+
+- (NSString *)lastModified {
+    return p_headerValue(self.response, @"Last-Modified");
+}
+
+- (BOOL)isFresh {
+    return [self.expirationDate timeIntervalSinceNow] > 0;
+}
+
+- (BOOL)canServeWhileRevalidating {
+    return [self.staleWhileRevalidateDate timeIntervalSinceNow] > 0;
+}
+
+- (BOOL)canRevalidate {
+    return (self.ETag != nil) || (self.lastModified != nil);
+}
+
+- (BOOL)p_matchesRequest:(NSURLRequest *)request {
+    __block BOOL matches = YES;
+    [self.varyingHeaders enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *value, BOOL *stop) {
+        NSString *requestValue = [request valueForHTTPHeaderField:field] ?: @"";
+        if (![requestValue isEqualToString:value]) {
+            matches = NO;
+            *stop = YES;
+        }
+    }];
+    return matches;
+}
+
+- (id)p_decodedObjectForFilter:(id)filter {
+    @synchronized (self) {
+        return [self.decodedObjectsByFilter objectForKey:filter];
+    }
+}
+
+- (void)p_setDecodedObject:(id)decodedObject forFilter:(id)filter {
+    @synchronized (self) {
+        [self.decodedObjectsByFilter setObject:decodedObject forKey:filter];
+    }
+}
+
+@end
+
+
+#pragma mark - LRU Node
+
+/// 内存缓存双向链表节点，仅内部使用
+@interface p_HTTPCacheLRUNode : NSObject {
+    @package
+    __unsafe_unretained p_HTTPCacheLRUNode *_prev;
+    __unsafe_unretained p_HTTPCacheLRUNode *_next;
+    NSString *_key;
+    SGSCachedResponse *_value;
+    NSUInteger _cost;
+}
+@end
+
+@implementation p_HTTPCacheLRUNode
+@end
+
+
+#pragma mark - SGSHTTPResponseCache
+
+@implementation SGSHTTPResponseCache {
+    pthread_mutex_t _lock;
+    NSMutableDictionary<NSString *, p_HTTPCacheLRUNode *> *_nodesByKey;
+    p_HTTPCacheLRUNode *_head;
+    p_HTTPCacheLRUNode *_tail;
+    NSUInteger _totalCost;
+
+    NSString *_directory;
+    dispatch_queue_t _ioQueue;
+    NSUInteger _diskUsage;
+
+    NSUInteger _hitCount;
+    NSUInteger _staleHitCount;
+    NSUInteger _missCount;
+    NSUInteger _notModifiedCount;
+    NSUInteger _decodedObjectHitCount;
+    NSUInteger _evictionCount;
+}
+
++ (instancetype)sharedCache {
+    static SGSHTTPResponseCache *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[SGSHTTPResponseCache alloc] initWithName:@"default" memoryCapacity:4 * 1024 * 1024 diskCapacity:50 * 1024 * 1024];
+    });
+
+    return cache;
+}
+
+- (instancetype)initWithName:(NSString *)name memoryCapacity:(NSUInteger)memoryCapacity diskCapacity:(NSUInteger)diskCapacity {
+    self = [super init];
+    if (self) {
+        _name = name.copy;
+        _memoryCapacity = memoryCapacity;
+        _diskCapacity = diskCapacity;
+        _maximumEntrySize = diskCapacity / 10;
+        _varyingHeaderFields = @[@"Accept", @"Accept-Language", @"Authorization"];
+
+        pthread_mutex_init(&_lock, NULL);
+        _nodesByKey = [NSMutableDictionary dictionary];
+
+        NSString *caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+        _directory = [[caches stringByAppendingPathComponent:kHTTPCacheDirectoryName] stringByAppendingPathComponent:name];
+        _ioQueue = dispatch_queue_create("com.southgis.SGSCategories.HTTPResponseCache.io", DISPATCH_QUEUE_SERIAL);
+
+        dispatch_async(_ioQueue, ^{
+            [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            _diskUsage = [self p_calculateDiskUsage];
+        });
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+
+#pragma mark - Public
+
+- (NSUInteger)currentMemoryUsage {
+    pthread_mutex_lock(&_lock);
+    NSUInteger cost = _totalCost;
+    pthread_mutex_unlock(&_lock);
+    return cost;
+}
+
+- (NSUInteger)currentDiskUsage {
+    __block NSUInteger usage = 0;
+    dispatch_sync(_ioQueue, ^{
+        usage = _diskUsage;
+    });
+    return usage;
+}
+
+- (SGSCachedResponse *)cachedResponseForRequest:(NSURLRequest *)request {
+    NSString *key = [self p_keyForRequest:request];
+    if (key == nil) return nil;
+
+    pthread_mutex_lock(&_lock);
+    p_HTTPCacheLRUNode *node = _nodesByKey[key];
+    if (node) [self p_bringNodeToHead:node];
+    SGSCachedResponse *cached = node ? node->_value : nil;
+    pthread_mutex_unlock(&_lock);
+
+    if (cached) return [cached p_matchesRequest:request] ? cached : nil;
+
+    __block NSDictionary *archive = nil;
+    NSString *path = [self p_pathForKey:key];
+    dispatch_sync(_ioQueue, ^{
+        NSData *archived = [NSData dataWithContentsOfFile:path];
+        if (archived == nil) return;
+
+        // 只解码缓存归档中会出现的类，避免磁盘上被篡改的文件实例化任意类
+        @try {
+            NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:archived];
+            unarchiver.requiresSecureCoding = YES;
+            archive = [unarchiver decodeObjectOfClasses:[SGSHTTPResponseCache p_archiveClasses] forKey:NSKeyedArchiveRootObjectKey];
+            [unarchiver finishDecoding];
+        } @catch (NSException *exception) {
+            archive = nil;
+        }
+
+        if ([archive isKindOfClass:[NSDictionary class]]) {
+            // 更新修改时间作为最近访问时间，用于磁盘淘汰
+            [[NSFileManager defaultManager] setAttributes:@{NSFileModificationDate: [NSDate date]} ofItemAtPath:path error:NULL];
+        } else {
+            archive = nil;
+            [self p_removeFileAtPath:path];
+        }
+    });
+
+    if (archive == nil) return nil;
+
+    cached = [[SGSCachedResponse alloc] init];
+    cached.key = key;
+    cached.response = archive[kArchiveResponseKey];
+    cached.data = archive[kArchiveDataKey];
+    cached.storedDate = archive[kArchiveStoredDateKey];
+    cached.expirationDate = archive[kArchiveExpirationDateKey];
+    cached.staleWhileRevalidateDate = archive[kArchiveStaleDateKey];
+    cached.varyingHeaders = archive[kArchiveVaryingHeadersKey] ?: @{};
+
+    if (![cached.response isKindOfClass:[NSHTTPURLResponse class]] ||
+        ![cached.data isKindOfClass:[NSData class]] ||
+        ![cached.storedDate isKindOfClass:[NSDate class]] ||
+        ![cached.expirationDate isKindOfClass:[NSDate class]]) return nil;
+    if (![cached.staleWhileRevalidateDate isKindOfClass:[NSDate class]]) cached.staleWhileRevalidateDate = nil;
+    if (![cached.varyingHeaders isKindOfClass:[NSDictionary class]]) cached.varyingHeaders = @{};
+    if (cached.staleWhileRevalidateDate == nil) cached.staleWhileRevalidateDate = cached.expirationDate;
+
+    [self p_setMemoryObject:cached forKey:key];
+    return [cached p_matchesRequest:request] ? cached : nil;
+}
+
+- (SGSCachedResponse *)storeData:(NSData *)data
+                        response:(NSHTTPURLResponse *)response
+                   decodedObject:(id)decodedObject
+                          filter:(id)filter
+                      forRequest:(NSURLRequest *)request
+                      timeToLive:(NSTimeInterval)timeToLive
+{
+    NSString *key = [self p_keyForRequest:request];
+    if ((key == nil) || (data == nil) || ![response isKindOfClass:[NSHTTPURLResponse class]]) return nil;
+    if ((response.statusCode != 200) || (data.length > self.maximumEntrySize)) return nil;
+
+    NSTimeInterval staleInterval = 0;
+    BOOL noStore = NO;
+    NSTimeInterval ttl = [self p_timeToLiveForResponse:response requested:timeToLive staleInterval:&staleInterval noStore:&noStore];
+
+    // Vary: * 表示响应可能随任意请求头变化，无法复用
+    NSArray<NSString *> *varyFields = p_varyFieldNames(response);
+    if (noStore || (varyFields == nil)) {
+        [self removeCachedResponseForRequest:request];
+        return nil;
+    }
+
+    NSMutableDictionary<NSString *, NSString *> *varyingHeaders = [NSMutableDictionary dictionaryWithCapacity:varyFields.count];
+    for (NSString *field in varyFields) {
+        varyingHeaders[field] = [request valueForHTTPHeaderField:field] ?: @"";
+    }
+
+    SGSCachedResponse *cached = [[SGSCachedResponse alloc] init];
+    cached.key = key;
+    cached.response = response;
+    cached.data = data;
+    cached.storedDate = [NSDate date];
+    cached.expirationDate = [cached.storedDate dateByAddingTimeInterval:ttl];
+    cached.staleWhileRevalidateDate = [cached.expirationDate dateByAddingTimeInterval:staleInterval];
+    cached.varyingHeaders = varyingHeaders;
+    if ((decodedObject != nil) && (filter != nil)) {
+        [cached p_setDecodedObject:decodedObject forFilter:filter];
+    }
+
+    [self p_setMemoryObject:cached forKey:key];
+    [self p_writeCachedResponseToDisk:cached];
+
+    return cached;
+}
+
+- (SGSCachedResponse *)refreshCachedResponse:(SGSCachedResponse *)cachedResponse
+                     withNotModifiedResponse:(NSHTTPURLResponse *)response
+                                  forRequest:(NSURLRequest *)request
+                                  timeToLive:(NSTimeInterval)timeToLive
+{
+    pthread_mutex_lock(&_lock);
+    _notModifiedCount += 1;
+    pthread_mutex_unlock(&_lock);
+
+    // 304 响应可能携带新的缓存控制头，否则沿用原响应头
+    NSHTTPURLResponse *headerSource = (p_headerValue(response, @"Cache-Control") || p_headerValue(response, @"Expires")) ? response : cachedResponse.response;
+
+    NSTimeInterval staleInterval = 0;
+    BOOL noStore = NO;
+    NSTimeInterval ttl = [self p_timeToLiveForResponse:headerSource requested:timeToLive staleInterval:&staleInterval noStore:&noStore];
+
+    cachedResponse.storedDate = [NSDate date];
+    cachedResponse.expirationDate = [cachedResponse.storedDate dateByAddingTimeInterval:ttl];
+    cachedResponse.staleWhileRevalidateDate = [cachedResponse.expirationDate dateByAddingTimeInterval:staleInterval];
+
+    if (noStore) {
+        [self removeCachedResponseForRequest:request];
+    } else {
+        [self p_setMemoryObject:cachedResponse forKey:cachedResponse.key];
+        [self p_writeCachedResponseToDisk:cachedResponse];
+    }
+
+    return cachedResponse;
+}
+
+- (id)decodedObjectForFilter:(id)filter inCachedResponse:(SGSCachedResponse *)cachedResponse {
+    if (filter == nil) return nil;
+
+    id obj = [cachedResponse p_decodedObjectForFilter:filter];
+    if (obj != nil) {
+        pthread_mutex_lock(&_lock);
+        _decodedObjectHitCount += 1;
+        pthread_mutex_unlock(&_lock);
+    }
+    return obj;
+}
+
+- (void)setDecodedObject:(id)decodedObject forFilter:(id)filter inCachedResponse:(SGSCachedResponse *)cachedResponse {
+    if ((decodedObject == nil) || (filter == nil)) return;
+    [cachedResponse p_setDecodedObject:decodedObject forFilter:filter];
+}
+
+- (void)removeCachedResponseForRequest:(NSURLRequest *)request {
+    NSString *key = [self p_keyForRequest:request];
+    if (key == nil) return;
+
+    pthread_mutex_lock(&_lock);
+    p_HTTPCacheLRUNode *node = _nodesByKey[key];
+    if (node) [self p_removeNode:node];
+    pthread_mutex_unlock(&_lock);
+
+    NSString *path = [self p_pathForKey:key];
+    dispatch_async(_ioQueue, ^{
+        [self p_removeFileAtPath:path];
+    });
+}
+
+- (void)removeAllCachedResponses {
+    pthread_mutex_lock(&_lock);
+    [_nodesByKey removeAllObjects];
+    _head = nil;
+    _tail = nil;
+    _totalCost = 0;
+    pthread_mutex_unlock(&_lock);
+
+    dispatch_async(_ioQueue, ^{
+        [[NSFileManager defaultManager] removeItemAtPath:_directory error:NULL];
+        [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+        _diskUsage = 0;
+    });
+}
+
+
+#pragma mark - Metrics
+
+- (NSUInteger)hitCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _hitCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)staleHitCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _staleHitCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)missCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _missCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)notModifiedCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _notModifiedCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)decodedObjectHitCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _decodedObjectHitCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)evictionCount {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = _evictionCount;
+    pthread_mutex_unlock(&_lock);
+    return count;
+}
+
+- (void)recordHitWithStale:(BOOL)stale {
+    pthread_mutex_lock(&_lock);
+    if (stale) {
+        _staleHitCount += 1;
+    } else {
+        _hitCount += 1;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+- (void)recordMiss {
+    pthread_mutex_lock(&_lock);
+    _missCount += 1;
+    pthread_mutex_unlock(&_lock);
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)metrics {
+    pthread_mutex_lock(&_lock);
+    NSDictionary *metrics = @{@"hitCount": @(_hitCount),
+                              @"staleHitCount": @(_staleHitCount),
+                              @"missCount": @(_missCount),
+                              @"notModifiedCount": @(_notModifiedCount),
+                              @"decodedObjectHitCount": @(_decodedObjectHitCount),
+                              @"evictionCount": @(_evictionCount),
+                              @"memoryUsage": @(_totalCost),
+                              @"memoryCount": @(_nodesByKey.count)};
+    pthread_mutex_unlock(&_lock);
+
+    return metrics;
+}
+
+- (void)resetMetrics {
+    pthread_mutex_lock(&_lock);
+    _hitCount = 0;
+    _staleHitCount = 0;
+    _missCount = 0;
+    _notModifiedCount = 0;
+    _decodedObjectHitCount = 0;
+    _evictionCount = 0;
+    pthread_mutex_unlock(&_lock);
+}
+
+
+#pragma mark - Freshness
+
+- (NSTimeInterval)p_timeToLiveForResponse:(NSHTTPURLResponse *)response
+                                requested:(NSTimeInterval)timeToLive
+                            staleInterval:(NSTimeInterval *)staleInterval
+                                  noStore:(BOOL *)noStore
+{
+    NSTimeInterval maxAge = -1;
+    *staleInterval = self.staleWhileRevalidateInterval;
+    *noStore = NO;
+
+    NSString *cacheControl = p_headerValue(response, @"Cache-Control");
+    for (NSString *component in [cacheControl.lowercaseString componentsSeparatedByString:@","]) {
+        NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([directive isEqualToString:@"no-store"]) {
+            *noStore = YES;
+        } else if ([directive isEqualToString:@"no-cache"]) {
+            maxAge = 0;
+        } else if ([directive hasPrefix:@"max-age="] && (maxAge != 0)) {
+            maxAge = [[directive substringFromIndex:8] doubleValue];
+        } else if ([directive hasPrefix:@"stale-while-revalidate="]) {
+            *staleInterval = [[directive substringFromIndex:23] doubleValue];
+        }
+    }
+
+    if (timeToLive >= 0) return timeToLive;
+    if (maxAge >= 0) return maxAge;
+
+    NSString *expires = p_headerValue(response, @"Expires");
+    if (expires != nil) {
+        NSDateFormatter *formatter = [NSDateFormatter RFC1123DateFormatter];
+        NSDate *expiresDate = nil;
+        NSDate *serverDate = nil;
+        @synchronized (formatter) {
+            expiresDate = [formatter dateFromString:expires];
+            NSString *date = p_headerValue(response, @"Date");
+            serverDate = date ? [formatter dateFromString:date] : nil;
+        }
+        // 无法解析的 Expires（例如 "0"）表示已过期
+        if (expiresDate == nil) return 0;
+        return MAX(0, [expiresDate timeIntervalSinceDate:(serverDate ?: [NSDate date])]);
+    }
+
+    return MAX(0, self.defaultTimeToLive);
+}
+
+
+#pragma mark - Memory
+
+- (void)p_setMemoryObject:(SGSCachedResponse *)cached forKey:(NSString *)key {
+    NSUInteger cost = cached.data.length;
+
+    pthread_mutex_lock(&_lock);
+    p_HTTPCacheLRUNode *node = _nodesByKey[key];
+    if (node) {
+        _totalCost = _totalCost - node->_cost + cost;
+        node->_value = cached;
+        node->_cost = cost;
+        [self p_bringNodeToHead:node];
+    } else {
+        node = [[p_HTTPCacheLRUNode alloc] init];
+        node->_key = key;
+        node->_value = cached;
+        node->_cost = cost;
+        _nodesByKey[key] = node;
+        _totalCost += cost;
+        [self p_insertNodeAtHead:node];
+    }
+
+    NSUInteger capacity = self.memoryCapacity;
+    while ((_totalCost > capacity) && (_tail != nil)) {
+        [self p_removeNode:_tail];
+        _evictionCount += 1;
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+// 以下链表操作调用时需持有锁
+- (void)p_insertNodeAtHead:(p_HTTPCacheLRUNode *)node {
+    node->_prev = nil;
+    node->_next = _head;
+    if (_head) _head->_prev = node;
+    _head = node;
+    if (_tail == nil) _tail = node;
+}
+
+- (void)p_bringNodeToHead:(p_HTTPCacheLRUNode *)node {
+    if (_head == node) return;
+
+    if (_tail == node) {
+        _tail = node->_prev;
+        _tail->_next = nil;
+    } else {
+        node->_next->_prev = node->_prev;
+        node->_prev->_next = node->_next;
+    }
+    [self p_insertNodeAtHead:node];
+}
+
+- (void)p_removeNode:(p_HTTPCacheLRUNode *)node {
+    if (node->_prev) node->_prev->_next = node->_next;
+    if (node->_next) node->_next->_prev = node->_prev;
+    if (_head == node) _head = node->_next;
+    if (_tail == node) _tail = node->_prev;
+    _totalCost -= node->_cost;
+    [_nodesByKey removeObjectForKey:node->_key];
+}
+
+
+#pragma mark - Disk
+
+- (NSString *)p_keyForRequest:(NSURLRequest *)request {
+    NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+    if (![method isEqualToString:@"GET"] || (request.URL == nil)) return nil;
+
+    NSMutableString *key = [NSMutableString stringWithString:request.URL.absoluteString];
+    for (NSString *field in self.varyingHeaderFields) {
+        NSString *value = [request valueForHTTPHeaderField:field];
+        if (value != nil) {
+            [key appendFormat:@"\n%@: %@", field.lowercaseString, value];
+        }
+    }
+    return key;
+}
+
++ (NSSet<Class> *)p_archiveClasses {
+    static NSSet<Class> *classes = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        classes = [NSSet setWithObjects:[NSDictionary class], [NSCachedURLResponse class], [NSHTTPURLResponse class],
+                   [NSData class], [NSString class], [NSDate class], [NSNumber class], nil];
+    });
+    return classes;
+}
+
+- (NSString *)p_pathForKey:(NSString *)key {
+    NSString *filename = [[key dataUsingEncoding:NSUTF8StringEncoding] sha256HexString];
+    return [_directory stringByAppendingPathComponent:filename];
+}
+
+- (void)p_writeCachedResponseToDisk:(SGSCachedResponse *)cached {
+    NSDictionary *archive = @{kArchiveResponseKey: cached.response,
+                              kArchiveDataKey: cached.data,
+                              kArchiveStoredDateKey: cached.storedDate,
+                              kArchiveExpirationDateKey: cached.expirationDate,
+                              kArchiveStaleDateKey: cached.staleWhileRevalidateDate,
+                              kArchiveVaryingHeadersKey: cached.varyingHeaders ?: @{}};
+    NSString *path = [self p_pathForKey:cached.key];
+
+    dispatch_async(_ioQueue, ^{
+        NSMutableData *archived = [NSMutableData data];
+        NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:archived];
+        archiver.requiresSecureCoding = YES;
+        [archiver encodeObject:archive forKey:NSKeyedArchiveRootObjectKey];
+        [archiver finishEncoding];
+        if (archived.length > self.diskCapacity) return;
+
+        [self p_removeFileAtPath:path];
+        if ([archived writeToFile:path atomically:YES]) {
+            _diskUsage += archived.length;
+            [self p_trimDiskIfNeeded];
+        }
+    });
+}
+
+// 以下方法只在 _ioQueue 中调用
+- (void)p_removeFileAtPath:(NSString *)path {
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+    if (attributes == nil) return;
+
+    if ([[NSFileManager defaultManager] removeItemAtPath:path error:NULL]) {
+        NSUInteger size = (NSUInteger)[attributes fileSize];
+        _diskUsage = (_diskUsage > size) ? _diskUsage - size : 0;
+    }
+}
+
+- (NSUInteger)p_calculateDiskUsage {
+    NSUInteger usage = 0;
+    NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directory error:NULL];
+    for (NSString *filename in contents) {
+        NSString *path = [_directory stringByAppendingPathComponent:filename];
+        usage += (NSUInteger)[[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+    }
+    return usage;
+}
+
+- (void)p_trimDiskIfNeeded {
+    NSUInteger capacity = self.diskCapacity;
+    if (_diskUsage <= capacity) return;
+
+    NSURL *directoryURL = [NSURL fileURLWithPath:_directory isDirectory:YES];
+    NSArray *keys = @[NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSArray<NSURL *> *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:directoryURL includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:NULL];
+
+    files = [files sortedArrayUsingComparator:^NSComparisonResult(NSURL *url1, NSURL *url2) {
+        NSDate *date1 = nil, *date2 = nil;
+        [url1 getResourceValue:&date1 forKey:NSURLContentModificationDateKey error:NULL];
+        [url2 getResourceValue:&date2 forKey:NSURLContentModificationDateKey error:NULL];
+        return [date1 compare:date2];
+    }];
+
+    NSUInteger evicted = 0;
+    for (NSURL *url in files) {
+        if (_diskUsage <= capacity) break;
+        [self p_removeFileAtPath:url.path];
+        evicted += 1;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _evictionCount += evicted;
+    pthread_mutex_unlock(&_lock);
+}
+
+@end
@@ -0,0 +1,70 @@
+/*!
+ *  @header SGSMappedPropertyList.h
+ *
+ *  @abstract 内存映射的二进制 plist 读取
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 内存映射的二进制 plist 读取
+ *
+ *  @discussion XML 格式的 plist 在第一次读取时会被转换为二进制格式并缓存到 Caches 目录，
+ *      源文件的大小或修改时间发生变化后会重新转换；本身就是二进制格式的文件直接读取，变化后重新映射
+ *
+ *      对象引用和长度都会检查是否越界，越界、引用自身或祖先、无法解析的元素和 value 连同其 key 一起被忽略，
+ *      非字符串的 key 也被忽略，count 只计算保留的元素，因此枚举到的每个 key 和下标都能取到对象，
+ *      重复的 key 以最后一个为准，文件损坏时读取失败而不会崩溃
+ *
+ *      二进制文件通过内存映射读取，返回的 NSDictionary / NSArray 只解析对象引用表，
+ *      元素在第一次访问时才会被解析并缓存，因此读取大文件时只需要为实际访问的 key 付出开销
+ *
+ *      返回的容器对象是不可变的，可以在多线程中读取
+ */
+@interface SGSMappedPropertyList : NSObject
+
+/*!
+ *  @brief 读取 plist 文件
+ *
+ *  @param path 文件路径
+ *
+ *  @return 根对象，容器类型为延迟解析的 NSDictionary 或 NSArray，读取失败时返回 nil
+ */
++ (nullable id)propertyListWithContentsOfFile:(NSString *)path;
+
+/*!
+ *  @brief 读取 plist 文件
+ *
+ *  @param path  文件路径
+ *  @param error 如果读取失败将会传递错误给该参数
+ *
+ *  @return 根对象，容器类型为延迟解析的 NSDictionary 或 NSArray，读取失败时返回 nil
+ */
++ (nullable id)propertyListWithContentsOfFile:(NSString *)path error:(NSError **)error;
+
+/*!
+ *  @brief 返回 plist 文件对应的二进制格式文件路径
+ *
+ *  @discussion 如果缓存中不存在将会立即转换，可以在后台线程中预先调用以避免启动时转换
+ *
+ *  @param path  文件路径
+ *  @param error 如果转换失败将会传递错误给该参数
+ *
+ *  @return 二进制格式的文件路径，源文件本身为二进制格式时返回 path
+ */
++ (nullable NSString *)binaryPropertyListPathForFile:(NSString *)path error:(NSError **)error;
+
+/*!
+ *  @brief 清除已转换的二进制文件以及内存中的映射
+ */
++ (void)removeAllCachedPropertyLists;
+
+@end
+
+NS_ASSUME_NONNULL_END
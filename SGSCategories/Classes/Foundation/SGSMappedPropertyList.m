@@ -0,0 +1,542 @@
+/*!
+ *  @header SGSMappedPropertyList.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSMappedPropertyList.h"
+#import "NSData+SGS.h"
+#include <pthread.h>
+
+static NSString * const kBinaryPlistCacheDirectoryName = @"com.southgis.SGSCategories.MappedPropertyList";
+static const char kBinaryPlistMagic[8] = {'b', 'p', 'l', 'i', 's', 't', '0', '0'};
+static const NSUInteger kBinaryPlistTrailerSize = 32;
+// 容器的最大嵌套层数，超过时视为损坏
+static const NSUInteger kBinaryPlistMaximumDepth = 512;
+
+static inline uint64_t p_readBigEndianUInt(const uint8_t *bytes, NSUInteger size) {
+    uint64_t result = 0;
+    for (NSUInteger i = 0; i < size; i++) {
+        result = (result << 8) | bytes[i];
+    }
+    return result;
+}
+
+// 计算 start + count * size 并检查是否溢出或超出 limit
+static inline BOOL p_checkedEnd(uint64_t start, uint64_t count, uint64_t size, uint64_t limit, uint64_t *end) {
+    uint64_t length = 0, result = 0;
+    if (__builtin_mul_overflow(count, size, &length)) return NO;
+    if (__builtin_add_overflow(start, length, &result)) return NO;
+    if (result > limit) return NO;
+    if (end) *end = result;
+    return YES;
+}
+
+static inline NSError * p_corruptError(NSString *reason) {
+    return [NSError errorWithDomain:NSCocoaErrorDomain
+                               code:NSPropertyListReadCorruptError
+                           userInfo:@{NSLocalizedDescriptionKey: reason}];
+}
+
+
+#pragma mark - Binary Plist Context
+
+/// 已映射的二进制 plist，负责按对象引用解析对象，仅内部使用
+@interface p_BinaryPlistContext : NSObject
+- (nullable instancetype)initWithData:(NSData *)data error:(NSError **)error;
+- (id)objectForRef:(uint64_t)ref ancestors:(NSSet<NSNumber *> *)ancestors;
+- (BOOL)isValidRef:(uint64_t)ref ancestors:(NSSet<NSNumber *> *)ancestors;
+- (uint64_t)refAtOffset:(uint64_t)offset;
+- (uint64_t)rootRef;
+@property (nonatomic, assign, readonly) uint8_t objectRefSize;
+@end
+
+@interface p_MappedDictionary : NSDictionary
+- (instancetype)initWithContext:(p_BinaryPlistContext *)context refsOffset:(uint64_t)offset count:(NSUInteger)count ancestors:(NSSet<NSNumber *> *)ancestors;
+@end
+
+@interface p_MappedArray : NSArray
+- (instancetype)initWithContext:(p_BinaryPlistContext *)context refsOffset:(uint64_t)offset count:(NSUInteger)count ancestors:(NSSet<NSNumber *> *)ancestors;
+@end
+
+@implementation p_BinaryPlistContext {
+    NSData *_data;
+    const uint8_t *_bytes;
+    uint64_t _length;
+    uint8_t _offsetIntSize;
+    uint64_t _numObjects;
+    uint64_t _topObject;
+    uint64_t _offsetTableOffset;
+}
+
+- (instancetype)initWithData:(NSData *)data error:(NSError **)error {
+    self = [super init];
+    if (self) {
+        _data = data;
+        _bytes = data.bytes;
+        _length = data.length;
+
+        if ((_length < sizeof(kBinaryPlistMagic) + kBinaryPlistTrailerSize) ||
+            (memcmp(_bytes, kBinaryPlistMagic, sizeof(kBinaryPlistMagic)) != 0)) {
+            if (error) *error = p_corruptError(@"Not a binary property list");
+            return nil;
+        }
+
+        const uint8_t *trailer = _bytes + _length - kBinaryPlistTrailerSize;
+        _offsetIntSize     = trailer[6];
+        _objectRefSize     = trailer[7];
+        _numObjects        = p_readBigEndianUInt(trailer + 8, 8);
+        _topObject         = p_readBigEndianUInt(trailer + 16, 8);
+        _offsetTableOffset = p_readBigEndianUInt(trailer + 24, 8);
+
+        BOOL valid = (_offsetIntSize >= 1) && (_offsetIntSize <= 8) &&
+                     (_objectRefSize >= 1) && (_objectRefSize <= 8) &&
+                     (_topObject < _numObjects) &&
+                     (_offsetTableOffset < _length) &&
+                     (_numObjects <= (_length - _offsetTableOffset) / _offsetIntSize);
+        if (!valid) {
+            if (error) *error = p_corruptError(@"Invalid binary property list trailer");
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (uint64_t)rootRef {
+    return _topObject;
+}
+
+- (uint64_t)refAtOffset:(uint64_t)offset {
+    if (!p_checkedEnd(offset, 1, _objectRefSize, _offsetTableOffset, NULL)) return UINT64_MAX;
+    return p_readBigEndianUInt(_bytes + offset, _objectRefSize);
+}
+
+- (uint64_t)p_offsetForRef:(uint64_t)ref {
+    if (ref >= _numObjects) return UINT64_MAX;
+    uint64_t offset = p_readBigEndianUInt(_bytes + _offsetTableOffset + ref * _offsetIntSize, _offsetIntSize);
+    return (offset < _offsetTableOffset) ? offset : UINT64_MAX;
+}
+
+// 读取对象长度，长度 >= 15 时紧随标记之后的是一个整数对象
+- (BOOL)p_readCountAtOffset:(uint64_t)offset count:(uint64_t *)count start:(uint64_t *)start {
+    uint8_t info = _bytes[offset] & 0x0F;
+    if (info != 0x0F) {
+        *count = info;
+        *start = offset + 1;
+        return YES;
+    }
+
+    if (offset + 2 > _offsetTableOffset) return NO;
+    uint8_t marker = _bytes[offset + 1];
+    if ((marker >> 4) != 0x1) return NO;
+
+    NSUInteger size = 1 << (marker & 0x0F);
+    if ((size > 8) || !p_checkedEnd(offset + 2, 1, size, _offsetTableOffset, NULL)) return NO;
+
+    *count = p_readBigEndianUInt(_bytes + offset + 2, size);
+    *start = offset + 2 + size;
+    return YES;
+}
+
+// 对象能否被解析，NSData 只检查长度而不复制内容，其他对象解析一次
+- (BOOL)isValidRef:(uint64_t)ref ancestors:(NSSet<NSNumber *> *)ancestors {
+    uint64_t offset = [self p_offsetForRef:ref];
+    if (offset == UINT64_MAX) return NO;
+
+    if ((_bytes[offset] >> 4) == 0x4) {
+        uint64_t count = 0, start = 0;
+        return [self p_readCountAtOffset:offset count:&count start:&start] &&
+               p_checkedEnd(start, count, 1, _offsetTableOffset, NULL);
+    }
+    return ([self objectForRef:ref ancestors:ancestors] != nil);
+}
+
+// ancestors 为包含该对象的各层容器的引用，引用自身或祖先的容器视为损坏，避免无限递归
+- (id)objectForRef:(uint64_t)ref ancestors:(NSSet<NSNumber *> *)ancestors {
+    uint64_t offset = [self p_offsetForRef:ref];
+    if (offset == UINT64_MAX) return nil;
+
+    uint8_t marker = _bytes[offset];
+    uint8_t type = marker >> 4;
+    uint8_t info = marker & 0x0F;
+
+    switch (type) {
+        case 0x0: {
+            if (info == 0x08) return @NO;
+            if (info == 0x09) return @YES;
+            return nil;
+        }
+        case 0x1: {
+            NSUInteger size = 1 << info;
+            if (offset + 1 + size > _offsetTableOffset) return nil;
+            // 16 字节整数只保留低 64 位；8 字节整数为有符号数，其他长度为无符号数
+            if (size == 16) return @(p_readBigEndianUInt(_bytes + offset + 9, 8));
+            if (size > 16) return nil;
+            uint64_t value = p_readBigEndianUInt(_bytes + offset + 1, size);
+            if (size == 8) return @((int64_t)value);
+            return @(value);
+        }
+        case 0x2: {
+            if (info == 2) {
+                if (offset + 5 > _offsetTableOffset) return nil;
+                uint32_t bits = (uint32_t)p_readBigEndianUInt(_bytes + offset + 1, 4);
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+                return @(value);
+            } else if (info == 3) {
+                if (offset + 9 > _offsetTableOffset) return nil;
+                uint64_t bits = p_readBigEndianUInt(_bytes + offset + 1, 8);
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                return @(value);
+            }
+            return nil;
+        }
+        case 0x3: {
+            if ((info != 3) || (offset + 9 > _offsetTableOffset)) return nil;
+            uint64_t bits = p_readBigEndianUInt(_bytes + offset + 1, 8);
+            double interval;
+            memcpy(&interval, &bits, sizeof(interval));
+            return [NSDate dateWithTimeIntervalSinceReferenceDate:interval];
+        }
+        case 0x4:
+        case 0x5:
+        case 0x6: {
+            uint64_t count = 0, start = 0;
+            if (![self p_readCountAtOffset:offset count:&count start:&start]) return nil;
+            uint64_t byteCount = 0, end = 0;
+            if (!p_checkedEnd(start, count, (type == 0x6) ? 2 : 1, _offsetTableOffset, &end)) return nil;
+            byteCount = end - start;
+
+            if (type == 0x4) {
+                return [NSData dataWithBytes:_bytes + start length:(NSUInteger)byteCount];
+            }
+            NSStringEncoding encoding = (type == 0x5) ? NSASCIIStringEncoding : NSUTF16BigEndianStringEncoding;
+            return [[NSString alloc] initWithBytes:_bytes + start length:(NSUInteger)byteCount encoding:encoding];
+        }
+        case 0x8: {
+            NSUInteger size = info + 1;
+            if (offset + 1 + size > _offsetTableOffset) return nil;
+            return @(p_readBigEndianUInt(_bytes + offset + 1, size));
+        }
+        case 0xA:
+        case 0xC:
+        case 0xD: {
+            uint64_t count = 0, start = 0;
+            if (![self p_readCountAtOffset:offset count:&count start:&start]) return nil;
+            uint64_t refsLength = 0;
+            if (__builtin_mul_overflow(count, (uint64_t)((type == 0xD) ? 2 : 1), &refsLength)) return nil;
+            if (!p_checkedEnd(start, refsLength, _objectRefSize, _offsetTableOffset, NULL)) return nil;
+
+            NSNumber *refNumber = @(ref);
+            if ([ancestors containsObject:refNumber] || (ancestors.count >= kBinaryPlistMaximumDepth)) return nil;
+            NSSet *childAncestors = [ancestors setByAddingObject:refNumber];
+
+            if (type == 0xA) {
+                return [[p_MappedArray alloc] initWithContext:self refsOffset:start count:(NSUInteger)count ancestors:childAncestors];
+            }
+            if (type == 0xD) {
+                return [[p_MappedDictionary alloc] initWithContext:self refsOffset:start count:(NSUInteger)count ancestors:childAncestors];
+            }
+
+            // NSSet 需要计算所有元素的 hash，无法延迟解析
+            NSMutableSet *set = [NSMutableSet setWithCapacity:(NSUInteger)MIN(count, 1024)];
+            for (uint64_t i = 0; i < count; i++) {
+                id obj = [self objectForRef:[self refAtOffset:start + i * _objectRefSize] ancestors:childAncestors];
+                if (obj) [set addObject:obj];
+            }
+            return set.copy;
+        }
+        default:
+            return nil;
+    }
+}
+
+@end
+
+
+#pragma mark - Mapped Dictionary
+
+@implementation p_MappedDictionary {
+    p_BinaryPlistContext *_context;
+    uint64_t _refsOffset;
+    NSUInteger _count;
+    NSSet<NSNumber *> *_ancestors;
+
+    pthread_mutex_t _lock;
+    NSDictionary *_valueRefsByKey;
+    NSMutableDictionary *_materializedObjects;
+}
+
+- (instancetype)initWithContext:(p_BinaryPlistContext *)context refsOffset:(uint64_t)offset count:(NSUInteger)count ancestors:(NSSet<NSNumber *> *)ancestors {
+    self = [super init];
+    if (self) {
+        _context = context;
+        _refsOffset = offset;
+        _count = count;
+        _ancestors = ancestors;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+// 只解析 key，value 保留为对象引用，调用时需持有锁
+// 只接受字符串 key 和能够解析的 value，重复的 key 以最后一个为准，count 以保留的 key 数为准，
+// 因此枚举到的每个 key 都能取到 value
+- (NSDictionary *)p_valueRefsByKey {
+    if (_valueRefsByKey == nil) {
+        NSMutableDictionary *refs = [NSMutableDictionary dictionaryWithCapacity:MIN(_count, 1024)];
+        uint64_t refSize = _context.objectRefSize;
+        uint64_t valueRefsOffset = _refsOffset + _count * refSize;
+        for (NSUInteger i = 0; i < _count; i++) {
+            id key = [_context objectForRef:[_context refAtOffset:_refsOffset + i * refSize] ancestors:_ancestors];
+            if (![key isKindOfClass:[NSString class]]) continue;
+
+            uint64_t valueRef = [_context refAtOffset:valueRefsOffset + i * refSize];
+            if (![_context isValidRef:valueRef ancestors:_ancestors]) continue;
+            refs[key] = @(valueRef);
+        }
+        _valueRefsByKey = refs.copy;
+        _materializedObjects = [NSMutableDictionary dictionary];
+    }
+    return _valueRefsByKey;
+}
+
+- (NSUInteger)count {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = [self p_valueRefsByKey].count;
+    pthread_mutex_unlock(&_lock);
+
+    return count;
+}
+
+- (id)objectForKey:(id)aKey {
+    if (aKey == nil) return nil;
+
+    pthread_mutex_lock(&_lock);
+    id obj = _materializedObjects[aKey];
+    if (obj == nil) {
+        NSNumber *ref = [self p_valueRefsByKey][aKey];
+        if (ref != nil) {
+            obj = [_context objectForRef:ref.unsignedLongLongValue ancestors:_ancestors];
+            if (obj) _materializedObjects[aKey] = obj;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return obj;
+}
+
+- (NSEnumerator *)keyEnumerator {
+    pthread_mutex_lock(&_lock);
+    NSDictionary *refs = [self p_valueRefsByKey];
+    pthread_mutex_unlock(&_lock);
+
+    return [refs keyEnumerator];
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+@end
+
+
+#pragma mark - Mapped Array
+
+@implementation p_MappedArray {
+    p_BinaryPlistContext *_context;
+    uint64_t _refsOffset;
+    NSUInteger _count;
+    NSSet<NSNumber *> *_ancestors;
+
+    pthread_mutex_t _lock;
+    // 能够解析的元素的对象引用，uint64_t 数组
+    NSData *_validRefs;
+    NSPointerArray *_materializedObjects;
+}
+
+- (instancetype)initWithContext:(p_BinaryPlistContext *)context refsOffset:(uint64_t)offset count:(NSUInteger)count ancestors:(NSSet<NSNumber *> *)ancestors {
+    self = [super init];
+    if (self) {
+        _context = context;
+        _refsOffset = offset;
+        _count = count;
+        _ancestors = ancestors;
+        pthread_mutex_init(&_lock, NULL);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+// 跳过无法解析的元素，与字典忽略无法解析的 value 一致，调用时需持有锁
+- (NSData *)p_validRefs {
+    if (_validRefs == nil) {
+        NSMutableData *refs = [NSMutableData dataWithCapacity:MIN(_count, 1024) * sizeof(uint64_t)];
+        uint64_t refSize = _context.objectRefSize;
+        for (NSUInteger i = 0; i < _count; i++) {
+            uint64_t ref = [_context refAtOffset:_refsOffset + i * refSize];
+            if (![_context isValidRef:ref ancestors:_ancestors]) continue;
+            [refs appendBytes:&ref length:sizeof(ref)];
+        }
+        _validRefs = refs.copy;
+
+        _materializedObjects = [NSPointerArray strongObjectsPointerArray];
+        _materializedObjects.count = _validRefs.length / sizeof(uint64_t);
+    }
+    return _validRefs;
+}
+
+- (NSUInteger)count {
+    pthread_mutex_lock(&_lock);
+    NSUInteger count = [self p_validRefs].length / sizeof(uint64_t);
+    pthread_mutex_unlock(&_lock);
+
+    return count;
+}
+
+- (id)objectAtIndex:(NSUInteger)index {
+    pthread_mutex_lock(&_lock);
+    NSData *refs = [self p_validRefs];
+    NSUInteger count = refs.length / sizeof(uint64_t);
+    if (index >= count) {
+        pthread_mutex_unlock(&_lock);
+        [NSException raise:NSRangeException format:@"index %lu beyond bounds [0 .. %lu]", (unsigned long)index, (unsigned long)count];
+    }
+
+    id obj = (__bridge id)[_materializedObjects pointerAtIndex:index];
+    if (obj == nil) {
+        obj = [_context objectForRef:((const uint64_t *)refs.bytes)[index] ancestors:_ancestors];
+        [_materializedObjects replacePointerAtIndex:index withPointer:(__bridge void *)obj];
+    }
+    pthread_mutex_unlock(&_lock);
+
+    return obj;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+@end
+
+
+#pragma mark - SGSMappedPropertyList
+
+@implementation SGSMappedPropertyList
+
++ (id)propertyListWithContentsOfFile:(NSString *)path {
+    return [self propertyListWithContentsOfFile:path error:NULL];
+}
+
++ (id)propertyListWithContentsOfFile:(NSString *)path error:(NSError **)error {
+    if (path == nil) return nil;
+
+    NSString *binaryPath = [self binaryPropertyListPathForFile:path error:error];
+    if (binaryPath == nil) return nil;
+
+    // 源文件本身为二进制格式时 binaryPath 就是源文件，修改后需要重新读取
+    NSString *identifier = [self p_identifierForFile:binaryPath error:error];
+    if (identifier == nil) return nil;
+
+    NSCache *rootObjects = [self p_rootObjects];
+    id root = [rootObjects objectForKey:identifier];
+    if (root != nil) return root;
+
+    NSData *data = [NSData dataWithContentsOfFile:binaryPath options:NSDataReadingMappedAlways error:error];
+    if (data == nil) return nil;
+
+    p_BinaryPlistContext *context = [[p_BinaryPlistContext alloc] initWithData:data error:error];
+    if (context == nil) return nil;
+
+    root = [context objectForRef:context.rootRef ancestors:[NSSet set]];
+    if (root == nil) {
+        if (error) *error = p_corruptError(@"Invalid root object");
+        return nil;
+    }
+
+    [rootObjects setObject:root forKey:identifier];
+    return root;
+}
+
++ (NSString *)binaryPropertyListPathForFile:(NSString *)path error:(NSError **)error {
+    if (path == nil) return nil;
+
+    if ([self p_isBinaryPropertyListAtPath:path]) return path;
+
+    // 源文件路径、大小、修改时间共同决定缓存文件名，源文件变化后自动失效
+    NSString *identifier = [self p_identifierForFile:path error:error];
+    if (identifier == nil) return nil;
+
+    NSString *cachePath = [[self p_cacheDirectory] stringByAppendingPathComponent:
+                           [[[identifier dataUsingEncoding:NSUTF8StringEncoding] sha256HexString] stringByAppendingPathExtension:@"bplist"]];
+
+    if ([[NSFileManager defaultManager] fileExistsAtPath:cachePath]) return cachePath;
+
+    NSData *source = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:error];
+    if (source == nil) return nil;
+
+    id plist = [NSPropertyListSerialization propertyListWithData:source options:NSPropertyListImmutable format:NULL error:error];
+    if (plist == nil) return nil;
+
+    NSData *binary = [NSPropertyListSerialization dataWithPropertyList:plist format:NSPropertyListBinaryFormat_v1_0 options:kNilOptions error:error];
+    if (binary == nil) return nil;
+
+    [[NSFileManager defaultManager] createDirectoryAtPath:[self p_cacheDirectory] withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (![binary writeToFile:cachePath options:NSDataWritingAtomic error:error]) return nil;
+
+    return cachePath;
+}
+
++ (void)removeAllCachedPropertyLists {
+    [[self p_rootObjects] removeAllObjects];
+    [[NSFileManager defaultManager] removeItemAtPath:[self p_cacheDirectory] error:NULL];
+}
+
+
+#pragma mark - Private
+
++ (NSCache *)p_rootObjects {
+    static NSCache *cache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        cache = [[NSCache alloc] init];
+    });
+
+    return cache;
+}
+
++ (NSString *)p_cacheDirectory {
+    NSString *caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+    return [caches stringByAppendingPathComponent:kBinaryPlistCacheDirectoryName];
+}
+
++ (NSString *)p_identifierForFile:(NSString *)path error:(NSError **)error {
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:error];
+    if (attributes == nil) return nil;
+
+    return [NSString stringWithFormat:@"%@|%llu|%f",
+            path,
+            [attributes fileSize],
+            [[attributes fileModificationDate] timeIntervalSinceReferenceDate]];
+}
+
++ (BOOL)p_isBinaryPropertyListAtPath:(NSString *)path {
+    NSFileHandle *handle = [NSFileHandle fileHandleForReadingAtPath:path];
+    NSData *header = [handle readDataOfLength:sizeof(kBinaryPlistMagic)];
+    [handle closeFile];
+
+    return (header.length == sizeof(kBinaryPlistMagic)) &&
+           (memcmp(header.bytes, kBinaryPlistMagic, sizeof(kBinaryPlistMagic)) == 0);
+}
+
+@end
@@ -0,0 +1,120 @@
+/*!
+ *  @header SGSMultipartFormData.h
+ *
+ *  @abstract 流式 multipart/form-data 请求体
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 流式 multipart/form-data 请求体
+ *
+ *  @discussion 依次添加字段、数据和文件，生成的请求体以 NSInputStream 的形式按需读取，
+ *      文件只在上传时分块读取，不会整体加载到内存中；
+ *      请求体长度根据文件属性计算，不需要读取文件内容
+ *
+ *      添加文件后到上传完成前不应修改文件，否则读取时将出错
+ */
+@interface SGSMultipartFormData : NSObject
+
+/*!
+ *  @brief 使用随机的分隔符初始化
+ *
+ *  @return SGSMultipartFormData
+ */
++ (instancetype)formData;
+
+/*!
+ *  @brief 分隔符
+ */
+@property (nonatomic, copy, readonly) NSString *boundary;
+
+/*!
+ *  @brief 请求头中的 Content-Type，包含分隔符
+ */
+@property (nonatomic, copy, readonly) NSString *contentType;
+
+/*!
+ *  @brief 请求体的总长度，单位：字节
+ */
+@property (nonatomic, assign, readonly) unsigned long long contentLength;
+
+/*!
+ *  @brief 添加文本字段
+ *
+ *  @param value 字段值，使用 UTF-8 编码
+ *  @param name  字段名
+ */
+- (void)appendFieldWithValue:(NSString *)value name:(NSString *)name;
+
+/*!
+ *  @brief 添加数据
+ *
+ *  @param data     数据，不会被复制
+ *  @param name     字段名
+ *  @param fileName 文件名，为空时作为普通字段
+ *  @param mimeType MIME 类型，为空时不设置 Content-Type
+ */
+- (void)appendPartWithData:(NSData *)data
+                      name:(NSString *)name
+                  fileName:(nullable NSString *)fileName
+                  mimeType:(nullable NSString *)mimeType;
+
+/*!
+ *  @brief 添加文件
+ *
+ *  @param fileURL  文件 URL
+ *  @param name     字段名
+ *  @param fileName 文件名，为空时使用文件 URL 的最后一个路径
+ *  @param mimeType MIME 类型，为空时根据扩展名判断，无法判断时使用 application/octet-stream
+ *  @param error    文件不存在或无法读取文件属性时的错误信息
+ *
+ *  @return 是否添加成功
+ */
+- (BOOL)appendPartWithFileURL:(NSURL *)fileURL
+                         name:(NSString *)name
+                     fileName:(nullable NSString *)fileName
+                     mimeType:(nullable NSString *)mimeType
+                        error:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
+/*!
+ *  @brief 生成请求体的输入流，每次调用都会生成新的输入流
+ *
+ *  @discussion 输入流无法回退，使用会话代理时应在 URLSession:task:needNewBodyStream: 中
+ *      调用此方法提供新的输入流，否则重定向、认证质询或重试时无法重新发送请求体
+ *
+ *  @return NSInputStream
+ */
+- (NSInputStream *)newBodyStream;
+
+/*!
+ *  @brief 将请求体分块写入文件，不会整体加载到内存中
+ *
+ *  @discussion 写入的文件可以用于 uploadTaskWithRequest:fromFile:，需要时可以重新发送
+ *
+ *  @param fileURL 目标文件，已存在时覆盖
+ *  @param error   读取或写入失败时的错误信息
+ *
+ *  @return 是否写入成功
+ */
+- (BOOL)writeToFileAtURL:(NSURL *)fileURL error:(NSError * _Nullable __autoreleasing * _Nullable)error;
+
+/*!
+ *  @brief 将请求体设置到请求中，同时设置 Content-Type 和 Content-Length 请求头
+ *
+ *  @discussion 没有文件时请求体设置为 HTTPBody，可以重复发送；
+ *      包含文件时设置为 HTTPBodyStream，使用方式参考 newBodyStream
+ *
+ *  @param request HTTP 请求
+ */
+- (void)applyToRequest:(NSMutableURLRequest *)request;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,375 @@
+/*!
+ *  @header SGSMultipartFormData.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSMultipartFormData.h"
+
+static NSString * const kMultipartCRLF = @"\r\n";
+static const NSUInteger kMultipartCopyBufferSize = 64 * 1024;
+
+#pragma mark - Multipart Chunk
+
+/// 请求体中连续的一段，内容为内存数据或文件，仅内部使用
+@interface p_MultipartChunk : NSObject
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, strong) NSURL *fileURL;
+@property (nonatomic, assign) unsigned long long length;
+@end
+
+@implementation p_MultipartChunk
+
++ (instancetype)chunkWithData:(NSData *)data {
+    p_MultipartChunk *chunk = [[p_MultipartChunk alloc] init];
+    chunk.data = data;
+    chunk.length = data.length;
+    return chunk;
+}
+
++ (instancetype)chunkWithFileURL:(NSURL *)fileURL length:(unsigned long long)length {
+    p_MultipartChunk *chunk = [[p_MultipartChunk alloc] init];
+    chunk.fileURL = fileURL;
+    chunk.length = length;
+    return chunk;
+}
+
+@end
+
+
+#pragma mark - Multipart Body Stream
+
+/*!
+ *  依次读取各段内容的输入流，仅内部使用
+ *
+ *  NSURLSession 通过 CFReadStream 使用请求体输入流，NSInputStream 子类需要实现以下 CFReadStream 桥接方法，
+ *  读取是同步的，因此不需要调度到 RunLoop 中
+ */
+@interface p_MultipartBodyStream : NSInputStream
+- (instancetype)initWithChunks:(NSArray<p_MultipartChunk *> *)chunks;
+@end
+
+@implementation p_MultipartBodyStream {
+    NSArray<p_MultipartChunk *> *_chunks;
+    NSUInteger _chunkIndex;
+    unsigned long long _chunkOffset;
+    NSInputStream *_fileStream;
+
+    NSStreamStatus _status;
+    NSError *_error;
+    __weak id<NSStreamDelegate> _delegate;
+}
+
+- (instancetype)initWithChunks:(NSArray<p_MultipartChunk *> *)chunks {
+    self = [super initWithData:[NSData data]];
+    if (self) {
+        _chunks = [chunks copy];
+        _status = NSStreamStatusNotOpen;
+    }
+    return self;
+}
+
+- (void)open {
+    if (_status != NSStreamStatusNotOpen) return;
+    _status = NSStreamStatusOpen;
+}
+
+- (void)close {
+    [_fileStream close];
+    _fileStream = nil;
+    _status = NSStreamStatusClosed;
+}
+
+- (NSStreamStatus)streamStatus {
+    return _status;
+}
+
+- (NSError *)streamError {
+    return _error;
+}
+
+- (id<NSStreamDelegate>)delegate {
+    return _delegate;
+}
+
+- (void)setDelegate:(id<NSStreamDelegate>)delegate {
+    _delegate = delegate;
+}
+
+- (BOOL)hasBytesAvailable {
+    return (_status == NSStreamStatusOpen) && (_chunkIndex < _chunks.count);
+}
+
+- (NSInteger)read:(uint8_t *)buffer maxLength:(NSUInteger)length {
+    if ((_status != NSStreamStatusOpen) && (_status != NSStreamStatusReading)) return 0;
+
+    _status = NSStreamStatusReading;
+    NSUInteger totalLength = 0;
+
+    while ((totalLength < length) && (_chunkIndex < _chunks.count)) {
+        p_MultipartChunk *chunk = _chunks[_chunkIndex];
+        NSUInteger maxLength = (NSUInteger)MIN((unsigned long long)(length - totalLength), chunk.length - _chunkOffset);
+        NSInteger readLength = 0;
+
+        if (chunk.data != nil) {
+            [chunk.data getBytes:(buffer + totalLength) range:NSMakeRange((NSUInteger)_chunkOffset, maxLength)];
+            readLength = maxLength;
+        } else {
+            if (_fileStream == nil) {
+                _fileStream = [NSInputStream inputStreamWithURL:chunk.fileURL];
+                [_fileStream open];
+            }
+
+            readLength = (maxLength > 0) ? [_fileStream read:(buffer + totalLength) maxLength:maxLength] : 0;
+            if (readLength < 0) {
+                return [self p_failWithError:_fileStream.streamError];
+            }
+            // 文件比添加时短，已经无法满足 Content-Length
+            if ((readLength == 0) && (_chunkOffset < chunk.length)) {
+                return [self p_failWithError:[NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:@{NSURLErrorKey: chunk.fileURL}]];
+            }
+        }
+
+        totalLength += readLength;
+        _chunkOffset += readLength;
+
+        if (_chunkOffset >= chunk.length) {
+            [_fileStream close];
+            _fileStream = nil;
+            _chunkIndex += 1;
+            _chunkOffset = 0;
+        }
+    }
+
+    _status = (_chunkIndex < _chunks.count) ? NSStreamStatusOpen : NSStreamStatusAtEnd;
+
+    return totalLength;
+}
+
+- (BOOL)getBuffer:(uint8_t * _Nullable *)buffer length:(NSUInteger *)len {
+    return NO;
+}
+
+- (id)propertyForKey:(NSString *)key {
+    return nil;
+}
+
+- (BOOL)setProperty:(id)property forKey:(NSString *)key {
+    return NO;
+}
+
+- (void)scheduleInRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {
+}
+
+- (void)removeFromRunLoop:(NSRunLoop *)aRunLoop forMode:(NSString *)mode {
+}
+
+- (NSInteger)p_failWithError:(NSError *)error {
+    [_fileStream close];
+    _fileStream = nil;
+    _error = error;
+    _status = NSStreamStatusError;
+    return -1;
+}
+
+
+#pragma mark - CFReadStream Bridging
+
+- (void)_scheduleInCFRunLoop:(__unused CFRunLoopRef)aRunLoop forMode:(__unused CFStringRef)aMode {
+}
+
+- (void)_unscheduleFromCFRunLoop:(__unused CFRunLoopRef)aRunLoop forMode:(__unused CFStringRef)aMode {
+}
+
+- (BOOL)_setCFClientFlags:(__unused CFOptionFlags)inFlags
+                 callback:(__unused CFReadStreamClientCallBack)inCallback
+                  context:(__unused CFStreamClientContext *)inContext
+{
+    return NO;
+}
+
+@end
+
+
+#pragma mark - SGSMultipartFormData
+
+@implementation SGSMultipartFormData {
+    NSMutableArray<p_MultipartChunk *> *_chunks;
+}
+
++ (instancetype)formData {
+    return [[self alloc] init];
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _boundary = [NSString stringWithFormat:@"Boundary+%08X%08X", arc4random(), arc4random()];
+        _chunks = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSString *)contentType {
+    return [NSString stringWithFormat:@"multipart/form-data; boundary=%@", _boundary];
+}
+
+- (unsigned long long)contentLength {
+    unsigned long long length = 0;
+    for (p_MultipartChunk *chunk in _chunks) {
+        length += chunk.length;
+    }
+    return length + [self p_closingBoundaryData].length;
+}
+
+- (void)appendFieldWithValue:(NSString *)value name:(NSString *)name {
+    [self appendPartWithData:[value dataUsingEncoding:NSUTF8StringEncoding] ?: [NSData data] name:name fileName:nil mimeType:nil];
+}
+
+- (void)appendPartWithData:(NSData *)data name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType {
+    [_chunks addObject:[p_MultipartChunk chunkWithData:[self p_headerDataWithName:name fileName:fileName mimeType:mimeType]]];
+    [_chunks addObject:[p_MultipartChunk chunkWithData:data]];
+    [_chunks addObject:[p_MultipartChunk chunkWithData:[kMultipartCRLF dataUsingEncoding:NSUTF8StringEncoding]]];
+}
+
+- (BOOL)appendPartWithFileURL:(NSURL *)fileURL name:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType error:(NSError *__autoreleasing *)error {
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:fileURL.path error:error];
+    if (attributes == nil) return NO;
+
+    if (fileName == nil) fileName = fileURL.lastPathComponent;
+    if (mimeType == nil) mimeType = [SGSMultipartFormData p_mimeTypeForPathExtension:fileURL.pathExtension];
+
+    [_chunks addObject:[p_MultipartChunk chunkWithData:[self p_headerDataWithName:name fileName:fileName mimeType:mimeType]]];
+    [_chunks addObject:[p_MultipartChunk chunkWithFileURL:fileURL length:attributes.fileSize]];
+    [_chunks addObject:[p_MultipartChunk chunkWithData:[kMultipartCRLF dataUsingEncoding:NSUTF8StringEncoding]]];
+
+    return YES;
+}
+
+- (NSInputStream *)newBodyStream {
+    NSMutableArray *chunks = [_chunks mutableCopy];
+    [chunks addObject:[p_MultipartChunk chunkWithData:[self p_closingBoundaryData]]];
+    return [[p_MultipartBodyStream alloc] initWithChunks:chunks];
+}
+
+- (BOOL)writeToFileAtURL:(NSURL *)fileURL error:(NSError *__autoreleasing *)error {
+    NSInputStream *inputStream = [self newBodyStream];
+    NSOutputStream *outputStream = [NSOutputStream outputStreamWithURL:fileURL append:NO];
+    [inputStream open];
+    [outputStream open];
+
+    uint8_t *buffer = malloc(kMultipartCopyBufferSize);
+    NSError *streamError = nil;
+
+    while (streamError == nil) {
+        NSInteger readLength = [inputStream read:buffer maxLength:kMultipartCopyBufferSize];
+        if (readLength == 0) break;
+        if (readLength < 0) {
+            streamError = inputStream.streamError ?: [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:nil];
+            break;
+        }
+
+        NSInteger offset = 0;
+        while (offset < readLength) {
+            NSInteger writeLength = [outputStream write:buffer + offset maxLength:readLength - offset];
+            if (writeLength <= 0) {
+                streamError = outputStream.streamError ?: [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: fileURL}];
+                break;
+            }
+            offset += writeLength;
+        }
+    }
+
+    free(buffer);
+    [inputStream close];
+    [outputStream close];
+
+    if (streamError != nil) {
+        [[NSFileManager defaultManager] removeItemAtURL:fileURL error:NULL];
+        if (error) *error = streamError;
+        return NO;
+    }
+    return YES;
+}
+
+- (void)applyToRequest:(NSMutableURLRequest *)request {
+    NSData *bodyData = [self p_bodyData];
+    if (bodyData != nil) {
+        request.HTTPBody = bodyData;
+    } else {
+        request.HTTPBodyStream = [self newBodyStream];
+    }
+    [request setValue:self.contentType forHTTPHeaderField:@"Content-Type"];
+    [request setValue:[NSString stringWithFormat:@"%llu", self.contentLength] forHTTPHeaderField:@"Content-Length"];
+}
+
+
+#pragma mark - Private
+
+- (NSData *)p_headerDataWithName:(NSString *)name fileName:(NSString *)fileName mimeType:(NSString *)mimeType {
+    NSMutableString *header = [NSMutableString stringWithFormat:@"--%@\r\n", _boundary];
+    [header appendFormat:@"Content-Disposition: form-data; name=\"%@\"", [SGSMultipartFormData p_escapedQuotedString:name]];
+    if (fileName != nil) {
+        [header appendFormat:@"; filename=\"%@\"", [SGSMultipartFormData p_escapedQuotedString:fileName]];
+    }
+    [header appendString:kMultipartCRLF];
+    if (mimeType != nil) {
+        [header appendFormat:@"Content-Type: %@\r\n", mimeType];
+    }
+    [header appendString:kMultipartCRLF];
+
+    return [header dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+// 只包含内存数据时拼接完整的请求体，包含文件时返回 nil
+- (NSData *)p_bodyData {
+    NSMutableData *bodyData = [NSMutableData dataWithCapacity:(NSUInteger)self.contentLength];
+    for (p_MultipartChunk *chunk in _chunks) {
+        if (chunk.data == nil) return nil;
+        [bodyData appendData:chunk.data];
+    }
+    [bodyData appendData:[self p_closingBoundaryData]];
+    return bodyData;
+}
+
+- (NSData *)p_closingBoundaryData {
+    return [[NSString stringWithFormat:@"--%@--\r\n", _boundary] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
++ (NSString *)p_escapedQuotedString:(NSString *)string {
+    string = [string stringByReplacingOccurrencesOfString:@"\"" withString:@"%22"];
+    string = [string stringByReplacingOccurrencesOfString:@"\r" withString:@"%0D"];
+    return [string stringByReplacingOccurrencesOfString:@"\n" withString:@"%0A"];
+}
+
++ (NSString *)p_mimeTypeForPathExtension:(NSString *)extension {
+    static NSDictionary<NSString *, NSString *> *mimeTypes = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mimeTypes = @{@"jpg": @"image/jpeg",
+                      @"jpeg": @"image/jpeg",
+                      @"png": @"image/png",
+                      @"gif": @"image/gif",
+                      @"heic": @"image/heic",
+                      @"tif": @"image/tiff",
+                      @"tiff": @"image/tiff",
+                      @"mp4": @"video/mp4",
+                      @"mov": @"video/quicktime",
+                      @"m4a": @"audio/mp4",
+                      @"mp3": @"audio/mpeg",
+                      @"txt": @"text/plain",
+                      @"csv": @"text/csv",
+                      @"json": @"application/json",
+                      @"xml": @"application/xml",
+                      @"pdf": @"application/pdf",
+                      @"zip": @"application/zip",
+                      @"geojson": @"application/geo+json",
+                      @"kml": @"application/vnd.google-earth.kml+xml"};
+    });
+
+    return mimeTypes[extension.lowercaseString] ?: @"application/octet-stream";
+}
+
+@end
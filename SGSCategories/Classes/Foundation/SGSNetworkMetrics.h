@@ -0,0 +1,272 @@
+/*!
+ *  @header SGSNetworkMetrics.h
+ *
+ *  @abstract 网络任务耗时统计
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 耗时未知
+ */
+FOUNDATION_EXPORT const NSTimeInterval SGSTaskMetricsDurationUnknown;
+
+/*!
+ *  @brief 单个任务的耗时统计
+ *
+ *  @discussion 各阶段耗时的单位为秒，无法获取时为 SGSTaskMetricsDurationUnknown，
+ *      复用连接时 DNS、连接和 TLS 阶段同样为 SGSTaskMetricsDurationUnknown
+ */
+@interface SGSTaskMetrics : NSObject
+
+/*!
+ *  @brief 使用系统收集的统计数据初始化，iOS 10 及以上可用
+ *
+ *  @param task    网络任务
+ *  @param metrics URLSession:task:didFinishCollectingMetrics: 中得到的统计数据
+ *
+ *  @return SGSTaskMetrics
+ */
+- (instancetype)initWithTask:(NSURLSessionTask *)task sessionTaskMetrics:(NSURLSessionTaskMetrics *)metrics NS_AVAILABLE_IOS(10_0);
+
+/*!
+ *  @brief 使用时间戳初始化，只能区分首字节时间和传输时间
+ *
+ *  @param task          网络任务
+ *  @param startDate     任务开始时间
+ *  @param firstByteDate 收到第一个字节的时间，没有收到数据时为空
+ *  @param endDate       任务结束时间
+ *
+ *  @return SGSTaskMetrics
+ */
+- (instancetype)initWithTask:(NSURLSessionTask *)task
+                   startDate:(NSDate *)startDate
+               firstByteDate:(nullable NSDate *)firstByteDate
+                     endDate:(NSDate *)endDate;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 网络任务，任务释放后为空
+ */
+@property (nonatomic, weak, readonly, nullable) NSURLSessionTask *task;
+
+/*!
+ *  @brief 请求地址
+ */
+@property (nonatomic, strong, readonly, nullable) NSURL *URL;
+
+/*!
+ *  @brief 主机名，没有主机名时为空字符串
+ */
+@property (nonatomic, copy, readonly) NSString *host;
+
+/*!
+ *  @brief HTTP 请求方法
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *HTTPMethod;
+
+/*!
+ *  @brief HTTP 状态码，没有收到响应时为 0
+ */
+@property (nonatomic, assign, readonly) NSInteger statusCode;
+
+/*!
+ *  @brief 任务失败的错误信息
+ */
+@property (nonatomic, strong, readonly, nullable) NSError *error;
+
+/*!
+ *  @brief 是否来自系统收集的统计数据，否则为时间戳估算
+ */
+@property (nonatomic, assign, readonly, getter=isCollectedBySystem) BOOL collectedBySystem;
+
+/*!
+ *  @brief 是否复用了已有连接
+ */
+@property (nonatomic, assign, readonly, getter=isReusedConnection) BOOL reusedConnection;
+
+/*!
+ *  @brief 任务开始时间
+ */
+@property (nonatomic, strong, readonly) NSDate *startDate;
+
+/*!
+ *  @brief DNS 解析耗时
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval domainLookupDuration;
+
+/*!
+ *  @brief 建立连接耗时，包括 TLS 握手
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval connectDuration;
+
+/*!
+ *  @brief TLS 握手耗时
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval secureConnectionDuration;
+
+/*!
+ *  @brief 首字节时间，从任务开始到收到响应的第一个字节
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval timeToFirstByte;
+
+/*!
+ *  @brief 传输耗时，从收到第一个字节到收到最后一个字节
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval transferDuration;
+
+/*!
+ *  @brief 任务总耗时
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval totalDuration;
+
+/*!
+ *  @brief 发送的请求体字节数
+ */
+@property (nonatomic, assign, readonly) int64_t countOfBytesSent;
+
+/*!
+ *  @brief 收到的响应体字节数
+ */
+@property (nonatomic, assign, readonly) int64_t countOfBytesReceived;
+
+/*!
+ *  @brief 请求体压缩前的长度，没有压缩时为 0，详见 NSMutableURLRequest 的 gzipHTTPBodyIfLargerThan:
+ */
+@property (nonatomic, assign, readonly) int64_t originalRequestBodyLength;
+
+/*!
+ *  @brief 转换为字典，耗时未知的阶段不包含在内
+ *
+ *  @return 字典
+ */
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation;
+
+@end
+
+
+@class SGSNetworkMetricsCollector;
+
+/*!
+ *  @brief 耗时统计的观察者
+ */
+@protocol SGSNetworkMetricsObserver <NSObject>
+
+/*!
+ *  @brief 收集到任务的耗时统计，在收集器的内部串行队列中回调
+ *
+ *  @param collector 收集器
+ *  @param metrics   耗时统计
+ */
+- (void)metricsCollector:(SGSNetworkMetricsCollector *)collector didCollectMetrics:(SGSTaskMetrics *)metrics;
+
+@end
+
+
+/*!
+ *  @brief 耗时统计收集器
+ *
+ *  @discussion 将收到的耗时统计分发给观察者，并按主机汇总各阶段耗时的直方图，
+ *      直方图按 5% 的相对精度分桶，可以计算 p50、p95 和 p99，内存占用与请求数量无关
+ *
+ *      使用系统统计数据时，需要在会话代理的 URLSession:task:didFinishCollectingMetrics: 中调用 collectSessionTaskMetrics:forTask:，
+ *      NSURLSession 设置 metricsCollector 后，SGS 辅助方法创建的任务在 iOS 15 及以上自动收集系统统计数据，
+ *      之前的系统以时间戳估算耗时，
+ *      同一任务只记录一次，系统统计数据和时间戳估算先收到的为准
+ *
+ *      只有成功（没有错误且状态码小于 400）的任务计入各阶段的直方图，
+ *      失败任务的总耗时单独记录在 failed 阶段中，观察者仍然会收到所有任务的统计
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSNetworkMetricsCollector : NSObject
+
+/*!
+ *  @brief 共享的收集器
+ */
++ (instancetype)sharedCollector;
+
+/*!
+ *  @brief 添加观察者，只弱引用观察者
+ *
+ *  @param observer 观察者
+ */
+- (void)addObserver:(id<SGSNetworkMetricsObserver>)observer;
+
+/*!
+ *  @brief 移除观察者
+ *
+ *  @param observer 观察者
+ */
+- (void)removeObserver:(id<SGSNetworkMetricsObserver>)observer;
+
+/*!
+ *  @brief 收集系统统计数据，同一任务已经记录过时忽略
+ *
+ *  @param metrics URLSession:task:didFinishCollectingMetrics: 中得到的统计数据
+ *  @param task    网络任务
+ */
+- (void)collectSessionTaskMetrics:(NSURLSessionTaskMetrics *)metrics forTask:(NSURLSessionTask *)task NS_AVAILABLE_IOS(10_0);
+
+/*!
+ *  @brief 收集以时间戳估算的耗时统计，同一任务已经记录过时忽略
+ *
+ *  @param task          网络任务
+ *  @param startDate     任务开始时间
+ *  @param firstByteDate 收到第一个字节的时间，没有收到数据时为空
+ *  @param endDate       任务结束时间
+ */
+- (void)collectMetricsForTask:(NSURLSessionTask *)task
+                    startDate:(NSDate *)startDate
+                firstByteDate:(nullable NSDate *)firstByteDate
+                      endDate:(NSDate *)endDate;
+
+/*!
+ *  @brief 收集耗时统计
+ *
+ *  @param metrics 耗时统计
+ */
+- (void)collectMetrics:(SGSTaskMetrics *)metrics;
+
+/*!
+ *  @brief 主机的耗时汇总
+ *
+ *  @discussion 以阶段名称为键（total、timeToFirstByte、transfer、domainLookup、connect、secureConnection，
+ *      以及失败任务的总耗时 failed），
+ *      值为包含 count、p50、p95、p99 和 max 的字典，耗时单位为毫秒
+ *
+ *  @param host 主机名
+ *
+ *  @return 汇总字典，没有记录时返回 nil
+ */
+- (nullable NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)latencySummaryForHost:(NSString *)host;
+
+/*!
+ *  @brief 所有主机的耗时汇总，以主机名为键，值的格式同 latencySummaryForHost:
+ *
+ *  @return 汇总字典
+ */
+- (NSDictionary<NSString *, NSDictionary *> *)latencySummary;
+
+/*!
+ *  @brief 所有主机的耗时汇总的 JSON 数据
+ *
+ *  @return JSON 数据
+ */
+- (NSData *)latencySummaryJSONData;
+
+/*!
+ *  @brief 清空汇总数据
+ */
+- (void)reset;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,334 @@
+/*!
+ *  @header SGSNetworkMetrics.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSNetworkMetrics.h"
+#import "NSMutableURLRequest+SGS.h"
+#include <math.h>
+
+const NSTimeInterval SGSTaskMetricsDurationUnknown = -1;
+
+static NSString * const kFailedPhaseName = @"failed";
+
+static NSTimeInterval p_DurationBetweenDates(NSDate *startDate, NSDate *endDate) {
+    if ((startDate == nil) || (endDate == nil)) return SGSTaskMetricsDurationUnknown;
+
+    return MAX([endDate timeIntervalSinceDate:startDate], 0);
+}
+
+#pragma mark - SGSTaskMetrics
+
+@interface SGSTaskMetrics ()
+- (NSDictionary<NSString *, NSNumber *> *)p_durations;
+- (BOOL)p_isSuccessful;
+@end
+
+@implementation SGSTaskMetrics
+
+- (instancetype)initWithTask:(NSURLSessionTask *)task sessionTaskMetrics:(NSURLSessionTaskMetrics *)metrics {
+    self = [super init];
+    if (self) {
+        [self p_setupWithTask:task];
+
+        NSURLSessionTaskTransactionMetrics *transaction = metrics.transactionMetrics.lastObject;
+
+        _collectedBySystem = YES;
+        _reusedConnection = transaction.isReusedConnection;
+        _startDate = metrics.taskInterval.startDate ?: [NSDate date];
+        _totalDuration = metrics.taskInterval.duration;
+        _domainLookupDuration = p_DurationBetweenDates(transaction.domainLookupStartDate, transaction.domainLookupEndDate);
+        _connectDuration = p_DurationBetweenDates(transaction.connectStartDate, transaction.connectEndDate);
+        _secureConnectionDuration = p_DurationBetweenDates(transaction.secureConnectionStartDate, transaction.secureConnectionEndDate);
+        _timeToFirstByte = p_DurationBetweenDates(metrics.taskInterval.startDate, transaction.responseStartDate);
+        _transferDuration = p_DurationBetweenDates(transaction.responseStartDate, transaction.responseEndDate);
+    }
+    return self;
+}
+
+- (instancetype)initWithTask:(NSURLSessionTask *)task startDate:(NSDate *)startDate firstByteDate:(NSDate *)firstByteDate endDate:(NSDate *)endDate {
+    self = [super init];
+    if (self) {
+        [self p_setupWithTask:task];
+
+        _collectedBySystem = NO;
+        _startDate = startDate;
+        _totalDuration = p_DurationBetweenDates(startDate, endDate);
+        _domainLookupDuration = SGSTaskMetricsDurationUnknown;
+        _connectDuration = SGSTaskMetricsDurationUnknown;
+        _secureConnectionDuration = SGSTaskMetricsDurationUnknown;
+        _timeToFirstByte = p_DurationBetweenDates(startDate, firstByteDate);
+        _transferDuration = p_DurationBetweenDates(firstByteDate, endDate);
+    }
+    return self;
+}
+
+- (void)p_setupWithTask:(NSURLSessionTask *)task {
+    NSURLRequest *request = task.originalRequest ?: task.currentRequest;
+
+    _task = task;
+    _URL = request.URL;
+    _host = request.URL.host ?: @"";
+    _HTTPMethod = request.HTTPMethod;
+    _error = task.error;
+    _countOfBytesSent = task.countOfBytesSent;
+    _countOfBytesReceived = task.countOfBytesReceived;
+
+    if ([task.response isKindOfClass:[NSHTTPURLResponse class]]) {
+        _statusCode = ((NSHTTPURLResponse *)task.response).statusCode;
+    }
+
+    if (request != nil) {
+        _originalRequestBodyLength = [[NSURLProtocol propertyForKey:SGSHTTPBodyOriginalLengthKey inRequest:request] longLongValue];
+    }
+}
+
+- (NSDictionary<NSString *,id> *)dictionaryRepresentation {
+    NSMutableDictionary *dict = [NSMutableDictionary dictionary];
+    dict[@"url"] = _URL.absoluteString;
+    dict[@"host"] = _host;
+    dict[@"method"] = _HTTPMethod;
+    dict[@"statusCode"] = @(_statusCode);
+    dict[@"collectedBySystem"] = @(_collectedBySystem);
+    dict[@"reusedConnection"] = @(_reusedConnection);
+    dict[@"bytesSent"] = @(_countOfBytesSent);
+    dict[@"bytesReceived"] = @(_countOfBytesReceived);
+    if (_originalRequestBodyLength > 0) dict[@"originalRequestBodyLength"] = @(_originalRequestBodyLength);
+    if (_error != nil) dict[@"error"] = [NSString stringWithFormat:@"%@ %ld", _error.domain, (long)_error.code];
+
+    NSDictionary<NSString *, NSNumber *> *durations = [self p_durations];
+    [durations enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSNumber *obj, BOOL *stop) {
+        dict[key] = @(obj.doubleValue * 1000);
+    }];
+
+    return dict.copy;
+}
+
+// 以阶段名称为键的已知耗时，单位：秒
+- (NSDictionary<NSString *, NSNumber *> *)p_durations {
+    NSMutableDictionary *durations = [NSMutableDictionary dictionaryWithCapacity:6];
+    if (_totalDuration >= 0)            durations[@"total"] = @(_totalDuration);
+    if (_timeToFirstByte >= 0)          durations[@"timeToFirstByte"] = @(_timeToFirstByte);
+    if (_transferDuration >= 0)         durations[@"transfer"] = @(_transferDuration);
+    if (_domainLookupDuration >= 0)     durations[@"domainLookup"] = @(_domainLookupDuration);
+    if (_connectDuration >= 0)          durations[@"connect"] = @(_connectDuration);
+    if (_secureConnectionDuration >= 0) durations[@"secureConnection"] = @(_secureConnectionDuration);
+
+    return durations;
+}
+
+// 没有错误且状态码小于 400，非 HTTP 任务的状态码为 0
+- (BOOL)p_isSuccessful {
+    return (_error == nil) && (_statusCode < 400);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p> %@", [self class], self, [self dictionaryRepresentation]];
+}
+
+@end
+
+
+#pragma mark - Latency Histogram
+
+/// 对数分桶，相邻桶的边界相差 5%，覆盖 0 ~ 约 100 分钟
+#define kLatencyHistogramBucketCount 320
+static const double kLatencyHistogramGrowth = 1.05;
+
+/// 耗时直方图，单位：毫秒，只在收集器的队列中访问，仅内部使用
+@interface p_LatencyHistogram : NSObject
+- (void)recordValue:(double)milliseconds;
+- (NSDictionary<NSString *, NSNumber *> *)summary;
+@end
+
+@implementation p_LatencyHistogram {
+    uint32_t _buckets[kLatencyHistogramBucketCount];
+    uint64_t _count;
+    double _max;
+}
+
+- (void)recordValue:(double)milliseconds {
+    if (!(milliseconds >= 0)) return;
+
+    NSInteger bucketIndex = (NSInteger)floor(log1p(milliseconds) / log(kLatencyHistogramGrowth));
+    bucketIndex = MIN(MAX(bucketIndex, 0), kLatencyHistogramBucketCount - 1);
+
+    _buckets[bucketIndex] += 1;
+    _count += 1;
+    _max = MAX(_max, milliseconds);
+}
+
+- (double)p_valueAtQuantile:(double)quantile {
+    if (_count == 0) return 0;
+
+    uint64_t target = MAX((uint64_t)ceil(quantile * _count), 1);
+    uint64_t cumulative = 0;
+    for (NSInteger i = 0; i < kLatencyHistogramBucketCount; i++) {
+        cumulative += _buckets[i];
+        if (cumulative >= target) {
+            // 取桶的上界，不超过记录到的最大值
+            return MIN(expm1((i + 1) * log(kLatencyHistogramGrowth)), _max);
+        }
+    }
+    return _max;
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)summary {
+    return @{@"count": @(_count),
+             @"p50": @(round([self p_valueAtQuantile:0.5] * 10) / 10),
+             @"p95": @(round([self p_valueAtQuantile:0.95] * 10) / 10),
+             @"p99": @(round([self p_valueAtQuantile:0.99] * 10) / 10),
+             @"max": @(round(_max * 10) / 10)};
+}
+
+@end
+
+
+#pragma mark - SGSNetworkMetricsCollector
+
+@implementation SGSNetworkMetricsCollector {
+    dispatch_queue_t _queue;
+    NSHashTable<id<SGSNetworkMetricsObserver>> *_observers;
+    NSHashTable<NSURLSessionTask *> *_recordedTasks;
+    NSMutableDictionary<NSString *, NSMutableDictionary<NSString *, p_LatencyHistogram *> *> *_histogramsByHost;
+}
+
++ (instancetype)sharedCollector {
+    static SGSNetworkMetricsCollector *collector = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        collector = [[SGSNetworkMetricsCollector alloc] init];
+    });
+    return collector;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _queue = dispatch_queue_create("com.southgis.SGSCategories.NetworkMetricsCollector", DISPATCH_QUEUE_SERIAL);
+        _observers = [NSHashTable weakObjectsHashTable];
+        _recordedTasks = [NSHashTable hashTableWithOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)];
+        _histogramsByHost = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)addObserver:(id<SGSNetworkMetricsObserver>)observer {
+    dispatch_async(_queue, ^{
+        [_observers addObject:observer];
+    });
+}
+
+- (void)removeObserver:(id<SGSNetworkMetricsObserver>)observer {
+    dispatch_async(_queue, ^{
+        [_observers removeObject:observer];
+    });
+}
+
+- (void)collectSessionTaskMetrics:(NSURLSessionTaskMetrics *)metrics forTask:(NSURLSessionTask *)task {
+    SGSTaskMetrics *taskMetrics = [[SGSTaskMetrics alloc] initWithTask:task sessionTaskMetrics:metrics];
+
+    dispatch_async(_queue, ^{
+        if (![self p_markTaskRecorded:task]) return ;
+        [self p_recordMetrics:taskMetrics];
+    });
+}
+
+- (void)collectMetricsForTask:(NSURLSessionTask *)task startDate:(NSDate *)startDate firstByteDate:(NSDate *)firstByteDate endDate:(NSDate *)endDate {
+    SGSTaskMetrics *taskMetrics = [[SGSTaskMetrics alloc] initWithTask:task startDate:startDate firstByteDate:firstByteDate endDate:endDate];
+
+    dispatch_async(_queue, ^{
+        if (![self p_markTaskRecorded:task]) return ;
+        [self p_recordMetrics:taskMetrics];
+    });
+}
+
+- (void)collectMetrics:(SGSTaskMetrics *)metrics {
+    dispatch_async(_queue, ^{
+        [self p_recordMetrics:metrics];
+    });
+}
+
+- (NSDictionary<NSString *,NSDictionary<NSString *,NSNumber *> *> *)latencySummaryForHost:(NSString *)host {
+    __block NSDictionary *summary = nil;
+    dispatch_sync(_queue, ^{
+        summary = [self p_summaryWithHistograms:_histogramsByHost[host]];
+    });
+    return summary;
+}
+
+- (NSDictionary<NSString *,NSDictionary *> *)latencySummary {
+    NSMutableDictionary *summary = [NSMutableDictionary dictionary];
+    dispatch_sync(_queue, ^{
+        [_histogramsByHost enumerateKeysAndObjectsUsingBlock:^(NSString *host, NSMutableDictionary *histograms, BOOL *stop) {
+            summary[host] = [self p_summaryWithHistograms:histograms];
+        }];
+    });
+    return summary.copy;
+}
+
+- (NSData *)latencySummaryJSONData {
+    return [NSJSONSerialization dataWithJSONObject:[self latencySummary] options:NSJSONWritingPrettyPrinted error:NULL] ?: [NSData data];
+}
+
+- (void)reset {
+    dispatch_async(_queue, ^{
+        [_histogramsByHost removeAllObjects];
+    });
+}
+
+
+#pragma mark - Private
+
+// 同一任务只记录一次，系统统计数据和时间戳估算先到者为准，只在 _queue 中调用
+- (BOOL)p_markTaskRecorded:(NSURLSessionTask *)task {
+    if (task == nil) return YES;
+    if ([_recordedTasks containsObject:task]) return NO;
+
+    [_recordedTasks addObject:task];
+    return YES;
+}
+
+// 只在 _queue 中调用
+- (void)p_recordMetrics:(SGSTaskMetrics *)metrics {
+    NSMutableDictionary<NSString *, p_LatencyHistogram *> *histograms = _histogramsByHost[metrics.host];
+    if (histograms == nil) {
+        histograms = [NSMutableDictionary dictionary];
+        _histogramsByHost[metrics.host] = histograms;
+    }
+
+    // 失败的任务通常很快返回或一直等到超时，只单独记录总耗时，避免影响各阶段的分布
+    NSDictionary<NSString *, NSNumber *> *durations = [metrics p_durations];
+    if (![metrics p_isSuccessful]) {
+        durations = (durations[@"total"] != nil) ? @{kFailedPhaseName: durations[@"total"]} : @{};
+    }
+
+    [durations enumerateKeysAndObjectsUsingBlock:^(NSString *phase, NSNumber *duration, BOOL *stop) {
+        p_LatencyHistogram *histogram = histograms[phase];
+        if (histogram == nil) {
+            histogram = [[p_LatencyHistogram alloc] init];
+            histograms[phase] = histogram;
+        }
+        [histogram recordValue:duration.doubleValue * 1000];
+    }];
+
+    for (id<SGSNetworkMetricsObserver> observer in _observers.allObjects) {
+        [observer metricsCollector:self didCollectMetrics:metrics];
+    }
+}
+
+// 只在 _queue 中调用
+- (NSDictionary *)p_summaryWithHistograms:(NSDictionary<NSString *, p_LatencyHistogram *> *)histograms {
+    if (histograms.count == 0) return nil;
+
+    NSMutableDictionary *summary = [NSMutableDictionary dictionaryWithCapacity:histograms.count];
+    [histograms enumerateKeysAndObjectsUsingBlock:^(NSString *phase, p_LatencyHistogram *histogram, BOOL *stop) {
+        summary[phase] = [histogram summary];
+    }];
+    return summary.copy;
+}
+
+@end
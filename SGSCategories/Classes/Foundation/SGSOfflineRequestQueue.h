@@ -0,0 +1,225 @@
+/*!
+ *  @header SGSOfflineRequestQueue.h
+ *
+ *  @abstract 持久化的离线请求队列
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class SGSRetryPolicy;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 离线请求队列的错误域
+ */
+FOUNDATION_EXPORT NSString * const SGSOfflineRequestErrorDomain;
+
+/*!
+ *  @brief 离线请求队列的错误码
+ */
+typedef NS_ENUM(NSInteger, SGSOfflineRequestErrorCode) {
+    /// 会话无法为请求创建任务（例如会话已失效），请求未发出
+    SGSOfflineRequestErrorTaskCreationFailed = 1,
+};
+
+/*!
+ *  @brief 离线请求的处理结果
+ */
+typedef NS_ENUM(NSInteger, SGSOfflineRequestStatus) {
+    /// 请求成功（状态码小于 400），已从队列中移除
+    SGSOfflineRequestStatusSucceeded = 0,
+    /// 暂时失败（离线或可重试的失败），保留在队列中等待下次重放
+    SGSOfflineRequestStatusDeferred,
+    /// 不可重试的失败、重放次数用完或无法创建任务，已从队列中移除
+    SGSOfflineRequestStatusFailed,
+    /// 被相同 collapseKey 的新请求替代，没有发出，已从队列中移除
+    SGSOfflineRequestStatusSuperseded,
+};
+
+/*!
+ *  @brief 离线请求的处理结果闭包，在主线程回调
+ *
+ *  @param identifier 入队时返回的标识
+ *  @param status     处理结果
+ *  @param response   响应，没有发出或没有响应时为 nil
+ *  @param data       响应数据
+ *  @param error      错误信息
+ */
+typedef void(^SGSOfflineRequestResultBlock)(NSString *identifier, SGSOfflineRequestStatus status, NSURLResponse * _Nullable response, NSData * _Nullable data, NSError * _Nullable error);
+
+/*!
+ *  @brief 重放前为请求重新签名的闭包，在队列内部的串行队列中调用
+ *
+ *  @param request 保存的请求，不含 strippedHeaderFields 中的请求头
+ *
+ *  @return 实际发出的请求，返回 nil 时发出原请求
+ */
+typedef NSURLRequest * _Nullable (^SGSOfflineRequestSigningBlock)(NSURLRequest *request);
+
+/*!
+ *  @brief 持久化的离线请求队列
+ *
+ *  @discussion 入队的请求连同请求体保存在 Application Support 目录下，应用重新启动后仍然保留，
+ *      请求体可以是 HTTPBody、HTTPBodyStream（例如 SGSMultipartFormData 生成的流，入队时读取到文件中）
+ *      或者单独指定的文件（入队时复制一份），重放时以文件上传的形式发出，不需要把请求体读入内存
+ *
+ *      入队时网络可用、网络从不可用变为可用、应用回到前台或调用 replay 时按入队顺序重放，
+ *      每批 batchSize 个请求，批内最多同时发出 maximumConcurrentRequests 个，一批结束后再开始下一批，
+ *      重放过程中出现离线错误时停止本次重放，剩余的请求等待网络恢复
+ *
+ *      collapseKey 相同的请求只保留最后入队的一个，例如同一条记录的多次修改只需要提交最后一次，
+ *      被替代的请求以 SGSOfflineRequestStatusSuperseded 回调，已经发出的请求不会被替代
+ *
+ *      每个请求的处理结果通过 resultHandler 回调，应用启动时应尽早设置，以便接收上次启动时入队的请求的结果
+ *
+ *      Authorization、Cookie 等凭证请求头不写入磁盘，重放时通过 requestSigningHandler 重新签名，
+ *      索引和请求体使用 NSFileProtectionComplete 保护，设备锁定期间不重放，解锁后继续
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSOfflineRequestQueue : NSObject
+
+/*!
+ *  @brief 默认队列，名称为 @"default"，使用 [SGSSessionRegistry sharedRegistry].defaultSession 发出请求
+ *
+ *  @return SGSOfflineRequestQueue
+ */
++ (instancetype)sharedQueue;
+
+/*!
+ *  @brief 初始化
+ *
+ *  @discussion 同一个名称在同一时间只应有一个实例
+ *
+ *  @param name    队列名称，不同名称的队列分开保存
+ *  @param session 重放请求的会话
+ *
+ *  @return SGSOfflineRequestQueue
+ */
+- (instancetype)initWithName:(NSString *)name session:(NSURLSession *)session NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 队列名称
+ */
+@property (nonatomic, copy, readonly) NSString *name;
+
+/*!
+ *  @brief 重放请求的会话
+ */
+@property (atomic, strong) NSURLSession *session;
+
+/*!
+ *  @brief 每批重放的请求数，默认为 10
+ */
+@property (atomic, assign) NSUInteger batchSize;
+
+/*!
+ *  @brief 每批中最多同时发出的请求数，默认为 2
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentRequests;
+
+/*!
+ *  @brief 每个请求最多重放的次数，默认为 5，用完后以 SGSOfflineRequestStatusFailed 移除
+ */
+@property (atomic, assign) NSUInteger maximumAttemptCount;
+
+/*!
+ *  @brief 判断失败是否可重试，默认为 [SGSRetryPolicy defaultPolicy]，只使用其中的 isRetryableResponse:error:
+ */
+@property (atomic, copy) SGSRetryPolicy *retryPolicy;
+
+/*!
+ *  @brief 入队时网络可用、网络恢复或应用回到前台时是否自动重放，默认为 YES
+ */
+@property (atomic, assign) BOOL automaticallyReplays;
+
+/*!
+ *  @brief 入队时从请求中移除、不写入磁盘的请求头，不区分大小写，
+ *      默认为 Authorization、Proxy-Authorization 和 Cookie
+ */
+@property (atomic, copy) NSSet<NSString *> *strippedHeaderFields;
+
+/*!
+ *  @brief 重放前为请求重新签名，例如添加当前的 Authorization 请求头
+ */
+@property (atomic, copy, nullable) SGSOfflineRequestSigningBlock requestSigningHandler;
+
+/*!
+ *  @brief 每个请求的处理结果
+ */
+@property (atomic, copy, nullable) SGSOfflineRequestResultBlock resultHandler;
+
+/*!
+ *  @brief 队列中的请求数，包括正在重放的请求
+ */
+@property (atomic, assign, readonly) NSUInteger count;
+
+/*!
+ *  @brief 是否正在重放
+ */
+@property (atomic, assign, readonly, getter=isReplaying) BOOL replaying;
+
+/*!
+ *  @brief 请求入队
+ *
+ *  @param request     HTTP 请求，HTTPBodyStream 在入队时同步读取到文件中，strippedHeaderFields 中的请求头不会保存
+ *  @param collapseKey 合并标识，为空时不合并
+ *  @param error       保存失败时的错误信息
+ *
+ *  @return 请求的标识，保存失败时返回 nil
+ */
+- (nullable NSString *)enqueueRequest:(NSURLRequest *)request
+                          collapseKey:(nullable NSString *)collapseKey
+                                error:(NSError **)error;
+
+/*!
+ *  @brief 以文件作为请求体的请求入队
+ *
+ *  @discussion 文件在入队时复制到队列目录中，之后原文件可以修改或删除
+ *
+ *  @param request     HTTP 请求，原有的请求体被忽略
+ *  @param fileURL     请求体文件
+ *  @param collapseKey 合并标识，为空时不合并
+ *  @param error       保存失败时的错误信息
+ *
+ *  @return 请求的标识，保存失败时返回 nil
+ */
+- (nullable NSString *)enqueueRequest:(NSURLRequest *)request
+                             fromFile:(NSURL *)fileURL
+                          collapseKey:(nullable NSString *)collapseKey
+                                error:(NSError **)error;
+
+/*!
+ *  @brief 移除请求，已经发出的请求不会被取消
+ *
+ *  @param identifier 请求的标识
+ */
+- (void)removeRequestWithIdentifier:(NSString *)identifier;
+
+/*!
+ *  @brief 移除所有请求
+ */
+- (void)removeAllRequests;
+
+/*!
+ *  @brief 立即重放，正在重放时忽略
+ */
+- (void)replay;
+
+/*!
+ *  @brief 立即重放
+ *
+ *  @param completion 本次重放结束时在主线程回调，参数为队列中剩余的请求数，正在重放时在当前重放结束后回调
+ */
+- (void)replayWithCompletion:(nullable void (^)(NSUInteger remainingCount))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
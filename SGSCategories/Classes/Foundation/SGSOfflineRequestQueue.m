@@ -0,0 +1,718 @@
+/*!
+ *  @header SGSOfflineRequestQueue.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSOfflineRequestQueue.h"
+#import "SGSRetryPolicy.h"
+#import "SGSSessionRegistry.h"
+#import <SystemConfiguration/SystemConfiguration.h>
+#include <netinet/in.h>
+
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
+NSString * const SGSOfflineRequestErrorDomain = @"SGSOfflineRequestErrorDomain";
+
+static NSString * const kOfflineQueueDirectoryName = @"com.southgis.SGSCategories.OfflineRequestQueue";
+static NSString * const kOfflineQueueIndexFileName = @"queue.plist";
+static NSString * const kOfflineQueueBodyExtension = @"body";
+static const NSUInteger kOfflineQueueCopyBufferSize = 64 * 1024;
+// 合并这段时间内的索引修改，只写入一次
+static const NSTimeInterval kOfflineQueueSaveDelay = 0.5;
+
+// 索引文件中每个请求的键
+static NSString * const kOfflineRequestIdentifierKey = @"identifier";
+static NSString * const kOfflineRequestCollapseKeyKey = @"collapseKey";
+static NSString * const kOfflineRequestRequestKey = @"request";
+static NSString * const kOfflineRequestHasBodyKey = @"hasBody";
+static NSString * const kOfflineRequestAttemptCountKey = @"attemptCount";
+
+
+#pragma mark - Reachability Callback
+
+static const void *p_retainReachabilityInfo(const void *info) {
+    return Block_copy(info);
+}
+
+static void p_releaseReachabilityInfo(const void *info) {
+    if (info) Block_release(info);
+}
+
+static void p_reachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info) {
+    void (^handler)(SCNetworkReachabilityFlags) = (__bridge void (^)(SCNetworkReachabilityFlags))info;
+    if (handler) handler(flags);
+}
+
+static BOOL p_isReachableWithFlags(SCNetworkReachabilityFlags flags) {
+    if ((flags & kSCNetworkReachabilityFlagsReachable) == 0) return NO;
+    if ((flags & kSCNetworkReachabilityFlagsConnectionRequired) == 0) return YES;
+
+    // 需要按需建立连接但不需要用户干预时也视为可用
+    BOOL onDemand = (flags & (kSCNetworkReachabilityFlagsConnectionOnDemand | kSCNetworkReachabilityFlagsConnectionOnTraffic)) != 0;
+    return onDemand && ((flags & kSCNetworkReachabilityFlagsInterventionRequired) == 0);
+}
+
+
+#pragma mark - Offline Request
+
+/// 队列中的一个请求，仅内部使用
+@interface p_OfflineRequest : NSObject
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, copy) NSString *collapseKey;
+@property (nonatomic, strong) NSURLRequest *request;    // 不含请求体，请求体保存在单独的文件中
+@property (nonatomic, assign) BOOL hasBody;
+@property (nonatomic, assign) NSUInteger attemptCount;
+@property (nonatomic, assign) BOOL inFlight;            // 以下两项不保存
+@property (nonatomic, assign) BOOL attempted;           // 本次重放中已经发出过
+@end
+
+@implementation p_OfflineRequest
+
+- (instancetype)initWithDictionary:(NSDictionary *)dictionary {
+    NSString *identifier = dictionary[kOfflineRequestIdentifierKey];
+    NSData *requestData = dictionary[kOfflineRequestRequestKey];
+    if (![identifier isKindOfClass:[NSString class]] || ![requestData isKindOfClass:[NSData class]]) return nil;
+
+    id request = nil;
+    @try {
+        NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:requestData];
+        unarchiver.requiresSecureCoding = YES;
+        request = [unarchiver decodeObjectOfClass:[NSURLRequest class] forKey:NSKeyedArchiveRootObjectKey];
+        [unarchiver finishDecoding];
+    } @catch (NSException *exception) {
+        request = nil;
+    }
+    if (![request isKindOfClass:[NSURLRequest class]]) return nil;
+
+    self = [super init];
+    if (self) {
+        _identifier = identifier.copy;
+        _collapseKey = [dictionary[kOfflineRequestCollapseKeyKey] copy];
+        _request = request;
+        _hasBody = [dictionary[kOfflineRequestHasBodyKey] boolValue];
+        _attemptCount = [dictionary[kOfflineRequestAttemptCountKey] unsignedIntegerValue];
+    }
+    return self;
+}
+
+- (NSDictionary *)dictionaryRepresentation {
+    NSMutableData *requestData = [NSMutableData data];
+    NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:requestData];
+    archiver.requiresSecureCoding = YES;
+    [archiver encodeObject:_request forKey:NSKeyedArchiveRootObjectKey];
+    [archiver finishEncoding];
+
+    NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:5];
+    dictionary[kOfflineRequestIdentifierKey] = _identifier;
+    dictionary[kOfflineRequestRequestKey] = requestData;
+    dictionary[kOfflineRequestHasBodyKey] = @(_hasBody);
+    dictionary[kOfflineRequestAttemptCountKey] = @(_attemptCount);
+    if (_collapseKey) dictionary[kOfflineRequestCollapseKeyKey] = _collapseKey;
+    return dictionary;
+}
+
+@end
+
+
+#pragma mark - SGSOfflineRequestQueue
+
+@implementation SGSOfflineRequestQueue {
+    NSString *_directory;
+    dispatch_queue_t _queue;
+
+    // 以下变量只在 _queue 中访问
+    NSMutableArray<p_OfflineRequest *> *_items;
+    NSMutableArray<void (^)(NSUInteger)> *_completions;
+    NSMutableArray<p_OfflineRequest *> *_batch;
+    NSUInteger _batchRunningCount;
+    BOOL _replayingFlag;
+    BOOL _offlineDuringReplay;
+    BOOL _reachable;
+    BOOL _loaded;                   // 索引已经读取，之前不写入索引以免覆盖
+    BOOL _protectedDataAvailable;   // 设备锁定时无法读取受保护的请求体，暂停重放
+    BOOL _saveScheduled;
+
+    SCNetworkReachabilityRef _reachability;
+}
+
++ (instancetype)sharedQueue {
+    static SGSOfflineRequestQueue *queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = [[SGSOfflineRequestQueue alloc] initWithName:@"default" session:[SGSSessionRegistry sharedRegistry].defaultSession];
+    });
+    return queue;
+}
+
+- (instancetype)initWithName:(NSString *)name session:(NSURLSession *)session {
+    self = [super init];
+    if (self) {
+        _name = name.copy;
+        _session = session;
+        _batchSize = 10;
+        _maximumConcurrentRequests = 2;
+        _maximumAttemptCount = 5;
+        _retryPolicy = [SGSRetryPolicy defaultPolicy];
+        _automaticallyReplays = YES;
+        _strippedHeaderFields = [NSSet setWithObjects:@"Authorization", @"Proxy-Authorization", @"Cookie", nil];
+        _protectedDataAvailable = YES;
+
+        _items = [NSMutableArray array];
+        _completions = [NSMutableArray array];
+        _batch = [NSMutableArray array];
+
+        NSString *support = NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory, NSUserDomainMask, YES).firstObject;
+        _directory = [[support stringByAppendingPathComponent:kOfflineQueueDirectoryName] stringByAppendingPathComponent:name];
+        _queue = dispatch_queue_create("com.southgis.SGSCategories.OfflineRequestQueue", DISPATCH_QUEUE_SERIAL);
+
+        dispatch_async(_queue, ^{
+            [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            [self p_load];
+        });
+
+        [self p_startMonitoringReachability];
+
+#if TARGET_OS_IPHONE
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(p_applicationDidBecomeActive:)
+                                                     name:UIApplicationDidBecomeActiveNotification
+                                                   object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(p_protectedDataWillBecomeUnavailable:)
+                                                     name:UIApplicationProtectedDataWillBecomeUnavailable
+                                                   object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(p_protectedDataDidBecomeAvailable:)
+                                                     name:UIApplicationProtectedDataDidBecomeAvailable
+                                                   object:nil];
+#endif
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+
+    if (_reachability) {
+        SCNetworkReachabilitySetDispatchQueue(_reachability, NULL);
+        SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
+        CFRelease(_reachability);
+    }
+}
+
+
+#pragma mark - Public
+
+- (NSUInteger)count {
+    __block NSUInteger count = 0;
+    dispatch_sync(_queue, ^{
+        count = _items.count;
+    });
+    return count;
+}
+
+- (BOOL)isReplaying {
+    __block BOOL replaying = NO;
+    dispatch_sync(_queue, ^{
+        replaying = _replayingFlag;
+    });
+    return replaying;
+}
+
+- (NSString *)enqueueRequest:(NSURLRequest *)request collapseKey:(NSString *)collapseKey error:(NSError **)error {
+    return [self p_enqueueRequest:request bodyFileURL:nil collapseKey:collapseKey error:error];
+}
+
+- (NSString *)enqueueRequest:(NSURLRequest *)request fromFile:(NSURL *)fileURL collapseKey:(NSString *)collapseKey error:(NSError **)error {
+    return [self p_enqueueRequest:request bodyFileURL:fileURL collapseKey:collapseKey error:error];
+}
+
+- (void)removeRequestWithIdentifier:(NSString *)identifier {
+    dispatch_async(_queue, ^{
+        for (p_OfflineRequest *item in [_items copy]) {
+            if ([item.identifier isEqualToString:identifier]) {
+                [self p_removeItem:item];
+            }
+        }
+    });
+}
+
+- (void)removeAllRequests {
+    dispatch_async(_queue, ^{
+        for (p_OfflineRequest *item in [_items copy]) {
+            [self p_removeItem:item];
+        }
+    });
+}
+
+- (void)replay {
+    [self replayWithCompletion:nil];
+}
+
+- (void)replayWithCompletion:(void (^)(NSUInteger))completion {
+    dispatch_async(_queue, ^{
+        [self p_startReplayWithCompletion:completion];
+    });
+}
+
+
+#pragma mark - Enqueue
+
+- (NSString *)p_enqueueRequest:(NSURLRequest *)request
+                   bodyFileURL:(NSURL *)fileURL
+                   collapseKey:(NSString *)collapseKey
+                         error:(NSError **)error
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if (![fileManager createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:error]) return nil;
+
+    NSString *identifier = [NSUUID UUID].UUIDString;
+    NSString *bodyPath = [self p_bodyPathForIdentifier:identifier];
+
+    // 请求体统一保存为文件，流只能读取一次，需要在入队时同步读取
+    BOOL hasBody = YES;
+    BOOL saved = YES;
+    if (fileURL != nil) {
+        saved = [fileManager copyItemAtPath:fileURL.path toPath:bodyPath error:error] &&
+                [fileManager setAttributes:@{NSFileProtectionKey: NSFileProtectionComplete} ofItemAtPath:bodyPath error:error];
+    } else if (request.HTTPBody != nil) {
+        saved = [request.HTTPBody writeToFile:bodyPath options:(NSDataWritingAtomic | NSDataWritingFileProtectionComplete) error:error];
+    } else if (request.HTTPBodyStream != nil) {
+        saved = [self p_writeStream:request.HTTPBodyStream toPath:bodyPath error:error];
+    } else {
+        hasBody = NO;
+    }
+
+    if (!saved) {
+        [fileManager removeItemAtPath:bodyPath error:NULL];
+        return nil;
+    }
+
+    // 凭证不写入磁盘，重放时由 requestSigningHandler 重新签名
+    NSMutableURLRequest *storedRequest = [request mutableCopy];
+    storedRequest.HTTPBody = nil;
+    storedRequest.HTTPBodyStream = nil;
+    NSSet<NSString *> *strippedHeaderFields = self.strippedHeaderFields;
+    for (NSString *field in request.allHTTPHeaderFields) {
+        for (NSString *strippedField in strippedHeaderFields) {
+            if ([field caseInsensitiveCompare:strippedField] == NSOrderedSame) {
+                [storedRequest setValue:nil forHTTPHeaderField:field];
+            }
+        }
+    }
+
+    p_OfflineRequest *item = [[p_OfflineRequest alloc] init];
+    item.identifier = identifier;
+    item.collapseKey = collapseKey;
+    item.request = storedRequest;
+    item.hasBody = hasBody;
+
+    dispatch_async(_queue, ^{
+        // 已经发出的请求无法撤回，只替代仍在排队的请求
+        NSMutableArray<p_OfflineRequest *> *superseded = [NSMutableArray array];
+        if (collapseKey != nil) {
+            for (p_OfflineRequest *existing in _items) {
+                if (!existing.inFlight && [existing.collapseKey isEqualToString:collapseKey]) {
+                    [superseded addObject:existing];
+                }
+            }
+        }
+
+        [_items addObject:item];
+        for (p_OfflineRequest *existing in superseded) {
+            [self p_removeItem:existing];
+            [self p_reportItem:existing status:SGSOfflineRequestStatusSuperseded response:nil data:nil error:nil];
+        }
+        [self p_save];
+
+        if (self.automaticallyReplays && _reachable) {
+            [self p_startReplayWithCompletion:nil];
+        }
+    });
+
+    return identifier;
+}
+
+- (BOOL)p_writeStream:(NSInputStream *)inputStream toPath:(NSString *)path error:(NSError **)error {
+    // 先以受保护的方式创建文件，再追加写入
+    if (![[NSData data] writeToFile:path options:NSDataWritingFileProtectionComplete error:error]) return NO;
+
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToFileAtPath:path append:YES];
+    [inputStream open];
+    [outputStream open];
+
+    uint8_t *buffer = malloc(kOfflineQueueCopyBufferSize);
+    NSError *streamError = nil;
+
+    while (streamError == nil) {
+        NSInteger readLength = [inputStream read:buffer maxLength:kOfflineQueueCopyBufferSize];
+        if (readLength == 0) break;
+        if (readLength < 0) {
+            streamError = inputStream.streamError ?: [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:nil];
+            break;
+        }
+
+        NSInteger offset = 0;
+        while (offset < readLength) {
+            NSInteger writeLength = [outputStream write:buffer + offset maxLength:readLength - offset];
+            if (writeLength <= 0) {
+                streamError = outputStream.streamError ?: [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:nil];
+                break;
+            }
+            offset += writeLength;
+        }
+    }
+
+    free(buffer);
+    [inputStream close];
+    [outputStream close];
+
+    if (streamError != nil) {
+        if (error) *error = streamError;
+        return NO;
+    }
+    return YES;
+}
+
+
+#pragma mark - Replay
+
+// 以下方法只在 _queue 中调用
+
+- (void)p_startReplayWithCompletion:(void (^)(NSUInteger))completion {
+    if (completion) [_completions addObject:[completion copy]];
+    if (_replayingFlag) return;
+
+    _replayingFlag = YES;
+    _offlineDuringReplay = NO;
+    for (p_OfflineRequest *item in _items) {
+        item.attempted = NO;
+    }
+
+    [self p_replayNextBatch];
+}
+
+// 按入队顺序取出本次重放中还没有发出过的请求，没有时结束本次重放
+- (void)p_replayNextBatch {
+    [_batch removeAllObjects];
+    _batchRunningCount = 0;
+
+    if (!_offlineDuringReplay && _protectedDataAvailable) {
+        NSUInteger batchSize = MAX(self.batchSize, 1);
+        for (p_OfflineRequest *item in _items) {
+            if (item.attempted || item.inFlight) continue;
+            [_batch addObject:item];
+            if (_batch.count == batchSize) break;
+        }
+    }
+
+    if (_batch.count == 0) {
+        [self p_finishReplay];
+        return;
+    }
+
+    [self p_startBatchRequests];
+}
+
+- (void)p_startBatchRequests {
+    NSUInteger maximumConcurrentRequests = MAX(self.maximumConcurrentRequests, 1);
+
+    while ((_batch.count > 0) && (_batchRunningCount < maximumConcurrentRequests) && !_offlineDuringReplay) {
+        p_OfflineRequest *item = _batch.firstObject;
+        [_batch removeObjectAtIndex:0];
+
+        // 等待期间被移除或替代
+        if (![_items containsObject:item]) continue;
+
+        item.attempted = YES;
+        item.inFlight = YES;
+        _batchRunningCount += 1;
+        [self p_sendItem:item];
+    }
+
+    if (_batchRunningCount == 0) {
+        [self p_replayNextBatch];
+    }
+}
+
+- (void)p_sendItem:(p_OfflineRequest *)item {
+    void (^completionHandler)(NSData *, NSURLResponse *, NSError *) = ^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        dispatch_async(_queue, ^{
+            [self p_item:item didCompleteWithResponse:response data:data error:error];
+        });
+    };
+
+    NSURLRequest *request = item.request;
+    SGSOfflineRequestSigningBlock signingHandler = self.requestSigningHandler;
+    if (signingHandler) request = signingHandler(request) ?: request;
+
+    NSURLSession *session = self.session;
+    NSURLSessionTask *task = nil;
+    if (item.hasBody) {
+        NSURL *bodyURL = [NSURL fileURLWithPath:[self p_bodyPathForIdentifier:item.identifier]];
+        task = [session uploadTaskWithRequest:request fromFile:bodyURL completionHandler:completionHandler];
+    } else {
+        task = [session dataTaskWithRequest:request completionHandler:completionHandler];
+    }
+
+    // 无法创建任务与网络状态无关，重放也不会成功
+    if (task == nil) {
+        completionHandler(nil, nil, [NSError errorWithDomain:SGSOfflineRequestErrorDomain code:SGSOfflineRequestErrorTaskCreationFailed userInfo:nil]);
+        return;
+    }
+    [task resume];
+}
+
+- (void)p_item:(p_OfflineRequest *)item didCompleteWithResponse:(NSURLResponse *)response data:(NSData *)data error:(NSError *)error {
+    item.inFlight = NO;
+    _batchRunningCount -= 1;
+
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    BOOL permanentFailure = [error.domain isEqualToString:SGSOfflineRequestErrorDomain];
+    SGSOfflineRequestStatus status = SGSOfflineRequestStatusFailed;
+
+    if ((error == nil) && ((httpResponse == nil) || (httpResponse.statusCode < 400))) {
+        status = SGSOfflineRequestStatusSucceeded;
+    } else if ([self p_isOfflineError:error]) {
+        // 离线不是请求本身的问题，不计入重放次数
+        status = SGSOfflineRequestStatusDeferred;
+        _offlineDuringReplay = YES;
+    } else if (!permanentFailure && [self.retryPolicy isRetryableResponse:response error:error] && (item.attemptCount + 1 < MAX(self.maximumAttemptCount, 1))) {
+        status = SGSOfflineRequestStatusDeferred;
+        item.attemptCount += 1;
+    }
+
+    // 发出期间被移除的请求不再保留
+    if ((status != SGSOfflineRequestStatusDeferred) || ![_items containsObject:item]) {
+        [self p_removeItem:item];
+    } else {
+        [self p_setNeedsSave];
+    }
+
+    [self p_reportItem:item status:status response:response data:data error:error];
+    [self p_startBatchRequests];
+}
+
+- (void)p_finishReplay {
+    _replayingFlag = NO;
+
+    NSArray<void (^)(NSUInteger)> *completions = [_completions copy];
+    [_completions removeAllObjects];
+    NSUInteger remainingCount = _items.count;
+
+    if (completions.count == 0) return;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (void (^completion)(NSUInteger) in completions) {
+            completion(remainingCount);
+        }
+    });
+}
+
+- (BOOL)p_isOfflineError:(NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+
+    switch (error.code) {
+        case NSURLErrorNotConnectedToInternet:
+        case NSURLErrorInternationalRoamingOff:
+        case NSURLErrorDataNotAllowed:
+        case NSURLErrorCallIsActive:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+- (void)p_reportItem:(p_OfflineRequest *)item
+              status:(SGSOfflineRequestStatus)status
+            response:(NSURLResponse *)response
+                data:(NSData *)data
+               error:(NSError *)error
+{
+    SGSOfflineRequestResultBlock handler = self.resultHandler;
+    if (handler == nil) return;
+
+    NSString *identifier = item.identifier;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        handler(identifier, status, response, data, error);
+    });
+}
+
+
+#pragma mark - Storage
+
+// 以下方法只在 _queue 中调用
+
+- (void)p_load {
+    NSString *indexPath = [_directory stringByAppendingPathComponent:kOfflineQueueIndexFileName];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+
+    NSData *indexData = nil;
+    if ([fileManager fileExistsAtPath:indexPath]) {
+        indexData = [NSData dataWithContentsOfFile:indexPath options:0 error:NULL];
+        // 设备锁定时无法读取受保护的索引，解锁后再读取
+        if (indexData == nil) {
+            _protectedDataAvailable = NO;
+            return;
+        }
+    }
+    _loaded = YES;
+
+    NSArray *dictionaries = nil;
+    if (indexData != nil) {
+        dictionaries = [NSPropertyListSerialization propertyListWithData:indexData options:NSPropertyListImmutable format:NULL error:NULL];
+        if (![dictionaries isKindOfClass:[NSArray class]]) dictionaries = nil;
+    }
+
+    // 读取前入队的请求排在后面
+    NSMutableSet<NSString *> *identifiers = [NSMutableSet setWithArray:[_items valueForKey:@"identifier"]];
+    NSMutableArray<p_OfflineRequest *> *loadedItems = [NSMutableArray arrayWithCapacity:dictionaries.count];
+
+    for (NSDictionary *dictionary in dictionaries) {
+        if (![dictionary isKindOfClass:[NSDictionary class]]) continue;
+
+        p_OfflineRequest *item = [[p_OfflineRequest alloc] initWithDictionary:dictionary];
+        if ((item == nil) || [identifiers containsObject:item.identifier]) continue;
+
+        if (item.hasBody && ![fileManager fileExistsAtPath:[self p_bodyPathForIdentifier:item.identifier]]) continue;
+
+        [loadedItems addObject:item];
+    }
+    BOOL enqueuedBeforeLoad = (_items.count > 0);
+    [_items insertObjects:loadedItems atIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, loadedItems.count)]];
+
+    // 清理入队后没来得及写入索引的请求体
+    NSMutableSet<NSString *> *bodyFileNames = [NSMutableSet setWithCapacity:_items.count];
+    for (p_OfflineRequest *item in _items) {
+        if (item.hasBody) [bodyFileNames addObject:[self p_bodyPathForIdentifier:item.identifier].lastPathComponent];
+    }
+    for (NSString *fileName in [fileManager contentsOfDirectoryAtPath:_directory error:NULL]) {
+        if ([fileName.pathExtension isEqualToString:kOfflineQueueBodyExtension] && ![bodyFileNames containsObject:fileName]) {
+            [fileManager removeItemAtPath:[_directory stringByAppendingPathComponent:fileName] error:NULL];
+        }
+    }
+
+    if (enqueuedBeforeLoad) [self p_save];
+}
+
+// 索引包含请求地址和请求头，只在设备解锁时可读
+- (void)p_save {
+    _saveScheduled = NO;
+    if (!_loaded) return;
+
+    NSMutableArray *dictionaries = [NSMutableArray arrayWithCapacity:_items.count];
+    for (p_OfflineRequest *item in _items) {
+        [dictionaries addObject:[item dictionaryRepresentation]];
+    }
+
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:dictionaries format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+    [data writeToFile:[_directory stringByAppendingPathComponent:kOfflineQueueIndexFileName]
+              options:(NSDataWritingAtomic | NSDataWritingFileProtectionComplete)
+                error:NULL];
+}
+
+// 合并短时间内的多次修改，例如一批请求完成或移除所有请求
+- (void)p_setNeedsSave {
+    if (_saveScheduled) return;
+    _saveScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kOfflineQueueSaveDelay * NSEC_PER_SEC)), _queue, ^{
+        if (_saveScheduled) [self p_save];
+    });
+}
+
+- (void)p_removeItem:(p_OfflineRequest *)item {
+    [_items removeObject:item];
+    [self p_setNeedsSave];
+
+    // 发出中的请求体在完成后删除
+    if (item.hasBody && !item.inFlight) {
+        [[NSFileManager defaultManager] removeItemAtPath:[self p_bodyPathForIdentifier:item.identifier] error:NULL];
+    }
+}
+
+- (NSString *)p_bodyPathForIdentifier:(NSString *)identifier {
+    return [_directory stringByAppendingPathComponent:[identifier stringByAppendingPathExtension:kOfflineQueueBodyExtension]];
+}
+
+
+#pragma mark - Reachability
+
+- (void)p_startMonitoringReachability {
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+
+    _reachability = SCNetworkReachabilityCreateWithAddress(kCFAllocatorDefault, (const struct sockaddr *)&address);
+    if (_reachability == NULL) {
+        _reachable = YES;
+        return;
+    }
+
+    __weak typeof(&*self) weakSelf = self;
+    void (^handler)(SCNetworkReachabilityFlags) = ^(SCNetworkReachabilityFlags flags) {
+        [weakSelf p_reachabilityDidChangeWithFlags:flags];
+    };
+
+    SCNetworkReachabilityContext context = {0, (__bridge void *)handler, p_retainReachabilityInfo, p_releaseReachabilityInfo, NULL};
+    SCNetworkReachabilitySetCallback(_reachability, p_reachabilityCallback, &context);
+    SCNetworkReachabilitySetDispatchQueue(_reachability, _queue);
+
+    // 回调只在状态变化时触发，启动时主动获取一次，网络可用时重放上次启动时留下的请求
+    SCNetworkReachabilityRef reachability = (SCNetworkReachabilityRef)CFRetain(_reachability);
+    dispatch_async(_queue, ^{
+        SCNetworkReachabilityFlags flags = 0;
+        _reachable = SCNetworkReachabilityGetFlags(reachability, &flags) ? p_isReachableWithFlags(flags) : YES;
+        CFRelease(reachability);
+
+        if (_reachable && self.automaticallyReplays && (_items.count > 0)) {
+            [self p_startReplayWithCompletion:nil];
+        }
+    });
+}
+
+// 在 _queue 中回调
+- (void)p_reachabilityDidChangeWithFlags:(SCNetworkReachabilityFlags)flags {
+    BOOL wasReachable = _reachable;
+    _reachable = p_isReachableWithFlags(flags);
+
+    if (_reachable && !wasReachable && self.automaticallyReplays) {
+        [self p_startReplayWithCompletion:nil];
+    }
+}
+
+#if TARGET_OS_IPHONE
+- (void)p_applicationDidBecomeActive:(NSNotification *)notification {
+    if (!self.automaticallyReplays) return;
+
+    dispatch_async(_queue, ^{
+        if (_items.count > 0) [self p_startReplayWithCompletion:nil];
+    });
+}
+
+- (void)p_protectedDataWillBecomeUnavailable:(NSNotification *)notification {
+    dispatch_async(_queue, ^{
+        _protectedDataAvailable = NO;
+    });
+}
+
+- (void)p_protectedDataDidBecomeAvailable:(NSNotification *)notification {
+    dispatch_async(_queue, ^{
+        _protectedDataAvailable = YES;
+        if (!_loaded) [self p_load];
+        // 锁定期间的修改可能没有写入
+        [self p_save];
+
+        if (self.automaticallyReplays && _reachable && (_items.count > 0)) {
+            [self p_startReplayWithCompletion:nil];
+        }
+    });
+}
+#endif
+
+@end
@@ -0,0 +1,132 @@
+/*!
+ *  @header SGSPrefetcher.h
+ *
+ *  @abstract 低优先级预加载，预热响应缓存
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class SGSHTTPResponseCache;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 出现前台请求时预加载的处理方式
+ */
+typedef NS_ENUM(NSInteger, SGSPrefetchForegroundPolicy) {
+    /// 进行中的预加载继续以低优先级完成，暂停启动新的预加载，直到前台请求结束
+    SGSPrefetchForegroundPolicyPause = 0,
+    /// 取消进行中的预加载并重新排队，直到前台请求结束后再启动
+    SGSPrefetchForegroundPolicyCancel,
+};
+
+/*!
+ *  @brief 预加载器
+ *
+ *  @discussion 以 NSURLSessionTaskPriorityLow 优先级获取请求并保存到 SGSHTTPResponseCache 中，
+ *      之后使用 dataTaskWithRequest:cache:timeToLive:responseFilter:success:failure: 时可以直接命中缓存，
+ *      缓存中已有未过期的响应时跳过，已过期但可以重新验证的响应使用条件请求刷新
+ *
+ *      会话中存在其他正在进行的任务时视为有前台请求，按 foregroundPolicy 处理，
+ *      通过 KVO 观察前台请求的状态，前台请求结束后继续预加载，不需要轮询；
+ *      会话的 prefetcher 会自动观察 SGS 辅助方法创建的任务，其他任务在启动或结束预加载时检查，
+ *      也可以通过 observeForegroundTask: 通知
+ *
+ *      每批预加载有各自的字节预算，收到响应时按 Content-Length 预留，
+ *      长度未知时按已接收的字节数计算，超出预算时取消该请求，预算用完后该批剩余的请求不再启动
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSPrefetcher : NSObject
+
+/*!
+ *  @brief 初始化
+ *
+ *  @param session 发起请求的会话，只弱引用
+ *  @param cache   保存响应的缓存，为空时使用 [SGSHTTPResponseCache sharedCache]
+ *
+ *  @return SGSPrefetcher
+ */
+- (instancetype)initWithSession:(NSURLSession *)session cache:(nullable SGSHTTPResponseCache *)cache NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 发起请求的会话
+ */
+@property (nonatomic, weak, readonly) NSURLSession *session;
+
+/*!
+ *  @brief 保存响应的缓存
+ */
+@property (nonatomic, strong, readonly) SGSHTTPResponseCache *cache;
+
+/*!
+ *  @brief 最多同时进行的预加载数，默认为 2
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentPrefetches;
+
+/*!
+ *  @brief 缓存有效期，默认为 SGSHTTPCacheTimeToLiveAutomatic
+ */
+@property (atomic, assign) NSTimeInterval timeToLive;
+
+/*!
+ *  @brief 出现前台请求时的处理方式，默认为 SGSPrefetchForegroundPolicyPause
+ */
+@property (atomic, assign) SGSPrefetchForegroundPolicy foregroundPolicy;
+
+
+/*!
+ *  @brief 预加载一批地址
+ *
+ *  @param URLs       请求地址
+ *  @param byteBudget 该批预加载的字节预算，小于等于 0 时不限制
+ */
+- (void)prefetchURLs:(NSArray<NSURL *> *)URLs byteBudget:(long long)byteBudget;
+
+/*!
+ *  @brief 预加载一批请求，只预加载 GET 请求
+ *
+ *  @param requests   HTTP 请求
+ *  @param byteBudget 该批预加载的字节预算，小于等于 0 时不限制
+ */
+- (void)prefetchRequests:(NSArray<NSURLRequest *> *)requests byteBudget:(long long)byteBudget;
+
+/*!
+ *  @brief 通知预加载器出现前台请求
+ *
+ *  @discussion 任务开始时按 foregroundPolicy 处理进行中的预加载，结束后继续预加载
+ *
+ *  @param task 前台请求的任务，可以尚未开始
+ */
+- (void)observeForegroundTask:(NSURLSessionTask *)task;
+
+/*!
+ *  @brief 取消所有排队中和进行中的预加载
+ */
+- (void)cancelAllPrefetches;
+
+/*!
+ *  @brief 统计数据
+ *
+ *  @discussion 统计数据包括：
+ *      - pendingCount：排队中的请求数
+ *      - runningCount：进行中的请求数
+ *      - fetchedCount：已保存或刷新到缓存的请求数
+ *      - fetchedBytes：已获取的字节数
+ *      - skippedCount：缓存未过期或超出预算而跳过或取消的请求数
+ *      - failedCount：失败的请求数
+ *      - preemptedCount：因前台请求被取消并重新排队的次数
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSNumber *> *)metrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,395 @@
+/*!
+ *  @header SGSPrefetcher.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSPrefetcher.h"
+#import "SGSHTTPResponseCache.h"
+
+static void *kPrefetchTaskContext = &kPrefetchTaskContext;
+static void *kForegroundTaskContext = &kForegroundTaskContext;
+
+#pragma mark - Prefetch Batch & Item
+
+/// 一批预加载共享的字节预算，只在预加载器的队列中访问，仅内部使用
+@interface p_PrefetchBatch : NSObject
+@property (nonatomic, assign) long long byteBudget;
+@property (nonatomic, assign) long long consumedBytes;
+/// 进行中的预加载按 Content-Length 预留的字节数
+@property (nonatomic, assign) long long reservedBytes;
+@end
+
+@implementation p_PrefetchBatch
+@end
+
+/// 单个预加载请求，只在预加载器的队列中访问，仅内部使用
+@interface p_PrefetchItem : NSObject
+@property (nonatomic, strong) NSURLRequest *request;
+@property (nonatomic, strong) p_PrefetchBatch *batch;
+@property (nonatomic, strong) NSURLSessionDataTask *task;
+/// 因前台请求被取消，完成后需要重新排队
+@property (nonatomic, assign) BOOL preempted;
+/// 因超出预算被取消
+@property (nonatomic, assign) BOOL overBudget;
+/// 收到响应后在批次中预留的字节数
+@property (nonatomic, assign) long long reservedBytes;
+/// 是否已添加 KVO
+@property (nonatomic, assign) BOOL observing;
+@end
+
+@implementation p_PrefetchItem
+@end
+
+
+#pragma mark - SGSPrefetcher
+
+@implementation SGSPrefetcher {
+    dispatch_queue_t _queue;
+    NSMutableArray<p_PrefetchItem *> *_pendingItems;
+    NSMutableArray<p_PrefetchItem *> *_runningItems;
+    NSHashTable<NSURLSessionTask *> *_foregroundTasks;
+    BOOL _checkingSessionTasks;
+
+    NSUInteger _fetchedCount;
+    long long _fetchedBytes;
+    NSUInteger _skippedCount;
+    NSUInteger _failedCount;
+    NSUInteger _preemptedCount;
+}
+
+- (instancetype)initWithSession:(NSURLSession *)session cache:(SGSHTTPResponseCache *)cache {
+    self = [super init];
+    if (self) {
+        _session = session;
+        _cache = cache ?: [SGSHTTPResponseCache sharedCache];
+        _maximumConcurrentPrefetches = 2;
+        _timeToLive = SGSHTTPCacheTimeToLiveAutomatic;
+        _foregroundPolicy = SGSPrefetchForegroundPolicyPause;
+
+        _queue = dispatch_queue_create("com.southgis.SGSCategories.Prefetcher", DISPATCH_QUEUE_SERIAL);
+        _pendingItems = [NSMutableArray array];
+        _runningItems = [NSMutableArray array];
+        _foregroundTasks = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (p_PrefetchItem *item in _runningItems) {
+        [self p_stopObservingItem:item];
+    }
+    for (NSURLSessionTask *task in _foregroundTasks) {
+        [task removeObserver:self forKeyPath:@"state" context:kForegroundTaskContext];
+    }
+}
+
+
+#pragma mark - Public
+
+- (void)prefetchURLs:(NSArray<NSURL *> *)URLs byteBudget:(long long)byteBudget {
+    NSMutableArray<NSURLRequest *> *requests = [NSMutableArray arrayWithCapacity:URLs.count];
+    for (NSURL *url in URLs) {
+        [requests addObject:[NSURLRequest requestWithURL:url]];
+    }
+    [self prefetchRequests:requests byteBudget:byteBudget];
+}
+
+- (void)prefetchRequests:(NSArray<NSURLRequest *> *)requests byteBudget:(long long)byteBudget {
+    p_PrefetchBatch *batch = [[p_PrefetchBatch alloc] init];
+    batch.byteBudget = byteBudget;
+
+    NSMutableArray<p_PrefetchItem *> *items = [NSMutableArray arrayWithCapacity:requests.count];
+    for (NSURLRequest *request in requests) {
+        NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+        if (![method isEqualToString:@"GET"]) continue;
+
+        p_PrefetchItem *item = [[p_PrefetchItem alloc] init];
+        item.request = request;
+        item.batch = batch;
+        [items addObject:item];
+    }
+    if (items.count == 0) return;
+
+    dispatch_async(_queue, ^{
+        [_pendingItems addObjectsFromArray:items];
+        [self p_pump];
+    });
+}
+
+- (void)cancelAllPrefetches {
+    dispatch_async(_queue, ^{
+        [_pendingItems removeAllObjects];
+        for (p_PrefetchItem *item in _runningItems) {
+            item.preempted = NO;
+            [item.task cancel];
+        }
+    });
+}
+
+- (void)observeForegroundTask:(NSURLSessionTask *)task {
+    if (task == nil) return;
+
+    dispatch_async(_queue, ^{
+        [self p_observeForegroundTask:task];
+    });
+}
+
+- (NSDictionary<NSString *,NSNumber *> *)metrics {
+    __block NSDictionary *metrics = nil;
+    dispatch_sync(_queue, ^{
+        metrics = @{@"pendingCount": @(_pendingItems.count),
+                    @"runningCount": @(_runningItems.count),
+                    @"fetchedCount": @(_fetchedCount),
+                    @"fetchedBytes": @(_fetchedBytes),
+                    @"skippedCount": @(_skippedCount),
+                    @"failedCount": @(_failedCount),
+                    @"preemptedCount": @(_preemptedCount)};
+    });
+    return metrics;
+}
+
+
+#pragma mark - Private
+
+// 以下方法只在 _queue 中调用
+
+// 先查询会话中的任务判断是否有前台请求，再决定是否启动新的预加载
+- (void)p_pump {
+    if ((_pendingItems.count == 0) && (_runningItems.count == 0)) return;
+    if (_checkingSessionTasks) return;
+
+    NSURLSession *session = self.session;
+    if (session == nil) {
+        [_pendingItems removeAllObjects];
+        return;
+    }
+
+    _checkingSessionTasks = YES;
+    [session getTasksWithCompletionHandler:^(NSArray<NSURLSessionDataTask *> *dataTasks, NSArray<NSURLSessionUploadTask *> *uploadTasks, NSArray<NSURLSessionDownloadTask *> *downloadTasks) {
+        NSMutableArray<NSURLSessionTask *> *tasks = [NSMutableArray arrayWithArray:dataTasks];
+        [tasks addObjectsFromArray:uploadTasks];
+        [tasks addObjectsFromArray:downloadTasks];
+
+        dispatch_async(_queue, ^{
+            _checkingSessionTasks = NO;
+            [self p_pumpWithSessionTasks:tasks];
+        });
+    }];
+}
+
+- (void)p_pumpWithSessionTasks:(NSArray<NSURLSessionTask *> *)tasks {
+    NSHashTable<NSURLSessionTask *> *prefetchTasks = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    for (p_PrefetchItem *item in _runningItems) {
+        if (item.task != nil) [prefetchTasks addObject:item.task];
+    }
+
+    BOOL hasForegroundTask = NO;
+    for (NSURLSessionTask *task in tasks) {
+        if ((task.state == NSURLSessionTaskStateRunning) && ![prefetchTasks containsObject:task]) {
+            hasForegroundTask = YES;
+            // 前台请求结束时通过 KVO 重新检查，不需要轮询
+            [self p_observeForegroundTask:task];
+        }
+    }
+
+    if (hasForegroundTask) {
+        if (self.foregroundPolicy == SGSPrefetchForegroundPolicyCancel) {
+            for (p_PrefetchItem *item in _runningItems) {
+                if (item.preempted) continue;
+                item.preempted = YES;
+                [item.task cancel];
+            }
+        }
+        return;
+    }
+
+    NSUInteger maximumCount = MAX(self.maximumConcurrentPrefetches, 1);
+    while ((_runningItems.count < maximumCount) && (_pendingItems.count > 0)) {
+        p_PrefetchItem *item = _pendingItems.firstObject;
+        [_pendingItems removeObjectAtIndex:0];
+
+        p_PrefetchBatch *batch = item.batch;
+        if ((batch.byteBudget > 0) && (batch.consumedBytes + batch.reservedBytes >= batch.byteBudget)) {
+            _skippedCount += 1;
+            continue;
+        }
+        [self p_startItem:item];
+    }
+}
+
+- (void)p_observeForegroundTask:(NSURLSessionTask *)task {
+    if ((task.state == NSURLSessionTaskStateCompleted) || [_foregroundTasks containsObject:task]) return;
+
+    [_foregroundTasks addObject:task];
+    // 任务可能在添加 KVO 前已经开始，立即回调一次
+    [task addObserver:self forKeyPath:@"state" options:NSKeyValueObservingOptionInitial context:kForegroundTaskContext];
+}
+
+- (void)p_foregroundTaskDidChangeState:(NSURLSessionTask *)task {
+    switch (task.state) {
+        case NSURLSessionTaskStateRunning:
+            // 前台请求开始，按 foregroundPolicy 暂停或取消进行中的预加载
+            [self p_pump];
+            break;
+        case NSURLSessionTaskStateCompleted:
+            if ([_foregroundTasks containsObject:task]) {
+                [_foregroundTasks removeObject:task];
+                [task removeObserver:self forKeyPath:@"state" context:kForegroundTaskContext];
+            }
+            [self p_pump];
+            break;
+        default:
+            break;
+    }
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSKeyValueChangeKey,id> *)change context:(void *)context {
+    if ((context != kPrefetchTaskContext) && (context != kForegroundTaskContext)) {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+        return;
+    }
+
+    NSURLSessionTask *task = object;
+    __weak typeof(&*self) weakSelf = self;
+    dispatch_async(_queue, ^{
+        typeof(&*weakSelf) strongSelf = weakSelf;
+        if (strongSelf == nil) return;
+
+        if (context == kForegroundTaskContext) {
+            [strongSelf p_foregroundTaskDidChangeState:task];
+        } else {
+            [strongSelf p_checkBudgetForTask:task];
+        }
+    });
+}
+
+// 收到响应时按 Content-Length 预留预算，长度未知时按已接收的字节数计算，超出预算时取消
+- (void)p_checkBudgetForTask:(NSURLSessionTask *)task {
+    p_PrefetchItem *item = nil;
+    for (p_PrefetchItem *runningItem in _runningItems) {
+        if (runningItem.task == task) {
+            item = runningItem;
+            break;
+        }
+    }
+    if ((item == nil) || item.overBudget || (task.response == nil)) return;
+
+    p_PrefetchBatch *batch = item.batch;
+    long long expectedLength = task.countOfBytesExpectedToReceive;
+    long long requiredLength = 0;
+
+    if (expectedLength > 0) {
+        if (item.reservedBytes > 0) return;
+        requiredLength = expectedLength;
+    } else {
+        requiredLength = task.countOfBytesReceived;
+    }
+
+    if (batch.consumedBytes + batch.reservedBytes - item.reservedBytes + requiredLength > batch.byteBudget) {
+        item.overBudget = YES;
+        [task cancel];
+        return;
+    }
+
+    batch.reservedBytes += requiredLength - item.reservedBytes;
+    item.reservedBytes = requiredLength;
+}
+
+- (void)p_stopObservingItem:(p_PrefetchItem *)item {
+    if (!item.observing) return;
+    item.observing = NO;
+
+    [item.task removeObserver:self forKeyPath:@"response" context:kPrefetchTaskContext];
+    [item.task removeObserver:self forKeyPath:@"countOfBytesReceived" context:kPrefetchTaskContext];
+}
+
+- (void)p_startItem:(p_PrefetchItem *)item {
+    NSURLSession *session = self.session;
+    SGSHTTPResponseCache *cache = self.cache;
+    NSTimeInterval timeToLive = self.timeToLive;
+    NSURLRequest *request = item.request;
+
+    SGSCachedResponse *cached = [cache cachedResponseForRequest:request];
+    if (cached.isFresh) {
+        _skippedCount += 1;
+        return;
+    }
+
+    NSMutableURLRequest *mutableRequest = [request mutableCopy];
+    mutableRequest.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    if (cached.canRevalidate) {
+        if (cached.ETag) [mutableRequest setValue:cached.ETag forHTTPHeaderField:@"If-None-Match"];
+        if (cached.lastModified) [mutableRequest setValue:cached.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+    }
+
+    __weak typeof(&*self) weakSelf = self;
+    NSURLSessionDataTask *task = [session dataTaskWithRequest:mutableRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        BOOL stored = NO;
+
+        if (error == nil) {
+            if ((cached != nil) && (httpResponse.statusCode == 304)) {
+                [cache refreshCachedResponse:cached withNotModifiedResponse:httpResponse forRequest:request timeToLive:timeToLive];
+                stored = YES;
+            } else if ((httpResponse.statusCode >= 200) && (httpResponse.statusCode < 300) && (data != nil)) {
+                stored = ([cache storeData:data response:httpResponse decodedObject:nil filter:nil forRequest:request timeToLive:timeToLive] != nil);
+            }
+        }
+
+        [weakSelf p_finishItem:item receivedLength:data.length stored:stored error:error];
+    }];
+    if (task == nil) return;
+
+    task.priority = NSURLSessionTaskPriorityLow;
+    item.task = task;
+    [_runningItems addObject:item];
+
+    if (item.batch.byteBudget > 0) {
+        item.observing = YES;
+        [task addObserver:self forKeyPath:@"response" options:0 context:kPrefetchTaskContext];
+        [task addObserver:self forKeyPath:@"countOfBytesReceived" options:0 context:kPrefetchTaskContext];
+    }
+    [task resume];
+}
+
+// 在会话的回调队列中调用
+- (void)p_finishItem:(p_PrefetchItem *)item receivedLength:(NSUInteger)length stored:(BOOL)stored error:(NSError *)error {
+    dispatch_async(_queue, ^{
+        int64_t receivedLength = item.task.countOfBytesReceived;
+        [self p_stopObservingItem:item];
+        [_runningItems removeObjectIdenticalTo:item];
+        item.task = nil;
+
+        item.batch.reservedBytes -= item.reservedBytes;
+        item.reservedBytes = 0;
+
+        if (item.overBudget) {
+            // 超出预算时已接收的部分同样计入
+            item.batch.consumedBytes += receivedLength;
+            _fetchedBytes += receivedLength;
+            _skippedCount += 1;
+        } else if (item.preempted && (error.code == NSURLErrorCancelled)) {
+            // 前台请求结束后优先重新获取
+            item.preempted = NO;
+            _preemptedCount += 1;
+            [_pendingItems insertObject:item atIndex:0];
+        } else if (error != nil) {
+            if (error.code != NSURLErrorCancelled) _failedCount += 1;
+        } else {
+            item.batch.consumedBytes += length;
+            _fetchedBytes += length;
+            if (stored) {
+                _fetchedCount += 1;
+            } else {
+                _failedCount += 1;
+            }
+        }
+
+        [self p_pump];
+    });
+}
+
+@end
@@ -0,0 +1,91 @@
+/*!
+ *  @header SGSProgressGroup.h
+ *
+ *  @abstract 限频进度回调与任务组总进度
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NSURLSession+SGS.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 限频进度回调
+ *
+ *  @discussion 两次回调之间的间隔不小于 1 / maximumRate 秒，间隔内的变化会合并为一次延迟回调，
+ *      调用 finishWithProgress: 后立即进行最后一次回调（与上一次回调的进度相同时不再重复回调），之后不再回调
+ */
+@interface SGSProgressThrottle : NSObject
+
+/*!
+ *  @brief 初始化
+ *
+ *  @param maximumRate 每秒最多回调次数，小于等于 0 表示不限制
+ *  @param queue       回调所在的队列，为空时不限频则在进度变化的线程中回调，限频则在内部的串行队列中回调
+ *  @param block       进度回调
+ *
+ *  @return SGSProgressThrottle
+ */
+- (instancetype)initWithMaximumRate:(double)maximumRate
+                              queue:(nullable dispatch_queue_t)queue
+                              block:(SGSProgressBlock)block;
+
+/*!
+ *  @brief 进度发生变化
+ *
+ *  @param progress 进度
+ */
+- (void)progressDidChange:(NSProgress *)progress;
+
+/*!
+ *  @brief 结束并立即进行最后一次回调
+ *
+ *  @param progress 进度
+ */
+- (void)finishWithProgress:(NSProgress *)progress;
+
+@end
+
+
+/*!
+ *  @brief 任务组总进度
+ *
+ *  @discussion 以字节数合计组内所有任务的上传和下载进度，预期大小未知的任务以已传输的字节数计入，
+ *      所有任务完成后进行一次 100% 的回调，因此应在任务启动前添加组内的所有任务
+ *
+ *      取消 progress 将取消组内所有任务
+ */
+@interface SGSProgressGroup : NSObject
+
+/*!
+ *  @brief 初始化
+ *
+ *  @param maximumRate 每秒最多回调次数，小于等于 0 表示不限制
+ *  @param queue       回调所在的队列，为空时不限频则在进度变化的线程中回调，限频则在内部的串行队列中回调
+ *  @param block       总进度回调
+ *
+ *  @return SGSProgressGroup
+ */
+- (instancetype)initWithMaximumRate:(double)maximumRate
+                              queue:(nullable dispatch_queue_t)queue
+                           progress:(nullable SGSProgressBlock)block;
+
+/*!
+ *  @brief 总进度
+ */
+@property (nonatomic, strong, readonly) NSProgress *progress;
+
+/*!
+ *  @brief 添加任务，任务完成前由任务组持有
+ *
+ *  @param task 网络任务
+ */
+- (void)addTask:(NSURLSessionTask *)task;
+
+@end
+
+NS_ASSUME_NONNULL_END
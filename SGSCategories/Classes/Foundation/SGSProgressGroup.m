@@ -0,0 +1,310 @@
+/*!
+ *  @header SGSProgressGroup.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSProgressGroup.h"
+
+#pragma mark - SGSProgressThrottle
+
+@implementation SGSProgressThrottle {
+    double _maximumRate;
+    dispatch_queue_t _queue;
+    SGSProgressBlock _block;
+
+    NSLock *_lock;
+    CFAbsoluteTime _lastDeliveryTime;
+    BOOL _pendingDelivery;
+    BOOL _finished;
+
+    // 最近一次回调的进度，用于避免结束时重复回调相同的进度
+    BOOL _delivered;
+    int64_t _deliveredCompletedUnitCount;
+    int64_t _deliveredTotalUnitCount;
+}
+
+- (instancetype)initWithMaximumRate:(double)maximumRate queue:(dispatch_queue_t)queue block:(SGSProgressBlock)block {
+    self = [super init];
+    if (self) {
+        _maximumRate = maximumRate;
+        // 限频时延迟回调需要一个队列，没有指定队列时所有回调统一在内部串行队列中进行，保证回调的线程和顺序一致
+        _queue = queue;
+        if ((_queue == nil) && (maximumRate > 0)) {
+            _queue = dispatch_queue_create("com.southgis.SGSCategories.ProgressThrottle", DISPATCH_QUEUE_SERIAL);
+        }
+        _block = [block copy];
+        _lock = [[NSLock alloc] init];
+    }
+    return self;
+}
+
+- (void)progressDidChange:(NSProgress *)progress {
+    NSTimeInterval interval = (_maximumRate > 0) ? (1.0 / _maximumRate) : 0;
+    NSTimeInterval delay = 0;
+    BOOL deliverNow = NO;
+    BOOL scheduleDelivery = NO;
+
+    [_lock lock];
+    if (!_finished) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        NSTimeInterval elapsed = now - _lastDeliveryTime;
+        if ((interval <= 0) || (elapsed >= interval)) {
+            _lastDeliveryTime = now;
+            deliverNow = YES;
+            [self p_markDelivered:progress];
+        } else if (!_pendingDelivery) {
+            _pendingDelivery = YES;
+            scheduleDelivery = YES;
+            delay = interval - elapsed;
+        }
+    }
+    [_lock unlock];
+
+    if (deliverNow) {
+        [self p_deliver:progress];
+    } else if (scheduleDelivery) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), _queue, ^{
+            [self p_deliverPending:progress];
+        });
+    }
+}
+
+- (void)finishWithProgress:(NSProgress *)progress {
+    [_lock lock];
+    BOOL deliver = !_finished;
+    _finished = YES;
+
+    // 最后一次变化已经立即回调过时不再重复回调
+    if (deliver && _delivered &&
+        (_deliveredCompletedUnitCount == progress.completedUnitCount) &&
+        (_deliveredTotalUnitCount == progress.totalUnitCount)) {
+        deliver = NO;
+    }
+    if (deliver) [self p_markDelivered:progress];
+    [_lock unlock];
+
+    if (deliver) {
+        [self p_deliver:progress];
+    }
+}
+
+// 调用时需持有锁
+- (void)p_markDelivered:(NSProgress *)progress {
+    _delivered = YES;
+    _deliveredCompletedUnitCount = progress.completedUnitCount;
+    _deliveredTotalUnitCount = progress.totalUnitCount;
+}
+
+- (void)p_deliverPending:(NSProgress *)progress {
+    [_lock lock];
+    BOOL finished = _finished;
+    _pendingDelivery = NO;
+    _lastDeliveryTime = CFAbsoluteTimeGetCurrent();
+    if (!finished) [self p_markDelivered:progress];
+    [_lock unlock];
+
+    if (finished) return;
+
+    // 延迟回调已经在目标队列中，直接回调
+    if (_block) _block(progress);
+}
+
+- (void)p_deliver:(NSProgress *)progress {
+    if (_block == nil) return;
+
+    if (_queue) {
+        SGSProgressBlock block = _block;
+        dispatch_async(_queue, ^{
+            block(progress);
+        });
+    } else {
+        _block(progress);
+    }
+}
+
+@end
+
+
+#pragma mark - Group Task State
+
+/// 任务组中单个任务的传输状态，仅内部使用
+@interface p_GroupTaskState : NSObject
+@property (nonatomic, assign) int64_t completedUnitCount;
+@property (nonatomic, assign) int64_t totalUnitCount;
+/// 是否已向任务添加 KVO 观察者，只在持有锁时访问
+@property (nonatomic, assign) BOOL observing;
+@end
+
+@implementation p_GroupTaskState
+@end
+
+
+#pragma mark - SGSProgressGroup
+
+@implementation SGSProgressGroup {
+    NSLock *_lock;
+    NSMapTable<NSURLSessionTask *, p_GroupTaskState *> *_statesByTask;
+    SGSProgressThrottle *_throttle;
+}
+
+- (instancetype)init {
+    return [self initWithMaximumRate:0 queue:nil progress:nil];
+}
+
+- (instancetype)initWithMaximumRate:(double)maximumRate queue:(dispatch_queue_t)queue progress:(SGSProgressBlock)block {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        _statesByTask = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality)
+                                              valueOptions:NSPointerFunctionsStrongMemory];
+        _throttle = [[SGSProgressThrottle alloc] initWithMaximumRate:maximumRate queue:queue block:block];
+
+        _progress = [[NSProgress alloc] initWithParent:nil userInfo:nil];
+        _progress.totalUnitCount = 0;
+        _progress.cancellable = YES;
+
+        __weak typeof(&*self) weakSelf = self;
+        _progress.cancellationHandler = ^{
+            [weakSelf p_cancelAllTasks];
+        };
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSURLSessionTask *task in _statesByTask.keyEnumerator.allObjects) {
+        [self p_stopObservingTask:task state:[_statesByTask objectForKey:task]];
+    }
+}
+
+- (void)addTask:(NSURLSessionTask *)task {
+    if (task == nil) return;
+
+    p_GroupTaskState *state = [[p_GroupTaskState alloc] init];
+
+    [_lock lock];
+    if ([_statesByTask objectForKey:task] != nil) {
+        [_lock unlock];
+        return;
+    }
+    [_statesByTask setObject:state forKey:task];
+    [self p_updateState:state withTask:task];
+    // 完成通知只能来自最后添加的 state 观察者或下面的检查，此时所有观察者都已添加
+    state.observing = YES;
+    [_lock unlock];
+
+    for (NSString *keyPath in [SGSProgressGroup p_observedKeyPaths]) {
+        [task addObserver:self forKeyPath:keyPath options:NSKeyValueObservingOptionNew context:NULL];
+    }
+
+    // 添加观察者之前任务可能已经完成
+    if (task.state == NSURLSessionTaskStateCompleted) {
+        [self p_taskDidComplete:task];
+    }
+}
+
+
+#pragma mark - KVO
+
++ (NSArray<NSString *> *)p_observedKeyPaths {
+    static NSArray *keyPaths = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        keyPaths = @[NSStringFromSelector(@selector(countOfBytesReceived)),
+                     NSStringFromSelector(@selector(countOfBytesExpectedToReceive)),
+                     NSStringFromSelector(@selector(countOfBytesSent)),
+                     NSStringFromSelector(@selector(countOfBytesExpectedToSend)),
+                     NSStringFromSelector(@selector(state))];
+    });
+    return keyPaths;
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSString *,id> *)change context:(void *)context {
+    NSURLSessionTask *task = object;
+
+    if ([keyPath isEqualToString:NSStringFromSelector(@selector(state))]) {
+        if (task.state == NSURLSessionTaskStateCompleted) {
+            [self p_taskDidComplete:task];
+        }
+        return;
+    }
+
+    [_lock lock];
+    p_GroupTaskState *state = [_statesByTask objectForKey:task];
+    if (state) [self p_updateState:state withTask:task];
+    [_lock unlock];
+
+    [_throttle progressDidChange:_progress];
+}
+
+
+#pragma mark - Private
+
+// 调用时需持有锁
+- (void)p_updateState:(p_GroupTaskState *)state withTask:(NSURLSessionTask *)task {
+    int64_t completed = task.countOfBytesSent + task.countOfBytesReceived;
+    int64_t total = MAX(task.countOfBytesExpectedToSend, 0) + MAX(task.countOfBytesExpectedToReceive, 0);
+    total = MAX(total, completed);
+
+    _progress.totalUnitCount += total - state.totalUnitCount;
+    _progress.completedUnitCount += completed - state.completedUnitCount;
+    state.totalUnitCount = total;
+    state.completedUnitCount = completed;
+}
+
+- (void)p_taskDidComplete:(NSURLSessionTask *)task {
+    BOOL allCompleted = NO;
+
+    [_lock lock];
+    p_GroupTaskState *state = [_statesByTask objectForKey:task];
+    if (state == nil) {
+        [_lock unlock];
+        return;
+    }
+
+    // 已完成的任务按实际传输的字节数计入总量
+    [self p_updateState:state withTask:task];
+    _progress.totalUnitCount -= state.totalUnitCount - state.completedUnitCount;
+    state.totalUnitCount = state.completedUnitCount;
+    [_statesByTask removeObjectForKey:task];
+    allCompleted = (_statesByTask.count == 0);
+    [_lock unlock];
+
+    [self p_stopObservingTask:task state:state];
+
+    if (allCompleted) {
+        if (_progress.totalUnitCount == 0) {
+            _progress.totalUnitCount = 1;
+            _progress.completedUnitCount = 1;
+        }
+        [_throttle finishWithProgress:_progress];
+    } else {
+        [_throttle progressDidChange:_progress];
+    }
+}
+
+- (void)p_stopObservingTask:(NSURLSessionTask *)task state:(p_GroupTaskState *)state {
+    [_lock lock];
+    BOOL observing = state.observing;
+    state.observing = NO;
+    [_lock unlock];
+
+    if (!observing) return;
+
+    for (NSString *keyPath in [SGSProgressGroup p_observedKeyPaths]) {
+        [task removeObserver:self forKeyPath:keyPath];
+    }
+}
+
+- (void)p_cancelAllTasks {
+    [_lock lock];
+    NSArray *tasks = _statesByTask.keyEnumerator.allObjects;
+    [_lock unlock];
+
+    [tasks makeObjectsPerformSelector:@selector(cancel)];
+}
+
+@end
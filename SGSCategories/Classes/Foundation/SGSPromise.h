@@ -0,0 +1,251 @@
+/*!
+ *  @header SGSPromise.h
+ *
+ *  @abstract 轻量的 Promise，组合多个网络请求
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief Promise 相关的错误域
+ */
+FOUNDATION_EXPORT NSString * const SGSPromiseErrorDomain;
+
+/*!
+ *  @brief any: 中所有 Promise 的错误，值为 NSArray<NSError *>
+ */
+FOUNDATION_EXPORT NSString * const SGSPromiseUnderlyingErrorsKey;
+
+/*!
+ *  @brief Promise 相关的错误码
+ */
+typedef NS_ENUM(NSInteger, SGSPromiseErrorCode) {
+    /// any: 中所有 Promise 都失败了，各自的错误在 userInfo 的 SGSPromiseUnderlyingErrorsKey 中
+    SGSPromiseErrorAllRejected = 1,
+};
+
+@class SGSPromise;
+
+/*!
+ *  @brief 成功后的后续操作
+ *
+ *  @param value 成功的值
+ *
+ *  @return 根据返回值决定后续 Promise 的结果：
+ *      - NSError 类型    ：后续 Promise 失败
+ *      - SGSPromise 类型 ：后续 Promise 跟随该 Promise 的结果，可用于串联下一个请求
+ *      - 其他类型        ：后续 Promise 以该值成功
+ */
+typedef id _Nullable (^SGSPromiseThenBlock)(id _Nullable value);
+
+/*!
+ *  @brief 失败后的后续操作
+ *
+ *  @param error 失败的错误信息
+ *
+ *  @return 含义同 SGSPromiseThenBlock
+ */
+typedef id _Nullable (^SGSPromiseRecoverBlock)(NSError *error);
+
+/*!
+ *  @brief Promise
+ *
+ *  @discussion 代表一个异步操作的结果，只会成功（fulfill）或失败（reject）一次，之后的调用被忽略
+ *
+ *      then 和 recover 返回新的 Promise，后续操作在指定的队列中执行，失败会跳过 then 一直传递到 recover，
+ *      结果确定后直接在确定结果的线程中分发，只有执行后续操作时才切换到指定的队列，不会额外切换到主线程
+ *
+ *      取消会沿着链向上传递：后续 Promise 被取消或提前确定结果时释放对前序 Promise 和 then 中返回的 Promise 的依赖，
+ *      前序 Promise 的所有后续 Promise 都释放后才会被取消，最终调用网络请求 Promise 的 cancellationHandler 取消任务，
+ *      因此被多个后续 Promise 共享的前序 Promise 不会因为其中一个被取消而取消，
+ *      取消后 Promise 以 NSURLErrorDomain 中的 NSURLErrorCancelled 错误失败
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSPromise : NSObject
+
+/*!
+ *  @brief 等待中的 Promise，由调用方调用 fulfill: 或 reject: 确定结果
+ *
+ *  @return SGSPromise
+ */
++ (instancetype)pendingPromise;
+
+/*!
+ *  @brief 已经成功的 Promise
+ *
+ *  @param value 成功的值
+ *
+ *  @return SGSPromise
+ */
++ (instancetype)promiseWithValue:(nullable id)value;
+
+/*!
+ *  @brief 已经失败的 Promise
+ *
+ *  @param error 错误信息
+ *
+ *  @return SGSPromise
+ */
++ (instancetype)promiseWithError:(NSError *)error;
+
+/*!
+ *  @brief 是否等待中
+ */
+@property (atomic, assign, readonly, getter=isPending) BOOL pending;
+
+/*!
+ *  @brief 是否已成功
+ */
+@property (atomic, assign, readonly, getter=isFulfilled) BOOL fulfilled;
+
+/*!
+ *  @brief 是否已失败
+ */
+@property (atomic, assign, readonly, getter=isRejected) BOOL rejected;
+
+/*!
+ *  @brief 成功的值
+ */
+@property (atomic, strong, readonly, nullable) id value;
+
+/*!
+ *  @brief 失败的错误信息
+ */
+@property (atomic, strong, readonly, nullable) NSError *error;
+
+/*!
+ *  @brief 等待中被取消时执行的闭包，只会执行一次，结果确定后释放
+ *
+ *  @discussion 设置时已经被取消的，立即执行
+ */
+@property (atomic, copy, nullable) void (^cancellationHandler)(void);
+
+/*!
+ *  @brief 以 value 成功，已经确定结果时忽略
+ *
+ *  @param value 成功的值
+ */
+- (void)fulfill:(nullable id)value;
+
+/*!
+ *  @brief 以 error 失败，已经确定结果时忽略
+ *
+ *  @param error 错误信息
+ */
+- (void)reject:(NSError *)error;
+
+/*!
+ *  @brief 取消，已经确定结果时忽略
+ *
+ *  @discussion 直接调用时无论是否有后续 Promise 都会取消，并释放对前序 Promise 的依赖
+ */
+- (void)cancel;
+
+
+#pragma mark - Chaining
+///-----------------------------------------------------------------------------
+/// @name Chaining
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 成功后在主队列中执行后续操作
+ *
+ *  @param block 后续操作
+ *
+ *  @return 后续 Promise
+ */
+- (SGSPromise *)then:(SGSPromiseThenBlock)block;
+
+/*!
+ *  @brief 成功后在指定队列中执行后续操作
+ *
+ *  @discussion 串联请求时可以使用后台队列，避免切换到主线程
+ *
+ *  @param queue 执行后续操作的队列
+ *  @param block 后续操作
+ *
+ *  @return 后续 Promise
+ */
+- (SGSPromise *)thenOnQueue:(dispatch_queue_t)queue block:(SGSPromiseThenBlock)block;
+
+/*!
+ *  @brief 失败后在主队列中执行后续操作
+ *
+ *  @param block 后续操作，返回值的含义同 SGSPromiseThenBlock
+ *
+ *  @return 后续 Promise
+ */
+- (SGSPromise *)recover:(SGSPromiseRecoverBlock)block;
+
+/*!
+ *  @brief 失败后在指定队列中执行后续操作
+ *
+ *  @param queue 执行后续操作的队列
+ *  @param block 后续操作，返回值的含义同 SGSPromiseThenBlock
+ *
+ *  @return 后续 Promise
+ */
+- (SGSPromise *)recoverOnQueue:(dispatch_queue_t)queue block:(SGSPromiseRecoverBlock)block;
+
+/*!
+ *  @brief 超时
+ *
+ *  @discussion 超过 interval 秒仍未确定结果时，返回的 Promise 以 NSURLErrorTimedOut 错误失败，
+ *      并释放对当前 Promise 的依赖，没有其他后续 Promise 时取消当前 Promise
+ *
+ *  @param interval 超时时间，单位：秒
+ *
+ *  @return 后续 Promise
+ */
+- (SGSPromise *)timeout:(NSTimeInterval)interval;
+
+
+#pragma mark - Combining
+///-----------------------------------------------------------------------------
+/// @name Combining
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 全部成功
+ *
+ *  @discussion 全部成功后以按顺序排列的值的数组成功，nil 用 NSNull 代替，
+ *      任意一个失败时以该错误失败并释放其他 Promise，为空时以空数组成功
+ *
+ *  @param promises Promise 数组
+ *
+ *  @return SGSPromise
+ */
++ (SGSPromise *)all:(NSArray<SGSPromise *> *)promises;
+
+/*!
+ *  @brief 任意一个成功
+ *
+ *  @discussion 以第一个成功的值成功并释放其他 Promise，全部失败时以 SGSPromiseErrorAllRejected 错误失败
+ *
+ *  @param promises Promise 数组
+ *
+ *  @return SGSPromise
+ */
++ (SGSPromise *)any:(NSArray<SGSPromise *> *)promises;
+
+/*!
+ *  @brief 第一个确定结果
+ *
+ *  @discussion 以第一个确定的结果成功或失败并释放其他 Promise，为空时以 nil 成功
+ *
+ *  @param promises Promise 数组
+ *
+ *  @return SGSPromise
+ */
++ (SGSPromise *)race:(NSArray<SGSPromise *> *)promises;
+
+@end
+
+NS_ASSUME_NONNULL_END
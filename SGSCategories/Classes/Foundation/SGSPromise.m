@@ -0,0 +1,395 @@
+/*!
+ *  @header SGSPromise.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSPromise.h"
+
+NSString * const SGSPromiseErrorDomain = @"SGSPromiseErrorDomain";
+NSString * const SGSPromiseUnderlyingErrorsKey = @"SGSPromiseUnderlyingErrors";
+
+typedef NS_ENUM(NSInteger, kPromiseState) {
+    kPromiseStatePending,
+    kPromiseStateFulfilled,
+    kPromiseStateRejected,
+};
+
+/// 结果确定后在确定结果的线程中同步执行，只做分发，不执行调用方的代码
+typedef void(^p_PromiseCallback)(id value, NSError *error);
+
+@implementation SGSPromise {
+    kPromiseState _state;
+    id _value;
+    NSError *_error;
+    BOOL _cancelled;
+
+    NSMutableArray<p_PromiseCallback> *_callbacks;
+    /// 等待中依赖的 Promise，取消时释放
+    NSArray<SGSPromise *> *_upstreamPromises;
+    /// 依赖当前结果的后续 Promise 数，最后一个释放时取消
+    NSUInteger _dependentCount;
+    void (^_cancellationHandler)(void);
+}
+
++ (instancetype)pendingPromise {
+    return [[self alloc] init];
+}
+
++ (instancetype)promiseWithValue:(id)value {
+    SGSPromise *promise = [[self alloc] init];
+    [promise fulfill:value];
+    return promise;
+}
+
++ (instancetype)promiseWithError:(NSError *)error {
+    SGSPromise *promise = [[self alloc] init];
+    [promise reject:error];
+    return promise;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _state = kPromiseStatePending;
+    }
+    return self;
+}
+
+
+#pragma mark - State
+
+- (BOOL)isPending {
+    @synchronized (self) {
+        return _state == kPromiseStatePending;
+    }
+}
+
+- (BOOL)isFulfilled {
+    @synchronized (self) {
+        return _state == kPromiseStateFulfilled;
+    }
+}
+
+- (BOOL)isRejected {
+    @synchronized (self) {
+        return _state == kPromiseStateRejected;
+    }
+}
+
+- (id)value {
+    @synchronized (self) {
+        return _value;
+    }
+}
+
+- (NSError *)error {
+    @synchronized (self) {
+        return _error;
+    }
+}
+
+- (void (^)(void))cancellationHandler {
+    @synchronized (self) {
+        return _cancellationHandler;
+    }
+}
+
+- (void)setCancellationHandler:(void (^)(void))cancellationHandler {
+    BOOL cancelled = NO;
+    @synchronized (self) {
+        if (_state == kPromiseStatePending) {
+            _cancellationHandler = [cancellationHandler copy];
+            return;
+        }
+        cancelled = _cancelled;
+    }
+
+    if (cancelled && cancellationHandler) cancellationHandler();
+}
+
+- (void)fulfill:(id)value {
+    [self p_settleWithValue:value error:nil];
+}
+
+- (void)reject:(NSError *)error {
+    [self p_settleWithValue:nil error:error ?: [NSError errorWithDomain:SGSPromiseErrorDomain code:0 userInfo:nil]];
+}
+
+- (void)cancel {
+    void (^handler)(void) = nil;
+    NSArray<SGSPromise *> *upstreamPromises = nil;
+    NSArray<p_PromiseCallback> *callbacks = nil;
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+
+    @synchronized (self) {
+        if (_state != kPromiseStatePending) return;
+        _cancelled = YES;
+        handler = _cancellationHandler;
+        upstreamPromises = _upstreamPromises;
+        callbacks = [self p_lockedSettleWithValue:nil error:error];
+    }
+
+    if (handler) handler();
+    [SGSPromise p_releasePromises:upstreamPromises];
+    for (p_PromiseCallback callback in callbacks) {
+        callback(nil, error);
+    }
+}
+
+
+#pragma mark - Chaining
+
+- (SGSPromise *)then:(SGSPromiseThenBlock)block {
+    return [self thenOnQueue:dispatch_get_main_queue() block:block];
+}
+
+- (SGSPromise *)thenOnQueue:(dispatch_queue_t)queue block:(SGSPromiseThenBlock)block {
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:@[self]];
+
+    [self p_addCallback:^(id value, NSError *error) {
+        if (error != nil) {
+            [promise reject:error];
+            return ;
+        }
+        dispatch_async(queue, ^{
+            if (!promise.isPending) return ;
+            [promise p_resolveWithResult:block ? block(value) : value];
+        });
+    }];
+
+    return promise;
+}
+
+- (SGSPromise *)recover:(SGSPromiseRecoverBlock)block {
+    return [self recoverOnQueue:dispatch_get_main_queue() block:block];
+}
+
+- (SGSPromise *)recoverOnQueue:(dispatch_queue_t)queue block:(SGSPromiseRecoverBlock)block {
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:@[self]];
+
+    [self p_addCallback:^(id value, NSError *error) {
+        if (error == nil) {
+            [promise fulfill:value];
+            return ;
+        }
+        dispatch_async(queue, ^{
+            if (!promise.isPending) return ;
+            [promise p_resolveWithResult:block ? block(error) : error];
+        });
+    }];
+
+    return promise;
+}
+
+- (SGSPromise *)timeout:(NSTimeInterval)interval {
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:@[self]];
+
+    [self p_addCallback:^(id value, NSError *error) {
+        [promise p_settleWithValue:value error:error];
+    }];
+
+    __weak SGSPromise *weakPromise = promise;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+        [weakPromise p_settleWithValue:nil error:error];
+    });
+
+    return promise;
+}
+
+
+#pragma mark - Combining
+
++ (SGSPromise *)all:(NSArray<SGSPromise *> *)promises {
+    if (promises.count == 0) return [SGSPromise promiseWithValue:@[]];
+
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:promises];
+
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:promises.count];
+    for (NSUInteger i = 0; i < promises.count; i++) {
+        [values addObject:[NSNull null]];
+    }
+    __block NSUInteger remainingCount = promises.count;
+
+    [promises enumerateObjectsUsingBlock:^(SGSPromise * _Nonnull obj, NSUInteger idx, BOOL * _Nonnull stop) {
+        [obj p_addCallback:^(id value, NSError *error) {
+            if (error != nil) {
+                [promise p_settleWithValue:nil error:error];
+                return ;
+            }
+
+            BOOL finished = NO;
+            @synchronized (values) {
+                if (value != nil) values[idx] = value;
+                remainingCount -= 1;
+                finished = (remainingCount == 0);
+            }
+            if (finished) [promise fulfill:[values copy]];
+        }];
+    }];
+
+    return promise;
+}
+
++ (SGSPromise *)any:(NSArray<SGSPromise *> *)promises {
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:promises];
+
+    NSMutableArray<NSError *> *errors = [NSMutableArray arrayWithCapacity:promises.count];
+    if (promises.count == 0) {
+        [promise reject:[SGSPromise p_allRejectedErrorWithErrors:errors]];
+        return promise;
+    }
+
+    for (SGSPromise *obj in promises) {
+        [obj p_addCallback:^(id value, NSError *error) {
+            if (error == nil) {
+                [promise p_settleWithValue:value error:nil];
+                return ;
+            }
+
+            BOOL finished = NO;
+            @synchronized (errors) {
+                [errors addObject:error];
+                finished = (errors.count == promises.count);
+            }
+            if (finished) [promise reject:[SGSPromise p_allRejectedErrorWithErrors:[errors copy]]];
+        }];
+    }
+
+    return promise;
+}
+
++ (SGSPromise *)race:(NSArray<SGSPromise *> *)promises {
+    if (promises.count == 0) return [SGSPromise promiseWithValue:nil];
+
+    SGSPromise *promise = [SGSPromise pendingPromise];
+    [promise p_setUpstreamPromises:promises];
+
+    for (SGSPromise *obj in promises) {
+        [obj p_addCallback:^(id value, NSError *error) {
+            [promise p_settleWithValue:value error:error];
+        }];
+    }
+
+    return promise;
+}
+
+
+#pragma mark - Private
+
+// 确定结果并释放仍在等待的依赖，已经确定时返回 NO
+- (BOOL)p_settleWithValue:(id)value error:(NSError *)error {
+    NSArray<SGSPromise *> *upstreamPromises = nil;
+    NSArray<p_PromiseCallback> *callbacks = nil;
+    @synchronized (self) {
+        if (_state != kPromiseStatePending) return NO;
+        upstreamPromises = _upstreamPromises;
+        callbacks = [self p_lockedSettleWithValue:value error:error];
+    }
+
+    [SGSPromise p_releasePromises:upstreamPromises];
+    for (p_PromiseCallback callback in callbacks) {
+        callback(value, error);
+    }
+    return YES;
+}
+
+// 需要在 @synchronized (self) 中调用，返回需要执行的回调
+- (NSArray<p_PromiseCallback> *)p_lockedSettleWithValue:(id)value error:(NSError *)error {
+    _state = (error != nil) ? kPromiseStateRejected : kPromiseStateFulfilled;
+    _value = value;
+    _error = error;
+
+    NSArray<p_PromiseCallback> *callbacks = _callbacks;
+    _callbacks = nil;
+    _upstreamPromises = nil;
+    _cancellationHandler = nil;
+
+    return callbacks;
+}
+
+- (void)p_addCallback:(p_PromiseCallback)callback {
+    id value = nil;
+    NSError *error = nil;
+    @synchronized (self) {
+        if (_state == kPromiseStatePending) {
+            if (_callbacks == nil) _callbacks = [NSMutableArray arrayWithCapacity:1];
+            [_callbacks addObject:[callback copy]];
+            return;
+        }
+        value = _value;
+        error = _error;
+    }
+
+    callback(value, error);
+}
+
+// 先登记为依赖再保存，已经确定结果时不再需要依赖的结果
+- (void)p_setUpstreamPromises:(NSArray<SGSPromise *> *)promises {
+    for (SGSPromise *promise in promises) {
+        [promise p_addDependent];
+    }
+
+    @synchronized (self) {
+        if (_state == kPromiseStatePending) {
+            _upstreamPromises = [promises arrayByAddingObjectsFromArray:_upstreamPromises ?: @[]];
+            return;
+        }
+    }
+
+    [SGSPromise p_releasePromises:promises];
+}
+
+- (void)p_addDependent {
+    @synchronized (self) {
+        if (_state == kPromiseStatePending) _dependentCount += 1;
+    }
+}
+
+// 后续 Promise 不再需要结果，最后一个依赖释放时取消
+- (void)p_removeDependent {
+    BOOL cancels = NO;
+    @synchronized (self) {
+        if ((_state != kPromiseStatePending) || (_dependentCount == 0)) return;
+        _dependentCount -= 1;
+        cancels = (_dependentCount == 0);
+    }
+
+    if (cancels) [self cancel];
+}
+
+- (void)p_resolveWithResult:(id)result {
+    if ([result isKindOfClass:[NSError class]]) {
+        [self reject:result];
+    } else if ([result isKindOfClass:[SGSPromise class]] && (result != self)) {
+        SGSPromise *promise = result;
+        [self p_setUpstreamPromises:@[promise]];
+        [promise p_addCallback:^(id value, NSError *error) {
+            [self p_settleWithValue:value error:error];
+        }];
+    } else {
+        [self fulfill:result];
+    }
+}
+
++ (void)p_releasePromises:(NSArray<SGSPromise *> *)promises {
+    for (SGSPromise *promise in promises) {
+        [promise p_removeDependent];
+    }
+}
+
++ (NSError *)p_allRejectedErrorWithErrors:(NSArray<NSError *> *)errors {
+    return [NSError errorWithDomain:SGSPromiseErrorDomain
+                               code:SGSPromiseErrorAllRejected
+                           userInfo:@{SGSPromiseUnderlyingErrorsKey: errors}];
+}
+
+@end
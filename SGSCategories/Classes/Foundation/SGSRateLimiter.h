@@ -0,0 +1,157 @@
+/*!
+ *  @header SGSRateLimiter.h
+ *
+ *  @abstract 按主机和接口限制请求速率的令牌桶
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class SGSTaskHandle;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 请求限速器
+ *
+ *  @discussion 每个主机和每个设置了速率的接口（主机 + 路径前缀）各有一个令牌桶，
+ *      令牌以每秒 requestsPerSecond 个的速度补充，最多积攒 burst 个，请求需要从所在主机的桶
+ *      和匹配的最长路径前缀的桶中各取得一个令牌才会创建任务
+ *
+ *      等待令牌的请求在内部串行队列中排队，由定时器在令牌补充后启动，不会阻塞任何线程，
+ *      同一个桶中的请求先进先出，某个桶没有令牌时不影响其他主机和接口的请求，
+ *      没有单独设置速率的主机在空闲（令牌已满且没有暂停）后会被清理，不会随访问过的主机数增长
+ *
+ *      honorsServerRateLimitHeaders 为 YES 时，updateWithResponse:forRequest: 根据响应调整令牌桶：
+ *      - 429 和 503 响应按 Retry-After 暂停该桶，没有 Retry-After 时暂停 1 秒
+ *      - RateLimit-Remaining（或 X-RateLimit-Remaining）限制桶中剩余的令牌数，为 0 时按
+ *        RateLimit-Reset（或 X-RateLimit-Reset，秒数或 Unix 时间戳）暂停该桶
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSRateLimiter : NSObject
+
+/*!
+ *  @brief 共享的限速器
+ */
++ (instancetype)sharedLimiter;
+
+/*!
+ *  @brief 没有单独设置的主机的速率，单位：次/秒，默认为 0，表示不限制
+ *
+ *  @discussion 不限制速率的主机仍会根据服务器的限速响应头暂停
+ */
+@property (atomic, assign) double defaultRequestsPerSecond;
+
+/*!
+ *  @brief 没有单独设置的主机最多积攒的令牌数，默认为 1
+ */
+@property (atomic, assign) NSUInteger defaultBurst;
+
+/*!
+ *  @brief 是否根据服务器的限速响应头调整令牌桶，默认为 YES
+ */
+@property (atomic, assign) BOOL honorsServerRateLimitHeaders;
+
+/*!
+ *  @brief 设置主机的速率
+ *
+ *  @param requestsPerSecond 速率，单位：次/秒，小于等于 0 时不限制
+ *  @param burst             最多积攒的令牌数，为 0 时按 1 处理
+ *  @param host              主机名，不区分大小写
+ */
+- (void)setRequestsPerSecond:(double)requestsPerSecond burst:(NSUInteger)burst forHost:(NSString *)host;
+
+/*!
+ *  @brief 设置接口的速率
+ *
+ *  @discussion 请求路径匹配多个前缀时使用最长的前缀，匹配的请求同时受主机速率的限制
+ *
+ *  @param requestsPerSecond 速率，单位：次/秒，小于等于 0 时不限制
+ *  @param burst             最多积攒的令牌数，为 0 时按 1 处理
+ *  @param host              主机名，不区分大小写
+ *  @param pathPrefix        路径前缀，例如 @"/api/search"
+ */
+- (void)setRequestsPerSecond:(double)requestsPerSecond
+                       burst:(NSUInteger)burst
+                     forHost:(NSString *)host
+                  pathPrefix:(NSString *)pathPrefix;
+
+/*!
+ *  @brief 移除所有主机和接口的速率设置以及服务器要求的暂停
+ */
+- (void)removeAllLimits;
+
+/*!
+ *  @brief 添加请求
+ *
+ *  @discussion 调用句柄的 resume 后开始等待令牌，取得令牌后调用 taskFactory 创建任务并启动，
+ *      任务完成后应调用 updateWithResponse:forRequest: 以便根据服务器的限速响应头调整
+ *
+ *      没有启动任务就结束时调用 failure：等待中被取消时错误码为 NSURLErrorCancelled，
+ *      taskFactory 返回 nil 时错误码为 NSURLErrorUnknown，此时归还取得的令牌
+ *
+ *  @param request     HTTP 请求，用于获取主机和路径
+ *  @param taskFactory 创建任务的闭包
+ *  @param failure     没有启动任务就结束时调用
+ *
+ *  @return SGSTaskHandle，等待中的 task 为 nil
+ */
+- (SGSTaskHandle *)limitRequest:(NSURLRequest *)request
+                    taskFactory:(NSURLSessionTask * _Nullable (^)(void))taskFactory
+                        failure:(nullable void (^)(NSError *error))failure;
+
+/*!
+ *  @brief 根据服务器的响应调整令牌桶
+ *
+ *  @param response 响应，不是 NSHTTPURLResponse 时忽略
+ *  @param request  对应的请求
+ */
+- (void)updateWithResponse:(nullable NSURLResponse *)response forRequest:(NSURLRequest *)request;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 等待令牌的请求数
+ */
+@property (nonatomic, assign, readonly) NSUInteger queuedCount;
+
+/*!
+ *  @brief 主机已启动请求的平均等待时间
+ *
+ *  @param host 主机名，不区分大小写
+ *
+ *  @return 平均等待时间，单位：秒
+ */
+- (NSTimeInterval)averageWaitTimeForHost:(NSString *)host;
+
+/*!
+ *  @brief 所有统计数据
+ *
+ *  @discussion 包括：
+ *      - queuedCount：等待令牌的请求数
+ *      - startedCount：已启动的请求数
+ *      - delayedCount：需要等待令牌的请求数
+ *      - averageWaitTime、maximumWaitTime：已启动请求的平均和最长等待时间，单位：秒
+ *      - throttledResponseCount：收到 429 和 503 响应的次数
+ *      - hosts：以主机名为键，值为包含 started、delayed、averageWaitTime、maximumWaitTime 的字典
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, id> *)metrics;
+
+/*!
+ *  @brief 重置等待时间的统计
+ */
+- (void)resetMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,576 @@
+/*!
+ *  @header SGSRateLimiter.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSRateLimiter.h"
+#import "SGSTaskHandle.h"
+#import "SGSRetryPolicy.h"
+
+/// 服务器返回 429 或 503 但没有 Retry-After 时暂停的时间
+static const NSTimeInterval kRateLimitDefaultPause = 1.0;
+
+/// 大于该值的 RateLimit-Reset 视为 Unix 时间戳
+static const double kRateLimitResetTimestampThreshold = 1000000000;
+
+/// 主机桶超过该数量时清理空闲的桶
+static const NSUInteger kRateLimitIdleBucketSweepThreshold = 64;
+
+typedef NS_ENUM(NSInteger, kLimitedRequestState) {
+    kLimitedRequestStateIdle,
+    kLimitedRequestStateQueued,
+    kLimitedRequestStateStarted,
+    kLimitedRequestStateFinished,
+};
+
+#pragma mark - Token Bucket
+
+/// 令牌桶，只在限速器的队列中访问，仅内部使用
+@interface p_TokenBucket : NSObject
+@property (nonatomic, copy) NSString *pathPrefix;
+@property (nonatomic, assign) double rate;
+@property (nonatomic, assign) double capacity;
+@property (nonatomic, assign) double tokens;
+@property (nonatomic, assign) CFAbsoluteTime lastRefillTime;
+/// 服务器要求暂停到的时间
+@property (nonatomic, assign) CFAbsoluteTime pausedUntil;
+/// 是否单独设置过速率，否则跟随默认速率
+@property (nonatomic, assign) BOOL configured;
+@end
+
+@implementation p_TokenBucket
+
+- (void)refillAtTime:(CFAbsoluteTime)now {
+    if (self.rate <= 0) {
+        self.tokens = self.capacity;
+    } else if (now > self.lastRefillTime) {
+        self.tokens = MIN(self.capacity, self.tokens + (now - self.lastRefillTime) * self.rate);
+    }
+    self.lastRefillTime = now;
+}
+
+// 可以取得一个令牌的时间，不晚于 now 时表示现在就可以取得
+- (CFAbsoluteTime)availableTimeAtTime:(CFAbsoluteTime)now {
+    CFAbsoluteTime time = now;
+    if ((self.rate > 0) && (self.tokens < 1)) {
+        time = now + (1 - self.tokens) / self.rate;
+    }
+    return MAX(time, self.pausedUntil);
+}
+
+@end
+
+
+#pragma mark - Limited Request & Stats
+
+/// 限速中的请求，仅内部使用
+@interface p_LimitedRequest : NSObject
+@property (nonatomic, strong) SGSTaskHandle *handle;
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, assign) kLimitedRequestState state;
+@property (nonatomic, assign) CFAbsoluteTime enqueueTime;
+/// 启动后创建的任务，用于取消
+@property (nonatomic, weak) NSURLSessionTask *task;
+@property (nonatomic, copy) NSURLSessionTask *(^taskFactory)(void);
+@property (nonatomic, copy) void (^failure)(NSError *error);
+@end
+
+@implementation p_LimitedRequest
+@end
+
+/// 单个主机的等待时间统计，仅内部使用
+@interface p_RateLimitStats : NSObject
+@property (nonatomic, assign) NSUInteger startedCount;
+@property (nonatomic, assign) NSUInteger delayedCount;
+@property (nonatomic, assign) NSTimeInterval totalWaitTime;
+@property (nonatomic, assign) NSTimeInterval maximumWaitTime;
+@end
+
+@implementation p_RateLimitStats
+@end
+
+
+#pragma mark - SGSRateLimiter
+
+@implementation SGSRateLimiter {
+    dispatch_queue_t _queue;
+    dispatch_source_t _timer;
+    CFAbsoluteTime _timerFireTime;
+
+    NSMutableDictionary<NSString *, p_TokenBucket *> *_hostBuckets;
+    NSMutableDictionary<NSString *, NSMutableArray<p_TokenBucket *> *> *_endpointBuckets;
+    NSMutableArray<p_LimitedRequest *> *_pendingRequests;
+
+    NSMutableDictionary<NSString *, p_RateLimitStats *> *_statsByHost;
+    NSUInteger _throttledResponseCount;
+}
+
++ (instancetype)sharedLimiter {
+    static SGSRateLimiter *limiter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        limiter = [[SGSRateLimiter alloc] init];
+    });
+    return limiter;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _defaultRequestsPerSecond = 0;
+        _defaultBurst = 1;
+        _honorsServerRateLimitHeaders = YES;
+
+        _queue = dispatch_queue_create("com.southgis.SGSCategories.RateLimiter", DISPATCH_QUEUE_SERIAL);
+        _hostBuckets = [NSMutableDictionary dictionary];
+        _endpointBuckets = [NSMutableDictionary dictionary];
+        _pendingRequests = [NSMutableArray array];
+        _statsByHost = [NSMutableDictionary dictionary];
+
+        __weak typeof(&*self) weakSelf = self;
+        _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+        dispatch_source_set_event_handler(_timer, ^{
+            [weakSelf p_timerFired];
+        });
+        dispatch_source_set_timer(_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(_timer);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(_timer);
+}
+
+
+#pragma mark - Configuration
+
+- (void)setRequestsPerSecond:(double)requestsPerSecond burst:(NSUInteger)burst forHost:(NSString *)host {
+    NSString *key = host.lowercaseString ?: @"";
+
+    dispatch_async(_queue, ^{
+        p_TokenBucket *bucket = [self p_hostBucketForHost:key];
+        [self p_configureBucket:bucket requestsPerSecond:requestsPerSecond burst:burst];
+        [self p_pump];
+    });
+}
+
+- (void)setRequestsPerSecond:(double)requestsPerSecond
+                       burst:(NSUInteger)burst
+                     forHost:(NSString *)host
+                  pathPrefix:(NSString *)pathPrefix
+{
+    NSString *key = host.lowercaseString ?: @"";
+    NSString *prefix = [pathPrefix copy] ?: @"";
+
+    dispatch_async(_queue, ^{
+        NSMutableArray<p_TokenBucket *> *buckets = _endpointBuckets[key];
+        if (buckets == nil) {
+            buckets = [NSMutableArray array];
+            _endpointBuckets[key] = buckets;
+        }
+
+        p_TokenBucket *bucket = nil;
+        for (p_TokenBucket *existing in buckets) {
+            if ([existing.pathPrefix isEqualToString:prefix]) {
+                bucket = existing;
+                break;
+            }
+        }
+        if (bucket == nil) {
+            bucket = [self p_bucketWithRate:0 capacity:1];
+            bucket.pathPrefix = prefix;
+            [buckets addObject:bucket];
+        }
+
+        [self p_configureBucket:bucket requestsPerSecond:requestsPerSecond burst:burst];
+        [self p_pump];
+    });
+}
+
+- (void)removeAllLimits {
+    dispatch_async(_queue, ^{
+        [_hostBuckets removeAllObjects];
+        [_endpointBuckets removeAllObjects];
+        [self p_pump];
+    });
+}
+
+
+#pragma mark - Request
+
+- (SGSTaskHandle *)limitRequest:(NSURLRequest *)request
+                    taskFactory:(NSURLSessionTask *(^)(void))taskFactory
+                        failure:(void (^)(NSError *))failure
+{
+    p_LimitedRequest *limited = [[p_LimitedRequest alloc] init];
+    limited.host = request.URL.host.lowercaseString ?: @"";
+    limited.path = request.URL.path ?: @"";
+    limited.taskFactory = taskFactory;
+    limited.failure = failure;
+
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+
+    handle.resumingHandler = ^{
+        [weakSelf p_enqueue:limited withHandle:weakHandle];
+    };
+    handle.cancellationHandler = ^{
+        [weakSelf p_cancel:limited];
+    };
+
+    return handle;
+}
+
+- (void)updateWithResponse:(NSURLResponse *)response forRequest:(NSURLRequest *)request {
+    if (!self.honorsServerRateLimitHeaders) return;
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) return;
+
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+    BOOL throttled = (httpResponse.statusCode == 429) || (httpResponse.statusCode == 503);
+    NSTimeInterval pause = -1;
+
+    if (throttled) {
+        pause = [SGSRetryPolicy retryAfterIntervalForResponse:response];
+        if (pause < 0) pause = kRateLimitDefaultPause;
+    }
+
+    double remaining = [SGSRateLimiter p_doubleValueForHeaderFields:@[@"RateLimit-Remaining", @"X-RateLimit-Remaining"] inResponse:httpResponse];
+    if (remaining == 0) {
+        double reset = [SGSRateLimiter p_doubleValueForHeaderFields:@[@"RateLimit-Reset", @"X-RateLimit-Reset"] inResponse:httpResponse];
+        if (reset > kRateLimitResetTimestampThreshold) {
+            reset -= [[NSDate date] timeIntervalSince1970];
+        }
+        pause = MAX(pause, reset);
+    }
+
+    if (!throttled && (remaining < 0) && (pause < 0)) return;
+
+    NSString *host = request.URL.host.lowercaseString ?: @"";
+    NSString *path = request.URL.path ?: @"";
+
+    dispatch_async(_queue, ^{
+        if (throttled) _throttledResponseCount += 1;
+
+        // 服务器的限制作用在最具体的桶上
+        p_TokenBucket *bucket = [self p_endpointBucketForHost:host path:path] ?: [self p_hostBucketForHost:host];
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        [bucket refillAtTime:now];
+
+        if (remaining >= 0) {
+            bucket.tokens = MIN(bucket.tokens, remaining);
+        }
+        if (pause > 0) {
+            bucket.pausedUntil = MAX(bucket.pausedUntil, now + pause);
+        }
+
+        [self p_pump];
+    });
+}
+
+
+#pragma mark - Metrics
+
+- (NSUInteger)queuedCount {
+    __block NSUInteger count = 0;
+    dispatch_sync(_queue, ^{
+        count = _pendingRequests.count;
+    });
+    return count;
+}
+
+- (NSTimeInterval)averageWaitTimeForHost:(NSString *)host {
+    NSString *key = host.lowercaseString ?: @"";
+    __block NSTimeInterval average = 0;
+    dispatch_sync(_queue, ^{
+        p_RateLimitStats *stats = _statsByHost[key];
+        if (stats.startedCount > 0) average = stats.totalWaitTime / stats.startedCount;
+    });
+    return average;
+}
+
+- (NSDictionary<NSString *,id> *)metrics {
+    __block NSDictionary *metrics = nil;
+    dispatch_sync(_queue, ^{
+        NSMutableDictionary *hosts = [NSMutableDictionary dictionaryWithCapacity:_statsByHost.count];
+        NSUInteger startedCount = 0;
+        NSUInteger delayedCount = 0;
+        NSTimeInterval totalWaitTime = 0;
+        NSTimeInterval maximumWaitTime = 0;
+
+        for (NSString *host in _statsByHost) {
+            p_RateLimitStats *stats = _statsByHost[host];
+            startedCount += stats.startedCount;
+            delayedCount += stats.delayedCount;
+            totalWaitTime += stats.totalWaitTime;
+            maximumWaitTime = MAX(maximumWaitTime, stats.maximumWaitTime);
+
+            hosts[host] = @{@"started": @(stats.startedCount),
+                            @"delayed": @(stats.delayedCount),
+                            @"averageWaitTime": @((stats.startedCount > 0) ? (stats.totalWaitTime / stats.startedCount) : 0),
+                            @"maximumWaitTime": @(stats.maximumWaitTime)};
+        }
+
+        metrics = @{@"queuedCount": @(_pendingRequests.count),
+                    @"startedCount": @(startedCount),
+                    @"delayedCount": @(delayedCount),
+                    @"averageWaitTime": @((startedCount > 0) ? (totalWaitTime / startedCount) : 0),
+                    @"maximumWaitTime": @(maximumWaitTime),
+                    @"throttledResponseCount": @(_throttledResponseCount),
+                    @"hosts": hosts};
+    });
+    return metrics;
+}
+
+- (void)resetMetrics {
+    dispatch_async(_queue, ^{
+        [_statsByHost removeAllObjects];
+        _throttledResponseCount = 0;
+    });
+}
+
+
+#pragma mark - Private
+
+- (void)p_enqueue:(p_LimitedRequest *)limited withHandle:(SGSTaskHandle *)handle {
+    if (handle == nil) return;
+
+    dispatch_async(_queue, ^{
+        if (limited.state != kLimitedRequestStateIdle) return;
+
+        // 等待中由限速器持有句柄，启动后释放
+        limited.handle = handle;
+        limited.state = kLimitedRequestStateQueued;
+        limited.enqueueTime = CFAbsoluteTimeGetCurrent();
+        [_pendingRequests addObject:limited];
+
+        [self p_pump];
+    });
+}
+
+- (void)p_cancel:(p_LimitedRequest *)limited {
+    dispatch_async(_queue, ^{
+        switch (limited.state) {
+            case kLimitedRequestStateIdle:
+            case kLimitedRequestStateQueued:
+                [_pendingRequests removeObjectIdenticalTo:limited];
+                limited.state = kLimitedRequestStateFinished;
+                limited.handle = nil;
+                if (limited.failure) limited.failure([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]);
+                [self p_pump];
+                break;
+            case kLimitedRequestStateStarted:
+                [limited.task cancel];
+                break;
+            case kLimitedRequestStateFinished:
+                break;
+        }
+    });
+}
+
+- (void)p_timerFired {
+    _timerFireTime = 0;
+    [self p_pump];
+}
+
+// 以下方法只在 _queue 中调用
+
+// 按顺序为等待中的请求分配令牌，某个桶的令牌不足时，同一个桶中排在后面的请求也继续等待
+- (void)p_pump {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (_hostBuckets.count > kRateLimitIdleBucketSweepThreshold) {
+        [self p_removeIdleHostBucketsAtTime:now];
+    }
+
+    if (_pendingRequests.count == 0) return;
+
+    CFAbsoluteTime nextTime = DBL_MAX;
+    NSHashTable<p_TokenBucket *> *exhaustedBuckets = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    NSMutableIndexSet *startedIndexes = [NSMutableIndexSet indexSet];
+    NSMutableArray<p_LimitedRequest *> *startings = [NSMutableArray array];
+
+    for (NSUInteger i = 0; i < _pendingRequests.count; i++) {
+        p_LimitedRequest *limited = _pendingRequests[i];
+        NSArray<p_TokenBucket *> *buckets = [self p_bucketsForRequest:limited];
+
+        BOOL available = YES;
+        for (p_TokenBucket *bucket in buckets) {
+            if ([exhaustedBuckets containsObject:bucket]) {
+                available = NO;
+                continue;
+            }
+
+            [bucket refillAtTime:now];
+            CFAbsoluteTime availableTime = [bucket availableTimeAtTime:now];
+            if (availableTime > now) {
+                available = NO;
+                nextTime = MIN(nextTime, availableTime);
+                [exhaustedBuckets addObject:bucket];
+            }
+        }
+        if (!available) continue;
+
+        for (p_TokenBucket *bucket in buckets) {
+            if (bucket.rate > 0) bucket.tokens -= 1;
+        }
+        [startedIndexes addIndex:i];
+        [startings addObject:limited];
+    }
+
+    [_pendingRequests removeObjectsAtIndexes:startedIndexes];
+
+    for (p_LimitedRequest *limited in startings) {
+        [self p_start:limited atTime:now];
+    }
+
+    if ((_pendingRequests.count > 0) && (nextTime < DBL_MAX)) {
+        [self p_scheduleTimerAtTime:nextTime now:now];
+    }
+}
+
+- (void)p_start:(p_LimitedRequest *)limited atTime:(CFAbsoluteTime)now {
+    SGSTaskHandle *handle = limited.handle;
+    limited.handle = nil;
+    limited.state = kLimitedRequestStateStarted;
+
+    NSTimeInterval waitTime = MAX(now - limited.enqueueTime, 0);
+    p_RateLimitStats *stats = _statsByHost[limited.host];
+    if (stats == nil) {
+        stats = [[p_RateLimitStats alloc] init];
+        _statsByHost[limited.host] = stats;
+    }
+    stats.startedCount += 1;
+    stats.totalWaitTime += waitTime;
+    stats.maximumWaitTime = MAX(stats.maximumWaitTime, waitTime);
+    // 定时器的精度以内视为没有等待
+    if (waitTime > 0.001) stats.delayedCount += 1;
+
+    NSURLSessionTask *task = limited.taskFactory();
+    if (task == nil) {
+        // 没有发出请求，归还取得的令牌
+        for (p_TokenBucket *bucket in [self p_bucketsForRequest:limited]) {
+            if (bucket.rate > 0) bucket.tokens = MIN(bucket.tokens + 1, bucket.capacity);
+        }
+        limited.state = kLimitedRequestStateFinished;
+        if (limited.failure) {
+            limited.failure([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorUnknown userInfo:@{NSLocalizedDescriptionKey: @"Could not create a task for the request."}]);
+        }
+        // 当前仍在 p_pump 中，归还的令牌在下一轮分配
+        dispatch_async(_queue, ^{
+            [self p_pump];
+        });
+        return;
+    }
+
+    limited.task = task;
+    handle.task = task;
+    if (handle.isCancelled) {
+        [task cancel];
+    } else {
+        [task resume];
+    }
+}
+
+- (void)p_scheduleTimerAtTime:(CFAbsoluteTime)fireTime now:(CFAbsoluteTime)now {
+    // 已经安排了更早的定时器时不需要调整，届时会重新计算
+    if ((_timerFireTime > 0) && (_timerFireTime <= fireTime)) return;
+
+    _timerFireTime = fireTime;
+    int64_t delay = (int64_t)(MAX(fireTime - now, 0) * NSEC_PER_SEC);
+    dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, delay), DISPATCH_TIME_FOREVER, NSEC_PER_MSEC);
+}
+
+- (NSArray<p_TokenBucket *> *)p_bucketsForRequest:(p_LimitedRequest *)limited {
+    p_TokenBucket *hostBucket = [self p_hostBucketForHost:limited.host];
+    p_TokenBucket *endpointBucket = [self p_endpointBucketForHost:limited.host path:limited.path];
+
+    return (endpointBucket != nil) ? @[hostBucket, endpointBucket] : @[hostBucket];
+}
+
+- (p_TokenBucket *)p_hostBucketForHost:(NSString *)host {
+    p_TokenBucket *bucket = _hostBuckets[host];
+    if (bucket == nil) {
+        bucket = [self p_bucketWithRate:0 capacity:1];
+        _hostBuckets[host] = bucket;
+    }
+
+    // 没有单独设置的主机跟随默认速率
+    if (!bucket.configured) {
+        bucket.rate = self.defaultRequestsPerSecond;
+        bucket.capacity = MAX(self.defaultBurst, 1);
+        bucket.tokens = MIN(bucket.tokens, bucket.capacity);
+    }
+
+    return bucket;
+}
+
+// 移除没有单独设置、令牌已满且没有暂停的主机桶，这些桶与重新创建的桶等价
+- (void)p_removeIdleHostBucketsAtTime:(CFAbsoluteTime)now {
+    NSMutableSet<NSString *> *busyHosts = [NSMutableSet setWithCapacity:_pendingRequests.count];
+    for (p_LimitedRequest *limited in _pendingRequests) {
+        [busyHosts addObject:limited.host];
+    }
+
+    NSMutableArray<NSString *> *idleHosts = [NSMutableArray array];
+    [_hostBuckets enumerateKeysAndObjectsUsingBlock:^(NSString *host, p_TokenBucket *bucket, BOOL *stop) {
+        if (bucket.configured || [busyHosts containsObject:host]) return;
+
+        [bucket refillAtTime:now];
+        if ((bucket.tokens >= bucket.capacity) && (bucket.pausedUntil <= now)) {
+            [idleHosts addObject:host];
+        }
+    }];
+    [_hostBuckets removeObjectsForKeys:idleHosts];
+}
+
+- (p_TokenBucket *)p_endpointBucketForHost:(NSString *)host path:(NSString *)path {
+    p_TokenBucket *matched = nil;
+    for (p_TokenBucket *bucket in _endpointBuckets[host]) {
+        if (![path hasPrefix:bucket.pathPrefix]) continue;
+        if ((matched == nil) || (bucket.pathPrefix.length > matched.pathPrefix.length)) {
+            matched = bucket;
+        }
+    }
+    return matched;
+}
+
+- (p_TokenBucket *)p_bucketWithRate:(double)rate capacity:(double)capacity {
+    p_TokenBucket *bucket = [[p_TokenBucket alloc] init];
+    bucket.rate = rate;
+    bucket.capacity = capacity;
+    bucket.tokens = capacity;
+    bucket.lastRefillTime = CFAbsoluteTimeGetCurrent();
+    return bucket;
+}
+
+- (void)p_configureBucket:(p_TokenBucket *)bucket requestsPerSecond:(double)requestsPerSecond burst:(NSUInteger)burst {
+    [bucket refillAtTime:CFAbsoluteTimeGetCurrent()];
+    bucket.configured = YES;
+    bucket.rate = requestsPerSecond;
+    bucket.capacity = MAX(burst, 1);
+    bucket.tokens = MIN(bucket.tokens, bucket.capacity);
+}
+
+// 返回第一个存在的响应头的数值，都不存在或不是数值时返回 -1
++ (double)p_doubleValueForHeaderFields:(NSArray<NSString *> *)fields inResponse:(NSHTTPURLResponse *)response {
+    NSDictionary *headers = response.allHeaderFields;
+
+    for (NSString *field in fields) {
+        for (NSString *key in headers) {
+            if ([key caseInsensitiveCompare:field] != NSOrderedSame) continue;
+
+            NSScanner *scanner = [NSScanner scannerWithString:[headers[key] description]];
+            double value = 0;
+            if ([scanner scanDouble:&value]) return MAX(value, 0);
+        }
+    }
+
+    return -1;
+}
+
+@end
@@ -0,0 +1,72 @@
+/*!
+ *  @header SGSRequestCoalescer.h
+ *
+ *  @abstract 相同请求合并
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NSURLSession+SGS.h"
+#import "SGSTaskHandle.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 相同请求合并
+ *
+ *  @discussion 对于 GET 和 HEAD 请求，如果已有请求方法、请求地址以及 varyingHeaderFields 中的请求头都相同的任务正在进行，
+ *      后来的调用方不再创建新的任务，而是等待已有任务完成后一起回调，
+ *      使用相同 filter 的调用方只会解析一次返回数据
+ *
+ *      取消采用引用计数：调用方取消时只会收到自己的 NSURLErrorCancelled 回调，
+ *      只有当所有调用方都取消后才会取消共享的任务
+ *
+ *      其他请求方法不会合并
+ */
+@interface SGSRequestCoalescer : NSObject
+
+/*!
+ *  @brief 参与计算请求键的请求头，默认为 Accept、Accept-Language、Accept-Encoding、Authorization、Cookie
+ */
+@property (atomic, copy) NSArray<NSString *> *varyingHeaderFields;
+
+/*!
+ *  @brief 当前正在进行的合并任务数
+ */
+@property (nonatomic, assign, readonly) NSUInteger inFlightCount;
+
+/*!
+ *  @brief 被合并（没有创建新任务）的请求总数
+ */
+@property (nonatomic, assign, readonly) NSUInteger coalescedCount;
+
+/*!
+ *  @brief 返回请求键
+ *
+ *  @param request HTTP 请求
+ *
+ *  @return 请求键，请求不允许合并时返回 nil
+ */
+- (nullable NSString *)canonicalKeyForRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 获取请求句柄，如果存在相同的请求正在进行则加入该请求
+ *
+ *  @param request    HTTP 请求
+ *  @param session    用于创建任务的会话
+ *  @param filter     请求完毕后的过滤闭包
+ *  @param completion 完成回调，在任务的回调线程中执行，error 不为空时表示请求失败
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                            session:(NSURLSession *)session
+                     responseFilter:(nullable SGSResponseFilterBlock)filter
+                         completion:(void (^)(NSURLResponse * _Nullable response, id _Nullable responseObject, NSError * _Nullable error))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,230 @@
+/*!
+ *  @header SGSRequestCoalescer.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSRequestCoalescer.h"
+
+typedef void(^p_CoalescedCompletionBlock)(NSURLResponse *response, id responseObject, NSError *error);
+
+#pragma mark - Coalesced Waiter
+
+/// 等待共享任务完成的调用方，仅内部使用
+@interface p_CoalescedWaiter : NSObject
+@property (nonatomic, copy) SGSResponseFilterBlock filter;
+@property (nonatomic, copy) p_CoalescedCompletionBlock completion;
+@property (nonatomic, assign) BOOL cancelled;
+@end
+
+@implementation p_CoalescedWaiter
+@end
+
+
+#pragma mark - Coalesced Group
+
+/// 共享同一个任务的调用方集合，仅内部使用
+@interface p_CoalescedGroup : NSObject
+@property (nonatomic, strong) NSURLSessionDataTask *task;
+@property (nonatomic, strong) NSMutableArray<p_CoalescedWaiter *> *waiters;
+@property (nonatomic, assign) NSUInteger activeCount;
+@end
+
+@implementation p_CoalescedGroup
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _waiters = [NSMutableArray array];
+    }
+    return self;
+}
+
+@end
+
+
+#pragma mark - SGSRequestCoalescer
+
+@implementation SGSRequestCoalescer {
+    NSLock *_lock;
+    NSMutableDictionary<NSString *, p_CoalescedGroup *> *_groupsByKey;
+    NSUInteger _coalescedCount;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        _groupsByKey = [NSMutableDictionary dictionary];
+        _varyingHeaderFields = @[@"Accept", @"Accept-Language", @"Accept-Encoding", @"Authorization", @"Cookie"];
+    }
+    return self;
+}
+
+- (NSUInteger)inFlightCount {
+    [_lock lock];
+    NSUInteger count = _groupsByKey.count;
+    [_lock unlock];
+    return count;
+}
+
+- (NSUInteger)coalescedCount {
+    [_lock lock];
+    NSUInteger count = _coalescedCount;
+    [_lock unlock];
+    return count;
+}
+
+- (NSString *)canonicalKeyForRequest:(NSURLRequest *)request {
+    NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+    if (![method isEqualToString:@"GET"] && ![method isEqualToString:@"HEAD"]) return nil;
+    if ((request.URL == nil) || (request.HTTPBody != nil) || (request.HTTPBodyStream != nil)) return nil;
+
+    NSMutableString *key = [NSMutableString stringWithFormat:@"%@ %@", method, request.URL.absoluteString];
+    for (NSString *field in self.varyingHeaderFields) {
+        NSString *value = [request valueForHTTPHeaderField:field];
+        if (value != nil) {
+            [key appendFormat:@"\n%@: %@", field.lowercaseString, value];
+        }
+    }
+
+    return key;
+}
+
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                            session:(NSURLSession *)session
+                     responseFilter:(SGSResponseFilterBlock)filter
+                         completion:(p_CoalescedCompletionBlock)completion
+{
+    NSString *key = [self canonicalKeyForRequest:request];
+    if (key == nil) {
+        NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+            p_CoalescedWaiter *waiter = [[p_CoalescedWaiter alloc] init];
+            waiter.filter = filter;
+            waiter.completion = completion;
+            [SGSRequestCoalescer p_deliverToWaiters:@[waiter] response:response data:data error:error];
+        }];
+        return [SGSTaskHandle handleWithTask:task];
+    }
+
+    p_CoalescedWaiter *waiter = [[p_CoalescedWaiter alloc] init];
+    waiter.filter = filter;
+    waiter.completion = completion;
+
+    [_lock lock];
+    p_CoalescedGroup *group = _groupsByKey[key];
+    if (group == nil) {
+        group = [[p_CoalescedGroup alloc] init];
+        __weak typeof(&*self) weakSelf = self;
+        __weak p_CoalescedGroup *weakGroup = group;
+        group.task = [session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+            [weakSelf p_completeGroup:weakGroup forKey:key response:response data:data error:error];
+        }];
+        _groupsByKey[key] = group;
+    } else {
+        _coalescedCount += 1;
+    }
+    [group.waiters addObject:waiter];
+    group.activeCount += 1;
+    [_lock unlock];
+
+    SGSTaskHandle *handle = [SGSTaskHandle handleWithTask:group.task];
+    __weak typeof(&*self) weakSelf = self;
+    handle.cancellationHandler = ^{
+        [weakSelf p_cancelWaiter:waiter inGroup:group forKey:key];
+    };
+
+    return handle;
+}
+
+
+#pragma mark - Private
+
+- (void)p_cancelWaiter:(p_CoalescedWaiter *)waiter inGroup:(p_CoalescedGroup *)group forKey:(NSString *)key {
+    BOOL didCancel = NO;
+    BOOL cancelTask = NO;
+
+    [_lock lock];
+    if (!waiter.cancelled && [group.waiters containsObject:waiter]) {
+        didCancel = YES;
+        waiter.cancelled = YES;
+        group.activeCount -= 1;
+        if (group.activeCount == 0) {
+            cancelTask = YES;
+            if (_groupsByKey[key] == group) {
+                [_groupsByKey removeObjectForKey:key];
+            }
+        }
+    }
+    [_lock unlock];
+
+    if (!didCancel) return;
+
+    if (cancelTask) {
+        [group.task cancel];
+    }
+
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    waiter.completion(nil, nil, error);
+}
+
+- (void)p_completeGroup:(p_CoalescedGroup *)group
+                 forKey:(NSString *)key
+               response:(NSURLResponse *)response
+                   data:(NSData *)data
+                  error:(NSError *)error
+{
+    if (group == nil) return;
+
+    NSMutableArray<p_CoalescedWaiter *> *waiters = [NSMutableArray array];
+
+    [_lock lock];
+    if (_groupsByKey[key] == group) {
+        [_groupsByKey removeObjectForKey:key];
+    }
+    for (p_CoalescedWaiter *waiter in group.waiters) {
+        if (!waiter.cancelled) [waiters addObject:waiter];
+    }
+    [group.waiters removeAllObjects];
+    group.activeCount = 0;
+    [_lock unlock];
+
+    [SGSRequestCoalescer p_deliverToWaiters:waiters response:response data:data error:error];
+}
+
+// 相同 filter 的调用方只解析一次
++ (void)p_deliverToWaiters:(NSArray<p_CoalescedWaiter *> *)waiters
+                  response:(NSURLResponse *)response
+                      data:(NSData *)data
+                     error:(NSError *)error
+{
+    NSMapTable *resultsByFilter = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsObjectPointerPersonality
+                                                        valueOptions:NSPointerFunctionsStrongMemory];
+
+    for (p_CoalescedWaiter *waiter in waiters) {
+        if (error) {
+            waiter.completion(response, nil, error);
+            continue;
+        }
+
+        id responseObject = data;
+        if (waiter.filter != nil) {
+            responseObject = [resultsByFilter objectForKey:waiter.filter];
+            if (responseObject == nil) {
+                responseObject = waiter.filter(response, data) ?: [NSNull null];
+                [resultsByFilter setObject:responseObject forKey:waiter.filter];
+            }
+            if (responseObject == [NSNull null]) responseObject = nil;
+        }
+
+        if ([responseObject isKindOfClass:[NSError class]]) {
+            waiter.completion(response, nil, responseObject);
+        } else {
+            waiter.completion(response, responseObject, nil);
+        }
+    }
+}
+
+@end
@@ -0,0 +1,137 @@
+/*!
+ *  @header SGSRequestScheduler.h
+ *
+ *  @abstract 按优先级排队并限制并发数的请求调度器
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class SGSTaskHandle;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 请求优先级
+ */
+typedef NS_ENUM(NSInteger, SGSRequestPriority) {
+    /// 后台，例如预加载
+    SGSRequestPriorityBackground = 0,
+    /// 一般任务，例如同步数据
+    SGSRequestPriorityUtility,
+    /// 用户发起，需要尽快完成
+    SGSRequestPriorityUserInitiated,
+};
+
+/*!
+ *  @brief 请求调度器
+ *
+ *  @discussion 排队中的请求按优先级从高到低、同一优先级先进先出的顺序启动，
+ *      同时进行的请求数不超过 maximumConcurrentRequests，同一主机不超过 maximumConcurrentRequestsPerHost，
+ *      主机已达到上限的请求不会阻塞其他主机的请求
+ *
+ *      启动的任务会根据优先级设置 NSURLSessionTask 的 priority，所有方法都是线程安全的
+ */
+@interface SGSRequestScheduler : NSObject
+
+/*!
+ *  @brief 共享的调度器
+ */
++ (instancetype)sharedScheduler;
+
+/*!
+ *  @brief 最多同时进行的请求数，默认为 8
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentRequests;
+
+/*!
+ *  @brief 同一主机最多同时进行的请求数，默认为 4
+ */
+@property (atomic, assign) NSUInteger maximumConcurrentRequestsPerHost;
+
+/*!
+ *  @brief 添加请求
+ *
+ *  @discussion 调用句柄的 resume 后开始排队，轮到该请求时调用 taskFactory 创建任务并启动，
+ *      任务完成时需要调用 taskFactory 传入的 finish 闭包，释放占用的并发数
+ *
+ *      没有启动任务就结束时调用 failure：排队中被取消时错误码为 NSURLErrorCancelled，
+ *      taskFactory 返回 nil 时错误码为 NSURLErrorUnknown，此时立即释放占用的并发数
+ *
+ *  @param request     HTTP 请求，用于获取主机
+ *  @param priority    优先级
+ *  @param taskFactory 创建任务的闭包
+ *  @param failure     没有启动任务就结束时调用
+ *
+ *  @return SGSTaskHandle，排队中的 task 为 nil
+ */
+- (SGSTaskHandle *)scheduleRequest:(NSURLRequest *)request
+                          priority:(SGSRequestPriority)priority
+                       taskFactory:(NSURLSessionTask * _Nullable (^)(dispatch_block_t finish))taskFactory
+                           failure:(nullable void (^)(NSError *error))failure;
+
+/*!
+ *  @brief 修改请求的优先级
+ *
+ *  @discussion 排队中的请求将移动到新优先级队列的末尾，已启动的请求只修改任务的 priority
+ *
+ *  @param priority 优先级
+ *  @param handle   scheduleRequest:priority:taskFactory:failure: 返回的句柄
+ */
+- (void)setPriority:(SGSRequestPriority)priority forHandle:(SGSTaskHandle *)handle;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 排队中的请求数
+ */
+@property (nonatomic, assign, readonly) NSUInteger queuedCount;
+
+/*!
+ *  @brief 正在进行的请求数
+ */
+@property (nonatomic, assign, readonly) NSUInteger runningCount;
+
+/*!
+ *  @brief 某个优先级排队中的请求数
+ *
+ *  @param priority 优先级
+ *
+ *  @return 请求数
+ */
+- (NSUInteger)queuedCountForPriority:(SGSRequestPriority)priority;
+
+/*!
+ *  @brief 某个优先级已启动请求的平均排队时间
+ *
+ *  @param priority 优先级
+ *
+ *  @return 平均排队时间，单位：秒
+ */
+- (NSTimeInterval)averageWaitTimeForPriority:(SGSRequestPriority)priority;
+
+/*!
+ *  @brief 所有统计数据
+ *
+ *  @discussion 包括 queuedCount、runningCount 以及每个优先级（background、utility、userInitiated）的
+ *      queued、started、averageWaitTime、maximumWaitTime
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, id> *)metrics;
+
+/*!
+ *  @brief 重置排队时间的统计
+ */
+- (void)resetMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
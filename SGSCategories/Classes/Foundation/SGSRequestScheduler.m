@@ -0,0 +1,344 @@
+/*!
+ *  @header SGSRequestScheduler.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSRequestScheduler.h"
+#import "SGSTaskHandle.h"
+
+#define kSchedulerPriorityCount 3
+
+typedef NS_ENUM(NSInteger, kScheduledRequestState) {
+    kScheduledRequestStateIdle,
+    kScheduledRequestStateQueued,
+    kScheduledRequestStateRunning,
+    kScheduledRequestStateFinished,
+};
+
+#pragma mark - Scheduled Request
+
+/// 调度中的请求，仅内部使用
+@interface p_ScheduledRequest : NSObject
+@property (nonatomic, strong) SGSTaskHandle *handle;
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, assign) SGSRequestPriority priority;
+@property (nonatomic, assign) kScheduledRequestState state;
+@property (nonatomic, assign) CFAbsoluteTime enqueueTime;
+@property (nonatomic, copy) NSURLSessionTask *(^taskFactory)(dispatch_block_t finish);
+@property (nonatomic, copy) void (^failure)(NSError *error);
+@end
+
+@implementation p_ScheduledRequest
+@end
+
+
+#pragma mark - SGSRequestScheduler
+
+@implementation SGSRequestScheduler {
+    NSLock *_lock;
+    NSMutableArray<p_ScheduledRequest *> *_queues[kSchedulerPriorityCount];
+    NSCountedSet<NSString *> *_runningCountsByHost;
+    NSMapTable<SGSTaskHandle *, p_ScheduledRequest *> *_requestsByHandle;
+    NSUInteger _runningCount;
+
+    NSUInteger _startedCounts[kSchedulerPriorityCount];
+    NSTimeInterval _totalWaitTimes[kSchedulerPriorityCount];
+    NSTimeInterval _maximumWaitTimes[kSchedulerPriorityCount];
+}
+
++ (instancetype)sharedScheduler {
+    static SGSRequestScheduler *scheduler = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        scheduler = [[SGSRequestScheduler alloc] init];
+    });
+    return scheduler;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        for (int i = 0; i < kSchedulerPriorityCount; i++) {
+            _queues[i] = [NSMutableArray array];
+        }
+        _runningCountsByHost = [NSCountedSet set];
+        _requestsByHandle = [NSMapTable mapTableWithKeyOptions:(NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                  valueOptions:NSPointerFunctionsStrongMemory];
+        _maximumConcurrentRequests = 8;
+        _maximumConcurrentRequestsPerHost = 4;
+    }
+    return self;
+}
+
+- (SGSTaskHandle *)scheduleRequest:(NSURLRequest *)request
+                          priority:(SGSRequestPriority)priority
+                       taskFactory:(NSURLSessionTask *(^)(dispatch_block_t))taskFactory
+                           failure:(void (^)(NSError *))failure
+{
+    p_ScheduledRequest *scheduled = [[p_ScheduledRequest alloc] init];
+    scheduled.host = request.URL.host.lowercaseString ?: @"";
+    scheduled.priority = [SGSRequestScheduler p_clampedPriority:priority];
+    scheduled.taskFactory = taskFactory;
+    scheduled.failure = failure;
+
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    __weak typeof(&*self) weakSelf = self;
+    __weak SGSTaskHandle *weakHandle = handle;
+
+    handle.resumingHandler = ^{
+        [weakSelf p_enqueue:scheduled withHandle:weakHandle];
+    };
+    handle.cancellationHandler = ^{
+        [weakSelf p_cancel:scheduled];
+    };
+
+    [_lock lock];
+    [_requestsByHandle setObject:scheduled forKey:handle];
+    [_lock unlock];
+
+    return handle;
+}
+
+- (void)setPriority:(SGSRequestPriority)priority forHandle:(SGSTaskHandle *)handle {
+    priority = [SGSRequestScheduler p_clampedPriority:priority];
+    NSURLSessionTask *runningTask = nil;
+
+    [_lock lock];
+    p_ScheduledRequest *scheduled = [_requestsByHandle objectForKey:handle];
+    if (scheduled != nil) {
+        if (scheduled.state == kScheduledRequestStateQueued) {
+            if (scheduled.priority != priority) {
+                [_queues[scheduled.priority] removeObjectIdenticalTo:scheduled];
+                [_queues[priority] addObject:scheduled];
+            }
+        } else if (scheduled.state == kScheduledRequestStateRunning) {
+            runningTask = scheduled.handle.task;
+        }
+        scheduled.priority = priority;
+    }
+    [_lock unlock];
+
+    runningTask.priority = [SGSRequestScheduler p_taskPriorityForPriority:priority];
+
+    // 提升优先级后可能可以立即启动
+    [self p_startPendingRequests];
+}
+
+
+#pragma mark - Metrics
+
+- (NSUInteger)queuedCount {
+    NSUInteger count = 0;
+    [_lock lock];
+    for (int i = 0; i < kSchedulerPriorityCount; i++) {
+        count += _queues[i].count;
+    }
+    [_lock unlock];
+    return count;
+}
+
+- (NSUInteger)runningCount {
+    [_lock lock];
+    NSUInteger count = _runningCount;
+    [_lock unlock];
+    return count;
+}
+
+- (NSUInteger)queuedCountForPriority:(SGSRequestPriority)priority {
+    priority = [SGSRequestScheduler p_clampedPriority:priority];
+    [_lock lock];
+    NSUInteger count = _queues[priority].count;
+    [_lock unlock];
+    return count;
+}
+
+- (NSTimeInterval)averageWaitTimeForPriority:(SGSRequestPriority)priority {
+    priority = [SGSRequestScheduler p_clampedPriority:priority];
+    [_lock lock];
+    NSTimeInterval average = (_startedCounts[priority] > 0) ? (_totalWaitTimes[priority] / _startedCounts[priority]) : 0;
+    [_lock unlock];
+    return average;
+}
+
+- (NSDictionary<NSString *,id> *)metrics {
+    NSMutableDictionary *metrics = [NSMutableDictionary dictionary];
+    NSArray *names = @[@"background", @"utility", @"userInitiated"];
+    NSUInteger queuedCount = 0;
+
+    [_lock lock];
+    for (int i = 0; i < kSchedulerPriorityCount; i++) {
+        queuedCount += _queues[i].count;
+        metrics[names[i]] = @{@"queued": @(_queues[i].count),
+                              @"started": @(_startedCounts[i]),
+                              @"averageWaitTime": @((_startedCounts[i] > 0) ? (_totalWaitTimes[i] / _startedCounts[i]) : 0),
+                              @"maximumWaitTime": @(_maximumWaitTimes[i])};
+    }
+    metrics[@"queuedCount"] = @(queuedCount);
+    metrics[@"runningCount"] = @(_runningCount);
+    [_lock unlock];
+
+    return metrics;
+}
+
+- (void)resetMetrics {
+    [_lock lock];
+    for (int i = 0; i < kSchedulerPriorityCount; i++) {
+        _startedCounts[i] = 0;
+        _totalWaitTimes[i] = 0;
+        _maximumWaitTimes[i] = 0;
+    }
+    [_lock unlock];
+}
+
+
+#pragma mark - Private
+
+- (void)p_enqueue:(p_ScheduledRequest *)scheduled withHandle:(SGSTaskHandle *)handle {
+    if (handle == nil) return;
+
+    [_lock lock];
+    if (scheduled.state != kScheduledRequestStateIdle) {
+        [_lock unlock];
+        return;
+    }
+    // 排队和进行中由调度器持有句柄，完成后释放
+    scheduled.handle = handle;
+    scheduled.state = kScheduledRequestStateQueued;
+    scheduled.enqueueTime = CFAbsoluteTimeGetCurrent();
+    [_queues[scheduled.priority] addObject:scheduled];
+    [_lock unlock];
+
+    [self p_startPendingRequests];
+}
+
+- (void)p_cancel:(p_ScheduledRequest *)scheduled {
+    BOOL wasQueued = NO;
+    BOOL wasIdle = NO;
+    NSURLSessionTask *runningTask = nil;
+
+    [_lock lock];
+    switch (scheduled.state) {
+        case kScheduledRequestStateIdle:
+            wasIdle = YES;
+            scheduled.state = kScheduledRequestStateFinished;
+            break;
+        case kScheduledRequestStateQueued:
+            wasQueued = YES;
+            [_queues[scheduled.priority] removeObjectIdenticalTo:scheduled];
+            scheduled.state = kScheduledRequestStateFinished;
+            scheduled.handle = nil;
+            break;
+        case kScheduledRequestStateRunning:
+            runningTask = scheduled.handle.task;
+            break;
+        case kScheduledRequestStateFinished:
+            break;
+    }
+    [_lock unlock];
+
+    if (wasQueued || wasIdle) {
+        if (scheduled.failure) scheduled.failure([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]);
+    } else {
+        // 任务完成时调用 finish 释放并发数
+        [runningTask cancel];
+    }
+}
+
+- (void)p_finish:(p_ScheduledRequest *)scheduled {
+    [_lock lock];
+    if (scheduled.state != kScheduledRequestStateRunning) {
+        [_lock unlock];
+        return;
+    }
+    scheduled.state = kScheduledRequestStateFinished;
+    scheduled.handle = nil;
+    _runningCount -= 1;
+    [_runningCountsByHost removeObject:scheduled.host];
+    [_lock unlock];
+
+    [self p_startPendingRequests];
+}
+
+- (void)p_startPendingRequests {
+    NSMutableArray<p_ScheduledRequest *> *startings = [NSMutableArray array];
+    NSUInteger maximumCount = MAX(self.maximumConcurrentRequests, 1);
+    NSUInteger maximumCountPerHost = MAX(self.maximumConcurrentRequestsPerHost, 1);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    [_lock lock];
+    for (NSInteger priority = kSchedulerPriorityCount - 1; (priority >= 0) && (_runningCount < maximumCount); priority--) {
+        NSMutableArray<p_ScheduledRequest *> *queue = _queues[priority];
+        NSMutableIndexSet *startedIndexes = [NSMutableIndexSet indexSet];
+
+        // 跳过主机已达上限的请求，不阻塞其他主机
+        for (NSUInteger i = 0; (i < queue.count) && (_runningCount < maximumCount); i++) {
+            p_ScheduledRequest *scheduled = queue[i];
+            if ([_runningCountsByHost countForObject:scheduled.host] >= maximumCountPerHost) continue;
+
+            [startedIndexes addIndex:i];
+            scheduled.state = kScheduledRequestStateRunning;
+            _runningCount += 1;
+            [_runningCountsByHost addObject:scheduled.host];
+
+            NSTimeInterval waitTime = now - scheduled.enqueueTime;
+            _startedCounts[priority] += 1;
+            _totalWaitTimes[priority] += waitTime;
+            _maximumWaitTimes[priority] = MAX(_maximumWaitTimes[priority], waitTime);
+
+            [startings addObject:scheduled];
+        }
+
+        [queue removeObjectsAtIndexes:startedIndexes];
+    }
+    [_lock unlock];
+
+    for (p_ScheduledRequest *scheduled in startings) {
+        [self p_start:scheduled];
+    }
+}
+
+- (void)p_start:(p_ScheduledRequest *)scheduled {
+    __weak typeof(&*self) weakSelf = self;
+    SGSTaskHandle *handle = scheduled.handle;
+
+    NSURLSessionTask *task = scheduled.taskFactory(^{
+        [weakSelf p_finish:scheduled];
+    });
+
+    if (task == nil) {
+        [self p_finish:scheduled];
+        if (scheduled.failure) {
+            scheduled.failure([NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorUnknown userInfo:@{NSLocalizedDescriptionKey: @"Could not create a task for the request."}]);
+        }
+        return;
+    }
+
+    task.priority = [SGSRequestScheduler p_taskPriorityForPriority:scheduled.priority];
+    handle.task = task;
+    if (handle.isCancelled) {
+        [task cancel];
+    } else {
+        [task resume];
+    }
+}
+
++ (SGSRequestPriority)p_clampedPriority:(SGSRequestPriority)priority {
+    return MAX(SGSRequestPriorityBackground, MIN(priority, SGSRequestPriorityUserInitiated));
+}
+
++ (float)p_taskPriorityForPriority:(SGSRequestPriority)priority {
+    switch (priority) {
+        case SGSRequestPriorityUserInitiated:
+            return NSURLSessionTaskPriorityHigh;
+        case SGSRequestPriorityUtility:
+            return NSURLSessionTaskPriorityDefault;
+        default:
+            return NSURLSessionTaskPriorityLow;
+    }
+}
+
+@end
@@ -0,0 +1,198 @@
+/*!
+ *  @header SGSResponsePipeline.h
+ *
+ *  @abstract 分阶段的响应处理管道
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 响应处理管道的错误域
+ */
+FOUNDATION_EXPORT NSString * const SGSResponsePipelineErrorDomain;
+
+/*!
+ *  @brief 管道产生的错误的 userInfo 中出错阶段名称的键，阶段返回的 NSError 原样传出，不包含该键
+ */
+FOUNDATION_EXPORT NSString * const SGSResponsePipelineStageNameKey;
+
+/*!
+ *  @brief 拆信封失败时 userInfo 中信封状态码的键，值为 NSNumber
+ */
+FOUNDATION_EXPORT NSString * const SGSResponsePipelineEnvelopeCodeKey;
+
+/*!
+ *  @brief 响应处理管道的错误码
+ */
+typedef NS_ENUM(NSInteger, SGSResponsePipelineErrorCode) {
+    /// 阶段的输入不是声明的类型
+    SGSResponsePipelineErrorUnexpectedInput = 1,
+    /// 信封中的状态码不是成功状态码
+    SGSResponsePipelineErrorEnvelopeFailure,
+};
+
+/*!
+ *  @brief 处理阶段
+ *
+ *  @param response 响应
+ *  @param input    上一阶段的输出，第一个阶段为响应数据
+ *
+ *  @return 本阶段的输出，返回 NSError 时不再执行后续阶段
+ */
+typedef id _Nullable (^SGSResponseStageBlock)(NSURLResponse *response, id _Nullable input);
+
+
+/*!
+ *  @brief 分阶段的响应处理管道
+ *
+ *  @discussion 把“解压 → 解析 JSON → 拆信封 → 转换模型”这样的处理拆成多个阶段依次执行，
+ *      每个阶段可以声明输入类型，输入类型不符时以 SGSResponsePipelineErrorUnexpectedInput 结束，
+ *      任何阶段返回 NSError 时不再执行后续阶段，管道的结果即为该 NSError
+ *
+ *      processResponse:data:completion: 在并发的解码队列中执行，不占用会话的代理队列，
+ *      filterBlock 把管道包装为 SGSResponseFilterBlock，在调用线程中同步执行，
+ *      可用于所有接受 responseFilter 的方法
+ *
+ *      每个阶段的执行次数、耗时和出错次数记录在 stageMetrics 中
+ *
+ *      管道执行时使用当时阶段的副本，执行期间添加阶段不影响正在执行的处理，所有方法都是线程安全的
+ */
+@interface SGSResponsePipeline : NSObject
+
+/*!
+ *  @brief 解码队列，并发队列，所有管道共用
+ *
+ *  @return dispatch_queue_t
+ */
++ (dispatch_queue_t)decodeQueue;
+
+/*!
+ *  @brief 以已有的过滤闭包作为唯一阶段的管道
+ *
+ *  @param filter 过滤闭包，为空时返回没有阶段的管道，结果为原始数据
+ *
+ *  @return SGSResponsePipeline
+ */
++ (instancetype)pipelineWithFilter:(nullable id _Nullable (^)(NSURLResponse *response, NSData * _Nullable responseData))filter;
+
+/*!
+ *  @brief 添加处理阶段
+ *
+ *  @param name       阶段名称，用于统计数据，同一管道中的名称不应重复
+ *  @param inputClass 输入类型，为 Nil 时不检查，输入为 nil 时不检查
+ *  @param block      处理闭包
+ *
+ *  @return 管道本身，便于连续添加
+ */
+- (instancetype)addStageNamed:(NSString *)name
+                   inputClass:(nullable Class)inputClass
+                        block:(SGSResponseStageBlock)block;
+
+/*!
+ *  @brief 添加 gzip 解压阶段，名称为 @"decompress"
+ *
+ *  @discussion 只解压以 gzip 文件头开始的数据（例如服务端直接返回的 .gz 文件），
+ *      其他数据原样输出，由 Content-Encoding 声明的压缩已经由系统解压
+ *
+ *  @return 管道本身
+ */
+- (instancetype)addDecompressionStage;
+
+/*!
+ *  @brief 添加 JSON 解析阶段，名称为 @"json"，输入为 NSData，空数据输出 nil
+ *
+ *  @return 管道本身
+ */
+- (instancetype)addJSONStage;
+
+/*!
+ *  @brief 添加拆信封阶段，名称为 @"envelope"，输入为 NSDictionary
+ *
+ *  @discussion 适用于 {"code": 200, "description": "...", "results": {...}} 这样的响应，
+ *      状态码等于 successCode 时输出 resultKey 对应的值，
+ *      否则以 SGSResponsePipelineErrorEnvelopeFailure 结束，错误的 userInfo 中
+ *      SGSResponsePipelineEnvelopeCodeKey 为信封中的状态码，NSLocalizedDescriptionKey 为信封中的消息
+ *
+ *  @param codeKey     状态码的键
+ *  @param successCode 成功的状态码
+ *  @param messageKey  消息的键，可以为空
+ *  @param resultKey   结果的键
+ *
+ *  @return 管道本身
+ */
+- (instancetype)addEnvelopeStageWithCodeKey:(NSString *)codeKey
+                                successCode:(NSInteger)successCode
+                                 messageKey:(nullable NSString *)messageKey
+                                  resultKey:(NSString *)resultKey;
+
+/*!
+ *  @brief 阶段名称，按执行顺序
+ */
+@property (nonatomic, copy, readonly) NSArray<NSString *> *stageNames;
+
+/*!
+ *  @brief 在解码队列中处理响应
+ *
+ *  @param response   响应
+ *  @param data       响应数据
+ *  @param completion 在解码队列中回调，result 为最后一个阶段的输出或 NSError
+ */
+- (void)processResponse:(NSURLResponse *)response
+                   data:(nullable NSData *)data
+             completion:(void (^)(id _Nullable result))completion;
+
+/*!
+ *  @brief 在调用线程中同步处理响应
+ *
+ *  @param response 响应
+ *  @param data     响应数据
+ *
+ *  @return 最后一个阶段的输出或 NSError
+ */
+- (nullable id)resultForResponse:(NSURLResponse *)response data:(nullable NSData *)data;
+
+/*!
+ *  @brief 包装为过滤闭包，在调用线程中同步执行
+ *
+ *  @discussion 闭包持有管道，多次调用返回不同的闭包对象，
+ *      需要响应缓存复用解码结果时应保存并复用同一个闭包
+ *
+ *  @return 过滤闭包
+ */
+- (id _Nullable (^)(NSURLResponse *response, NSData * _Nullable responseData))filterBlock;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 各阶段的统计数据
+ *
+ *  @discussion 以阶段名称为键，值为包含以下数据的字典：
+ *      - count：执行次数
+ *      - errorCount：返回 NSError 或输入类型不符的次数
+ *      - totalDuration：累计耗时，单位：秒
+ *      - averageDuration：平均耗时，单位：秒
+ *      - maximumDuration：最长耗时，单位：秒
+ *      - lastDuration：最近一次耗时，单位：秒
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)stageMetrics;
+
+/*!
+ *  @brief 重置统计数据
+ */
+- (void)resetStageMetrics;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,249 @@
+/*!
+ *  @header SGSResponsePipeline.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSResponsePipeline.h"
+#import "NSData+SGS.h"
+
+NSString * const SGSResponsePipelineErrorDomain = @"com.southgis.SGSCategories.ResponsePipeline";
+NSString * const SGSResponsePipelineStageNameKey = @"SGSResponsePipelineStageName";
+NSString * const SGSResponsePipelineEnvelopeCodeKey = @"SGSResponsePipelineEnvelopeCode";
+
+
+#pragma mark - Stage
+
+/// 处理阶段，创建后不再修改，仅内部使用
+@interface p_ResponseStage : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, strong) Class inputClass;
+@property (nonatomic, copy) SGSResponseStageBlock block;
+@end
+
+@implementation p_ResponseStage
+@end
+
+
+/// 阶段的统计数据，只在 @synchronized (_metrics) 中访问，仅内部使用
+@interface p_ResponseStageStats : NSObject
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) NSUInteger errorCount;
+@property (nonatomic, assign) NSTimeInterval totalDuration;
+@property (nonatomic, assign) NSTimeInterval maximumDuration;
+@property (nonatomic, assign) NSTimeInterval lastDuration;
+@end
+
+@implementation p_ResponseStageStats
+@end
+
+
+#pragma mark - SGSResponsePipeline
+
+@implementation SGSResponsePipeline {
+    NSArray<p_ResponseStage *> *_stages;
+    NSMutableDictionary<NSString *, p_ResponseStageStats *> *_metrics;
+}
+
++ (dispatch_queue_t)decodeQueue {
+    static dispatch_queue_t queue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT, QOS_CLASS_UTILITY, 0);
+        queue = dispatch_queue_create("com.southgis.SGSCategories.ResponseDecode", attr);
+    });
+    return queue;
+}
+
++ (instancetype)pipelineWithFilter:(id (^)(NSURLResponse *, NSData *))filter {
+    SGSResponsePipeline *pipeline = [[self alloc] init];
+    // 没有过滤闭包时不添加阶段，结果为原始数据
+    if (filter == nil) return pipeline;
+
+    return [pipeline addStageNamed:@"filter" inputClass:Nil block:^id(NSURLResponse *response, id input) {
+        return filter(response, input);
+    }];
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _stages = @[];
+        _metrics = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (instancetype)addStageNamed:(NSString *)name inputClass:(Class)inputClass block:(SGSResponseStageBlock)block {
+    NSParameterAssert(name != nil);
+    NSParameterAssert(block != nil);
+
+    p_ResponseStage *stage = [[p_ResponseStage alloc] init];
+    stage.name = name;
+    stage.inputClass = inputClass;
+    stage.block = block;
+
+    @synchronized (self) {
+        _stages = [_stages arrayByAddingObject:stage];
+    }
+    return self;
+}
+
+- (instancetype)addDecompressionStage {
+    return [self addStageNamed:@"decompress" inputClass:[NSData class] block:^id(NSURLResponse *response, NSData *data) {
+        if (data.length < 2) return data;
+
+        const uint8_t *bytes = data.bytes;
+        if ((bytes[0] != 0x1f) || (bytes[1] != 0x8b)) return data;
+
+        NSData *inflated = [data gzipInflate];
+        if (inflated == nil) {
+            return [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:nil];
+        }
+        return inflated;
+    }];
+}
+
+- (instancetype)addJSONStage {
+    return [self addStageNamed:@"json" inputClass:[NSData class] block:^id(NSURLResponse *response, NSData *data) {
+        if ((data == nil) || (data.length == 0)) return nil;
+
+        NSError *error = nil;
+        id json = [NSJSONSerialization JSONObjectWithData:data options:kNilOptions error:&error];
+
+        if (error != nil) return error;
+
+        return json;
+    }];
+}
+
+- (instancetype)addEnvelopeStageWithCodeKey:(NSString *)codeKey
+                                successCode:(NSInteger)successCode
+                                 messageKey:(NSString *)messageKey
+                                  resultKey:(NSString *)resultKey
+{
+    return [self addStageNamed:@"envelope" inputClass:[NSDictionary class] block:^id(NSURLResponse *response, NSDictionary *json) {
+        if (json == nil) return nil;
+
+        id code = json[codeKey];
+        if ([code respondsToSelector:@selector(integerValue)] && ([code integerValue] == successCode)) {
+            id result = json[resultKey];
+            return (result == [NSNull null]) ? nil : result;
+        }
+
+        NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+        userInfo[SGSResponsePipelineStageNameKey] = @"envelope";
+        if ([code respondsToSelector:@selector(integerValue)]) {
+            userInfo[SGSResponsePipelineEnvelopeCodeKey] = @([code integerValue]);
+        }
+        id message = (messageKey != nil) ? json[messageKey] : nil;
+        if ([message isKindOfClass:[NSString class]]) {
+            userInfo[NSLocalizedDescriptionKey] = message;
+        }
+
+        return [NSError errorWithDomain:SGSResponsePipelineErrorDomain code:SGSResponsePipelineErrorEnvelopeFailure userInfo:userInfo];
+    }];
+}
+
+- (NSArray<NSString *> *)stageNames {
+    return [[self p_stages] valueForKey:@"name"];
+}
+
+- (void)processResponse:(NSURLResponse *)response data:(NSData *)data completion:(void (^)(id))completion {
+    NSArray<p_ResponseStage *> *stages = [self p_stages];
+
+    dispatch_async([SGSResponsePipeline decodeQueue], ^{
+        completion([self p_runStages:stages response:response data:data]);
+    });
+}
+
+- (id)resultForResponse:(NSURLResponse *)response data:(NSData *)data {
+    return [self p_runStages:[self p_stages] response:response data:data];
+}
+
+- (id (^)(NSURLResponse *, NSData *))filterBlock {
+    return ^id(NSURLResponse *response, NSData *data) {
+        return [self resultForResponse:response data:data];
+    };
+}
+
+
+#pragma mark - Metrics
+
+- (NSDictionary<NSString *,NSDictionary<NSString *,NSNumber *> *> *)stageMetrics {
+    NSMutableDictionary *metrics = [NSMutableDictionary dictionary];
+
+    @synchronized (_metrics) {
+        [_metrics enumerateKeysAndObjectsUsingBlock:^(NSString *name, p_ResponseStageStats *stats, BOOL *stop) {
+            metrics[name] = @{@"count": @(stats.count),
+                              @"errorCount": @(stats.errorCount),
+                              @"totalDuration": @(stats.totalDuration),
+                              @"averageDuration": @((stats.count > 0) ? (stats.totalDuration / stats.count) : 0),
+                              @"maximumDuration": @(stats.maximumDuration),
+                              @"lastDuration": @(stats.lastDuration)};
+        }];
+    }
+
+    return metrics;
+}
+
+- (void)resetStageMetrics {
+    @synchronized (_metrics) {
+        [_metrics removeAllObjects];
+    }
+}
+
+
+#pragma mark - Private
+
+- (NSArray<p_ResponseStage *> *)p_stages {
+    @synchronized (self) {
+        return _stages;
+    }
+}
+
+- (id)p_runStages:(NSArray<p_ResponseStage *> *)stages response:(NSURLResponse *)response data:(NSData *)data {
+    id value = data;
+
+    for (p_ResponseStage *stage in stages) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+
+        if ((value != nil) && (stage.inputClass != Nil) && ![value isKindOfClass:stage.inputClass]) {
+            NSString *reason = [NSString stringWithFormat:@"Stage \"%@\" expects %@ but received %@", stage.name, NSStringFromClass(stage.inputClass), NSStringFromClass([value class])];
+            value = [NSError errorWithDomain:SGSResponsePipelineErrorDomain
+                                        code:SGSResponsePipelineErrorUnexpectedInput
+                                    userInfo:@{SGSResponsePipelineStageNameKey: stage.name,
+                                               NSLocalizedDescriptionKey: reason}];
+        } else {
+            value = stage.block(response, value);
+        }
+
+        BOOL failed = [value isKindOfClass:[NSError class]];
+        [self p_recordStage:stage.name duration:(CFAbsoluteTimeGetCurrent() - start) failed:failed];
+
+        // 出错后不再执行后续阶段
+        if (failed) break;
+    }
+
+    return value;
+}
+
+- (void)p_recordStage:(NSString *)name duration:(NSTimeInterval)duration failed:(BOOL)failed {
+    @synchronized (_metrics) {
+        p_ResponseStageStats *stats = _metrics[name];
+        if (stats == nil) {
+            stats = [[p_ResponseStageStats alloc] init];
+            _metrics[name] = stats;
+        }
+
+        stats.count += 1;
+        if (failed) stats.errorCount += 1;
+        stats.totalDuration += duration;
+        stats.maximumDuration = MAX(stats.maximumDuration, duration);
+        stats.lastDuration = duration;
+    }
+}
+
+@end
@@ -0,0 +1,214 @@
+/*!
+ *  @header SGSRetryPolicy.h
+ *
+ *  @abstract 请求重试策略与熔断器
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 重试相关的错误域
+ */
+FOUNDATION_EXPORT NSString * const SGSRetryErrorDomain;
+
+/*!
+ *  @brief 重试相关的错误码
+ */
+typedef NS_ENUM(NSInteger, SGSRetryErrorCode) {
+    /// 熔断器处于打开状态，请求未发出
+    SGSRetryErrorCircuitOpen = 1,
+};
+
+/*!
+ *  @brief 熔断器状态
+ */
+typedef NS_ENUM(NSInteger, SGSCircuitBreakerState) {
+    /// 关闭，请求正常发出
+    SGSCircuitBreakerStateClosed,
+    /// 打开，请求直接失败
+    SGSCircuitBreakerStateOpen,
+    /// 半开，允许一个探测请求
+    SGSCircuitBreakerStateHalfOpen,
+};
+
+
+/*!
+ *  @brief 按主机熔断
+ *
+ *  @discussion 同一主机连续失败 failureThreshold 次后熔断器打开，resetTimeout 时间内该主机的请求直接失败，
+ *      之后进入半开状态，只允许一个探测请求，探测成功则关闭，失败则重新打开
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSCircuitBreaker : NSObject
+
+/*!
+ *  @brief 共享的熔断器
+ */
++ (instancetype)sharedBreaker;
+
+/*!
+ *  @brief 连续失败多少次后打开，默认为 5
+ */
+@property (atomic, assign) NSUInteger failureThreshold;
+
+/*!
+ *  @brief 打开后多久进入半开状态，单位：秒，默认为 30
+ */
+@property (atomic, assign) NSTimeInterval resetTimeout;
+
+/*!
+ *  @brief 获取主机当前的熔断状态
+ *
+ *  @param host 主机
+ *
+ *  @return SGSCircuitBreakerState
+ */
+- (SGSCircuitBreakerState)stateForHost:(NSString *)host;
+
+/*!
+ *  @brief 是否允许向该主机发出请求，半开状态下只有第一次调用返回 YES
+ *
+ *  @param host 主机
+ *
+ *  @return YES 允许发出请求
+ */
+- (BOOL)allowsRequestToHost:(NSString *)host;
+
+/*!
+ *  @brief 记录一次成功
+ *
+ *  @param host 主机
+ */
+- (void)recordSuccessForHost:(NSString *)host;
+
+/*!
+ *  @brief 记录一次失败
+ *
+ *  @param host 主机
+ */
+- (void)recordFailureForHost:(NSString *)host;
+
+/*!
+ *  @brief 重置所有主机的状态
+ */
+- (void)reset;
+
+@end
+
+
+/*!
+ *  @brief 请求重试策略
+ *
+ *  @discussion 网络错误或 retryableStatusCodes 中的状态码视为可重试的失败：
+ *      - 幂等请求（GET、HEAD、OPTIONS、PUT、DELETE、TRACE 或带有 Idempotency-Key 请求头）可以重试
+ *      - 非幂等请求只在确定请求没有到达服务器（无法解析或连接主机）时重试
+ *
+ *      重试间隔使用 decorrelated jitter 退避：在 [baseDelay, 上次间隔 × 3] 中随机取值且不超过 maximumDelay，
+ *      避免服务恢复时所有客户端同时重试；
+ *      响应头包含 Retry-After 时使用该值，超过 maximumRetryAfter 时不再重试
+ */
+@interface SGSRetryPolicy : NSObject <NSCopying>
+
+/*!
+ *  @brief 默认策略：最多重试 3 次，初始间隔 0.5 秒，最大间隔 30 秒，使用共享的熔断器
+ */
++ (instancetype)defaultPolicy;
+
+/*!
+ *  @brief 最多重试次数，默认为 3
+ */
+@property (nonatomic, assign) NSUInteger maximumRetryCount;
+
+/*!
+ *  @brief 最小重试间隔，单位：秒，默认为 0.5
+ */
+@property (nonatomic, assign) NSTimeInterval baseDelay;
+
+/*!
+ *  @brief 最大重试间隔，单位：秒，默认为 30
+ */
+@property (nonatomic, assign) NSTimeInterval maximumDelay;
+
+/*!
+ *  @brief 可重试的状态码，默认为 408、429、500、502、503、504
+ */
+@property (nonatomic, copy) NSIndexSet *retryableStatusCodes;
+
+/*!
+ *  @brief 是否重试非幂等请求的所有可重试失败，默认为 NO
+ */
+@property (nonatomic, assign) BOOL retriesNonIdempotentRequests;
+
+/*!
+ *  @brief Retry-After 的最大值，单位：秒，超过时不再重试，默认为 120
+ */
+@property (nonatomic, assign) NSTimeInterval maximumRetryAfter;
+
+/*!
+ *  @brief 熔断器，为空时不熔断，默认为 [SGSCircuitBreaker sharedBreaker]
+ */
+@property (nonatomic, strong, nullable) SGSCircuitBreaker *circuitBreaker;
+
+/*!
+ *  @brief 请求是否幂等
+ *
+ *  @param request HTTP 请求
+ *
+ *  @return YES 幂等
+ */
+- (BOOL)isIdempotentRequest:(NSURLRequest *)request;
+
+/*!
+ *  @brief 是否为可重试的失败
+ *
+ *  @param response 响应
+ *  @param error    错误信息
+ *
+ *  @return YES 网络错误（取消除外）或状态码在 retryableStatusCodes 中
+ */
+- (BOOL)isRetryableResponse:(nullable NSURLResponse *)response error:(nullable NSError *)error;
+
+/*!
+ *  @brief 是否重试请求
+ *
+ *  @param request    HTTP 请求
+ *  @param response   本次响应
+ *  @param error      本次错误信息
+ *  @param retryCount 已经重试的次数
+ *
+ *  @return YES 需要重试
+ */
+- (BOOL)shouldRetryRequest:(NSURLRequest *)request
+                  response:(nullable NSURLResponse *)response
+                     error:(nullable NSError *)error
+                retryCount:(NSUInteger)retryCount;
+
+/*!
+ *  @brief 计算下一次重试的间隔
+ *
+ *  @param previousDelay 上一次重试的间隔，第一次重试时为 0
+ *  @param response      本次响应，用于读取 Retry-After
+ *
+ *  @return 重试间隔，单位：秒
+ */
+- (NSTimeInterval)delayAfterPreviousDelay:(NSTimeInterval)previousDelay response:(nullable NSURLResponse *)response;
+
+/*!
+ *  @brief 解析响应头中的 Retry-After，支持秒数和 HTTP 日期两种格式
+ *
+ *  @param response 响应
+ *
+ *  @return 间隔，单位：秒，没有 Retry-After 时返回 -1
+ */
++ (NSTimeInterval)retryAfterIntervalForResponse:(nullable NSURLResponse *)response;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,302 @@
+/*!
+ *  @header SGSRetryPolicy.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSRetryPolicy.h"
+#import "NSDateFormatter+SGS.h"
+
+NSString * const SGSRetryErrorDomain = @"SGSRetryErrorDomain";
+
+#pragma mark - Circuit State
+
+/// 单个主机的熔断状态，仅内部使用
+@interface p_CircuitState : NSObject
+@property (nonatomic, assign) SGSCircuitBreakerState state;
+@property (nonatomic, assign) NSUInteger consecutiveFailures;
+@property (nonatomic, assign) CFAbsoluteTime openedTime;
+@property (nonatomic, assign) CFAbsoluteTime probeTime;
+@property (nonatomic, assign) BOOL probeInFlight;
+@end
+
+@implementation p_CircuitState
+@end
+
+
+#pragma mark - SGSCircuitBreaker
+
+@implementation SGSCircuitBreaker {
+    NSLock *_lock;
+    NSMutableDictionary<NSString *, p_CircuitState *> *_statesByHost;
+}
+
++ (instancetype)sharedBreaker {
+    static SGSCircuitBreaker *breaker = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        breaker = [[SGSCircuitBreaker alloc] init];
+    });
+    return breaker;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = [[NSLock alloc] init];
+        _statesByHost = [NSMutableDictionary dictionary];
+        _failureThreshold = 5;
+        _resetTimeout = 30;
+    }
+    return self;
+}
+
+- (SGSCircuitBreakerState)stateForHost:(NSString *)host {
+    [_lock lock];
+    p_CircuitState *circuit = _statesByHost[host.lowercaseString ?: @""];
+    SGSCircuitBreakerState state = circuit ? circuit.state : SGSCircuitBreakerStateClosed;
+    if ((state == SGSCircuitBreakerStateOpen) && (CFAbsoluteTimeGetCurrent() - circuit.openedTime >= self.resetTimeout)) {
+        state = SGSCircuitBreakerStateHalfOpen;
+    }
+    [_lock unlock];
+
+    return state;
+}
+
+- (BOOL)allowsRequestToHost:(NSString *)host {
+    BOOL allows = YES;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSTimeInterval resetTimeout = self.resetTimeout;
+
+    [_lock lock];
+    p_CircuitState *circuit = _statesByHost[host.lowercaseString ?: @""];
+    if (circuit != nil) {
+        switch (circuit.state) {
+            case SGSCircuitBreakerStateClosed:
+                break;
+            case SGSCircuitBreakerStateOpen:
+                if (now - circuit.openedTime < resetTimeout) {
+                    allows = NO;
+                } else {
+                    circuit.state = SGSCircuitBreakerStateHalfOpen;
+                    circuit.probeInFlight = YES;
+                    circuit.probeTime = now;
+                }
+                break;
+            case SGSCircuitBreakerStateHalfOpen:
+                // 探测请求被取消时不会有结果，超时后允许新的探测请求
+                if (circuit.probeInFlight && (now - circuit.probeTime < resetTimeout)) {
+                    allows = NO;
+                } else {
+                    circuit.probeInFlight = YES;
+                    circuit.probeTime = now;
+                }
+                break;
+        }
+    }
+    [_lock unlock];
+
+    return allows;
+}
+
+- (void)recordSuccessForHost:(NSString *)host {
+    [_lock lock];
+    [_statesByHost removeObjectForKey:host.lowercaseString ?: @""];
+    [_lock unlock];
+}
+
+- (void)recordFailureForHost:(NSString *)host {
+    NSString *key = host.lowercaseString ?: @"";
+    NSUInteger threshold = MAX(self.failureThreshold, 1);
+
+    [_lock lock];
+    p_CircuitState *circuit = _statesByHost[key];
+    if (circuit == nil) {
+        circuit = [[p_CircuitState alloc] init];
+        _statesByHost[key] = circuit;
+    }
+
+    circuit.consecutiveFailures += 1;
+    if ((circuit.state == SGSCircuitBreakerStateHalfOpen) || (circuit.consecutiveFailures >= threshold)) {
+        circuit.state = SGSCircuitBreakerStateOpen;
+        circuit.openedTime = CFAbsoluteTimeGetCurrent();
+        circuit.probeInFlight = NO;
+    }
+    [_lock unlock];
+}
+
+- (void)reset {
+    [_lock lock];
+    [_statesByHost removeAllObjects];
+    [_lock unlock];
+}
+
+@end
+
+
+#pragma mark - SGSRetryPolicy
+
+@implementation SGSRetryPolicy
+
++ (instancetype)defaultPolicy {
+    return [[self alloc] init];
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _maximumRetryCount = 3;
+        _baseDelay = 0.5;
+        _maximumDelay = 30;
+        _maximumRetryAfter = 120;
+        _circuitBreaker = [SGSCircuitBreaker sharedBreaker];
+
+        NSMutableIndexSet *statusCodes = [NSMutableIndexSet indexSet];
+        [statusCodes addIndex:408];
+        [statusCodes addIndex:429];
+        [statusCodes addIndex:500];
+        [statusCodes addIndex:502];
+        [statusCodes addIndex:503];
+        [statusCodes addIndex:504];
+        _retryableStatusCodes = [statusCodes copy];
+    }
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    SGSRetryPolicy *policy = [[[self class] allocWithZone:zone] init];
+    policy.maximumRetryCount = self.maximumRetryCount;
+    policy.baseDelay = self.baseDelay;
+    policy.maximumDelay = self.maximumDelay;
+    policy.retryableStatusCodes = self.retryableStatusCodes;
+    policy.retriesNonIdempotentRequests = self.retriesNonIdempotentRequests;
+    policy.maximumRetryAfter = self.maximumRetryAfter;
+    policy.circuitBreaker = self.circuitBreaker;
+    return policy;
+}
+
+- (BOOL)isIdempotentRequest:(NSURLRequest *)request {
+    if ([request valueForHTTPHeaderField:@"Idempotency-Key"] != nil) return YES;
+
+    static NSSet *idempotentMethods = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        idempotentMethods = [NSSet setWithObjects:@"GET", @"HEAD", @"OPTIONS", @"PUT", @"DELETE", @"TRACE", nil];
+    });
+
+    return [idempotentMethods containsObject:request.HTTPMethod.uppercaseString ?: @"GET"];
+}
+
+- (BOOL)isRetryableResponse:(NSURLResponse *)response error:(NSError *)error {
+    if (error != nil) {
+        return [SGSRetryPolicy p_isTransientError:error];
+    }
+
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        return [self.retryableStatusCodes containsIndex:((NSHTTPURLResponse *)response).statusCode];
+    }
+
+    return NO;
+}
+
+- (BOOL)shouldRetryRequest:(NSURLRequest *)request
+                  response:(NSURLResponse *)response
+                     error:(NSError *)error
+                retryCount:(NSUInteger)retryCount
+{
+    if (retryCount >= self.maximumRetryCount) return NO;
+    if (![self isRetryableResponse:response error:error]) return NO;
+
+    // 非幂等请求只在请求确定没有发出时重试
+    if (!self.retriesNonIdempotentRequests && ![self isIdempotentRequest:request] && ![SGSRetryPolicy p_isUnsentError:error]) {
+        return NO;
+    }
+
+    NSTimeInterval retryAfter = [SGSRetryPolicy retryAfterIntervalForResponse:response];
+    if (retryAfter > self.maximumRetryAfter) return NO;
+
+    return YES;
+}
+
+- (NSTimeInterval)delayAfterPreviousDelay:(NSTimeInterval)previousDelay response:(NSURLResponse *)response {
+    NSTimeInterval retryAfter = [SGSRetryPolicy retryAfterIntervalForResponse:response];
+    if (retryAfter >= 0) return retryAfter;
+
+    // decorrelated jitter: delay = min(maximumDelay, random(baseDelay, previousDelay * 3))
+    NSTimeInterval base = MAX(self.baseDelay, 0);
+    NSTimeInterval upper = MAX(base, previousDelay * 3);
+    NSTimeInterval delay = base + (upper - base) * ((double)arc4random() / UINT32_MAX);
+
+    return MIN(delay, MAX(self.maximumDelay, base));
+}
+
++ (NSTimeInterval)retryAfterIntervalForResponse:(NSURLResponse *)response {
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) return -1;
+
+    NSString *value = [((NSHTTPURLResponse *)response).allHeaderFields[@"Retry-After"] description];
+    if (value == nil) {
+        for (NSString *field in ((NSHTTPURLResponse *)response).allHeaderFields) {
+            if ([field caseInsensitiveCompare:@"Retry-After"] == NSOrderedSame) {
+                value = [((NSHTTPURLResponse *)response).allHeaderFields[field] description];
+                break;
+            }
+        }
+    }
+
+    value = [value stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    if (value.length == 0) return -1;
+
+    NSScanner *scanner = [NSScanner scannerWithString:value];
+    double seconds = 0;
+    if ([scanner scanDouble:&seconds] && scanner.isAtEnd) {
+        return MAX(seconds, 0);
+    }
+
+    // 共享的格式化器不是线程安全的
+    NSDateFormatter *formatter = [NSDateFormatter RFC1123DateFormatter];
+    NSDate *date = nil;
+    @synchronized (formatter) {
+        date = [formatter dateFromString:value];
+    }
+    if (date == nil) return -1;
+
+    return MAX(date.timeIntervalSinceNow, 0);
+}
+
+
+#pragma mark - Private
+
++ (BOOL)p_isTransientError:(NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+
+    switch (error.code) {
+        case NSURLErrorTimedOut:
+        case NSURLErrorNetworkConnectionLost:
+        case NSURLErrorBadServerResponse:
+        case NSURLErrorCallIsActive:
+            return YES;
+        default:
+            return [self p_isUnsentError:error];
+    }
+}
+
+// 请求确定没有到达服务器的错误
++ (BOOL)p_isUnsentError:(NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) return NO;
+
+    switch (error.code) {
+        case NSURLErrorCannotFindHost:
+        case NSURLErrorCannotConnectToHost:
+        case NSURLErrorDNSLookupFailed:
+        case NSURLErrorNotConnectedToInternet:
+        case NSURLErrorInternationalRoamingOff:
+        case NSURLErrorDataNotAllowed:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+@end
@@ -0,0 +1,75 @@
+/*!
+ *  @header SGSSegmentedDownloader.h
+ *
+ *  @abstract 分段并行下载
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+#import "NSURLSession+SGS.h"
+
+@class SGSTaskHandle, SGSRetryPolicy;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 分段下载完成闭包
+ *
+ *  @param response 响应
+ *  @param location 下载文件的临时路径，只在闭包中有效，闭包返回后将被删除
+ *  @param error    失败信息
+ */
+typedef void(^SGSSegmentedDownloadCompletionBlock)(NSURLResponse * _Nullable response, NSURL * _Nullable location, NSError * _Nullable error);
+
+/*!
+ *  @brief 分段并行下载
+ *
+ *  @discussion 先使用 HEAD 请求探测文件大小和 Accept-Ranges，服务器支持 bytes 范围请求时，
+ *      按 segmentCount 将文件分为多段同时下载，写入预先分配好大小的临时文件，
+ *      每段请求都带有 If-Range，下载过程中文件发生变化时下载失败
+ *
+ *      单个分段失败时按 retryPolicy 单独重试，不影响其他分段；
+ *      服务器不支持范围请求、探测失败或文件小于两个 minimumSegmentSize 时退化为普通的单连接下载
+ *
+ *      所有分段的进度合并为一个总进度，回调频率和队列使用会话的 progressMaximumRate 和 progressDeliveryQueue
+ */
+@interface SGSSegmentedDownloader : NSObject
+
+/*!
+ *  @brief 最多分段数，默认为 4
+ */
+@property (atomic, assign) NSUInteger segmentCount;
+
+/*!
+ *  @brief 最小分段大小，单位：字节，默认为 1 MB
+ */
+@property (atomic, assign) int64_t minimumSegmentSize;
+
+/*!
+ *  @brief 分段失败时的重试策略，默认最多重试 3 次且不使用熔断器
+ */
+@property (atomic, copy) SGSRetryPolicy *retryPolicy;
+
+/*!
+ *  @brief 创建分段下载
+ *
+ *  @discussion 调用句柄的 resume 后开始下载，句柄的 task 为最近启动的任务，取消句柄将取消所有分段
+ *
+ *  @param request       HTTP 请求
+ *  @param session       网络会话
+ *  @param progressBlock 下载进度闭包
+ *  @param completion    完成闭包，在后台线程回调
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                            session:(NSURLSession *)session
+                           progress:(nullable SGSProgressBlock)progressBlock
+                         completion:(SGSSegmentedDownloadCompletionBlock)completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,590 @@
+/*!
+ *  @header SGSSegmentedDownloader.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSSegmentedDownloader.h"
+#import "SGSTaskHandle.h"
+#import "SGSRetryPolicy.h"
+#import "SGSProgressGroup.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static const size_t kSegmentCopyBufferSize = 1 << 20;
+
+#pragma mark - Download Segment
+
+/// 单个分段的状态，仅内部使用
+@interface p_DownloadSegment : NSObject
+@property (nonatomic, assign) int64_t offset;
+@property (nonatomic, assign) int64_t length;           // 未知时为 -1（单连接下载）
+@property (nonatomic, assign) int64_t receivedLength;
+@property (nonatomic, assign) NSUInteger retryCount;
+@property (nonatomic, assign) NSTimeInterval retryDelay;
+@property (nonatomic, assign) BOOL completed;
+@property (nonatomic, strong) NSURLSessionTask *task;
+@end
+
+@implementation p_DownloadSegment
+@end
+
+
+#pragma mark - Segmented Download
+
+/// 一次分段下载，仅内部使用
+@interface p_SegmentedDownload : NSObject
+@property (nonatomic, weak) SGSTaskHandle *handle;
+@end
+
+@implementation p_SegmentedDownload {
+    NSURLSession *_session;
+    NSURLRequest *_request;
+    NSUInteger _segmentCount;
+    int64_t _minimumSegmentSize;
+    SGSRetryPolicy *_retryPolicy;
+    SGSSegmentedDownloadCompletionBlock _completion;
+
+    NSLock *_lock;
+    NSMutableArray<p_DownloadSegment *> *_segments;
+    NSUInteger _remainingCount;
+    BOOL _finished;
+
+    NSURLSessionTask *_probeTask;
+    NSHTTPURLResponse *_probeResponse;
+    NSURL *_fileURL;
+    int _fd;
+    // 正在写入临时文件的分段，结束后才能关闭和删除文件
+    dispatch_group_t _writeGroup;
+
+    NSProgress *_progress;
+    SGSProgressThrottle *_throttle;
+}
+
+- (instancetype)initWithSession:(NSURLSession *)session
+                        request:(NSURLRequest *)request
+                   segmentCount:(NSUInteger)segmentCount
+             minimumSegmentSize:(int64_t)minimumSegmentSize
+                    retryPolicy:(SGSRetryPolicy *)retryPolicy
+                       progress:(SGSProgressBlock)progressBlock
+                     completion:(SGSSegmentedDownloadCompletionBlock)completion
+{
+    self = [super init];
+    if (self) {
+        _session = session;
+        _request = [request copy];
+        _segmentCount = MAX(segmentCount, 1);
+        _minimumSegmentSize = MAX(minimumSegmentSize, 1);
+        _retryPolicy = retryPolicy;
+        _completion = [completion copy];
+
+        _lock = [[NSLock alloc] init];
+        _segments = [NSMutableArray array];
+        _fd = -1;
+        _writeGroup = dispatch_group_create();
+
+        _progress = [[NSProgress alloc] initWithParent:nil userInfo:nil];
+        _progress.totalUnitCount = NSURLSessionTransferSizeUnknown;
+        if (progressBlock) {
+            _throttle = [[SGSProgressThrottle alloc] initWithMaximumRate:session.progressMaximumRate queue:session.progressDeliveryQueue block:progressBlock];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_fd >= 0) close(_fd);
+}
+
+- (void)start {
+    NSMutableURLRequest *probeRequest = [_request mutableCopy];
+    probeRequest.HTTPMethod = @"HEAD";
+    probeRequest.HTTPBody = nil;
+
+    NSURLSessionDataTask *task = [_session dataTaskWithRequest:probeRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [self p_didProbeWithResponse:response error:error];
+    }];
+
+    [_lock lock];
+    _probeTask = task;
+    [_lock unlock];
+
+    [self p_resumeTask:task];
+}
+
+- (void)cancel {
+    [self p_finishWithResponse:nil error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil]];
+}
+
+
+#pragma mark - Probe
+
+- (void)p_didProbeWithResponse:(NSURLResponse *)response error:(NSError *)error {
+    [_lock lock];
+    _probeTask = nil;
+    [_lock unlock];
+
+    if ([self p_isFinished]) return;
+
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    NSString *acceptRanges = [httpResponse.allHeaderFields[@"Accept-Ranges"] description];
+    int64_t length = httpResponse.expectedContentLength;
+
+    BOOL supportsRanges = (error == nil) &&
+                          (httpResponse.statusCode == 200) &&
+                          ([acceptRanges rangeOfString:@"bytes" options:NSCaseInsensitiveSearch].location != NSNotFound) &&
+                          (length >= _minimumSegmentSize * 2);
+
+    if (!supportsRanges || (_segmentCount < 2)) {
+        [self p_startSingleStream];
+        return;
+    }
+
+    _probeResponse = httpResponse;
+
+    NSError *fileError = nil;
+    if (![self p_createFileWithLength:length error:&fileError]) {
+        [self p_finishWithResponse:httpResponse error:fileError];
+        return;
+    }
+
+    NSUInteger count = (NSUInteger)MIN((int64_t)_segmentCount, length / _minimumSegmentSize);
+    int64_t segmentLength = length / count;
+
+    [_lock lock];
+    for (NSUInteger i = 0; i < count; i++) {
+        p_DownloadSegment *segment = [[p_DownloadSegment alloc] init];
+        segment.offset = segmentLength * i;
+        segment.length = (i == count - 1) ? (length - segment.offset) : segmentLength;
+        [_segments addObject:segment];
+    }
+    _remainingCount = count;
+    _progress.totalUnitCount = length;
+    NSArray *segments = [_segments copy];
+    [_lock unlock];
+
+    for (p_DownloadSegment *segment in segments) {
+        [self p_startSegment:segment];
+    }
+}
+
+// 不支持范围请求时退化为单连接下载
+- (void)p_startSingleStream {
+    p_DownloadSegment *segment = [[p_DownloadSegment alloc] init];
+    segment.length = -1;
+
+    [_lock lock];
+    [_segments addObject:segment];
+    _remainingCount = 1;
+    [_lock unlock];
+
+    NSURLSessionDownloadTask *task = [_session downloadTaskWithRequest:_request completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [self p_stopObservingSegment:segment];
+        [self p_finishWithResponse:response location:location error:error];
+    }];
+
+    [self p_observeTask:task forSegment:segment];
+    [self p_resumeTask:task];
+}
+
+
+#pragma mark - Segment
+
+- (void)p_startSegment:(p_DownloadSegment *)segment {
+    if ([self p_isFinished]) return;
+
+    NSMutableURLRequest *request = [_request mutableCopy];
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+    [request setValue:[NSString stringWithFormat:@"bytes=%lld-%lld", segment.offset, segment.offset + segment.length - 1] forHTTPHeaderField:@"Range"];
+
+    // 文件发生变化时服务器返回 200 而不是 206
+    NSString *ETag = [_probeResponse.allHeaderFields[@"ETag"] description];
+    NSString *lastModified = [_probeResponse.allHeaderFields[@"Last-Modified"] description];
+    if ((ETag.length > 0) && ![ETag hasPrefix:@"W/"]) {
+        [request setValue:ETag forHTTPHeaderField:@"If-Range"];
+    } else if (lastModified.length > 0) {
+        [request setValue:lastModified forHTTPHeaderField:@"If-Range"];
+    }
+
+    NSURLSessionDownloadTask *task = [_session downloadTaskWithRequest:request completionHandler:^(NSURL * _Nullable location, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+        [self p_stopObservingSegment:segment];
+        [self p_segment:segment didCompleteWithRequest:request response:response location:location error:error];
+    }];
+
+    [self p_observeTask:task forSegment:segment];
+    [self p_resumeTask:task];
+}
+
+- (void)p_segment:(p_DownloadSegment *)segment
+didCompleteWithRequest:(NSURLRequest *)request
+         response:(NSURLResponse *)response
+         location:(NSURL *)location
+            error:(NSError *)error
+{
+    if ([self p_isFinished]) return;
+
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+
+    if ((error == nil) && (httpResponse.statusCode == 206)) {
+        NSError *writeError = nil;
+        if ([self p_writeFileAtURL:location toSegment:segment error:&writeError]) {
+            [self p_segmentDidFinish:segment];
+        } else {
+            [self p_finishWithResponse:httpResponse error:writeError];
+        }
+        return;
+    }
+
+    // 服务器忽略了范围请求或文件已经变化，无法继续分段下载
+    if ((error == nil) && (httpResponse.statusCode == 200)) {
+        [self p_finishWithResponse:httpResponse error:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSLocalizedDescriptionKey: @"The resource changed during the segmented download.", NSURLErrorFailingURLErrorKey: request.URL}]];
+        return;
+    }
+
+    if (![_retryPolicy shouldRetryRequest:request response:response error:error retryCount:segment.retryCount]) {
+        if (error == nil) {
+            error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey: request.URL}];
+        }
+        [self p_finishWithResponse:httpResponse error:error];
+        return;
+    }
+
+    // 单独重试失败的分段，已下载的字节不再计入进度
+    [_lock lock];
+    segment.retryCount += 1;
+    segment.retryDelay = [_retryPolicy delayAfterPreviousDelay:segment.retryDelay response:response];
+    segment.receivedLength = 0;
+    NSTimeInterval delay = segment.retryDelay;
+    [_lock unlock];
+
+    [self p_updateProgress];
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [self p_startSegment:segment];
+    });
+}
+
+- (void)p_segmentDidFinish:(p_DownloadSegment *)segment {
+    [_lock lock];
+    segment.completed = YES;
+    segment.receivedLength = segment.length;
+    segment.task = nil;
+    _remainingCount -= 1;
+    BOOL allFinished = (_remainingCount == 0);
+    // 所有分段都已写完，此时没有其他线程使用文件描述符
+    if (allFinished && (_fd >= 0)) {
+        close(_fd);
+        _fd = -1;
+    }
+    NSURL *fileURL = _fileURL;
+    [_lock unlock];
+
+    if (allFinished) {
+        [self p_finishWithResponse:_probeResponse location:fileURL error:nil];
+    } else {
+        [self p_updateProgress];
+    }
+}
+
+
+#pragma mark - File
+
+- (BOOL)p_createFileWithLength:(int64_t)length error:(NSError **)error {
+    NSString *fileName = [NSString stringWithFormat:@"SGSSegmentedDownload-%@.download", [NSUUID UUID].UUIDString];
+    NSURL *fileURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:fileName]];
+
+    int fd = open(fileURL.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return NO;
+    }
+
+    // 创建文件期间可能已经取消，此时由这里删除文件
+    [_lock lock];
+    BOOL finished = _finished;
+    if (!finished) {
+        _fileURL = fileURL;
+        _fd = fd;
+    }
+    [_lock unlock];
+
+    if (finished) {
+        close(fd);
+        unlink(fileURL.fileSystemRepresentation);
+        if (error) *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+        return NO;
+    }
+
+#ifdef F_PREALLOCATE
+    // 尽量分配连续的磁盘空间，空间不足时提前失败
+    fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, length, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+            if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+            return NO;
+        }
+    }
+#endif
+
+    if (ftruncate(fd, length) != 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return NO;
+    }
+
+    return YES;
+}
+
+// 将分段的临时文件写入目标文件的对应位置，必须在任务的 completionHandler 中同步调用，
+// 下载结束（例如其他分段失败或取消）后停止写入
+- (BOOL)p_writeFileAtURL:(NSURL *)location toSegment:(p_DownloadSegment *)segment error:(NSError **)error {
+    [_lock lock];
+    BOOL finished = _finished;
+    int fd = _fd;
+    if (!finished) dispatch_group_enter(_writeGroup);
+    [_lock unlock];
+
+    if (finished) {
+        if (error) *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+        return NO;
+    }
+
+    BOOL result = [self p_copyFileAtURL:location toDescriptor:fd segment:segment error:error];
+    dispatch_group_leave(_writeGroup);
+    return result;
+}
+
+- (BOOL)p_copyFileAtURL:(NSURL *)location toDescriptor:(int)fd segment:(p_DownloadSegment *)segment error:(NSError **)error {
+    int source = open(location.fileSystemRepresentation, O_RDONLY);
+    if (source < 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return NO;
+    }
+
+    char *buffer = malloc(kSegmentCopyBufferSize);
+    int64_t written = 0;
+    int errorCode = 0;
+
+    while (errorCode == 0) {
+        if ([self p_isFinished]) {
+            errorCode = ECANCELED;
+            break;
+        }
+
+        ssize_t readLength = read(source, buffer, kSegmentCopyBufferSize);
+        if (readLength == 0) break;
+        if (readLength < 0) {
+            if (errno != EINTR) errorCode = errno;
+            continue;
+        }
+        if (written + readLength > segment.length) {
+            errorCode = EOVERFLOW;
+            break;
+        }
+
+        ssize_t offset = 0;
+        while (offset < readLength) {
+            ssize_t writeLength = pwrite(fd, buffer + offset, readLength - offset, segment.offset + written + offset);
+            if (writeLength < 0) {
+                if (errno == EINTR) continue;
+                errorCode = errno;
+                break;
+            }
+            offset += writeLength;
+        }
+        written += offset;
+    }
+
+    free(buffer);
+    close(source);
+
+    if (errorCode != 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errorCode userInfo:nil];
+        return NO;
+    }
+
+    if (written != segment.length) {
+        if (error) *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:@{NSLocalizedDescriptionKey: @"The segment length does not match the requested range."}];
+        return NO;
+    }
+
+    return YES;
+}
+
+
+#pragma mark - Progress
+
+- (void)p_observeTask:(NSURLSessionTask *)task forSegment:(p_DownloadSegment *)segment {
+    [_lock lock];
+    segment.task = task;
+    [_lock unlock];
+
+    if (_throttle == nil) return;
+
+    [task addObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesReceived)) options:NSKeyValueObservingOptionNew context:(__bridge void *)segment];
+    [task addObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesExpectedToReceive)) options:NSKeyValueObservingOptionNew context:(__bridge void *)segment];
+}
+
+- (void)p_stopObservingSegment:(p_DownloadSegment *)segment {
+    if (_throttle == nil) return;
+
+    NSURLSessionTask *task = segment.task;
+    [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesReceived)) context:(__bridge void *)segment];
+    [task removeObserver:self forKeyPath:NSStringFromSelector(@selector(countOfBytesExpectedToReceive)) context:(__bridge void *)segment];
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary<NSString *,id> *)change context:(void *)context {
+    p_DownloadSegment *segment = (__bridge p_DownloadSegment *)context;
+    NSURLSessionTask *task = object;
+
+    [_lock lock];
+    segment.receivedLength = task.countOfBytesReceived;
+    // 单连接下载使用任务自身的预期大小
+    if (segment.length < 0) {
+        _progress.totalUnitCount = task.countOfBytesExpectedToReceive;
+    }
+    [_lock unlock];
+
+    [self p_updateProgress];
+}
+
+- (void)p_updateProgress {
+    if (_throttle == nil) return;
+
+    [_lock lock];
+    int64_t received = 0;
+    for (p_DownloadSegment *segment in _segments) {
+        received += segment.receivedLength;
+    }
+    _progress.completedUnitCount = received;
+    [_lock unlock];
+
+    [_throttle progressDidChange:_progress];
+}
+
+
+#pragma mark - Private
+
+- (void)p_resumeTask:(NSURLSessionTask *)task {
+    SGSTaskHandle *handle = self.handle;
+    handle.task = task;
+
+    if ([self p_isFinished]) {
+        [task cancel];
+    } else {
+        [task resume];
+    }
+}
+
+- (BOOL)p_isFinished {
+    [_lock lock];
+    BOOL finished = _finished;
+    [_lock unlock];
+    return finished;
+}
+
+- (void)p_finishWithResponse:(NSURLResponse *)response error:(NSError *)error {
+    [self p_finishWithResponse:response location:nil error:error];
+}
+
+// 只回调一次，失败时取消所有分段
+- (void)p_finishWithResponse:(NSURLResponse *)response location:(NSURL *)location error:(NSError *)error {
+    [_lock lock];
+    if (_finished) {
+        [_lock unlock];
+        return;
+    }
+    _finished = YES;
+    NSArray<p_DownloadSegment *> *segments = [_segments copy];
+    NSURLSessionTask *probeTask = _probeTask;
+    _probeTask = nil;
+    [_lock unlock];
+
+    if (error) {
+        [probeTask cancel];
+        for (p_DownloadSegment *segment in segments) {
+            if (!segment.completed) [segment.task cancel];
+        }
+    } else {
+        [_lock lock];
+        if (_progress.totalUnitCount <= 0) _progress.totalUnitCount = MAX(_progress.completedUnitCount, 1);
+        _progress.completedUnitCount = _progress.totalUnitCount;
+        [_lock unlock];
+    }
+    [_throttle finishWithProgress:_progress];
+
+    if (_completion) _completion(response, location, error);
+
+    // 失败时其他分段可能仍在写入，等写入停止后再关闭并删除临时文件
+    dispatch_group_notify(_writeGroup, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [_lock lock];
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+        NSURL *fileURL = _fileURL;
+        _fileURL = nil;
+        [_lock unlock];
+
+        if (fileURL) {
+            [[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+        }
+    });
+}
+
+@end
+
+
+#pragma mark - SGSSegmentedDownloader
+
+@implementation SGSSegmentedDownloader
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _segmentCount = 4;
+        _minimumSegmentSize = 1024 * 1024;
+
+        SGSRetryPolicy *policy = [SGSRetryPolicy defaultPolicy];
+        policy.circuitBreaker = nil;
+        _retryPolicy = policy;
+    }
+    return self;
+}
+
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                            session:(NSURLSession *)session
+                           progress:(SGSProgressBlock)progressBlock
+                         completion:(SGSSegmentedDownloadCompletionBlock)completion
+{
+    p_SegmentedDownload *download = [[p_SegmentedDownload alloc] initWithSession:session
+                                                                         request:request
+                                                                    segmentCount:self.segmentCount
+                                                              minimumSegmentSize:self.minimumSegmentSize
+                                                                     retryPolicy:self.retryPolicy
+                                                                        progress:progressBlock
+                                                                      completion:completion];
+
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    download.handle = handle;
+    __weak SGSTaskHandle *weakHandle = handle;
+
+    handle.resumingHandler = ^{
+        SGSTaskHandle *strongHandle = weakHandle;
+        @synchronized (strongHandle) {
+            if (strongHandle.resumingHandler == nil) return;
+            strongHandle.resumingHandler = nil;
+        }
+
+        [download start];
+    };
+    handle.cancellationHandler = ^{
+        [download cancel];
+    };
+
+    return handle;
+}
+
+@end
@@ -0,0 +1,108 @@
+/*!
+ *  @header SGSSessionRegistry.h
+ *
+ *  @abstract 按配置共享的网络会话
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 会话注册表
+ *
+ *  @discussion 每个 NSURLSession 有独立的连接池，各处分别创建会话时，到同一主机的连接会重复建立，
+ *      也无法利用 HTTP/2 的多路复用，注册表按配置共享会话，配置相同的调用方得到同一个会话
+ *
+ *      配置按缓存策略、超时、蜂窝网络、Cookie 策略、附加请求头、每主机最大连接数、协议类、TLS 版本、
+ *      等待连接、低数据模式、多路径等影响请求的属性区分，
+ *      缓存、Cookie 和凭据存储按对象区分，例如每次新建的 ephemeralSessionConfiguration 各自使用独立的存储，
+ *      需要共享时应复用同一个配置对象，不支持后台会话配置
+ *
+ *      defaultSession 一直存在，其他会话以租用的方式管理：acquireSessionWithConfiguration: 租用一次，
+ *      relinquishSession: 归还一次，全部归还后空闲超过 idleTimeout 秒时以 finishTasksAndInvalidate 释放，
+ *      释放前再次租用时继续使用同一个会话
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSSessionRegistry : NSObject
+
+/*!
+ *  @brief 共享的注册表
+ *
+ *  @return SGSSessionRegistry
+ */
++ (instancetype)sharedRegistry;
+
+/*!
+ *  @brief 使用 defaultSessionConfiguration 的会话，不会被释放
+ */
+@property (nonatomic, strong, readonly) NSURLSession *defaultSession;
+
+/*!
+ *  @brief 全部归还后释放会话前的空闲时间，单位：秒，默认为 30
+ */
+@property (atomic, assign) NSTimeInterval idleTimeout;
+
+/*!
+ *  @brief 租用与配置对应的共享会话
+ *
+ *  @discussion 配置与 defaultSession 相同时返回 defaultSession，不计入租用，
+ *      其他会话使用完毕后应调用 relinquishSession: 归还
+ *
+ *  @param configuration 会话配置，会话创建时复制一份，之后修改配置不影响已经创建的会话
+ *
+ *  @return NSURLSession
+ */
+- (NSURLSession *)acquireSessionWithConfiguration:(NSURLSessionConfiguration *)configuration;
+
+/*!
+ *  @brief 归还租用的会话
+ *
+ *  @param session acquireSessionWithConfiguration: 返回的会话，不是注册表中的会话时忽略
+ */
+- (void)relinquishSession:(NSURLSession *)session;
+
+
+#pragma mark - Metrics
+///-----------------------------------------------------------------------------
+/// @name Metrics
+///-----------------------------------------------------------------------------
+
+/*!
+ *  @brief 注册表的统计数据
+ *
+ *  @discussion 统计数据包括：
+ *      - sessionCount：当前的会话数，包括 defaultSession
+ *      - acquisitionCount：租用次数
+ *      - sharedCount：租用时复用了已有会话的次数
+ *      - createdCount：创建的会话数
+ *      - invalidatedCount：空闲后释放的会话数
+ *
+ *  @return 统计数据字典
+ */
+- (NSDictionary<NSString *, NSNumber *> *)metrics;
+
+/*!
+ *  @brief 各会话的使用情况
+ *
+ *  @discussion 在全局队列中回调，数组中每个会话对应一个字典：
+ *      - session：NSURLSession
+ *      - leaseCount：未归还的租用数，defaultSession 为 0
+ *      - acquisitionCount：该会话被租用的次数
+ *      - maximumConnectionsPerHost：每个主机的最大连接数
+ *      - runningTaskCount：进行中的任务数
+ *      - suspendedTaskCount：已创建但暂停的任务数
+ *      - hostCount：进行中和暂停的任务涉及的主机数
+ *
+ *  @param completion 完成闭包
+ */
+- (void)getUsageWithCompletion:(void (^)(NSArray<NSDictionary<NSString *, id> *> *usage))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,278 @@
+/*!
+ *  @header SGSSessionRegistry.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSSessionRegistry.h"
+
+// 区分会话的配置属性，缓存、Cookie 和凭据存储按对象区分
+static NSString *p_keyForConfiguration(NSURLSessionConfiguration *configuration) {
+    NSMutableArray<NSString *> *parts = [NSMutableArray arrayWithCapacity:8];
+
+    [parts addObject:[NSString stringWithFormat:@"%lu|%.3f|%.3f|%lu|%d|%d|%d|%lu|%ld",
+                      (unsigned long)configuration.requestCachePolicy,
+                      configuration.timeoutIntervalForRequest,
+                      configuration.timeoutIntervalForResource,
+                      (unsigned long)configuration.networkServiceType,
+                      configuration.allowsCellularAccess,
+                      configuration.HTTPShouldUsePipelining,
+                      configuration.HTTPShouldSetCookies,
+                      (unsigned long)configuration.HTTPCookieAcceptPolicy,
+                      (long)configuration.HTTPMaximumConnectionsPerHost]];
+
+    [parts addObject:[NSString stringWithFormat:@"%p|%p|%p",
+                      configuration.URLCache,
+                      configuration.HTTPCookieStorage,
+                      configuration.URLCredentialStorage]];
+
+    NSMutableArray<NSString *> *protocolNames = [NSMutableArray arrayWithCapacity:configuration.protocolClasses.count];
+    for (Class protocolClass in configuration.protocolClasses) {
+        [protocolNames addObject:NSStringFromClass(protocolClass)];
+    }
+    [parts addObject:[protocolNames componentsJoinedByString:@","]];
+
+    NSDictionary *headers = configuration.HTTPAdditionalHeaders;
+    NSMutableArray<NSString *> *headerPairs = [NSMutableArray arrayWithCapacity:headers.count];
+    for (id key in [headers.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+        [headerPairs addObject:[NSString stringWithFormat:@"%@=%@", key, headers[key]]];
+    }
+    [parts addObject:[headerPairs componentsJoinedByString:@"&"]];
+
+    [parts addObject:configuration.connectionProxyDictionary.description ?: @""];
+    [parts addObject:configuration.sharedContainerIdentifier ?: @""];
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    [parts addObject:[NSString stringWithFormat:@"%d|%d|%d|%d|%d",
+                      (int)configuration.TLSMinimumSupportedProtocol,
+                      (int)configuration.TLSMaximumSupportedProtocol,
+                      configuration.discretionary,
+                      configuration.sessionSendsLaunchEvents,
+                      configuration.shouldUseExtendedBackgroundIdleMode]];
+#pragma clang diagnostic pop
+
+    // 新系统增加的属性，旧系统上没有对应的行为，不需要区分
+    if (@available(iOS 11.0, *)) {
+        [parts addObject:[NSString stringWithFormat:@"%d|%ld",
+                          configuration.waitsForConnectivity,
+                          (long)configuration.multipathServiceType]];
+    }
+    if (@available(iOS 13.0, *)) {
+        [parts addObject:[NSString stringWithFormat:@"%d|%d|%d|%d",
+                          (int)configuration.TLSMinimumSupportedProtocolVersion,
+                          (int)configuration.TLSMaximumSupportedProtocolVersion,
+                          configuration.allowsExpensiveNetworkAccess,
+                          configuration.allowsConstrainedNetworkAccess]];
+    }
+#if defined(__IPHONE_16_0) && (__IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_16_0)
+    if (@available(iOS 16.0, *)) {
+        [parts addObject:[NSString stringWithFormat:@"%d", configuration.requiresDNSSECValidation]];
+    }
+#endif
+#if defined(__IPHONE_17_0) && (__IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_17_0)
+    if (@available(iOS 17.0, *)) {
+        [parts addObject:configuration.proxyConfigurations.description ?: @""];
+    }
+#endif
+
+    return [parts componentsJoinedByString:@"\n"];
+}
+
+
+#pragma mark - Registered Session
+
+/// 注册表中的会话，只在注册表的队列中访问，仅内部使用
+@interface p_RegisteredSession : NSObject
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, strong) NSURLSession *session;
+@property (nonatomic, assign) NSUInteger leaseCount;
+@property (nonatomic, assign) NSUInteger acquisitionCount;
+/// 每次全部归还时递增，用于判断空闲期间是否被再次租用
+@property (nonatomic, assign) NSUInteger idleGeneration;
+/// defaultSession 不会被释放
+@property (nonatomic, assign) BOOL permanent;
+@end
+
+@implementation p_RegisteredSession
+@end
+
+
+#pragma mark - SGSSessionRegistry
+
+@implementation SGSSessionRegistry {
+    dispatch_queue_t _queue;
+    NSMutableDictionary<NSString *, p_RegisteredSession *> *_entries;
+
+    NSUInteger _acquisitionCount;
+    NSUInteger _sharedCount;
+    NSUInteger _createdCount;
+    NSUInteger _invalidatedCount;
+}
+
++ (instancetype)sharedRegistry {
+    static SGSSessionRegistry *registry = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        registry = [[SGSSessionRegistry alloc] init];
+    });
+    return registry;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _idleTimeout = 30;
+        _queue = dispatch_queue_create("com.southgis.SGSCategories.SessionRegistry", DISPATCH_QUEUE_SERIAL);
+        _entries = [NSMutableDictionary dictionary];
+
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+        p_RegisteredSession *entry = [[p_RegisteredSession alloc] init];
+        entry.key = p_keyForConfiguration(configuration);
+        entry.session = [NSURLSession sessionWithConfiguration:configuration];
+        entry.permanent = YES;
+        _entries[entry.key] = entry;
+        _defaultSession = entry.session;
+        _createdCount = 1;
+    }
+    return self;
+}
+
+- (NSURLSession *)acquireSessionWithConfiguration:(NSURLSessionConfiguration *)configuration {
+    NSParameterAssert(configuration.identifier == nil);
+
+    NSString *key = p_keyForConfiguration(configuration);
+    __block NSURLSession *session = nil;
+
+    dispatch_sync(_queue, ^{
+        _acquisitionCount += 1;
+
+        p_RegisteredSession *entry = _entries[key];
+        if (entry != nil) {
+            _sharedCount += 1;
+        } else {
+            entry = [[p_RegisteredSession alloc] init];
+            entry.key = key;
+            entry.session = [NSURLSession sessionWithConfiguration:configuration];
+            _entries[key] = entry;
+            _createdCount += 1;
+        }
+
+        entry.acquisitionCount += 1;
+        if (!entry.permanent) entry.leaseCount += 1;
+        session = entry.session;
+    });
+
+    return session;
+}
+
+- (void)relinquishSession:(NSURLSession *)session {
+    dispatch_async(_queue, ^{
+        p_RegisteredSession *entry = [self p_entryForSession:session];
+        if ((entry == nil) || entry.permanent || (entry.leaseCount == 0)) return;
+
+        entry.leaseCount -= 1;
+        if (entry.leaseCount > 0) return;
+
+        entry.idleGeneration += 1;
+        NSUInteger generation = entry.idleGeneration;
+        NSTimeInterval idleTimeout = MAX(self.idleTimeout, 0);
+
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(idleTimeout * NSEC_PER_SEC)), _queue, ^{
+            // 空闲期间再次被租用
+            if ((entry.leaseCount > 0) || (entry.idleGeneration != generation)) return;
+            if (_entries[entry.key] != entry) return;
+
+            [_entries removeObjectForKey:entry.key];
+            _invalidatedCount += 1;
+            [entry.session finishTasksAndInvalidate];
+        });
+    });
+}
+
+
+#pragma mark - Metrics
+
+- (NSDictionary<NSString *,NSNumber *> *)metrics {
+    __block NSDictionary *metrics = nil;
+    dispatch_sync(_queue, ^{
+        metrics = @{@"sessionCount": @(_entries.count),
+                    @"acquisitionCount": @(_acquisitionCount),
+                    @"sharedCount": @(_sharedCount),
+                    @"createdCount": @(_createdCount),
+                    @"invalidatedCount": @(_invalidatedCount)};
+    });
+    return metrics;
+}
+
+- (void)getUsageWithCompletion:(void (^)(NSArray<NSDictionary<NSString *,id> *> *))completion {
+    __block NSArray<NSDictionary *> *snapshots = nil;
+
+    dispatch_sync(_queue, ^{
+        NSMutableArray *array = [NSMutableArray arrayWithCapacity:_entries.count];
+        for (p_RegisteredSession *entry in _entries.allValues) {
+            [array addObject:@{@"session": entry.session,
+                               @"leaseCount": @(entry.leaseCount),
+                               @"acquisitionCount": @(entry.acquisitionCount),
+                               @"maximumConnectionsPerHost": @(entry.session.configuration.HTTPMaximumConnectionsPerHost)}];
+        }
+        snapshots = array;
+    });
+
+    NSMutableArray<NSDictionary *> *usage = [NSMutableArray arrayWithCapacity:snapshots.count];
+    dispatch_group_t group = dispatch_group_create();
+
+    for (NSDictionary *snapshot in snapshots) {
+        NSURLSession *session = snapshot[@"session"];
+        dispatch_group_enter(group);
+
+        [session getTasksWithCompletionHandler:^(NSArray<NSURLSessionDataTask *> * _Nonnull dataTasks, NSArray<NSURLSessionUploadTask *> * _Nonnull uploadTasks, NSArray<NSURLSessionDownloadTask *> * _Nonnull downloadTasks) {
+            NSUInteger runningCount = 0;
+            NSUInteger suspendedCount = 0;
+            NSMutableSet<NSString *> *hosts = [NSMutableSet set];
+
+            for (NSArray<NSURLSessionTask *> *tasks in @[dataTasks, uploadTasks, downloadTasks]) {
+                for (NSURLSessionTask *task in tasks) {
+                    if (task.state == NSURLSessionTaskStateRunning) {
+                        runningCount += 1;
+                    } else if (task.state == NSURLSessionTaskStateSuspended) {
+                        suspendedCount += 1;
+                    } else {
+                        continue;
+                    }
+                    NSString *host = task.currentRequest.URL.host ?: task.originalRequest.URL.host;
+                    if (host) [hosts addObject:host.lowercaseString];
+                }
+            }
+
+            NSMutableDictionary *item = [snapshot mutableCopy];
+            item[@"runningTaskCount"] = @(runningCount);
+            item[@"suspendedTaskCount"] = @(suspendedCount);
+            item[@"hostCount"] = @(hosts.count);
+
+            @synchronized (usage) {
+                [usage addObject:item];
+            }
+            dispatch_group_leave(group);
+        }];
+    }
+
+    dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        completion([usage copy]);
+    });
+}
+
+
+#pragma mark - Private
+
+// 只在 _queue 中调用
+- (p_RegisteredSession *)p_entryForSession:(NSURLSession *)session {
+    for (p_RegisteredSession *entry in _entries.allValues) {
+        if (entry.session == session) return entry;
+    }
+    return nil;
+}
+
+@end
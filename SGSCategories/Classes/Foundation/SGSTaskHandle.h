@@ -0,0 +1,68 @@
+/*!
+ *  @header SGSTaskHandle.h
+ *
+ *  @abstract 网络任务句柄
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 网络任务句柄
+ *
+ *  @discussion 当一次请求对应的底层 NSURLSessionTask 不唯一或不确定时（例如多个调用方共享同一个任务、
+ *      失败后重试创建新任务、排队等待后才创建任务），由句柄代替 NSURLSessionTask 返回给调用方，
+ *      调用方通过句柄启动或取消请求
+ *
+ *      与 NSProgress 类似，resume 和 cancel 的具体行为由 resumingHandler 和 cancellationHandler 决定，
+ *      未设置时直接作用于 task
+ */
+@interface SGSTaskHandle : NSObject
+
+/*!
+ *  @brief 根据任务初始化句柄
+ *
+ *  @param task 网络任务
+ *
+ *  @return SGSTaskHandle
+ */
++ (instancetype)handleWithTask:(nullable NSURLSessionTask *)task;
+
+/*!
+ *  @brief 当前的底层网络任务，请求过程中可能会发生变化，排队中的请求为 nil
+ */
+@property (atomic, strong, nullable) NSURLSessionTask *task;
+
+/*!
+ *  @brief 调用 resume 时执行的闭包
+ */
+@property (atomic, copy, nullable) void (^resumingHandler)(void);
+
+/*!
+ *  @brief 调用 cancel 时执行的闭包，只会执行一次
+ */
+@property (atomic, copy, nullable) void (^cancellationHandler)(void);
+
+/*!
+ *  @brief 是否已被取消
+ */
+@property (atomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/*!
+ *  @brief 启动请求
+ */
+- (void)resume;
+
+/*!
+ *  @brief 取消请求
+ */
+- (void)cancel;
+
+@end
+
+NS_ASSUME_NONNULL_END
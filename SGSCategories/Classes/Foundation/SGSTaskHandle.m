@@ -0,0 +1,50 @@
+/*!
+ *  @header SGSTaskHandle.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSTaskHandle.h"
+
+@interface SGSTaskHandle ()
+@property (atomic, assign, readwrite, getter=isCancelled) BOOL cancelled;
+@end
+
+@implementation SGSTaskHandle
+
++ (instancetype)handleWithTask:(NSURLSessionTask *)task {
+    SGSTaskHandle *handle = [[SGSTaskHandle alloc] init];
+    handle.task = task;
+    return handle;
+}
+
+- (void)resume {
+    if (self.isCancelled) return;
+
+    void (^handler)(void) = self.resumingHandler;
+    if (handler) {
+        handler();
+    } else {
+        [self.task resume];
+    }
+}
+
+- (void)cancel {
+    void (^handler)(void) = nil;
+    @synchronized (self) {
+        if (self.isCancelled) return;
+        self.cancelled = YES;
+        handler = self.cancellationHandler;
+        self.cancellationHandler = nil;
+    }
+
+    if (handler) {
+        handler();
+    } else {
+        [self.task cancel];
+    }
+}
+
+@end
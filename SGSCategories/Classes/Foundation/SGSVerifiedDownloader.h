@@ -0,0 +1,128 @@
+/*!
+ *  @header SGSVerifiedDownloader.h
+ *
+ *  @abstract 预分配空间并边下载边校验的文件下载
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class SGSTaskHandle;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/*!
+ *  @brief 校验下载相关的错误域
+ */
+FOUNDATION_EXPORT NSString * const SGSVerifiedDownloadErrorDomain;
+
+/*!
+ *  @brief 校验下载相关的错误码
+ */
+typedef NS_ENUM(NSInteger, SGSVerifiedDownloadErrorCode) {
+    /// 目标磁盘的可用空间不足，请求没有发出或在收到响应后立即取消
+    SGSVerifiedDownloadErrorInsufficientSpace = 1,
+    /// 下载的字节数与期望的大小或 Content-Length 不一致
+    SGSVerifiedDownloadErrorSizeMismatch,
+    /// 下载内容的摘要与期望的摘要不一致
+    SGSVerifiedDownloadErrorDigestMismatch,
+};
+
+/*!
+ *  @brief 摘要算法
+ */
+typedef NS_ENUM(NSInteger, SGSDigestAlgorithm) {
+    /// SHA-1
+    SGSDigestAlgorithmSHA1 = 0,
+    /// SHA-256
+    SGSDigestAlgorithmSHA256,
+};
+
+/*!
+ *  @brief 校验下载完成闭包
+ *
+ *  @param response 响应
+ *  @param fileURL  发布后的文件路径，失败时为 nil
+ *  @param digest   下载内容的十六进制小写摘要，失败时为 nil
+ *  @param error    失败信息
+ */
+typedef void(^SGSVerifiedDownloadCompletionBlock)(NSURLResponse * _Nullable response, NSURL * _Nullable fileURL, NSString * _Nullable digest, NSError * _Nullable error);
+
+
+/*!
+ *  @brief 预分配空间并边下载边校验的文件下载
+ *
+ *  @discussion 下载任务把数据写入系统临时文件，完成后才能移动和校验，校验需要重新读取整个文件，
+ *      大文件还可能在下载到最后时才因磁盘已满而失败。校验下载使用数据任务直接写入目标目录中的隐藏文件：
+ *
+ *      - 已知大小（expectedSize 或 Content-Length）时先检查目标磁盘的可用空间并预分配文件，空间不足时提前失败
+ *      - 收到数据时写入文件并同时计算摘要，不需要下载后重新读取
+ *      - 完成后校验大小和摘要，全部通过后以 rename 原子地替换目标文件，失败时删除临时文件，目标文件保持不变
+ *
+ *      使用 initWithSession: 创建的下载器在 iOS 15 及以上直接在该会话中创建任务并为任务单独设置代理，与会话的其他请求共用连接，
+ *      旧系统以及 initWithConfiguration: 创建的下载器持有一个使用自己代理的会话，下载器释放时该会话在已有任务结束后失效
+ *
+ *      所有方法都是线程安全的
+ */
+@interface SGSVerifiedDownloader : NSObject
+
+/*!
+ *  @brief 初始化
+ *
+ *  @param configuration 会话配置，不支持后台会话配置
+ *
+ *  @return SGSVerifiedDownloader
+ */
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration NS_DESIGNATED_INITIALIZER;
+
+/*!
+ *  @brief 使用已有会话初始化
+ *
+ *  @discussion 下载器不持有会话，进度回调的频率和队列使用会话的 progressMaximumRate 和 progressDeliveryQueue，
+ *      iOS 15 之前使用会话的配置创建使用自己代理的会话
+ *
+ *  @param session 会话，不支持后台会话
+ *
+ *  @return SGSVerifiedDownloader
+ */
+- (instancetype)initWithSession:(NSURLSession *)session NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/*!
+ *  @brief 下载后需要保留的最小可用空间，单位：字节，默认为 0
+ */
+@property (atomic, assign) int64_t minimumFreeSpace;
+
+/*!
+ *  @brief 创建校验下载
+ *
+ *  @discussion 调用句柄的 resume 后开始下载，expectedSize 已知时先检查可用空间，不足时不发出请求，
+ *      状态码不是 2xx 时下载失败，目标文件所在的目录不存在时自动创建
+ *
+ *  @param request         HTTP 请求
+ *  @param fileURL         目标文件路径，已存在时在校验通过后被替换
+ *  @param expectedSize    期望的文件大小，未知时为 NSURLSessionTransferSizeUnknown，
+ *                         此时使用响应的 Content-Length 检查空间和校验大小
+ *  @param algorithm       摘要算法
+ *  @param expectedDigest  期望的十六进制摘要，不区分大小写，为空时只计算摘要不校验
+ *  @param progressBlock   下载进度闭包，initWithConfiguration: 创建的下载器在主线程回调，
+ *                         initWithSession: 创建的下载器按会话的 progressMaximumRate 和 progressDeliveryQueue 回调
+ *  @param completion      完成闭包，在后台线程回调
+ *
+ *  @return SGSTaskHandle
+ */
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                          toFileURL:(NSURL *)fileURL
+                       expectedSize:(int64_t)expectedSize
+                    digestAlgorithm:(SGSDigestAlgorithm)algorithm
+                     expectedDigest:(nullable NSString *)expectedDigest
+                           progress:(nullable void (^)(NSProgress *progress))progressBlock
+                         completion:(SGSVerifiedDownloadCompletionBlock)completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
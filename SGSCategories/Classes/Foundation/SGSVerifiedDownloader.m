@@ -0,0 +1,476 @@
+/*!
+ *  @header SGSVerifiedDownloader.m
+ *
+ *  @author Created by Lee on 26/10/19.
+ *
+ *  @copyright 2016年 SouthGIS. All rights reserved.
+ */
+
+#import "SGSVerifiedDownloader.h"
+#import "NSURLSession+SGS.h"
+#import "SGSTaskHandle.h"
+#import "SGSProgressGroup.h"
+#include <CommonCrypto/CommonCrypto.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+NSString * const SGSVerifiedDownloadErrorDomain = @"com.southgis.SGSCategories.VerifiedDownload";
+
+static NSError * p_verifiedDownloadError(SGSVerifiedDownloadErrorCode code, NSString *description, NSURL *fileURL) {
+    return [NSError errorWithDomain:SGSVerifiedDownloadErrorDomain
+                               code:code
+                           userInfo:@{NSLocalizedDescriptionKey: description,
+                                      NSURLErrorKey: fileURL}];
+}
+
+// 目标文件所在磁盘是否有足够的空间
+static BOOL p_hasFreeSpace(NSURL *fileURL, int64_t length, int64_t minimumFreeSpace) {
+    NSString *directory = fileURL.URLByDeletingLastPathComponent.path;
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfFileSystemForPath:directory error:nil];
+    NSNumber *freeSize = attributes[NSFileSystemFreeSize];
+
+    // 无法获取时交给写入失败处理
+    if (freeSize == nil) return YES;
+
+    return (length + minimumFreeSpace) <= freeSize.longLongValue;
+}
+
+// 任务是否可以单独设置代理（iOS 15 及以上）
+static BOOL p_supportsTaskDelegate(void) {
+#if defined(__IPHONE_15_0) && (__IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_15_0)
+    if (@available(iOS 15.0, *)) return YES;
+#endif
+    return NO;
+}
+
+
+#pragma mark - Verified Download
+
+/// 一次校验下载的状态，创建后只在会话的代理队列中访问，仅内部使用
+@interface p_VerifiedDownload : NSObject
+@property (nonatomic, copy) NSURLRequest *request;
+@property (nonatomic, copy) NSURL *fileURL;
+@property (nonatomic, copy) NSURL *partURL;
+@property (nonatomic, assign) int64_t expectedSize;
+@property (nonatomic, assign) int64_t minimumFreeSpace;
+@property (nonatomic, assign) SGSDigestAlgorithm algorithm;
+@property (nonatomic, copy) NSString *expectedDigest;
+@property (nonatomic, strong) SGSProgressThrottle *throttle;
+@property (nonatomic, copy) SGSVerifiedDownloadCompletionBlock completion;
+@property (nonatomic, strong) NSProgress *progress;
+@property (nonatomic, strong) NSURLResponse *response;
+/// 由下载器产生的错误，优先于任务的错误
+@property (nonatomic, strong) NSError *error;
+/// 需要校验的大小，未知时为 NSURLSessionTransferSizeUnknown
+@property (nonatomic, assign) int64_t verifiedSize;
+@property (nonatomic, assign) int64_t writtenLength;
+@property (nonatomic, assign) int fd;
+/// 句柄的 resume 或 cancel 是否已经调用过，在 @synchronized (self) 中访问
+@property (nonatomic, assign) BOOL resumed;
+
+- (void)updateDigestWithBytes:(const void *)bytes length:(NSUInteger)length;
+- (NSString *)finalDigest;
+@end
+
+@implementation p_VerifiedDownload {
+    CC_SHA1_CTX _sha1;
+    CC_SHA256_CTX _sha256;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _fd = -1;
+        CC_SHA1_Init(&_sha1);
+        CC_SHA256_Init(&_sha256);
+    }
+    return self;
+}
+
+- (void)updateDigestWithBytes:(const void *)bytes length:(NSUInteger)length {
+    if (_algorithm == SGSDigestAlgorithmSHA256) {
+        CC_SHA256_Update(&_sha256, bytes, (CC_LONG)length);
+    } else {
+        CC_SHA1_Update(&_sha1, bytes, (CC_LONG)length);
+    }
+}
+
+- (NSString *)finalDigest {
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    NSUInteger length = 0;
+
+    if (_algorithm == SGSDigestAlgorithmSHA256) {
+        CC_SHA256_Final(digest, &_sha256);
+        length = CC_SHA256_DIGEST_LENGTH;
+    } else {
+        CC_SHA1_Final(digest, &_sha1);
+        length = CC_SHA1_DIGEST_LENGTH;
+    }
+
+    NSMutableString *hex = [NSMutableString stringWithCapacity:length * 2];
+    for (NSUInteger i = 0; i < length; i++) {
+        [hex appendFormat:@"%02x", digest[i]];
+    }
+    return hex;
+}
+
+@end
+
+
+#pragma mark - Session Delegate
+
+/// 会话的代理，会话持有代理，代理不持有下载器，仅内部使用
+@interface p_VerifiedDownloadDelegate : NSObject <NSURLSessionDataDelegate>
+- (void)addDownload:(p_VerifiedDownload *)download forTask:(NSURLSessionTask *)task;
+- (void)removeDownloadForTask:(NSURLSessionTask *)task;
+@end
+
+@implementation p_VerifiedDownloadDelegate {
+    NSMutableDictionary<NSNumber *, p_VerifiedDownload *> *_downloads;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _downloads = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)addDownload:(p_VerifiedDownload *)download forTask:(NSURLSessionTask *)task {
+    @synchronized (_downloads) {
+        _downloads[@(task.taskIdentifier)] = download;
+    }
+}
+
+- (void)removeDownloadForTask:(NSURLSessionTask *)task {
+    @synchronized (_downloads) {
+        [_downloads removeObjectForKey:@(task.taskIdentifier)];
+    }
+}
+
+- (p_VerifiedDownload *)p_downloadForTask:(NSURLSessionTask *)task {
+    @synchronized (_downloads) {
+        return _downloads[@(task.taskIdentifier)];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session
+          dataTask:(NSURLSessionDataTask *)dataTask
+didReceiveResponse:(NSURLResponse *)response
+ completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler
+{
+    p_VerifiedDownload *download = [self p_downloadForTask:dataTask];
+    if (download == nil) {
+        completionHandler(NSURLSessionResponseCancel);
+        return;
+    }
+
+    download.response = response;
+
+    NSError *error = nil;
+    if ([self p_prepareDownload:download response:response error:&error]) {
+        completionHandler(NSURLSessionResponseAllow);
+    } else {
+        download.error = error;
+        completionHandler(NSURLSessionResponseCancel);
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    p_VerifiedDownload *download = [self p_downloadForTask:dataTask];
+    if ((download == nil) || (download.error != nil) || (download.fd < 0)) return;
+
+    __block int errorCode = 0;
+    __block int64_t offset = download.writtenLength;
+
+    [data enumerateByteRangesUsingBlock:^(const void * _Nonnull bytes, NSRange byteRange, BOOL * _Nonnull stop) {
+        NSUInteger written = 0;
+        while (written < byteRange.length) {
+            ssize_t length = pwrite(download.fd, (const char *)bytes + written, byteRange.length - written, offset + written);
+            if (length < 0) {
+                if (errno == EINTR) continue;
+                errorCode = errno;
+                *stop = YES;
+                return;
+            }
+            written += length;
+        }
+
+        [download updateDigestWithBytes:bytes length:byteRange.length];
+        offset += byteRange.length;
+    }];
+
+    download.writtenLength = offset;
+
+    if (errorCode != 0) {
+        // 磁盘已满等写入错误，立即停止下载
+        download.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errorCode userInfo:nil];
+        [dataTask cancel];
+        return;
+    }
+
+    if ((download.verifiedSize >= 0) && (offset > download.verifiedSize)) {
+        download.error = p_verifiedDownloadError(SGSVerifiedDownloadErrorSizeMismatch, @"Received more data than expected.", download.fileURL);
+        [dataTask cancel];
+        return;
+    }
+
+    download.progress.completedUnitCount = offset;
+    [download.throttle progressDidChange:download.progress];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+    p_VerifiedDownload *download = [self p_downloadForTask:task];
+    if (download == nil) return;
+    [self removeDownloadForTask:task];
+
+    if (download.error != nil) error = download.error;
+
+    NSString *digest = nil;
+    if (error == nil) {
+        digest = [self p_publishDownload:download error:&error];
+    }
+
+    if (download.fd >= 0) {
+        close(download.fd);
+        download.fd = -1;
+    }
+    if ((error != nil) && (download.partURL != nil)) {
+        [[NSFileManager defaultManager] removeItemAtURL:download.partURL error:nil];
+    }
+
+    [download.throttle finishWithProgress:download.progress];
+    download.completion(download.response ?: task.response, (error == nil) ? download.fileURL : nil, digest, error);
+}
+
+
+#pragma mark - File
+
+// 检查状态码和可用空间，创建并预分配临时文件
+- (BOOL)p_prepareDownload:(p_VerifiedDownload *)download response:(NSURLResponse *)response error:(NSError **)error {
+    NSHTTPURLResponse *httpResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    if ((httpResponse != nil) && ((httpResponse.statusCode < 200) || (httpResponse.statusCode >= 300))) {
+        if (error) *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey: download.request.URL}];
+        return NO;
+    }
+
+    // 系统解码 Content-Encoding 后收到的长度与 Content-Length 不同
+    NSString *contentEncoding = [httpResponse.allHeaderFields[@"Content-Encoding"] description];
+    BOOL encoded = (contentEncoding.length > 0) && ([contentEncoding caseInsensitiveCompare:@"identity"] != NSOrderedSame);
+    int64_t contentLength = encoded ? NSURLSessionTransferSizeUnknown : response.expectedContentLength;
+    if ((download.expectedSize >= 0) && (contentLength >= 0) && (contentLength != download.expectedSize)) {
+        if (error) *error = p_verifiedDownloadError(SGSVerifiedDownloadErrorSizeMismatch, @"The Content-Length does not match the expected size.", download.fileURL);
+        return NO;
+    }
+
+    int64_t length = (download.expectedSize >= 0) ? download.expectedSize : contentLength;
+    download.verifiedSize = length;
+    download.progress.totalUnitCount = (length >= 0) ? length : NSURLSessionTransferSizeUnknown;
+
+    NSURL *directoryURL = download.fileURL.URLByDeletingLastPathComponent;
+    if (![[NSFileManager defaultManager] createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:error]) {
+        return NO;
+    }
+
+    if ((length > 0) && !p_hasFreeSpace(download.fileURL, length, download.minimumFreeSpace)) {
+        if (error) *error = p_verifiedDownloadError(SGSVerifiedDownloadErrorInsufficientSpace, @"There is not enough free space for the download.", download.fileURL);
+        return NO;
+    }
+
+    // 同一目录下的临时文件，发布时 rename 不会跨磁盘
+    NSString *partName = [NSString stringWithFormat:@".%@.%@.download", download.fileURL.lastPathComponent, [NSUUID UUID].UUIDString];
+    download.partURL = [directoryURL URLByAppendingPathComponent:partName];
+
+    int fd = open(download.partURL.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return NO;
+    }
+    download.fd = fd;
+
+    if (length <= 0) return YES;
+
+    // 尽量分配连续的磁盘空间，文件系统不支持预分配时退回 ftruncate 设置文件长度
+    BOOL allocated = NO;
+#ifdef F_PREALLOCATE
+    fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, length, 0};
+    allocated = (fcntl(fd, F_PREALLOCATE, &store) != -1);
+    if (!allocated) {
+        store.fst_flags = F_ALLOCATEALL;
+        allocated = (fcntl(fd, F_PREALLOCATE, &store) != -1);
+    }
+#endif
+    if (!allocated && (ftruncate(fd, length) != 0)) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return NO;
+    }
+
+    return YES;
+}
+
+// 校验大小和摘要后发布文件，返回摘要，失败时返回 nil
+- (NSString *)p_publishDownload:(p_VerifiedDownload *)download error:(NSError **)error {
+    if (download.fd < 0) {
+        if (error) *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey: download.request.URL}];
+        return nil;
+    }
+
+    if ((download.verifiedSize >= 0) && (download.writtenLength != download.verifiedSize)) {
+        if (error) *error = p_verifiedDownloadError(SGSVerifiedDownloadErrorSizeMismatch, @"The downloaded length does not match the expected size.", download.fileURL);
+        return nil;
+    }
+
+    NSString *digest = [download finalDigest];
+    if ((download.expectedDigest.length > 0) && ([digest caseInsensitiveCompare:download.expectedDigest] != NSOrderedSame)) {
+        if (error) *error = p_verifiedDownloadError(SGSVerifiedDownloadErrorDigestMismatch, @"The downloaded content does not match the expected digest.", download.fileURL);
+        return nil;
+    }
+
+    // 确保数据已经写入磁盘后再替换目标文件
+    if ((fsync(download.fd) != 0) || (rename(download.partURL.fileSystemRepresentation, download.fileURL.fileSystemRepresentation) != 0)) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return nil;
+    }
+
+    return digest;
+}
+
+@end
+
+
+#pragma mark - SGSVerifiedDownloader
+
+@implementation SGSVerifiedDownloader {
+    // 下载器自己创建的会话，使用任务代理时为空
+    NSURLSession *_ownedSession;
+    // 创建下载器的会话，提供进度回调的设置，使用任务代理时也用于发出请求
+    __weak NSURLSession *_session;
+    p_VerifiedDownloadDelegate *_delegate;
+}
+
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration {
+    NSParameterAssert(configuration.identifier == nil);
+
+    self = [super init];
+    if (self) {
+        _delegate = [[p_VerifiedDownloadDelegate alloc] init];
+        _ownedSession = [self p_sessionWithConfiguration:configuration];
+        _ownedSession.progressDeliveryQueue = dispatch_get_main_queue();
+        _session = _ownedSession;
+    }
+    return self;
+}
+
+- (instancetype)initWithSession:(NSURLSession *)session {
+    NSParameterAssert(session.configuration.identifier == nil);
+
+    self = [super init];
+    if (self) {
+        _delegate = [[p_VerifiedDownloadDelegate alloc] init];
+        _session = session;
+
+        // 旧系统上任务不能单独设置代理，只能使用相同的配置创建使用自己代理的会话
+        if (!p_supportsTaskDelegate()) {
+            _ownedSession = [self p_sessionWithConfiguration:session.configuration];
+        }
+    }
+    return self;
+}
+
+- (NSURLSession *)p_sessionWithConfiguration:(NSURLSessionConfiguration *)configuration {
+    NSOperationQueue *delegateQueue = [[NSOperationQueue alloc] init];
+    delegateQueue.name = @"com.southgis.SGSCategories.VerifiedDownload";
+    delegateQueue.maxConcurrentOperationCount = 1;
+
+    return [NSURLSession sessionWithConfiguration:configuration delegate:_delegate delegateQueue:delegateQueue];
+}
+
+- (void)dealloc {
+    [_ownedSession finishTasksAndInvalidate];
+}
+
+- (SGSTaskHandle *)handleForRequest:(NSURLRequest *)request
+                          toFileURL:(NSURL *)fileURL
+                       expectedSize:(int64_t)expectedSize
+                    digestAlgorithm:(SGSDigestAlgorithm)algorithm
+                     expectedDigest:(NSString *)expectedDigest
+                           progress:(void (^)(NSProgress *))progressBlock
+                         completion:(SGSVerifiedDownloadCompletionBlock)completion
+{
+    NSParameterAssert(fileURL.isFileURL);
+    NSParameterAssert(completion != nil);
+
+    NSURLSession *session = _session;
+
+    p_VerifiedDownload *download = [[p_VerifiedDownload alloc] init];
+    download.request = request;
+    download.fileURL = fileURL;
+    download.expectedSize = (expectedSize >= 0) ? expectedSize : NSURLSessionTransferSizeUnknown;
+    download.verifiedSize = download.expectedSize;
+    download.minimumFreeSpace = MAX(self.minimumFreeSpace, 0);
+    download.algorithm = algorithm;
+    download.expectedDigest = expectedDigest;
+    download.completion = completion;
+    download.progress = [NSProgress progressWithTotalUnitCount:NSURLSessionTransferSizeUnknown];
+    if (progressBlock) {
+        download.throttle = [[SGSProgressThrottle alloc] initWithMaximumRate:session.progressMaximumRate queue:session.progressDeliveryQueue block:progressBlock];
+    }
+
+    NSURLSessionDataTask *task = [(_ownedSession ?: session) dataTaskWithRequest:request];
+#if defined(__IPHONE_15_0) && (__IPHONE_OS_VERSION_MAX_ALLOWED >= __IPHONE_15_0)
+    if (_ownedSession == nil) {
+        if (@available(iOS 15.0, *)) task.delegate = _delegate;
+    }
+#endif
+
+    SGSTaskHandle *handle = [SGSTaskHandle handleWithTask:task];
+    __weak NSURLSessionDataTask *weakTask = task;
+    __weak p_VerifiedDownloadDelegate *weakDelegate = _delegate;
+
+    // 首次 resume 时才登记下载，未 resume 就释放的句柄不会在代理中留下记录
+    handle.resumingHandler = ^{
+        NSURLSessionDataTask *strongTask = weakTask;
+        if (strongTask == nil) return;
+
+        BOOL firstResume = NO;
+        @synchronized (download) {
+            firstResume = !download.resumed;
+            download.resumed = YES;
+        }
+        if (!firstResume) {
+            [strongTask resume];
+            return;
+        }
+
+        // 已知大小时在发出请求前检查可用空间
+        if ((download.expectedSize > 0) && !p_hasFreeSpace(fileURL, download.expectedSize, download.minimumFreeSpace)) {
+            [strongTask cancel];
+            completion(nil, nil, nil, p_verifiedDownloadError(SGSVerifiedDownloadErrorInsufficientSpace, @"There is not enough free space for the download.", fileURL));
+            return;
+        }
+
+        [weakDelegate addDownload:download forTask:strongTask];
+        [strongTask resume];
+    };
+
+    // resume 之前取消时下载没有登记，直接回调取消
+    handle.cancellationHandler = ^{
+        BOOL registered = NO;
+        @synchronized (download) {
+            registered = download.resumed;
+            download.resumed = YES;
+        }
+
+        [weakTask cancel];
+        if (registered) return;
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            completion(nil, nil, nil, [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:@{NSURLErrorFailingURLErrorKey: request.URL}]);
+        });
+    };
+
+    return handle;
+}
+
+@end